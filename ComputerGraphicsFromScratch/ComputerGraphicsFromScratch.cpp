@@ -10,144 +10,304 @@ one is the entry and the other the exit point of the ray on the sphere. We compa
 will also be the closest intersection point to the ray origin (in this case where the camera is positioned). The sphere with the
 closest intersection point, dictates the color we use to paint the "pixel". If no intersection exists, we use Black.
 
+Before tracing, each sphere is projected to a conservative rectangle on the canvas and binned into 16x16 tiles. Rays only
+test the spheres binned into their tile, and tiles with no spheres at all are filled with the background without tracing.
+Tiles with candidates get a beam test first: if the pyramid of the tile's rays misses every sphere, or sits entirely inside
+the silhouette of one sphere that is in front of all others, the tile is filled with one color. Only tiles that contain
+silhouette edges are traced pixel by pixel.
+
+TAB cycles between that tiled renderer, a quadtree preview that only traces block corners and subdivides where they
+disagree, the plain per-pixel reference, the same per-pixel loop over a copy of the scene specialized at compile time
+(see static_scene.h), and a whole-canvas trace through SIMD kernels picked for the CPU at startup (see trace_kernels.h).
+H swaps the canvas for a heatmap of the sphere tests spent on each pixel. + adds a random sphere to the scene and - removes
+one (see scene.h). Edits are published as snapshots, and each frame renders the newest one (see scene_snapshot.h).
+
 In this case, to emulate painting pixels, we create a raylib Image which is a CPU buffer and then use it to paint, then upload it to a Texture2D
 in GPU land, which we then blit to the screen.
+
+Running with --bench skips the window and prints microbenchmarks of the intersection kernels and render modes instead, and exits with 1 if any of them disagrees with its reference.
+--isa=<scalar|sse2|avx2|avx512> (or the CGFS_ISA environment variable) forces a tracing kernel variant.
+--precision=<float|double|fast> picks the arithmetic of the tiled and preview renderers (see precision.h); P cycles it at runtime.
+--validate (or V) re-traces every frame with the scalar reference and marks pixels where the renderer disagrees with it
+(see validation.h).
+--scene=<uniform|clustered|corridor|mixed>:<count> replaces the scene with a generated one (see procedural_scene.h), for
+the bvh render mode, which traces through a hierarchy rebuilt whenever the scene changes. --bvh=<sah|lbvh> (or B) picks its
+builder (see bvh.h). Trees of large scenes are cached in --bvh-cache=<path>.<builder> (scene.bvhcache by default, empty
+to turn it off) and loaded from there when the scene comes back unchanged (see bvh_cache.h). The wide bvh mode traces an 8-wide collapse of the same tree, testing all children of a node at once
+with the selected kernels (see wide_bvh.h), and bvh packets walks it with a whole tile of rays at a time (see packet_bvh.h).
+out of core bvh writes the tree to --ooc-file=<path> in page-sized treelets and traces through a memory mapping of it,
+keeping at most --ooc-cap-mb=<n> of it mapped (see out_of_core_bvh.h). With --storage=treelets that file is the scene:
+a --scene is streamed into it slab by slab in at most --ooc-build-mb=<n>, or without one the file already there is
+opened, and neither the spheres nor a tree of them is ever held in memory.
+spatial hash rebuilds a hashed grid of the spheres from scratch every time the scene changes, for scenes where
+everything moves, and marches rays through its occupied cells (see spatial_hash.h).
+compact stores the spheres quantized to under 8 bytes each, for scenes of 10^8 and more, and decodes them while
+tracing (see compact_scene.h). With --storage=compact a --scene is generated straight into that storage and never held
+as spheres; the window then stays in the compact mode, as every other one reads the spheres it no longer has.
+bvh lod stops rays at nodes of the bvh that are smaller than a pixel on screen and blends in their average color
+and coverage instead, so distant clusters cost about the same however densely filled they are (see bvh_lod.h).
+pvs precomputes, for cells of camera positions around the origin, the spheres that could be seen from them, stores
+them in --pvs-file=<path> (scene.pvs by default, empty to turn it off) and only tests the camera cell's set (see pvs.h).
+lit traces the bvh and shades every hit with the book's ambient, point and directional lights, casting shadow rays
+that stop at the first sphere in the way and try the one that last blocked each light first. --lights=<n> adds n small
+point lights, which are culled against the screen tiles every frame so each hit is only lit by the ones near it (see lighting.h).
+path traced follows paths of several bounces from every pixel, a wave of pixels at a time through queues of rays that
+each stage runs over whole, and averages the frames since the scene last changed. Bounced and shadow rays are sorted by
+direction and origin before they are intersected, unless --ray-sort=off (see path_tracer.h).
+A generated scene is first sorted along --scene-order=<none|morton|hilbert> (hilbert by default), so spheres
+close in space are close in memory for all of them (see scene_order.h). The default scene keeps DEFAULT_SCENE's order,
+which the compile-time scene's hits are numbered by.
+
+The window opens in the auto mode, which measures the scene and draws it with whichever of the simd kernels, the tiled
+renderer, bvh packets or the spatial hash grid a cost model predicts to be fastest, and logs the prediction (see
+accel_select.h).
+--accel=<brute|culling|bvh|hash|auto> (or A) forces one, and --accel-calibrate refits the model on this machine at startup.
+Parallel passes split their work between one worker per hardware thread, or --workers=<n>, kept in a pool for the
+whole run (see parallel.h).
 */
 
+#include "accel_select.h"
+#include "benchmark.h"
+#include "bvh.h"
+#include "bvh_cache.h"
+#include "compact_scene.h"
+#include "lighting.h"
+#include "out_of_core_bvh.h"
+#include "parallel.h"
+#include "path_tracer.h"
+#include "precision.h"
+#include "procedural_scene.h"
+#include "pvs.h"
 #include "raylib_renderdoc.h"
+#include "raytracer.h"
+#include "render_stats.h"
+#include "renderer.h"
+#include "scene_order.h"
+#include "scene_snapshot.h"
+#include "trace_kernels.h"
+#include "validation.h"
 #include <raylib.h>
 #include <raymath.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
 
-#define CAMERA_ORIGIN_DISTANCE 1.0f
-#define VIEWPORT_WIDTH 1.0f
-#define VIEWPORT_HEIGHT 1.0f
-#define CANVAS_WIDTH 800
-#define CANVAS_HEIGHT 800
-
-struct Vector2Int
+int main(int argc, char** argv)
 {
-    int x;
-    int y;
-};
-
-struct Sphere
-{
-    Vector3 center;
-    float radius;
-    Color color;
-};
-
-struct RayIntersection
-{
-    float t1;
-    float t2;
-};
-
-const Vector3 CAMERA_ORIGIN = { 0 };
-const Vector3 CAMERA_LOOK_DIRECTION = { 0, 0, 1 };
-
-Sphere objects[] = 
-{
-        Sphere{ Vector3{ 0.0f, -1.0f, 3.0f }, 1.0f , RED},
-        Sphere{ Vector3{ 2.0f, 0.0f, 4.0f }, 1.0f , BLUE },
-        Sphere{ Vector3{ -2.0f, 0.0f, 4.0f }, 1.0f , GREEN }
-};
-
-void SetPixel(Image* buf, int x, int y, Color c) {
-    ImageDrawPixel(buf, x, y, c);
-}
-
-RayIntersection IntersectRaySphere(Ray R, Sphere sp)
-{
-    float r = sp.radius;
-    Vector3 CO = Vector3Subtract(CAMERA_ORIGIN, sp.center);
-
-    float a = Vector3DotProduct(R.direction, R.direction);
-    float b = 2.0f * Vector3DotProduct(CO, R.direction);
-    float c = Vector3DotProduct(CO, CO) - r*r;
-
-    float discriminant = (b * b) - (4.0f * a * c);
-    if (discriminant < 0.0f)
+    bool bench = false;
+    bool validate = false;
+    bool calibrate = false;
+    const char* isa_override = NULL;
+    const char* generated_scene = NULL;
+    for (int i = 1; i < argc; i++)
     {
-        return RayIntersection{ INFINITY, INFINITY };
-    }
-
-    RayIntersection collision;
-    collision.t1 = (-b + sqrtf(discriminant)) / (2.0f * a);
-    collision.t2 = (-b - sqrtf(discriminant)) / (2.0f * a);
-    return collision;
-}
-
-Vector2Int CanvasToScreen(Vector2Int canvas_point) 
- {
-    int sx = (CANVAS_WIDTH  / 2) + canvas_point.x;
-    int sy = (CANVAS_HEIGHT / 2) - canvas_point.y;
-    return Vector2Int{ sx, sy };
-}
-
-Vector3 CanvasToViewport(Vector2Int canvas_point) 
-{
-    float vx = (float)canvas_point.x * (VIEWPORT_WIDTH / CANVAS_WIDTH);
-    float vy = (float)canvas_point.y * (VIEWPORT_HEIGHT / CANVAS_HEIGHT);
-    return Vector3{ vx, vy, CAMERA_ORIGIN_DISTANCE };
-}
-
-Color TraceRay(Image* img, Ray r, float tmin, float tmax)
-{
-    float closest_t = INFINITY;
-    Sphere* closest_sphere = NULL;
-    for (int i = 0; i < 3; i++)
-    {
-        Sphere& sph = objects[i];
-        RayIntersection collision = IntersectRaySphere(r, sph);
-
-        if (collision.t1 != INFINITY
-            && collision.t2 != INFINITY)
+        if (strcmp(argv[i], "--bench") == 0)
+        {
+            bench = true;
+        }
+        else if (strcmp(argv[i], "--validate") == 0)
         {
-            if (collision.t1 >= tmin
-                && collision.t1 <= tmax
-                && collision.t1 < closest_t)
+            validate = true;
+        }
+        else if (strncmp(argv[i], "--isa=", 6) == 0)
+        {
+            isa_override = argv[i] + 6;
+        }
+        else if (strncmp(argv[i], "--precision=", 12) == 0)
+        {
+            if (!ParsePrecision(argv[i] + 12, &precision_tier))
             {
-                closest_t = collision.t1;
-                closest_sphere = &sph;
+                TraceLog(LOG_WARNING, "Unknown precision tier '%s', using %s", argv[i] + 12, precision_names[precision_tier]);
             }
-            if (collision.t2 >= tmin
-                && collision.t2 <= tmax
-                && collision.t2 < closest_t)
+        }
+        else if (strncmp(argv[i], "--bvh=", 6) == 0)
+        {
+            if (!ParseBvhBuilder(argv[i] + 6, &bvh_builder))
             {
-                closest_t = collision.t2;
-                closest_sphere = &sph;
+                TraceLog(LOG_WARNING, "Unknown BVH builder '%s', using %s", argv[i] + 6, bvh_builder_names[bvh_builder]);
+            }
+        }
+        else if (strncmp(argv[i], "--scene=", 8) == 0)
+        {
+            generated_scene = argv[i] + 8;
+        }
+        else if (strncmp(argv[i], "--storage=", 10) == 0)
+        {
+            if (!ParseSceneStorage(argv[i] + 10, &scene_storage))
+            {
+                TraceLog(LOG_WARNING, "Unknown storage '%s', using %s", argv[i] + 10, scene_storage_names[scene_storage]);
+            }
+        }
+        else if (strncmp(argv[i], "--scene-order=", 14) == 0)
+        {
+            if (!ParseSceneCurve(argv[i] + 14, &scene_curve))
+            {
+                TraceLog(LOG_WARNING, "Unknown scene order '%s', using %s", argv[i] + 14, scene_curve_names[scene_curve]);
+            }
+        }
+        else if (strncmp(argv[i], "--bvh-cache=", 12) == 0)
+        {
+            bvh_cache_path = argv[i] + 12;
+        }
+        else if (strncmp(argv[i], "--pvs-file=", 11) == 0)
+        {
+            pvs_path = argv[i] + 11;
+        }
+        else if (strncmp(argv[i], "--ray-sort=", 11) == 0)
+        {
+            if (strcmp(argv[i] + 11, "on") == 0 || strcmp(argv[i] + 11, "off") == 0)
+            {
+                path_sort_rays = strcmp(argv[i] + 11, "on") == 0;
+            }
+            else
+            {
+                TraceLog(LOG_WARNING, "Unknown ray sort '%s', keeping it %s", argv[i] + 11, path_sort_rays ? "on" : "off");
+            }
+        }
+        else if (strncmp(argv[i], "--lights=", 9) == 0)
+        {
+            int count = atoi(argv[i] + 9);
+            if (count <= 0)
+            {
+                TraceLog(LOG_WARNING, "Invalid light count '%s', keeping the default lights", argv[i] + 9);
+            }
+            else
+            {
+                GeneratePointLights(count, 1, &lights);
+            }
+        }
+        else if (strncmp(argv[i], "--accel=", 8) == 0)
+        {
+            if (!ParseAccelStrategy(argv[i] + 8, &accel_override))
+            {
+                TraceLog(LOG_WARNING, "Unknown acceleration strategy '%s', using %s", argv[i] + 8, accel_strategy_names[accel_override]);
+            }
+        }
+        else if (strcmp(argv[i], "--accel-calibrate") == 0)
+        {
+            calibrate = true;
+        }
+        else if (strncmp(argv[i], "--ooc-file=", 11) == 0)
+        {
+            out_of_core_path = argv[i] + 11;
+        }
+        else if (strncmp(argv[i], "--ooc-cap-mb=", 13) == 0)
+        {
+            int megabytes = atoi(argv[i] + 13);
+            if (megabytes > 0)
+            {
+                out_of_core_cap = (size_t)megabytes << 20;
+            }
+            else
+            {
+                TraceLog(LOG_WARNING, "Invalid treelet cap '%s', keeping %d MB", argv[i] + 13, (int)(out_of_core_cap >> 20));
+            }
+        }
+        else if (strncmp(argv[i], "--ooc-build-mb=", 15) == 0)
+        {
+            int megabytes = atoi(argv[i] + 15);
+            if (megabytes > 0)
+            {
+                out_of_core_build_budget = (size_t)megabytes << 20;
+            }
+            else
+            {
+                TraceLog(LOG_WARNING, "Invalid treelet build budget '%s', keeping %d MB", argv[i] + 15, (int)(out_of_core_build_budget >> 20));
+            }
+        }
+        else if (strncmp(argv[i], "--workers=", 10) == 0)
+        {
+            int count = atoi(argv[i] + 10);
+            if (count > 0)
+            {
+                worker_count_override = count;
+            }
+            else
+            {
+                TraceLog(LOG_WARNING, "Invalid worker count '%s', keeping %d", argv[i] + 10, WorkerCount());
             }
         }
     }
 
-    if (closest_sphere == NULL)
+    SelectTraceKernels(isa_override);
+    SetPrecisionTier(precision_tier);
+    if (calibrate)
     {
-        return WHITE;
+        CalibrateAccelCostModel(&accel_cost_model);
     }
-    return closest_sphere->color;
-}
-
-void DrawScene(Image* img)
-{
-    for (int x = -CANVAS_WIDTH / 2; x < CANVAS_WIDTH / 2; x++)
+    if (generated_scene != NULL)
     {
-        for (int y = -CANVAS_HEIGHT / 2; y < CANVAS_HEIGHT / 2; y++)
+        char name[32] = { 0 };
+        const char* separator = strchr(generated_scene, ':');
+        size_t name_length = separator != NULL ? (size_t)(separator - generated_scene) : strlen(generated_scene);
+        memcpy(name, generated_scene, name_length < sizeof(name) - 1 ? name_length : sizeof(name) - 1);
+        SceneDistribution distribution;
+        int count = separator != NULL ? atoi(separator + 1) : 10000;
+        if (!ParseSceneDistribution(name, &distribution) || count <= 0)
         {
-            Vector2Int canvas_pos = { x,y };
-            Vector3 viewport_pos = CanvasToViewport(canvas_pos);
-            Vector3 ray_direction = Vector3Subtract(viewport_pos, CAMERA_ORIGIN);
-            Ray r = { CAMERA_ORIGIN, ray_direction };
-
-            Color col = TraceRay(img, r, 1.0f, INFINITY);
-            canvas_pos = CanvasToScreen(canvas_pos);
-            SetPixel(img, canvas_pos.x, canvas_pos.y, col);
+            TraceLog(LOG_WARNING, "Unknown scene '%s', keeping the default one", generated_scene);
+        }
+        else if (scene_storage == STORAGE_COMPACT)
+        {
+            compact_scene.Build(SphereGenerator(distribution, count, 1), false);
+            scene.Clear();
+            TraceLog(LOG_INFO, "Stored %d spheres compact: %.1f MB, tree %.1f MB", count, (double)compact_scene.StorageBytes() / (1 << 20),
+                (double)compact_scene.TreeBytes() / (1 << 20));
         }
-    }    
-}
+        else if (scene_storage == STORAGE_TREELETS &&
+            WriteOutOfCoreScene(SphereGenerator(distribution, count, 1), bvh_builder, out_of_core_path, out_of_core_build_budget))
+        {
+            TraceLog(LOG_INFO, "Streamed %d spheres into '%s'", count, out_of_core_path);
+        }
+        else
+        {
+            if (scene_storage == STORAGE_TREELETS)
+            {
+                TraceLog(LOG_WARNING, "Could not write treelets to '%s', keeping the spheres", out_of_core_path);
+                scene_storage = STORAGE_SPHERES;
+            }
+            std::vector<Sphere> spheres;
+            GenerateSpheres(distribution, count, 1, &spheres);
+            scene.Clear();
+            for (const Sphere& sp : spheres)
+            {
+                scene.Add(sp);
+            }
+        }
+    }
+    if (scene_storage == STORAGE_TREELETS)
+    {
+        if (out_of_core.Open(out_of_core_path, out_of_core_cap))
+        {
+            scene.Clear();
+            TraceLog(LOG_INFO, "Tracing %d treelets of '%s'", out_of_core.TreeletCount(), out_of_core_path);
+        }
+        else
+        {
+            TraceLog(LOG_WARNING, "Could not open treelets at '%s', keeping the spheres", out_of_core_path);
+            scene_storage = STORAGE_SPHERES;
+        }
+    }
+    if (scene_storage == STORAGE_COMPACT && compact_scene.Count() == 0)
+    {
+        TraceLog(LOG_WARNING, "Compact storage needs a --scene to generate, keeping the spheres");
+        scene_storage = STORAGE_SPHERES;
+    }
+    bool storage_only = scene_storage != STORAGE_SPHERES;
+    if (storage_only && validate)
+    {
+        TraceLog(LOG_WARNING, "Validation compares against the spheres, which %s storage doesn't keep; turning it off", scene_storage_names[scene_storage]);
+        validate = false;
+    }
+    if (generated_scene != NULL)
+    {
+        SortSceneSpatially(&scene, scene_curve, NULL);
+    }
+    if (bench)
+    {
+        return RunBenchmarks();
+    }
 
-int main(void)
-{
     LoadRenderDoc();
     InitWindow(CANVAS_WIDTH, CANVAS_HEIGHT, "Computer Graphics from Scratch");
 
@@ -163,16 +323,80 @@ int main(void)
     camera.fovy = 53.0f;
     camera.projection = CAMERA_PERSPECTIVE;
 
+    RenderMode mode = StorageRenderMode(scene_storage);
+    bool show_heatmap = false;
+    ValidationReport validation = { 0 };
+    unsigned long long published_head = 0;
+
     while (!WindowShouldClose())
     {
+        if (IsKeyPressed(KEY_TAB) && !storage_only)
+        {
+            mode = (RenderMode)((mode + 1) % RENDER_MODE_COUNT);
+        }
+        if (IsKeyPressed(KEY_H))
+        {
+            show_heatmap = !show_heatmap;
+        }
+        if ((IsKeyPressed(KEY_EQUAL) || IsKeyPressed(KEY_KP_ADD)) && !storage_only)
+        {
+            Vector3 center = { (float)GetRandomValue(-40, 40) / 10.0f, (float)GetRandomValue(-40, 40) / 10.0f, (float)GetRandomValue(30, 80) / 10.0f };
+            Color color = ColorFromHSV((float)GetRandomValue(0, 359), 0.8f, 0.9f);
+            scene.Add(Sphere{ center, (float)GetRandomValue(2, 10) / 10.0f, color });
+        }
+        if ((IsKeyPressed(KEY_MINUS) || IsKeyPressed(KEY_KP_SUBTRACT)) && scene.Count() > 0)
+        {
+            scene.Remove(scene.HandleAt(GetRandomValue(0, scene.Count() - 1)));
+        }
+        if (scene.JournalHead() != published_head)
+        {
+            PublishScene();
+            published_head = scene.JournalHead();
+        }
+        if (IsKeyPressed(KEY_V) && !storage_only)
+        {
+            validate = !validate;
+        }
+        if (IsKeyPressed(KEY_P))
+        {
+            SetPrecisionTier((PrecisionTier)((precision_tier + 1) % PRECISION_COUNT));
+        }
+        if (IsKeyPressed(KEY_B))
+        {
+            bvh_builder = (BvhBuilder)((bvh_builder + 1) % BVH_BUILDER_COUNT);
+        }
+        if (IsKeyPressed(KEY_A))
+        {
+            accel_override = (AccelStrategy)((accel_override + 1) % (ACCEL_STRATEGY_COUNT + 1));
+        }
+
         if (RenderDocIsFrameCapturing())
         {
             RenderDocBeginFrameCapture();
         }
 
         {//Draw directly onto a texture
-            ImageClearBackground(&img, WHITE);
-            DrawScene(&img);           
+            double frame_start = GetTime();
+            ResetRenderStats();
+            BeginSceneFrame();
+            ImageClearBackground(&img, BACKGROUND_COLOR);
+            if (validate)
+            {
+                ValidateFrame(&img, mode, &validation);
+            }
+            else
+            {
+                DrawScene(&img, mode);
+            }
+            render_stats.frame_ms = (GetTime() - frame_start) * 1000.0;
+            if (show_heatmap)
+            {
+                DrawHeatmap(&img);
+            }
+            if (validate)
+            {
+                MarkMismatches(&img, validation);
+            }
             UpdateTexture(tex, img.data);             // Update GPU with new CPU data.
         }
         
@@ -181,6 +405,11 @@ int main(void)
         {
             //ClearBackground(WHITE); //We can skip bc we draw a full screen texture.
             DrawTextureRec(tex, canvas_rect, Vector2Zero(), WHITE); //white tint
+            DrawRenderStats(10, 10);
+            if (validate)
+            {
+                DrawValidationReport(10, 80, validation);
+            }
         }
         EndDrawing();
 
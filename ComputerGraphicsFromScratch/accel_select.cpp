@@ -0,0 +1,554 @@
+#include "accel_select.h"
+#include "parallel.h"
+#include "procedural_scene.h"
+#include "render_stats.h"
+#include "spatial_hash.h"
+#include "tile_binning.h"
+#include <atomic>
+#include <chrono>
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+const char* accel_strategy_names[ACCEL_STRATEGY_COUNT + 1] = { "brute", "culling", "bvh", "hash", "auto" };
+const RenderMode accel_strategy_modes[ACCEL_STRATEGY_COUNT] = { RENDER_KERNELS, RENDER_TILED, RENDER_BVH_PACKETS, RENDER_SPATIAL_HASH };
+AccelStrategy accel_override = ACCEL_AUTO;
+
+// Fitted by CalibrateAccelCostModel on an x64 machine running the AVX-512 kernels. Terms fitted
+// to 0 drown in the others over the probes' range.
+AccelCostModel accel_cost_model = { { 1.32, 0.0, 32.7, 232.0 }, 0.193, 0.0, 7.70, 0.0, 6.22, 0.0, 0.0, { 120.0, 15.1 }, 0.0, 0.0, 15.5, 0.0,
+    274.0 };
+
+bool ParseAccelStrategy(const char* name, AccelStrategy* strategy)
+{
+    for (int i = 0; i <= ACCEL_STRATEGY_COUNT; i++)
+    {
+        if (strcmp(name, accel_strategy_names[i]) == 0)
+        {
+            *strategy = (AccelStrategy)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/***************************  Scene statistics  ***************************/
+
+struct ChunkStatistics
+{
+    Vector3 min;
+    Vector3 max;
+    double radius_sum;
+    double radius_sq_sum;
+    int on_screen;
+    double footprint; // canvas pixels covered by sphere bounds, summed
+    long long tile_entries;
+};
+
+void AnalyzeScene(const SceneSnapshot& source, SceneStatistics* stats)
+{
+    *stats = SceneStatistics{ 0 };
+    stats->count = source.count;
+    if (source.count == 0)
+    {
+        return;
+    }
+
+    // Per chunk, then combined in order, so the result doesn't depend on the number of workers.
+    int chunk_count = (source.count + SNAPSHOT_CHUNK_SIZE - 1) / SNAPSHOT_CHUNK_SIZE;
+    std::vector<ChunkStatistics> chunks(chunk_count);
+    ParallelFor(0, chunk_count, 4, [&](int, int begin, int end)
+    {
+        for (int c = begin; c < end; c++)
+        {
+            ChunkStatistics& s = chunks[c];
+            s = ChunkStatistics{ { INFINITY, INFINITY, INFINITY }, { -INFINITY, -INFINITY, -INFINITY } };
+            int last = c == chunk_count - 1 ? source.count : (c + 1) * SNAPSHOT_CHUNK_SIZE;
+            for (int i = c * SNAPSHOT_CHUNK_SIZE; i < last; i++)
+            {
+                Sphere sp = source.GetSphere(i);
+                s.min = Vector3{ fminf(s.min.x, sp.center.x), fminf(s.min.y, sp.center.y), fminf(s.min.z, sp.center.z) };
+                s.max = Vector3{ fmaxf(s.max.x, sp.center.x), fmaxf(s.max.y, sp.center.y), fmaxf(s.max.z, sp.center.z) };
+                s.radius_sum += sp.radius;
+                s.radius_sq_sum += (double)sp.radius * sp.radius;
+
+                CanvasRect rect;
+                if (!SphereCanvasBounds(sp, &rect))
+                {
+                    continue;
+                }
+                s.on_screen++;
+                s.footprint += (double)(rect.x1 - rect.x0 + 1) * (double)(rect.y1 - rect.y0 + 1);
+                int tiles_x = (rect.x1 + CANVAS_WIDTH / 2) / TILE_SIZE - (rect.x0 + CANVAS_WIDTH / 2) / TILE_SIZE + 1;
+                int tiles_y = (rect.y1 + CANVAS_HEIGHT / 2) / TILE_SIZE - (rect.y0 + CANVAS_HEIGHT / 2) / TILE_SIZE + 1;
+                s.tile_entries += tiles_x * tiles_y;
+            }
+        }
+    });
+
+    Vector3 lo = chunks[0].min;
+    Vector3 hi = chunks[0].max;
+    double radius_sum = 0.0;
+    double radius_sq_sum = 0.0;
+    double footprint = 0.0;
+    for (const ChunkStatistics& s : chunks)
+    {
+        lo = Vector3{ fminf(lo.x, s.min.x), fminf(lo.y, s.min.y), fminf(lo.z, s.min.z) };
+        hi = Vector3{ fmaxf(hi.x, s.max.x), fmaxf(hi.y, s.max.y), fmaxf(hi.z, s.max.z) };
+        radius_sum += s.radius_sum;
+        radius_sq_sum += s.radius_sq_sum;
+        footprint += s.footprint;
+        stats->on_screen += s.on_screen;
+        stats->tile_entries += s.tile_entries;
+    }
+    double mean = radius_sum / source.count;
+    double variance = radius_sq_sum / source.count - mean * mean;
+    stats->radius_mean = (float)mean;
+    stats->radius_cv = mean > 0.0 ? (float)(sqrt(variance > 0.0 ? variance : 0.0) / mean) : 0.0f;
+    stats->overlap = footprint / ((double)CANVAS_WIDTH * CANVAS_HEIGHT);
+
+    // Occupancy of a grid with about one cubic cell per sphere over the centers' bounds. Flat
+    // bounds get one cell along their thin axes.
+    float extent[3] = { hi.x - lo.x, hi.y - lo.y, hi.z - lo.z };
+    float volume = 1.0f;
+    int flat_axes = 0;
+    for (float e : extent)
+    {
+        if (e > 0.0f)
+        {
+            volume *= e;
+        }
+        else
+        {
+            flat_axes++;
+        }
+    }
+    float cell = flat_axes == 3 ? 1.0f : powf(volume / (float)source.count, 1.0f / (float)(3 - flat_axes));
+    int dims[3];
+    long long cell_count = 1;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float cells = ceilf(extent[axis] / cell);
+        dims[axis] = cells < 1.0f ? 1 : cells > 4096.0f ? 4096 : (int)cells;
+        cell_count *= dims[axis];
+    }
+    std::vector<std::atomic<unsigned int>> occupied((size_t)((cell_count + 31) / 32));
+    float inv_cell = 1.0f / cell;
+    ParallelFor(0, chunk_count, 4, [&](int, int begin, int end)
+    {
+        for (int c = begin; c < end; c++)
+        {
+            int last = c == chunk_count - 1 ? source.count : (c + 1) * SNAPSHOT_CHUNK_SIZE;
+            for (int i = c * SNAPSHOT_CHUNK_SIZE; i < last; i++)
+            {
+                Vector3 p = source.GetSphere(i).center;
+                int x = (int)((p.x - lo.x) * inv_cell);
+                int y = (int)((p.y - lo.y) * inv_cell);
+                int z = (int)((p.z - lo.z) * inv_cell);
+                x = x < dims[0] ? x : dims[0] - 1;
+                y = y < dims[1] ? y : dims[1] - 1;
+                z = z < dims[2] ? z : dims[2] - 1;
+                long long index = ((long long)z * dims[1] + y) * dims[0] + x;
+                occupied[(size_t)(index >> 5)].fetch_or(1u << (index & 31), std::memory_order_relaxed);
+            }
+        }
+    });
+    long long occupied_cells = 0;
+    for (const std::atomic<unsigned int>& word : occupied)
+    {
+        for (unsigned int bits = word.load(std::memory_order_relaxed); bits != 0; bits &= bits - 1)
+        {
+            occupied_cells++;
+        }
+    }
+    stats->occupancy = (float)((double)occupied_cells / (double)cell_count);
+
+    // count centers spread uniformly over cell_count cells leave each one empty with probability
+    // (1 - 1/cell_count)^count.
+    double uniform = 1.0 - exp((double)source.count * log1p(-1.0 / (double)(cell_count > 1 ? cell_count : 2)));
+    float clustering = 1.0f - (float)(stats->occupancy / uniform);
+    stats->clustering = clustering < 0.0f ? 0.0f : clustering;
+}
+
+/***************************  Cost model  ***************************/
+
+#define ACCEL_MAX_TERMS 5
+
+// The quantities a strategy's per-frame coefficients are multiplied with, and pointers to those
+// coefficients in model, in the same order. Returns the number of terms.
+static int FrameTerms(AccelStrategy strategy, const SceneStatistics& stats, AccelCostModel* model, double* terms, double** coefficients)
+{
+    double pixels = (double)CANVAS_WIDTH * CANVAS_HEIGHT;
+    terms[0] = pixels;
+    coefficients[0] = &model->pixel_ns[strategy];
+    switch (strategy)
+    {
+    case ACCEL_BRUTE_FORCE:
+        terms[1] = pixels * stats.count;
+        coefficients[1] = &model->brute_test_ns;
+        return 2;
+    case ACCEL_TILE_CULLING:
+        terms[1] = stats.count;
+        coefficients[1] = &model->bin_sphere_ns;
+        terms[2] = (double)stats.tile_entries * (TILE_SIZE * TILE_SIZE);
+        coefficients[2] = &model->cull_test_ns;
+        return 3;
+    case ACCEL_BVH:
+        terms[1] = pixels * log2((double)stats.count + 1.0);
+        coefficients[1] = &model->bvh_level_ns;
+        terms[2] = pixels * stats.overlap;
+        coefficients[2] = &model->bvh_overlap_ns;
+        terms[3] = terms[1] * stats.clustering;
+        coefficients[3] = &model->bvh_cluster_ns;
+        terms[4] = terms[1] * stats.radius_cv;
+        coefficients[4] = &model->bvh_spread_ns;
+        return 5;
+    default:
+        terms[1] = pixels * cbrt((double)stats.count);
+        coefficients[1] = &model->hash_march_ns;
+        terms[2] = pixels * stats.overlap;
+        coefficients[2] = &model->hash_overlap_ns;
+        terms[3] = terms[2] * stats.clustering;
+        coefficients[3] = &model->hash_cluster_ns;
+        terms[4] = pixels * stats.radius_cv;
+        coefficients[4] = &model->hash_spread_ns;
+        return 5;
+    }
+}
+
+// What a strategy's build cost is proportional to, 0 for those that keep nothing between frames.
+static double BuildTerm(AccelStrategy strategy, const SceneStatistics& stats)
+{
+    switch (strategy)
+    {
+    case ACCEL_BVH:
+        return stats.count * log2((double)stats.count + 1.0);
+    case ACCEL_SPATIAL_HASH:
+        return stats.count;
+    default:
+        return 0.0;
+    }
+}
+
+AccelChoice ChooseAccelStrategy(const AccelCostModel& model, const SceneStatistics& stats, AccelStrategy override)
+{
+    AccelCostModel terms_model = model;
+    AccelChoice choice = {};
+    choice.stats = stats;
+    for (int s = 0; s < ACCEL_STRATEGY_COUNT; s++)
+    {
+        double terms[ACCEL_MAX_TERMS];
+        double* coefficients[ACCEL_MAX_TERMS];
+        int term_count = FrameTerms((AccelStrategy)s, stats, &terms_model, terms, coefficients);
+        double ns = 0.0;
+        for (int i = 0; i < term_count; i++)
+        {
+            ns += *coefficients[i] * terms[i];
+        }
+        choice.frame_ms[s] = ns * 1e-6;
+    }
+    choice.build_ms[ACCEL_BVH] = model.bvh_build_ns[bvh_builder] * BuildTerm(ACCEL_BVH, stats) * 1e-6;
+    choice.build_ms[ACCEL_SPATIAL_HASH] = model.hash_build_ns * BuildTerm(ACCEL_SPATIAL_HASH, stats) * 1e-6;
+
+    choice.forced = override != ACCEL_AUTO;
+    choice.strategy = choice.forced ? override : ACCEL_BRUTE_FORCE;
+    if (!choice.forced)
+    {
+        double best_ms = INFINITY;
+        for (int s = 0; s < ACCEL_STRATEGY_COUNT; s++)
+        {
+            double ms = choice.frame_ms[s] + choice.build_ms[s] / ACCEL_BUILD_FRAMES;
+            if (ms < best_ms)
+            {
+                best_ms = ms;
+                choice.strategy = (AccelStrategy)s;
+            }
+        }
+    }
+    return choice;
+}
+
+void LogAccelChoice(const AccelChoice& choice)
+{
+    const SceneStatistics& s = choice.stats;
+    TraceLog(LOG_INFO, "ACCEL: %d spheres (%d on screen), radius %.3g (cv %.2f), occupancy %.2f (clustering %.2f), %.1f per pixel",
+        s.count, s.on_screen, s.radius_mean, s.radius_cv, s.occupancy, s.clustering, s.overlap);
+    TraceLog(LOG_INFO, "ACCEL: predicted %s %.2f ms, %s %.2f ms, %s %.2f ms + %.1f ms build, %s %.2f ms + %.1f ms build: %s %s",
+        accel_strategy_names[ACCEL_BRUTE_FORCE], choice.frame_ms[ACCEL_BRUTE_FORCE],
+        accel_strategy_names[ACCEL_TILE_CULLING], choice.frame_ms[ACCEL_TILE_CULLING],
+        accel_strategy_names[ACCEL_BVH], choice.frame_ms[ACCEL_BVH], choice.build_ms[ACCEL_BVH],
+        accel_strategy_names[ACCEL_SPATIAL_HASH], choice.frame_ms[ACCEL_SPATIAL_HASH], choice.build_ms[ACCEL_SPATIAL_HASH],
+        choice.forced ? "forced" : "picked", accel_strategy_names[choice.strategy]);
+}
+
+/***************************  Calibration  ***************************/
+
+struct CostSample
+{
+    double terms[ACCEL_MAX_TERMS];
+    double ns;
+};
+
+// Least squares fit of ns = sum(coefficients[i] * terms[i]) with every coefficient >= 0: terms
+// whose coefficient comes out negative are dropped one at a time, most negative first.
+static void FitCost(const std::vector<CostSample>& samples, int term_count, double* coefficients)
+{
+    bool active[ACCEL_MAX_TERMS];
+    double scale[ACCEL_MAX_TERMS];
+    for (int i = 0; i < term_count; i++)
+    {
+        double sum = 0.0;
+        for (const CostSample& s : samples)
+        {
+            sum += s.terms[i] * s.terms[i];
+        }
+        scale[i] = sum > 0.0 ? 1.0 / sqrt(sum) : 0.0; // columns of unit length keep the system well conditioned
+        active[i] = sum > 0.0;
+        coefficients[i] = 0.0;
+    }
+
+    for (;;)
+    {
+        int columns[ACCEL_MAX_TERMS];
+        int n = 0;
+        for (int i = 0; i < term_count; i++)
+        {
+            if (active[i])
+            {
+                columns[n++] = i;
+            }
+        }
+        if (n == 0)
+        {
+            return;
+        }
+
+        // Normal equations, solved by Gaussian elimination with partial pivoting.
+        double a[ACCEL_MAX_TERMS][ACCEL_MAX_TERMS + 1] = {};
+        for (const CostSample& s : samples)
+        {
+            for (int r = 0; r < n; r++)
+            {
+                double tr = s.terms[columns[r]] * scale[columns[r]];
+                for (int c = 0; c < n; c++)
+                {
+                    a[r][c] += tr * s.terms[columns[c]] * scale[columns[c]];
+                }
+                a[r][n] += tr * s.ns;
+            }
+        }
+        for (int k = 0; k < n; k++)
+        {
+            int pivot = k;
+            for (int r = k + 1; r < n; r++)
+            {
+                pivot = fabs(a[r][k]) > fabs(a[pivot][k]) ? r : pivot;
+            }
+            for (int c = 0; c <= n; c++)
+            {
+                double t = a[k][c];
+                a[k][c] = a[pivot][c];
+                a[pivot][c] = t;
+            }
+            for (int r = 0; r < n; r++)
+            {
+                if (r != k && a[k][k] != 0.0)
+                {
+                    double f = a[r][k] / a[k][k];
+                    for (int c = k; c <= n; c++)
+                    {
+                        a[r][c] -= f * a[k][c];
+                    }
+                }
+            }
+        }
+
+        int most_negative = -1;
+        double solution[ACCEL_MAX_TERMS];
+        for (int k = 0; k < n; k++)
+        {
+            solution[k] = a[k][k] != 0.0 ? a[k][n] / a[k][k] : 0.0;
+            if (solution[k] < 0.0 && (most_negative < 0 || solution[k] < solution[most_negative]))
+            {
+                most_negative = k;
+            }
+        }
+        if (most_negative < 0)
+        {
+            for (int k = 0; k < n; k++)
+            {
+                coefficients[columns[k]] = solution[k] * scale[columns[k]];
+            }
+            return;
+        }
+        active[columns[most_negative]] = false;
+    }
+}
+
+static double NowMs()
+{
+    using namespace std::chrono;
+    return duration<double, std::milli>(steady_clock::now().time_since_epoch()).count();
+}
+
+static void LoadScene(const Sphere* spheres, int count)
+{
+    scene.Clear();
+    for (int i = 0; i < count; i++)
+    {
+        scene.Add(spheres[i]);
+    }
+    PublishScene();
+    BeginSceneFrame();
+}
+
+// Best of a few frames, after one that lets the renderer build what it keeps between frames.
+static double TimeFrame(Image* img, RenderMode mode)
+{
+    const int repeats = 3;
+    double best_ms = INFINITY;
+    for (int repeat = 0; repeat <= repeats; repeat++)
+    {
+        ResetRenderStats();
+        double start = NowMs();
+        DrawScene(img, mode);
+        double elapsed = NowMs() - start;
+        best_ms = repeat > 0 && elapsed < best_ms ? elapsed : best_ms;
+    }
+    return best_ms;
+}
+
+void CalibrateAccelCostModel(AccelCostModel* model)
+{
+    struct Probe
+    {
+        AccelStrategy strategy;
+        SceneDistribution distribution;
+        int count;
+    };
+    // Each strategy over a range where it could plausibly be picked, with distributions that
+    // pull its terms apart.
+    const Probe probes[] =
+    {
+        { ACCEL_BRUTE_FORCE, SCENE_UNIFORM, 1 },
+        { ACCEL_BRUTE_FORCE, SCENE_UNIFORM, 8 },
+        { ACCEL_BRUTE_FORCE, SCENE_UNIFORM, 32 },
+        { ACCEL_TILE_CULLING, SCENE_UNIFORM, 16 },
+        { ACCEL_TILE_CULLING, SCENE_CORRIDOR, 256 },
+        { ACCEL_TILE_CULLING, SCENE_UNIFORM, 1024 },
+        { ACCEL_TILE_CULLING, SCENE_CLUSTERED, 4096 },
+        { ACCEL_TILE_CULLING, SCENE_CORRIDOR, 16384 },
+        { ACCEL_BVH, SCENE_UNIFORM, 16 },
+        { ACCEL_BVH, SCENE_UNIFORM, 1024 },
+        { ACCEL_BVH, SCENE_CLUSTERED, 8192 },
+        { ACCEL_BVH, SCENE_MIXED_SIZES, 16384 },
+        { ACCEL_BVH, SCENE_CORRIDOR, 32768 },
+        { ACCEL_BVH, SCENE_MIXED_SIZES, 512 },
+        { ACCEL_BVH, SCENE_CLUSTERED, 65536 },
+        { ACCEL_SPATIAL_HASH, SCENE_UNIFORM, 16 },
+        { ACCEL_SPATIAL_HASH, SCENE_UNIFORM, 1024 },
+        { ACCEL_SPATIAL_HASH, SCENE_CLUSTERED, 512 },
+        { ACCEL_SPATIAL_HASH, SCENE_CLUSTERED, 8192 },
+        { ACCEL_SPATIAL_HASH, SCENE_MIXED_SIZES, 2048 },
+        { ACCEL_SPATIAL_HASH, SCENE_MIXED_SIZES, 16384 },
+        { ACCEL_SPATIAL_HASH, SCENE_CORRIDOR, 32768 },
+        { ACCEL_SPATIAL_HASH, SCENE_UNIFORM, 65536 },
+    };
+
+    Image img = GenImageColor(CANVAS_WIDTH, CANVAS_HEIGHT, BACKGROUND_COLOR);
+    std::vector<CostSample> samples[ACCEL_STRATEGY_COUNT];
+    std::vector<CostSample> builds[BVH_BUILDER_COUNT];
+    std::vector<CostSample> hash_builds;
+    int term_counts[ACCEL_STRATEGY_COUNT] = { 0 };
+    for (const Probe& probe : probes)
+    {
+        std::vector<Sphere> spheres;
+        GenerateSpheres(probe.distribution, probe.count, 1, &spheres);
+        LoadScene(spheres.data(), probe.count);
+        SceneStatistics stats;
+        AnalyzeScene(*frame_scene, &stats);
+
+        CostSample sample = {};
+        double* coefficients[ACCEL_MAX_TERMS];
+        term_counts[probe.strategy] = FrameTerms(probe.strategy, stats, model, sample.terms, coefficients);
+        sample.ns = TimeFrame(&img, accel_strategy_modes[probe.strategy]) * 1e6;
+        samples[probe.strategy].push_back(sample);
+        if (probe.strategy == ACCEL_BVH)
+        {
+            for (int builder = 0; builder < BVH_BUILDER_COUNT; builder++)
+            {
+                Bvh bvh;
+                double start = NowMs();
+                BuildBvh((BvhBuilder)builder, *frame_scene, &bvh);
+                builds[builder].push_back(CostSample{ { BuildTerm(ACCEL_BVH, stats) }, (NowMs() - start) * 1e6 });
+            }
+        }
+        if (probe.strategy == ACCEL_SPATIAL_HASH)
+        {
+            SpatialHashGrid grid;
+            double start = NowMs();
+            grid.Build(*frame_scene);
+            hash_builds.push_back(CostSample{ { BuildTerm(ACCEL_SPATIAL_HASH, stats) }, (NowMs() - start) * 1e6 });
+        }
+    }
+    UnloadImage(img);
+    LoadScene(DEFAULT_SCENE, DEFAULT_SCENE_COUNT);
+
+    for (int s = 0; s < ACCEL_STRATEGY_COUNT; s++)
+    {
+        SceneStatistics unused = {};
+        double terms[ACCEL_MAX_TERMS];
+        double* coefficients[ACCEL_MAX_TERMS];
+        FrameTerms((AccelStrategy)s, unused, model, terms, coefficients);
+        double fitted[ACCEL_MAX_TERMS];
+        FitCost(samples[s], term_counts[s], fitted);
+        for (int i = 0; i < term_counts[s]; i++)
+        {
+            *coefficients[i] = fitted[i];
+        }
+    }
+    for (int builder = 0; builder < BVH_BUILDER_COUNT; builder++)
+    {
+        FitCost(builds[builder], 1, &model->bvh_build_ns[builder]);
+    }
+    FitCost(hash_builds, 1, &model->hash_build_ns);
+    TraceLog(LOG_INFO, "ACCEL: calibrated per pixel brute %.2f, culling %.2f, bvh %.2f, hash %.2f ns; brute %.3f ns/test; culling %.1f ns/sphere + %.3f ns/test; "
+        "bvh %.2f ns/level + %.2f ns/overlap + %.2f ns/clustered level + %.2f ns/spread level; builds %.1f (%s) and %.1f (%s) ns/sphere/level",
+        model->pixel_ns[ACCEL_BRUTE_FORCE], model->pixel_ns[ACCEL_TILE_CULLING], model->pixel_ns[ACCEL_BVH], model->pixel_ns[ACCEL_SPATIAL_HASH],
+        model->brute_test_ns, model->bin_sphere_ns, model->cull_test_ns, model->bvh_level_ns, model->bvh_overlap_ns, model->bvh_cluster_ns,
+        model->bvh_spread_ns, model->bvh_build_ns[BVH_BUILD_SAH], bvh_builder_names[BVH_BUILD_SAH], model->bvh_build_ns[BVH_BUILD_LBVH],
+        bvh_builder_names[BVH_BUILD_LBVH]);
+    TraceLog(LOG_INFO, "ACCEL: calibrated hash %.2f ns/cell + %.2f ns/overlap + %.2f ns/clustered overlap + %.2f ns/unit cv; build %.1f ns/sphere",
+        model->hash_march_ns, model->hash_overlap_ns, model->hash_cluster_ns, model->hash_spread_ns, model->hash_build_ns);
+}
+
+/***************************  Auto render mode  ***************************/
+
+static AccelChoice auto_choice;
+static bool auto_analyzed = false;
+static AccelStrategy auto_override = ACCEL_AUTO;
+static BvhBuilder auto_builder = BVH_BUILD_SAH;
+
+void DrawSceneAuto(Image* img)
+{
+    int drift = frame_scene->count - auto_choice.stats.count;
+    bool reanalyze = !auto_analyzed || (float)(drift < 0 ? -drift : drift) > ACCEL_REANALYZE_RATIO * (float)auto_choice.stats.count;
+    if (reanalyze || accel_override != auto_override || bvh_builder != auto_builder)
+    {
+        SceneStatistics stats = auto_choice.stats;
+        if (reanalyze)
+        {
+            AnalyzeScene(*frame_scene, &stats);
+            auto_analyzed = true;
+        }
+        auto_override = accel_override;
+        auto_builder = bvh_builder;
+        auto_choice = ChooseAccelStrategy(accel_cost_model, stats, accel_override);
+        LogAccelChoice(auto_choice);
+    }
+
+    DrawScene(img, accel_strategy_modes[auto_choice.strategy]);
+    render_stats.mode = render_mode_names[RENDER_AUTO];
+    render_stats.strategy = accel_strategy_names[auto_choice.strategy];
+    render_stats.predicted_ms = auto_choice.frame_ms[auto_choice.strategy];
+}
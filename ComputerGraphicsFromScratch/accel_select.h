@@ -0,0 +1,124 @@
+/**********************************************************************************************
+*
+*   Acceleration strategy selection
+*
+*   Which renderer is fastest depends on the scene: testing every sphere with the SIMD kernels
+*   wins for a handful of them, screen tiles with beam culling for a few hundred to a few
+*   thousand, and a BVH or the spatial hash grid beyond that, depending on how the spheres
+*   cluster and how much their sizes vary. The auto render mode measures the scene once it
+*   changes enough (count, radius mean and spread, how much of its bounds the centers leave
+*   empty, how many spheres a pixel and a tile see) and predicts the frame time of each strategy
+*   from a linear cost model, on top of a cost per pixel of its own:
+*     - brute force: rays * spheres sphere tests
+*     - tile culling: a binning pass over the spheres, plus one test per tile candidate per
+*       pixel of the tile; the candidate lists already count what clustering and radius spread
+*       do on screen
+*     - bvh: log2(spheres) levels and the spheres overlapping the pixel per ray, and the levels
+*       again scaled by clustering and by radius spread, which change how much sibling boxes
+*       overlap
+*     - spatial hash: the cells a ray marches, about the cube root of the sphere count, and the
+*       spheres overlapping the pixel, again scaled by clustering, as clustered spheres crowd
+*       into fewer cells; plus a term in radius spread, as the cells are sized by the mean
+*       radius and large spheres go to the list every ray tests
+*   Strategies that keep a structure between frames add its build, spread over
+*   ACCEL_BUILD_FRAMES frames, as it is only rebuilt on edits.
+*
+*   The coefficients are fitted by timing each strategy on generated probe scenes. The defaults
+*   were fitted that way on a development machine; --accel-calibrate refits them at startup.
+*   --accel=<name> (or A) forces a strategy instead.
+*
+**********************************************************************************************/
+
+#ifndef ACCEL_SELECT_H
+#define ACCEL_SELECT_H
+
+#include "bvh.h"
+#include "renderer.h"
+#include "scene_snapshot.h"
+
+// Frames a BVH build is spread over when comparing it to strategies without one.
+#define ACCEL_BUILD_FRAMES 30
+
+// The scene is measured again once its sphere count drifts this far from the measured one.
+#define ACCEL_REANALYZE_RATIO 0.25f
+
+enum AccelStrategy
+{
+    ACCEL_BRUTE_FORCE,
+    ACCEL_TILE_CULLING,
+    ACCEL_BVH,
+    ACCEL_SPATIAL_HASH,
+    ACCEL_STRATEGY_COUNT,
+    ACCEL_AUTO = ACCEL_STRATEGY_COUNT
+};
+
+// Indexed up to and including ACCEL_AUTO.
+extern const char* accel_strategy_names[ACCEL_STRATEGY_COUNT + 1];
+
+// Render mode each strategy draws with.
+extern const RenderMode accel_strategy_modes[ACCEL_STRATEGY_COUNT];
+
+// Strategy the auto render mode uses, set with --accel=<name>; ACCEL_AUTO lets the cost model pick.
+extern AccelStrategy accel_override;
+
+bool ParseAccelStrategy(const char* name, AccelStrategy* strategy);
+
+struct SceneStatistics
+{
+    int count;
+    int on_screen;       // spheres with a canvas footprint
+    float radius_mean;
+    float radius_cv;     // standard deviation of the radius over its mean
+    float occupancy;     // fraction of a count-cell grid over the centers' bounds holding a center
+    float clustering;    // 1 - occupancy relative to uniformly spread centers, 0 for uniform
+    double overlap;      // sphere footprints covering the average pixel
+    long long tile_entries; // tile candidate list entries, as binned by the tiled renderer
+};
+
+// Nanoseconds per unit of each term.
+struct AccelCostModel
+{
+    double pixel_ns[ACCEL_STRATEGY_COUNT]; // per canvas pixel, whatever the scene
+    double brute_test_ns;   // per ray and sphere
+    double bin_sphere_ns;   // per sphere binned
+    double cull_test_ns;    // per tile candidate and pixel of the tile
+    double bvh_level_ns;    // per ray and log2(spheres)
+    double bvh_overlap_ns;  // per ray and overlapping sphere
+    double bvh_cluster_ns;  // per ray, log2(spheres) and unit of clustering
+    double bvh_spread_ns;   // per ray, log2(spheres) and unit of radius cv
+    double bvh_build_ns[BVH_BUILDER_COUNT]; // per sphere and log2(spheres)
+    double hash_march_ns;   // per ray and cube root of the sphere count
+    double hash_overlap_ns; // per ray and overlapping sphere
+    double hash_cluster_ns; // per ray, overlapping sphere and unit of clustering
+    double hash_spread_ns;  // per ray and unit of radius cv
+    double hash_build_ns;   // per sphere
+};
+
+extern AccelCostModel accel_cost_model;
+
+struct AccelChoice
+{
+    AccelStrategy strategy;
+    bool forced;
+    SceneStatistics stats;
+    double frame_ms[ACCEL_STRATEGY_COUNT]; // predicted per frame, builds excluded
+    double build_ms[ACCEL_STRATEGY_COUNT]; // predicted per rebuild
+};
+
+void AnalyzeScene(const SceneSnapshot& source, SceneStatistics* stats);
+
+// Predicted costs of every strategy, and the cheapest once builds are spread over
+// ACCEL_BUILD_FRAMES frames, unless override names one.
+AccelChoice ChooseAccelStrategy(const AccelCostModel& model, const SceneStatistics& stats, AccelStrategy override);
+
+// Refits model by timing every strategy on probe scenes loaded into the global scene, which is
+// left holding DEFAULT_SCENE. Takes a few seconds.
+void CalibrateAccelCostModel(AccelCostModel* model);
+
+void LogAccelChoice(const AccelChoice& choice);
+
+// Draws with the strategy chosen for frame_scene, choosing again when the scene has changed
+// enough or the override has.
+void DrawSceneAuto(Image* img);
+
+#endif //ACCEL_SELECT_H
@@ -0,0 +1,2067 @@
+#include "benchmark.h"
+#include "accel_select.h"
+#include "bvh.h"
+#include "bvh_lod.h"
+#include "bvh_cache.h"
+#include "compact_scene.h"
+#include "instancing.h"
+#include "lighting.h"
+#include "out_of_core_bvh.h"
+#include "packet_bvh.h"
+#include "path_tracer.h"
+#include "parallel.h"
+#include "precision.h"
+#include "procedural_scene.h"
+#include "pvs.h"
+#include "raytracer.h"
+#include "render_stats.h"
+#include "renderer.h"
+#include "scene_order.h"
+#include "scene_snapshot.h"
+#include "spatial_hash.h"
+#include "static_scene.h"
+#include "trace_kernels.h"
+#include "validation.h"
+#include "wide_bvh.h"
+#include <atomic>
+#include <chrono>
+#include <float.h>
+#include <math.h>
+#include <random>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#define BENCH_REPEATS 10
+
+typedef RayHit (*ClosestHitKernel)(Ray r, float tmin, float tmax);
+
+struct KernelBench
+{
+    const char* name;
+    ClosestHitKernel kernel;
+};
+
+static std::vector<int> all_objects;
+
+static RayHit RuntimeClosestHit(Ray r, float tmin, float tmax)
+{
+    return ClosestHit(r, tmin, tmax, all_objects.data(), scene.Count());
+}
+
+// Mismatches against a reference over every bench run so far; any at all fail --bench.
+static long long bench_mismatches = 0;
+
+// Whether a hit fails the reference the way CompareHits judges it: another sphere, or the same one
+// at a t off by more than VALIDATION_T_TOLERANCE relative to the expected t.
+static bool HitsDiffer(RayHit expected, RayHit actual)
+{
+    if (actual.sphere != expected.sphere)
+    {
+        return true;
+    }
+    return expected.sphere >= 0 && !(fabsf(actual.t - expected.t) <= VALIDATION_T_TOLERANCE * expected.t);
+}
+
+static double NowMs()
+{
+    using namespace std::chrono;
+    return duration<double, std::milli>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Camera rays through every step-th pixel of every step-th row, row after row, or column after
+// column as DrawScene casts them.
+static std::vector<Ray> CanvasRays(int step, bool by_column)
+{
+    std::vector<Ray> rays;
+    rays.reserve((size_t)(CANVAS_WIDTH / step) * (CANVAS_HEIGHT / step));
+    for (int outer = 0; outer < (by_column ? CANVAS_WIDTH : CANVAS_HEIGHT); outer += step)
+    {
+        for (int inner = 0; inner < (by_column ? CANVAS_HEIGHT : CANVAS_WIDTH); inner += step)
+        {
+            int x = by_column ? outer : inner;
+            int y = by_column ? inner : outer;
+            rays.push_back(CanvasRay(Vector2Int{ x - CANVAS_WIDTH / 2, y - CANVAS_HEIGHT / 2 }));
+        }
+    }
+    return rays;
+}
+
+// Calls trace(i, &counters) for every ray index, CANVAS_WIDTH of them per chunk across the
+// workers, and returns the milliseconds it took. Each chunk counts into counters of its own,
+// left in chunk_counters by worker, so workers don't share the cache lines they write.
+template <typename Counters, typename Trace>
+static double TimeRays(int ray_count, std::vector<Counters>* chunk_counters, Trace trace)
+{
+    chunk_counters->assign(WorkerCount(), Counters{});
+    double start = NowMs();
+    ParallelFor(0, ray_count, CANVAS_WIDTH, [&](int worker, int begin, int end)
+    {
+        Counters counters = {};
+        for (int i = begin; i < end; i++)
+        {
+            trace(i, &counters);
+        }
+        (*chunk_counters)[worker] = counters;
+    });
+    return NowMs() - start;
+}
+
+// One field summed over the chunks' counters.
+template <typename Counters>
+static long long SumCounters(const std::vector<Counters>& chunk_counters, long long Counters::*field)
+{
+    long long sum = 0;
+    for (const Counters& counters : chunk_counters)
+    {
+        sum += counters.*field;
+    }
+    return sum;
+}
+
+// A reader slot of snapshots a bench owns. Each bench registers on snapshots of its own and
+// releases its slot before returning, so running out means one leaked: stop rather than pin slot -1.
+static int RegisterBenchReader(SceneSnapshots* snapshots)
+{
+    int reader = snapshots->RegisterReader();
+    if (reader < 0)
+    {
+        TraceLog(LOG_FATAL, "All %d scene snapshot reader slots are taken", SNAPSHOT_MAX_READERS);
+    }
+    return reader;
+}
+
+// A scene published to snapshots of its own, pinned by one reader for as long as the fixture
+// lives. Generated scenes come from seed 1; sorted ones along scene_curve.
+class BenchScene
+{
+public:
+    BenchScene(const std::vector<Sphere>& spheres, bool sort_spatially) : scene(spheres.data(), (int)spheres.size())
+    {
+        Publish(sort_spatially);
+    }
+
+    BenchScene(SceneDistribution distribution, int count, bool sort_spatially) : scene(Generate(distribution, count))
+    {
+        Publish(sort_spatially);
+    }
+
+    ~BenchScene()
+    {
+        snapshots.Unpin(reader);
+        snapshots.UnregisterReader(reader);
+    }
+
+    const SceneSnapshot& Snapshot() const { return *snapshot; }
+
+private:
+    static Scene Generate(SceneDistribution distribution, int count)
+    {
+        std::vector<Sphere> spheres;
+        GenerateSpheres(distribution, count, 1, &spheres);
+        return Scene(spheres.data(), count);
+    }
+
+    void Publish(bool sort_spatially)
+    {
+        if (sort_spatially)
+        {
+            SortSceneSpatially(&scene, scene_curve, NULL);
+        }
+        snapshots.Publish(scene);
+        reader = RegisterBenchReader(&snapshots);
+        snapshot = snapshots.Pin(reader);
+    }
+
+    Scene scene;
+    SceneSnapshots snapshots;
+    int reader;
+    const SceneSnapshot* snapshot;
+};
+
+static void BenchKernels(const std::vector<Ray>& rays, std::vector<RayHit>* baseline_out)
+{
+    KernelBench kernels[] =
+    {
+        { "runtime scene", RuntimeClosestHit },
+        { "static unrolled", DefaultStaticClosestHitUnrolled },
+        { "static bvh", DefaultStaticClosestHitBvh },
+    };
+
+    // Runtime results are the baseline every other kernel is checked against, the static ones'
+    // hits translated to the runtime scene's indices first.
+    int remap[DEFAULT_SCENE_COUNT];
+    if (!DefaultStaticRemap(*frame_scene, remap))
+    {
+        printf("  the scene no longer holds exactly DEFAULT_SCENE, so the static kernels trace another one\n");
+    }
+    std::vector<RayHit> baseline(rays.size());
+    for (size_t i = 0; i < rays.size(); i++)
+    {
+        baseline[i] = RuntimeClosestHit(rays[i], 1.0f, INFINITY);
+    }
+
+    printf("closest hit, %d spheres, %d primary rays, best of %d\n", scene.Count(), (int)rays.size(), BENCH_REPEATS);
+    printf("  %-24s %10s %10s %12s\n", "kernel", "ns/ray", "Mrays/s", "mismatches");
+    for (const KernelBench& bench : kernels)
+    {
+        double best_ms = 1e30;
+        long long mismatches = 0;
+        for (int repeat = 0; repeat < BENCH_REPEATS; repeat++)
+        {
+            mismatches = 0;
+            double start = NowMs();
+            for (size_t i = 0; i < rays.size(); i++)
+            {
+                RayHit hit = bench.kernel(rays[i], 1.0f, INFINITY);
+                int sphere = bench.kernel == RuntimeClosestHit || hit.sphere < 0 ? hit.sphere : remap[hit.sphere];
+                mismatches += sphere != baseline[i].sphere;
+            }
+            double elapsed = NowMs() - start;
+            best_ms = elapsed < best_ms ? elapsed : best_ms;
+        }
+        double ns_per_ray = best_ms * 1e6 / (double)rays.size();
+        printf("  %-24s %10.2f %10.2f %12lld\n", bench.name, ns_per_ray, 1e3 / ns_per_ray, mismatches);
+        bench_mismatches += mismatches;
+    }
+    *baseline_out = baseline;
+}
+
+// Every variant the CPU can run, so they can be compared on one machine.
+static void BenchTraceKernels(const std::vector<RayHit>& baseline)
+{
+    SphereSoA spheres;
+    BuildSphereSoA(*frame_scene, &spheres);
+    HitBuffer hits;
+    ResizeHitBuffer(&hits);
+    Image img = GenImageColor(CANVAS_WIDTH, CANVAS_HEIGHT, BACKGROUND_COLOR);
+
+    printf("trace kernels, whole canvas incl. pixel conversion, best of %d\n", BENCH_REPEATS);
+    printf("  %-24s %10s %10s %12s\n", "isa", "ns/ray", "Mrays/s", "mismatches");
+    for (int isa = 0; isa <= DetectIsa(); isa++)
+    {
+        const TraceKernels& kernels = *GetTraceKernels((IsaLevel)isa);
+        double best_ms = 1e30;
+        for (int repeat = 0; repeat < BENCH_REPEATS; repeat++)
+        {
+            double start = NowMs();
+            DrawSceneKernels(&img, kernels, spheres, &hits);
+            double elapsed = NowMs() - start;
+            best_ms = elapsed < best_ms ? elapsed : best_ms;
+        }
+
+        // baseline is in DrawScene order (x outer, y inner), the hit buffer row by row.
+        long long mismatches = 0;
+        size_t ray = 0;
+        for (int x = 0; x < CANVAS_WIDTH; x++)
+        {
+            for (int y = 0; y < CANVAS_HEIGHT; y++)
+            {
+                mismatches += hits.sphere[(size_t)y * CANVAS_WIDTH + x] != baseline[ray++].sphere;
+            }
+        }
+
+        double ns_per_ray = best_ms * 1e6 / ((double)CANVAS_WIDTH * CANVAS_HEIGHT);
+        printf("  %-24s %10.2f %10.2f %12lld%s\n", isa_names[isa], ns_per_ray, 1e3 / ns_per_ray, mismatches,
+            &kernels == trace_kernels ? "  (selected)" : "");
+        bench_mismatches += mismatches;
+    }
+
+    UnloadImage(img);
+}
+
+template <typename P>
+static void BenchPrecisionTier(const char* name, const std::vector<Ray>& rays, const std::vector<RayHit>& reference)
+{
+    std::vector<RayHit> hits(rays.size());
+    double best_ms = 1e30;
+    for (int repeat = 0; repeat < BENCH_REPEATS; repeat++)
+    {
+        double start = NowMs();
+        for (size_t i = 0; i < rays.size(); i++)
+        {
+            hits[i] = ClosestHitT<P>(rays[i], 1.0f, INFINITY, all_objects.data(), scene.Count());
+        }
+        double elapsed = NowMs() - start;
+        best_ms = elapsed < best_ms ? elapsed : best_ms;
+    }
+
+    long long mismatches = 0;
+    double max_error = 0.0;
+    for (size_t i = 0; i < rays.size(); i++)
+    {
+        mismatches += hits[i].sphere != reference[i].sphere;
+        if (hits[i].sphere >= 0 && hits[i].sphere == reference[i].sphere)
+        {
+            double error = fabs((double)hits[i].t - (double)reference[i].t) / (double)reference[i].t;
+            max_error = error > max_error ? error : max_error;
+        }
+    }
+
+    double ns_per_ray = best_ms * 1e6 / (double)rays.size();
+    printf("  %-24s %10.2f %10.2f %12lld %12.2e\n", name, ns_per_ray, 1e3 / ns_per_ray, mismatches, max_error);
+}
+
+// Times each tier and diffs it against double. The second pass scales the scene up around the
+// camera: the image is the same, but the terms of the quadratic grow by the square of the scale.
+static void BenchPrecisionTiers(const std::vector<Ray>& rays)
+{
+    const float scales[] = { 1.0f, 1000.0f };
+    std::vector<Sphere> saved(scene.Count());
+    for (int i = 0; i < scene.Count(); i++)
+    {
+        saved[i] = scene.GetSphere(i);
+    }
+
+    for (float scale : scales)
+    {
+        for (int i = 0; i < scene.Count(); i++)
+        {
+            Sphere scaled = saved[i];
+            scaled.center = Vector3{ saved[i].center.x * scale, saved[i].center.y * scale, saved[i].center.z * scale };
+            scaled.radius = saved[i].radius * scale;
+            scene.Update(scene.HandleAt(i), scaled);
+        }
+        PublishScene();
+        BeginSceneFrame();
+
+        std::vector<RayHit> reference(rays.size());
+        for (size_t i = 0; i < rays.size(); i++)
+        {
+            reference[i] = ClosestHitT<PrecisionDouble>(rays[i], 1.0f, INFINITY, all_objects.data(), scene.Count());
+        }
+
+        printf("precision tiers, scene scaled x%g, best of %d, diffed against double\n", scale, BENCH_REPEATS);
+        printf("  %-24s %10s %10s %12s %12s\n", "tier", "ns/ray", "Mrays/s", "mismatches", "max t error");
+        BenchPrecisionTier<PrecisionFloat>(precision_names[PRECISION_FLOAT], rays, reference);
+        BenchPrecisionTier<PrecisionDouble>(precision_names[PRECISION_DOUBLE], rays, reference);
+        BenchPrecisionTier<PrecisionFast>(precision_names[PRECISION_FAST], rays, reference);
+        printf("\n");
+    }
+
+    for (int i = 0; i < scene.Count(); i++)
+    {
+        scene.Update(scene.HandleAt(i), saved[i]);
+    }
+    PublishScene();
+    BeginSceneFrame();
+}
+
+static void BenchRenderModes()
+{
+    Image img = GenImageColor(CANVAS_WIDTH, CANVAS_HEIGHT, BACKGROUND_COLOR);
+
+    printf("full frame, %dx%d, best of %d\n", CANVAS_WIDTH, CANVAS_HEIGHT, BENCH_REPEATS);
+    printf("  %-24s %10s %14s %14s\n", "mode", "ms", "primary rays", "sphere tests");
+    for (int mode = 0; mode < RENDER_MODE_COUNT; mode++)
+    {
+        double best_ms = 1e30;
+        for (int repeat = 0; repeat < BENCH_REPEATS; repeat++)
+        {
+            ResetRenderStats();
+            double start = NowMs();
+            DrawScene(&img, (RenderMode)mode);
+            double elapsed = NowMs() - start;
+            best_ms = elapsed < best_ms ? elapsed : best_ms;
+        }
+        printf("  %-24s %10.2f %14lld %14lld\n", render_mode_names[mode], best_ms,
+            render_stats.primary_rays, render_stats.intersection_tests);
+    }
+
+    UnloadImage(img);
+}
+
+// Edits against a large scene: each one must cost the same no matter how many spheres there are,
+// and publishing them and bringing the kernels' SoA up to date must only cost per touched chunk.
+static void BenchSceneEdits()
+{
+    const int sphere_count = 1000000;
+    const int edit_count = 1000;
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> position(-50.0f, 50.0f);
+    std::uniform_real_distribution<float> size(0.05f, 0.5f);
+    auto random_sphere = [&]()
+    {
+        return Sphere{ Vector3{ position(rng), position(rng), 60.0f + position(rng) }, size(rng), RED };
+    };
+
+    double start = NowMs();
+    std::vector<Sphere> initial(sphere_count);
+    for (Sphere& sp : initial)
+    {
+        sp = random_sphere();
+    }
+    Scene big(initial.data(), sphere_count);
+    double fill_ms = NowMs() - start;
+
+    SceneSnapshots snapshots;
+    int reader = RegisterBenchReader(&snapshots);
+    start = NowMs();
+    snapshots.Publish(big);
+    double publish_all_ms = NowMs() - start;
+
+    SphereSoA soa;
+    start = NowMs();
+    BuildSphereSoA(*snapshots.Pin(reader), &soa);
+    double build_ms = NowMs() - start;
+
+    // A third each of removals, additions and in-place updates.
+    std::vector<SceneHandle> targets(edit_count);
+    for (SceneHandle& handle : targets)
+    {
+        handle = big.HandleAt((int)(rng() % (unsigned int)big.Count()));
+    }
+    start = NowMs();
+    for (int i = 0; i < edit_count; i++)
+    {
+        switch (i % 3)
+        {
+        case 0: big.Remove(targets[i]); break;
+        case 1: big.Add(random_sphere()); break;
+        default: big.Update(targets[i], random_sphere()); break;
+        }
+    }
+    double edit_ms = NowMs() - start;
+
+    start = NowMs();
+    snapshots.Publish(big);
+    double publish_ms = NowMs() - start;
+
+    const SceneSnapshot* snapshot = snapshots.Pin(reader);
+    start = NowMs();
+    UpdateSphereSoA(*snapshot, &soa);
+    double update_ms = NowMs() - start;
+
+    SphereSoA rebuilt;
+    BuildSphereSoA(*snapshot, &rebuilt);
+    long long mismatches = 0;
+    for (int i = 0; i < rebuilt.count; i++)
+    {
+        mismatches += soa.c[i] != rebuilt.c[i] || soa.co_x[i] != rebuilt.co_x[i];
+    }
+    mismatches += soa.count != rebuilt.count;
+
+    // A single edit only copies the chunk it lands in.
+    big.Update(big.HandleAt(big.Count() / 2), random_sphere());
+    start = NowMs();
+    snapshots.Publish(big);
+    UpdateSphereSoA(*snapshots.Pin(reader), &soa);
+    double single_ms = NowMs() - start;
+
+    printf("scene edits, %d spheres\n", sphere_count);
+    printf("  %-24s %10.2f ms\n", "fill", fill_ms);
+    printf("  %-24s %10.2f ms\n", "first snapshot", publish_all_ms);
+    printf("  %-24s %10.2f ms\n", "full soa build", build_ms);
+    printf("  %-24s %10.1f ns/edit (%d edits)\n", "add/remove/update", edit_ms * 1e6 / edit_count, edit_count);
+    printf("  %-24s %10.3f ms\n", "publish the edits", publish_ms);
+    printf("  %-24s %10.3f ms, %lld mismatches against a rebuild\n", "soa update for them", update_ms, mismatches);
+    bench_mismatches += mismatches;
+    printf("  %-24s %10.3f ms\n", "one edit, publish + soa", single_ms);
+    snapshots.UnregisterReader(reader);
+}
+
+// A writer thread rewrites every sphere's radius to the same value and publishes, over and over,
+// while this thread pins snapshots and checks that each one holds a single radius throughout.
+static void BenchSnapshotConsistency()
+{
+    const int sphere_count = 3 * SNAPSHOT_CHUNK_SIZE;
+    const int publish_count = 2000;
+    std::vector<Sphere> initial(sphere_count, Sphere{ Vector3{ 0.0f, 0.0f, 10.0f }, 1.0f, RED });
+    Scene edited(initial.data(), sphere_count);
+    SceneSnapshots snapshots;
+    snapshots.Publish(edited);
+    int reader = RegisterBenchReader(&snapshots);
+
+    std::atomic<bool> done(false);
+    std::thread writer([&]()
+    {
+        for (int v = 0; v < publish_count; v++)
+        {
+            for (int i = 0; i < sphere_count; i++)
+            {
+                edited.Update(edited.HandleAt(i), Sphere{ Vector3{ 0.0f, 0.0f, 10.0f }, 1.0f + (float)v, RED });
+            }
+            snapshots.Publish(edited);
+        }
+        done.store(true);
+    });
+
+    long long frames = 0;
+    long long torn = 0;
+    unsigned long long versions_seen = 0;
+    unsigned long long last_version = 0;
+    while (!done.load())
+    {
+        const SceneSnapshot* snapshot = snapshots.Pin(reader);
+        float radius = snapshot->GetSphere(0).radius;
+        for (int i = 1; i < snapshot->count; i++)
+        {
+            torn += snapshot->GetSphere(i).radius != radius;
+        }
+        versions_seen += snapshot->version != last_version;
+        last_version = snapshot->version;
+        snapshots.Unpin(reader);
+        frames++;
+        std::this_thread::yield();
+    }
+    writer.join();
+    snapshots.Reclaim();
+
+    printf("snapshot consistency, %d spheres, %d publishes from a writer thread\n", sphere_count, publish_count);
+    printf("  %-24s %10lld frames, %llu distinct versions, %lld torn spheres\n", "reader", frames, versions_seen, torn);
+    printf("  %-24s %10llu reclaimed, %d still retired\n", "writer", snapshots.ReclaimedCount(), snapshots.RetiredCount());
+    bench_mismatches += torn;
+    snapshots.UnregisterReader(reader);
+}
+
+// Every render mode, checked pixel by pixel against the scalar reference.
+static void BenchValidation()
+{
+    Image img = GenImageColor(CANVAS_WIDTH, CANVAS_HEIGHT, BACKGROUND_COLOR);
+    PrecisionTier selected = precision_tier;
+
+    printf("validation against the scalar reference, t tolerance %g\n", VALIDATION_T_TOLERANCE);
+    printf("  %-24s %10s %10s %12s %12s %12s\n", "mode", "pixels", "filled", "id mismatch", "t mismatch", "max t error");
+    for (int mode = 0; mode < RENDER_MODE_COUNT; mode++)
+    {
+        // Only the tiled and preview renderers go through ClosestHit and follow the tier.
+        bool tiered = mode == RENDER_TILED || mode == RENDER_PREVIEW;
+        for (int tier = 0; tier < (tiered ? PRECISION_COUNT : 1); tier++)
+        {
+            precision_tier = (PrecisionTier)tier;
+            ValidationReport report;
+            ResetRenderStats();
+            ValidateFrame(&img, (RenderMode)mode, &report);
+            PrintValidationReport(tiered ? TextFormat("%s, %s", render_mode_names[mode], precision_names[tier]) : render_mode_names[mode], report);
+            // The compact scene's quantized spheres are expected to differ here and there.
+            if (mode != RENDER_COMPACT)
+            {
+                bench_mismatches += report.id_mismatches + report.t_mismatches;
+            }
+        }
+    }
+    precision_tier = selected;
+
+    UnloadImage(img);
+}
+
+// Both builders on each procedural distribution: what a build costs against what the tree saves
+// when tracing. Traces every 4th pixel in each direction and checks a sample of them by brute force.
+static void BenchBvhBuilders()
+{
+    const int sphere_count = 1000000;
+    const int step = 4;
+    const int checked_rays = 32;
+
+    std::vector<Ray> rays = CanvasRays(step, true);
+
+    printf("bvh builders, %d spheres, %d workers, %d primary rays\n", sphere_count, WorkerCount(), (int)rays.size());
+    printf("  %-24s %10s %10s %10s %10s %12s %10s\n", "scene, builder", "build ms", "nodes", "sah cost", "Mrays/s", "nodes/ray", "mismatch");
+    for (int dist = 0; dist < SCENE_DISTRIBUTION_COUNT; dist++)
+    {
+        BenchScene fixture((SceneDistribution)dist, sphere_count, false);
+        const SceneSnapshot* snapshot = &fixture.Snapshot();
+
+        for (int builder = 0; builder < BVH_BUILDER_COUNT; builder++)
+        {
+            Bvh bvh;
+            double start = NowMs();
+            BuildBvh((BvhBuilder)builder, *snapshot, &bvh);
+            double build_ms = NowMs() - start;
+
+            BvhTraceCounters counters = { 0 };
+            std::vector<RayHit> hits(rays.size());
+            start = NowMs();
+            for (size_t i = 0; i < rays.size(); i++)
+            {
+                hits[i] = BvhClosestHit(bvh, rays[i], 1.0f, INFINITY, &counters);
+            }
+            double trace_ms = NowMs() - start;
+
+            long long mismatches = 0;
+            for (int k = 0; k < checked_rays; k++)
+            {
+                size_t i = (size_t)k * rays.size() / checked_rays;
+                RayHit expected = { -1, INFINITY };
+                for (int s = 0; s < snapshot->count; s++)
+                {
+                    RayIntersection hit = IntersectRaySphere(rays[i], snapshot->GetSphere(s));
+                    if (hit.t1 >= 1.0f && hit.t1 < expected.t)
+                    {
+                        expected = RayHit{ s, hit.t1 };
+                    }
+                    if (hit.t2 >= 1.0f && hit.t2 < expected.t)
+                    {
+                        expected = RayHit{ s, hit.t2 };
+                    }
+                }
+                mismatches += HitsDiffer(expected, hits[i]);
+            }
+
+            printf("  %-24s %10.1f %10d %10.1f %10.2f %12.1f %10lld\n",
+                TextFormat("%s, %s", scene_distribution_names[dist], bvh_builder_names[builder]), build_ms, (int)bvh.nodes.size(),
+                BvhSahCost(bvh), (double)rays.size() / (trace_ms * 1000.0), (double)counters.nodes_visited / (double)rays.size(), mismatches);
+            bench_mismatches += mismatches;
+        }
+    }
+}
+
+// The binary SAH tree against its 8-wide collapse, in memory and in traversal speed with every
+// kernel variant this CPU runs.
+static void BenchWideBvh()
+{
+    const int sphere_count = 1000000;
+    const int step = 4;
+
+    std::vector<Ray> rays = CanvasRays(step, true);
+
+    printf("wide bvh, %d spheres, %d primary rays\n", sphere_count, (int)rays.size());
+    printf("  %-24s %10s %10s %10s %12s %10s\n", "scene, traversal", "node MB", "build ms", "Mrays/s", "nodes/ray", "mismatch");
+    for (int dist = 0; dist < SCENE_DISTRIBUTION_COUNT; dist++)
+    {
+        BenchScene fixture((SceneDistribution)dist, sphere_count, false);
+
+        Bvh binary;
+        BuildBvh(BVH_BUILD_SAH, fixture.Snapshot(), &binary);
+        WideBvh wide;
+        double start = NowMs();
+        BuildWideBvh(binary, &wide);
+        double collapse_ms = NowMs() - start;
+
+        BvhTraceCounters counters = { 0 };
+        std::vector<RayHit> expected(rays.size());
+        start = NowMs();
+        for (size_t i = 0; i < rays.size(); i++)
+        {
+            expected[i] = BvhClosestHit(binary, rays[i], 1.0f, INFINITY, &counters);
+        }
+        double trace_ms = NowMs() - start;
+        printf("  %-24s %10.1f %10s %10.2f %12.1f %10s\n", TextFormat("%s, binary", scene_distribution_names[dist]),
+            (double)(binary.nodes.size() * sizeof(BvhNode)) / (1024.0 * 1024.0), "", (double)rays.size() / (trace_ms * 1000.0),
+            (double)counters.nodes_visited / (double)rays.size(), "");
+
+        for (int isa = 0; isa <= DetectIsa(); isa++)
+        {
+            const TraceKernels& kernels = *GetTraceKernels((IsaLevel)isa);
+            counters = BvhTraceCounters{ 0 };
+            long long mismatches = 0;
+            start = NowMs();
+            for (size_t i = 0; i < rays.size(); i++)
+            {
+                RayHit hit = kernels.wide_bvh_closest_hit(wide, rays[i], 1.0f, INFINITY, &counters);
+                mismatches += HitsDiffer(expected[i], hit);
+            }
+            trace_ms = NowMs() - start;
+            printf("  %-24s %10.1f %10.1f %10.2f %12.1f %10lld\n", TextFormat("%s, wide %s", scene_distribution_names[dist], isa_names[isa]),
+                (double)(wide.nodes.size() * sizeof(WideBvhNode)) / (1024.0 * 1024.0), collapse_ms, (double)rays.size() / (trace_ms * 1000.0),
+                (double)counters.nodes_visited / (double)rays.size(), mismatches);
+            bench_mismatches += mismatches;
+        }
+    }
+}
+
+// Whole canvas through the binary SAH tree, one ray at a time against one tile packet at a time.
+static void BenchPacketBvh()
+{
+    const int sphere_count = 1000000;
+    const long long ray_count = (long long)CANVAS_WIDTH * CANVAS_HEIGHT;
+
+    printf("bvh packets, %d spheres, %dx%d rays per packet\n", sphere_count, TILE_SIZE, TILE_SIZE);
+    printf("  %-24s %10s %14s %14s %12s %10s\n", "scene, traversal", "Mrays/s", "fetches/ray", "box tests/ray", "frustum cull", "mismatch");
+    static RayPacket packet;
+    for (int dist = 0; dist < SCENE_DISTRIBUTION_COUNT; dist++)
+    {
+        BenchScene fixture((SceneDistribution)dist, sphere_count, false);
+        Bvh bvh;
+        BuildBvh(BVH_BUILD_SAH, fixture.Snapshot(), &bvh);
+
+        // Single rays, in the packets' order so both produce hits tile by tile.
+        BvhTraceCounters single = { 0 };
+        std::vector<RayHit> expected;
+        expected.reserve(ray_count);
+        double start = NowMs();
+        for (int tile = 0; tile < TILE_COUNT; tile++)
+        {
+            CanvasRect rect = TileCanvasRect(tile % TILE_COUNT_X, tile / TILE_COUNT_X);
+            for (int y = rect.y0; y <= rect.y1; y++)
+            {
+                for (int x = rect.x0; x <= rect.x1; x++)
+                {
+                    expected.push_back(BvhClosestHit(bvh, CanvasRay(Vector2Int{ x, y }), 1.0f, INFINITY, &single));
+                }
+            }
+        }
+        double single_ms = NowMs() - start;
+        printf("  %-24s %10.2f %14.2f %14.2f %12s %10s\n", TextFormat("%s, single rays", scene_distribution_names[dist]),
+            (double)ray_count / (single_ms * 1000.0), (double)single.nodes_visited / (double)ray_count, (double)single.nodes_visited / (double)ray_count, "", "");
+
+        PacketTraceCounters counters = { 0 };
+        long long mismatches = 0;
+        start = NowMs();
+        for (int tile = 0; tile < TILE_COUNT; tile++)
+        {
+            BuildTilePacket(tile % TILE_COUNT_X, tile / TILE_COUNT_X, &packet);
+            TracePacket(bvh, &packet, 1.0f, INFINITY, &counters);
+            for (int i = 0; i < PACKET_RAYS; i++)
+            {
+                const RayHit& e = expected[(size_t)tile * PACKET_RAYS + i];
+                mismatches += HitsDiffer(e, packet.hits[i]);
+            }
+        }
+        double packet_ms = NowMs() - start;
+        printf("  %-24s %10.2f %14.2f %14.2f %11.1f%% %10lld\n", TextFormat("%s, packets", scene_distribution_names[dist]),
+            (double)ray_count / (packet_ms * 1000.0), (double)counters.node_fetches / (double)ray_count, (double)counters.ray_box_tests / (double)ray_count,
+            100.0 * (double)counters.frustum_culls / (double)counters.node_fetches, mismatches);
+        bench_mismatches += mismatches;
+    }
+}
+
+// True if the ray passes so close to the sphere's edge that rounding decides whether it hits:
+// the squared distance of the center from the ray is within what the quadratic's cancellation
+// can move at this distance from the camera.
+static bool GrazesSphere(Ray r, const Sphere& sp)
+{
+    double cx = (double)sp.center.x - CAMERA_ORIGIN.x, cy = (double)sp.center.y - CAMERA_ORIGIN.y, cz = (double)sp.center.z - CAMERA_ORIGIN.z;
+    double dx = r.direction.x, dy = r.direction.y, dz = r.direction.z;
+    double along = (cx * dx + cy * dy + cz * dz) / (dx * dx + dy * dy + dz * dz);
+    double px = cx - along * dx, py = cy - along * dy, pz = cz - along * dz;
+    double distance_sq = px * px + py * py + pz * pz;
+    double r_sq = (double)sp.radius * sp.radius;
+    return fabs(distance_sq - r_sq) <= 32.0 * FLT_EPSILON * (cx * cx + cy * cy + cz * cz);
+}
+
+// Traces the instanced scene and the same spheres flattened into one BVH, and compares them. Hits
+// may differ on grazing rays, since the instanced spheres are intersected in their cluster's space
+// with different rounding; those are counted apart from real mismatches.
+static long long CompareInstancedToFlat(const InstancedScene& instanced, const std::vector<Ray>& rays, double* instanced_mrays,
+    double* flat_mrays, double* flat_build_ms, size_t* flat_bytes, long long* grazing)
+{
+    std::vector<Sphere> spheres;
+    instanced.Flatten(&spheres);
+    std::vector<int> first_sphere(instanced.InstanceCount());
+    int offset = 0;
+    for (int i = 0; i < instanced.InstanceCount(); i++)
+    {
+        first_sphere[i] = offset;
+        offset += (int)instanced.GetCluster(instanced.GetInstance(i).cluster).centers.size();
+    }
+
+    BenchScene flat(spheres, false);
+    Bvh bvh;
+    double start = NowMs();
+    BuildBvh(BVH_BUILD_SAH, flat.Snapshot(), &bvh);
+    *flat_build_ms = NowMs() - start;
+    *flat_bytes = bvh.nodes.size() * sizeof(BvhNode) + bvh.spheres.size() * (sizeof(BvhSphere) + sizeof(int)) + spheres.size() * sizeof(Sphere);
+
+    BvhTraceCounters counters = { 0 };
+    std::vector<RayHit> expected(rays.size());
+    start = NowMs();
+    for (size_t i = 0; i < rays.size(); i++)
+    {
+        expected[i] = BvhClosestHit(bvh, rays[i], 1.0f, INFINITY, &counters);
+    }
+    *flat_mrays = (double)rays.size() / ((NowMs() - start) * 1000.0);
+
+    std::vector<InstanceHit> hits(rays.size());
+    start = NowMs();
+    for (size_t i = 0; i < rays.size(); i++)
+    {
+        hits[i] = instanced.ClosestHit(rays[i], 1.0f, INFINITY, &counters);
+    }
+    *instanced_mrays = (double)rays.size() / ((NowMs() - start) * 1000.0);
+
+    long long mismatches = 0;
+    *grazing = 0;
+    for (size_t i = 0; i < rays.size(); i++)
+    {
+        int sphere = hits[i].instance < 0 ? -1 : first_sphere[hits[i].instance] + hits[i].sphere;
+        if (sphere == expected[i].sphere || fabsf(hits[i].t - expected[i].t) <= VALIDATION_T_TOLERANCE * expected[i].t)
+        {
+            continue;
+        }
+        if ((sphere >= 0 && GrazesSphere(rays[i], spheres[sphere])) || (expected[i].sphere >= 0 && GrazesSphere(rays[i], spheres[expected[i].sphere])))
+        {
+            (*grazing)++;
+        }
+        else
+        {
+            mismatches++;
+        }
+    }
+    bench_mismatches += mismatches;
+    return mismatches;
+}
+
+// A million spheres as 4096 instances of four clusters, against the same spheres in one flat BVH:
+// memory, trace speed, and what it costs to move instances.
+static void BenchInstancing()
+{
+    const int cluster_count = 4;
+    const int cluster_size = 256;
+    const int instance_count = 4096;
+    const int step = 4;
+
+    std::vector<Ray> rays = CanvasRays(step, true);
+
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    InstancedScene instanced;
+    double start = NowMs();
+    for (int c = 0; c < cluster_count; c++)
+    {
+        std::vector<Sphere> spheres(cluster_size);
+        for (Sphere& sp : spheres)
+        {
+            Vector3 p;
+            do
+            {
+                p = Vector3{ 2.0f * unit(rng) - 1.0f, 2.0f * unit(rng) - 1.0f, 2.0f * unit(rng) - 1.0f };
+            } while (Vector3LengthSqr(p) > 1.0f);
+            sp = Sphere{ p, 0.05f + 0.1f * unit(rng), ColorFromHSV(unit(rng) * 360.0f, 0.7f, 0.9f) };
+        }
+        instanced.AddCluster(spheres);
+    }
+    for (int i = 0; i < instance_count; i++)
+    {
+        float z = 6.0f + unit(rng) * 94.0f;
+        Vector3 position = { (2.0f * unit(rng) - 1.0f) * 0.5f * z, (2.0f * unit(rng) - 1.0f) * 0.5f * z, z };
+        Vector3 axis = { unit(rng) - 0.5f, unit(rng) - 0.5f, unit(rng) - 0.5f };
+        instanced.AddInstance(SphereInstance{ i % cluster_count, position, QuaternionFromAxisAngle(axis, unit(rng) * 2.0f * PI), 0.5f + unit(rng) });
+    }
+    instanced.Update();
+    double build_ms = NowMs() - start;
+
+    double instanced_mrays, flat_mrays, flat_build_ms;
+    size_t flat_bytes;
+    long long grazing;
+    long long mismatches = CompareInstancedToFlat(instanced, rays, &instanced_mrays, &flat_mrays, &flat_build_ms, &flat_bytes, &grazing);
+
+    printf("instancing, %d clusters of %d spheres, %d instances (%d spheres), %d primary rays\n", cluster_count, cluster_size, instance_count,
+        cluster_size * instance_count, (int)rays.size());
+    printf("  %-24s %10s %10s %10s %10s %10s\n", "layout", "build ms", "MB", "Mrays/s", "grazing", "mismatch");
+    printf("  %-24s %10.1f %10.2f %10.2f %10lld %10lld\n", "two-level", build_ms, (double)instanced.MemoryBytes() / (1024.0 * 1024.0), instanced_mrays,
+        grazing, mismatches);
+    printf("  %-24s %10.1f %10.2f %10.2f %10s %10s\n", "flat", flat_build_ms, (double)flat_bytes / (1024.0 * 1024.0), flat_mrays, "", "");
+
+    // Moving instances refits the top level; the flat scene would rebuild every sphere.
+    start = NowMs();
+    instanced.MoveInstance(0, Vector3Add(instanced.GetInstance(0).position, Vector3{ 1.0f, 0.0f, 0.0f }), instanced.GetInstance(0).rotation);
+    instanced.Update();
+    double move_one_ms = NowMs() - start;
+    Quaternion spin = QuaternionFromAxisAngle(Vector3{ 0.0f, 1.0f, 0.0f }, 0.1f);
+    start = NowMs();
+    for (int i = 0; i < instance_count; i++)
+    {
+        const SphereInstance& inst = instanced.GetInstance(i);
+        instanced.MoveInstance(i, Vector3Add(inst.position, Vector3{ 0.0f, 0.5f, 0.0f }), QuaternionMultiply(spin, inst.rotation));
+    }
+    instanced.Update();
+    double move_all_ms = NowMs() - start;
+    mismatches = CompareInstancedToFlat(instanced, rays, &instanced_mrays, &flat_mrays, &flat_build_ms, &flat_bytes, &grazing);
+    printf("  %-24s %10.3f ms refit, against %.1f ms to rebuild the flat bvh\n", "move one instance", move_one_ms, flat_build_ms);
+    printf("  %-24s %10.3f ms refit, then %.2f Mrays/s, %lld grazing, %lld mismatches\n", "move every instance", move_all_ms, instanced_mrays,
+        grazing, mismatches);
+}
+
+// Treelet files of a million spheres traced under shrinking resident caps, with tiles in scanline
+// and in Hilbert order, against the same tree in memory. The same scenes are then streamed from
+// their generator within a small budget, as --storage=treelets does, and traced against it too.
+static void BenchOutOfCore()
+{
+    const int sphere_count = 1000000;
+    const size_t caps[] = { (size_t)1 << 20, (size_t)2 << 20, (size_t)4 << 20, (size_t)1 << 30 };
+    const size_t stream_budget = (size_t)32 << 20;
+    const char* path = "bench.treelets";
+
+    std::vector<int> scanline(TILE_COUNT);
+    for (int i = 0; i < TILE_COUNT; i++)
+    {
+        scanline[i] = i;
+    }
+    std::vector<int> hilbert;
+    HilbertTileOrder(&hilbert);
+
+    printf("out of core bvh, %d spheres, %d KB treelets\n", sphere_count, OOC_TREELET_BYTES >> 10);
+    printf("  %-28s %10s %10s %10s %12s %12s %10s\n", "scene, cap, tile order", "Mrays/s", "nodes/ray", "maps", "maps/tile", "resident MB", "mismatch");
+    for (int dist = 0; dist < SCENE_DISTRIBUTION_COUNT; dist += 3)
+    {
+        BenchScene fixture((SceneDistribution)dist, sphere_count, false);
+        const SceneSnapshot* snapshot = &fixture.Snapshot();
+        Bvh bvh;
+        BuildBvh(BVH_BUILD_SAH, *snapshot, &bvh);
+
+        double start = NowMs();
+        if (!WriteOutOfCoreBvh(bvh, *snapshot, path))
+        {
+            printf("  could not write %s\n", path);
+            bench_mismatches++;
+            return;
+        }
+        double write_ms = NowMs() - start;
+        OutOfCoreBvh ooc;
+        ooc.Open(path, caps[0]);
+        printf("  %s: written in %.1f ms, %d treelets (%.1f MB), %.0f%% of the in-memory tree's bytes\n", scene_distribution_names[dist], write_ms,
+            ooc.TreeletCount(), (double)ooc.TreeletCount() * OOC_TREELET_BYTES / (1024.0 * 1024.0),
+            100.0 * (double)ooc.TreeletCount() * OOC_TREELET_BYTES / (double)(bvh.nodes.size() * sizeof(BvhNode) + bvh.spheres.size() * sizeof(OocSphere)));
+
+        for (size_t cap : caps)
+        {
+            for (int order = 0; order < 2; order++)
+            {
+                const std::vector<int>& tiles = order == 0 ? scanline : hilbert;
+                ooc.Open(path, cap);
+                OutOfCoreCounters counters = { 0 };
+                std::vector<Ray> rays;
+                for (int tile : tiles)
+                {
+                    CanvasRect rect = TileCanvasRect(tile % TILE_COUNT_X, tile / TILE_COUNT_X);
+                    for (int y = rect.y0; y <= rect.y1; y++)
+                    {
+                        for (int x = rect.x0; x <= rect.x1; x++)
+                        {
+                            rays.push_back(CanvasRay(Vector2Int{ x, y }));
+                        }
+                    }
+                }
+                std::vector<RayHit> hits(rays.size());
+                start = NowMs();
+                for (size_t i = 0; i < rays.size(); i++)
+                {
+                    Color col;
+                    hits[i] = ooc.ClosestHit(rays[i], 1.0f, INFINITY, &col, &counters);
+                }
+                double trace_ms = NowMs() - start;
+
+                BvhTraceCounters reference = { 0 };
+                long long mismatches = 0;
+                for (size_t i = 0; i < rays.size(); i++)
+                {
+                    RayHit expected = BvhClosestHit(bvh, rays[i], 1.0f, INFINITY, &reference);
+                    mismatches += hits[i].sphere != expected.sphere || hits[i].t != expected.t;
+                }
+                long long ray_count = (long long)rays.size();
+                printf("  %-28s %10.2f %10.1f %10lld %12.2f %12.1f %10lld\n",
+                    TextFormat("%s, %d MB, %s", scene_distribution_names[dist], (int)(cap >> 20), order == 0 ? "scanline" : "hilbert"),
+                    (double)ray_count / (trace_ms * 1000.0), (double)counters.nodes_visited / (double)ray_count, counters.treelet_maps,
+                    (double)counters.treelet_maps / (double)tiles.size(), (double)ooc.ResidentCount() * OOC_TREELET_BYTES / (1024.0 * 1024.0), mismatches);
+                bench_mismatches += mismatches;
+            }
+        }
+        ooc.Close();
+
+        // Generator indices are the fixture's scene indices, as it isn't sorted.
+        start = NowMs();
+        if (!WriteOutOfCoreScene(SphereGenerator((SceneDistribution)dist, sphere_count, 1), BVH_BUILD_SAH, path, stream_budget) ||
+            !ooc.Open(path, caps[2]))
+        {
+            printf("  could not stream %s\n", path);
+            bench_mismatches++;
+            return;
+        }
+        double stream_ms = NowMs() - start;
+        std::vector<Ray> rays;
+        for (int tile : hilbert)
+        {
+            CanvasRect rect = TileCanvasRect(tile % TILE_COUNT_X, tile / TILE_COUNT_X);
+            for (int y = rect.y0; y <= rect.y1; y++)
+            {
+                for (int x = rect.x0; x <= rect.x1; x++)
+                {
+                    rays.push_back(CanvasRay(Vector2Int{ x, y }));
+                }
+            }
+        }
+        std::vector<RayHit> hits(rays.size());
+        OutOfCoreCounters counters = { 0 };
+        start = NowMs();
+        for (size_t i = 0; i < rays.size(); i++)
+        {
+            Color col;
+            hits[i] = ooc.ClosestHit(rays[i], 1.0f, INFINITY, &col, &counters);
+        }
+        double trace_ms = NowMs() - start;
+
+        BvhTraceCounters reference = { 0 };
+        long long mismatches = 0;
+        for (size_t i = 0; i < rays.size(); i++)
+        {
+            RayHit expected = BvhClosestHit(bvh, rays[i], 1.0f, INFINITY, &reference);
+            mismatches += hits[i].sphere != expected.sphere || hits[i].t != expected.t;
+        }
+        long long ray_count = (long long)rays.size();
+        printf("  %s: streamed in %.1f ms within %d MB, %d treelets (%.1f MB)\n", scene_distribution_names[dist], stream_ms, (int)(stream_budget >> 20),
+            ooc.TreeletCount(), (double)ooc.TreeletCount() * OOC_TREELET_BYTES / (1024.0 * 1024.0));
+        printf("  %-28s %10.2f %10.1f %10lld %12.2f %12.1f %10lld\n", TextFormat("%s, streamed, %d MB", scene_distribution_names[dist],
+            (int)(caps[2] >> 20)), (double)ray_count / (trace_ms * 1000.0), (double)counters.nodes_visited / (double)ray_count, counters.treelet_maps,
+            (double)counters.treelet_maps / (double)hilbert.size(), (double)ooc.ResidentCount() * OOC_TREELET_BYTES / (1024.0 * 1024.0), mismatches);
+        bench_mismatches += mismatches;
+        ooc.Close();
+        remove(path);
+    }
+}
+
+// A cold start on a cached scene (hashing it, mapping the tree and tracing the first rays, which
+// page it in) against building the tree.
+static void BenchBvhCache()
+{
+    const int sphere_count = 10000000;
+    const int step = 4;
+    const char* path = "bench.bvhcache";
+
+    std::vector<Ray> rays = CanvasRays(step, true);
+
+    BenchScene fixture(SCENE_UNIFORM, sphere_count, false);
+    const SceneSnapshot* snapshot = &fixture.Snapshot();
+
+    printf("bvh cache, %d spheres, %d workers, first %d primary rays after loading\n", sphere_count, WorkerCount(), (int)rays.size());
+    printf("  %-10s %10s %10s %10s %10s %10s %12s %10s\n", "builder", "build ms", "save ms", "MB", "key ms", "map ms", "rays ms", "identical");
+    for (int builder = 0; builder < BVH_BUILDER_COUNT; builder++)
+    {
+        Bvh built;
+        double start = NowMs();
+        BuildBvh((BvhBuilder)builder, *snapshot, &built);
+        double build_ms = NowMs() - start;
+        start = NowMs();
+        bool saved = SaveBvhCache(path, BvhCacheKey((BvhBuilder)builder, *snapshot), built);
+        double save_ms = NowMs() - start;
+        if (!saved)
+        {
+            printf("  could not write %s\n", path);
+            bench_mismatches++;
+            break;
+        }
+
+        Bvh loaded;
+        start = NowMs();
+        unsigned long long key = BvhCacheKey((BvhBuilder)builder, *snapshot);
+        double key_ms = NowMs() - start;
+        start = NowMs();
+        bool hit = LoadBvhCache(path, key, snapshot->count, &loaded);
+        double map_ms = NowMs() - start;
+
+        BvhTraceCounters counters = { 0 };
+        start = NowMs();
+        for (const Ray& r : rays)
+        {
+            BvhClosestHit(loaded, r, 1.0f, INFINITY, &counters);
+        }
+        double rays_ms = NowMs() - start;
+        bool identical = hit && loaded.nodes.size() == built.nodes.size() &&
+            memcmp(loaded.nodes.data(), built.nodes.data(), built.nodes.size() * sizeof(BvhNode)) == 0 &&
+            memcmp(loaded.spheres.data(), built.spheres.data(), built.spheres.size() * sizeof(BvhSphere)) == 0 &&
+            memcmp(loaded.sphere_ids.data(), built.sphere_ids.data(), built.sphere_ids.size() * sizeof(int)) == 0;
+        double megabytes = (double)(sizeof(BvhCacheHeader) + built.nodes.size() * sizeof(BvhNode) + built.spheres.size() * (sizeof(BvhSphere) + sizeof(int))) /
+            (1024.0 * 1024.0);
+        printf("  %-10s %10.1f %10.1f %10.1f %10.1f %10.2f %12.1f %10s\n", bvh_builder_names[builder], build_ms, save_ms, megabytes, key_ms, map_ms,
+            rays_ms, identical ? "yes" : "no");
+        bench_mismatches += !identical;
+
+        // The other builder's key, or any edit to the spheres, must miss.
+        if (LoadBvhCache(path, BvhCacheKey((BvhBuilder)((builder + 1) % BVH_BUILDER_COUNT), *snapshot), snapshot->count, &loaded))
+        {
+            printf("  %-10s loaded under the wrong key\n", bvh_builder_names[builder]);
+            bench_mismatches++;
+        }
+    }
+    remove(path);
+}
+
+// Fully dynamic scenes: every sphere moves every frame, so the grid is rebuilt each frame and
+// compared with rebuilding an LBVH, both traced with rows split across the same workers.
+static void BenchSpatialHash()
+{
+    const int sphere_count = 1000000;
+    const int frame_count = 10;
+    const int warm_up_frames = 3;
+
+    std::vector<Ray> rays = CanvasRays(1, false);
+    std::vector<RayHit> grid_hits(rays.size());
+    std::vector<RayHit> bvh_hits(rays.size());
+    int ray_count = (int)rays.size();
+
+    printf("spatial hash grid, %d moving spheres, %d frames, %d workers\n", sphere_count, frame_count, WorkerCount());
+    printf("  %-12s %10s %10s %10s %10s %12s %12s %10s %10s %8s %10s\n", "scene", "build ms", "trace ms", "frame ms", "Mrays/s", "lbvh build",
+        "lbvh trace", "cells/ray", "tests/ray", "allocs", "mismatch");
+    for (int dist = 0; dist < SCENE_DISTRIBUTION_COUNT; dist++)
+    {
+        std::vector<Sphere> spheres;
+        GenerateSpheres((SceneDistribution)dist, sphere_count, 1, &spheres);
+        // Every sphere swings about where it was generated, a few radii each way, so the scene
+        // keeps about its extent while no two frames share a position. The warm-up frames come
+        // close to both ends of the swing.
+        std::vector<Vector3> rest(sphere_count);
+        std::vector<Vector3> swing(sphere_count);
+        std::mt19937 rng(2);
+        std::normal_distribution<float> normal(0.0f, 1.0f);
+        for (int i = 0; i < sphere_count; i++)
+        {
+            float amplitude = spheres[i].radius * 2.0f;
+            rest[i] = spheres[i].center;
+            swing[i] = Vector3{ normal(rng) * amplitude, normal(rng) * amplitude, normal(rng) * amplitude };
+        }
+        Scene moving(spheres.data(), sphere_count);
+        SceneSnapshots snapshots;
+        int reader = RegisterBenchReader(&snapshots);
+
+        SpatialHashGrid grid;
+        Bvh bvh;
+        double build_ms = 0.0;
+        double trace_ms = 0.0;
+        double lbvh_build_ms = 0.0;
+        double lbvh_trace_ms = 0.0;
+        long long cells_visited = 0;
+        long long sphere_tests = 0;
+        long long mismatches = 0;
+        int warm_allocations = 0;
+        std::vector<SpatialHashCounters> grid_counters;
+        std::vector<BvhTraceCounters> bvh_counters;
+        for (int frame = 0; frame < frame_count; frame++)
+        {
+            float phase = cosf(1.3f * (float)frame);
+            for (int i = 0; i < sphere_count; i++)
+            {
+                Sphere& sp = spheres[i];
+                sp.center = Vector3{ rest[i].x + swing[i].x * phase, rest[i].y + swing[i].y * phase, rest[i].z + swing[i].z * phase };
+                moving.Update(moving.HandleAt(i), sp);
+            }
+            snapshots.Publish(moving);
+            const SceneSnapshot* snapshot = snapshots.Pin(reader);
+
+            double start = NowMs();
+            grid.Build(*snapshot);
+            double grid_build = NowMs() - start;
+            double grid_trace = TimeRays(ray_count, &grid_counters, [&](int i, SpatialHashCounters* counters)
+            {
+                grid_hits[i] = grid.ClosestHit(rays[i], 1.0f, INFINITY, counters);
+            });
+
+            start = NowMs();
+            BuildBvh(BVH_BUILD_LBVH, *snapshot, &bvh);
+            double lbvh_build = NowMs() - start;
+            double lbvh_trace = TimeRays(ray_count, &bvh_counters, [&](int i, BvhTraceCounters* counters)
+            {
+                bvh_hits[i] = BvhClosestHit(bvh, rays[i], 1.0f, INFINITY, counters);
+            });
+            snapshots.Unpin(reader);
+
+            for (int i = 0; i < ray_count; i++)
+            {
+                mismatches += HitsDiffer(bvh_hits[i], grid_hits[i]);
+            }
+            // The first frames size the storage; later ones should reuse it.
+            if (frame < warm_up_frames)
+            {
+                warm_allocations = grid.Allocations();
+                continue;
+            }
+            build_ms += grid_build;
+            trace_ms += grid_trace;
+            lbvh_build_ms += lbvh_build;
+            lbvh_trace_ms += lbvh_trace;
+            cells_visited += SumCounters(grid_counters, &SpatialHashCounters::cells_visited);
+            sphere_tests += SumCounters(grid_counters, &SpatialHashCounters::sphere_tests);
+        }
+        snapshots.UnregisterReader(reader);
+
+        double frames = (double)(frame_count - warm_up_frames);
+        double traced = frames * ray_count;
+        printf("  %-12s %10.2f %10.2f %10.2f %10.2f %12.2f %12.2f %10.2f %10.2f %8d %10lld\n", scene_distribution_names[dist], build_ms / frames,
+            trace_ms / frames, (build_ms + trace_ms) / frames, traced / (trace_ms * 1000.0), lbvh_build_ms / frames, lbvh_trace_ms / frames,
+            (double)cells_visited / traced, (double)sphere_tests / traced, grid.Allocations() - warm_allocations, mismatches);
+        bench_mismatches += mismatches;
+        printf("  %-12s cell %.4f, %d occupied cells, %.2f entries per sphere, %d oversized, %.1f MB\n", "", grid.CellSize(), grid.OccupiedCells(),
+            (double)grid.EntryCount() / sphere_count, grid.OversizedCount(), (double)grid.MemoryBytes() / (1024.0 * 1024.0));
+    }
+}
+
+// Quantized storage against the full-precision spheres and BVH: bytes per sphere, the errors
+// the quantization actually made next to its bounds, and how many pixels hit another sphere. The
+// same scene built straight from its generator, as --storage=compact does, has to come out the same.
+static void BenchCompactScene()
+{
+    const int sphere_count = 1000000;
+
+    std::vector<Ray> rays = CanvasRays(1, false);
+    std::vector<RayHit> compact_hits(rays.size());
+    std::vector<RayHit> bvh_hits(rays.size());
+    int ray_count = (int)rays.size();
+
+    printf("compact scene, %d spheres, %d bits each, groups of %d, %d workers\n", sphere_count, COMPACT_RECORD_BITS, COMPACT_GROUP_SIZE, WorkerCount());
+    printf("  %-12s %10s %10s %10s %10s %10s %10s %10s %10s %20s %20s %10s\n", "scene", "build ms", "gen ms", "B/sphere", "tree B/sp", "bvh B/sp",
+        "Mrays/s", "bvh Mrays", "tests/ray", "center err / bound", "radius err / bound", "other hit");
+    for (int dist = 0; dist < SCENE_DISTRIBUTION_COUNT; dist++)
+    {
+        std::vector<Sphere> spheres;
+        GenerateSpheres((SceneDistribution)dist, sphere_count, 1, &spheres);
+        BenchScene fixture(spheres, false);
+        const SceneSnapshot* snapshot = &fixture.Snapshot();
+
+        CompactScene compact;
+        double start = NowMs();
+        compact.Build(*snapshot, true);
+        double build_ms = NowMs() - start;
+        Bvh bvh;
+        BuildBvh(BVH_BUILD_SAH, *snapshot, &bvh);
+
+        // Held as records only: every sphere and id has to match the snapshot's build.
+        double generated_ms;
+        {
+            CompactScene generated;
+            start = NowMs();
+            generated.Build(SphereGenerator((SceneDistribution)dist, sphere_count, 1), true);
+            generated_ms = NowMs() - start;
+            long long mismatches = generated.Count() != compact.Count() || generated.TreeBytes() != compact.TreeBytes();
+            for (int i = 0; i < sphere_count && mismatches == 0; i++)
+            {
+                Sphere a = generated.GetSphere(i);
+                Sphere b = compact.GetSphere(i);
+                mismatches += generated.SceneIndex(i) != compact.SceneIndex(i) || memcmp(&a, &b, sizeof(Sphere)) != 0;
+            }
+            if (mismatches > 0)
+            {
+                printf("  %-12s generated build differs from the snapshot's\n", scene_distribution_names[dist]);
+            }
+            bench_mismatches += mismatches;
+        }
+
+        std::vector<BvhTraceCounters> compact_counters;
+        double compact_ms = TimeRays(ray_count, &compact_counters, [&](int i, BvhTraceCounters* counters)
+        {
+            compact_hits[i] = compact.ClosestHit(rays[i], 1.0f, INFINITY, counters);
+        });
+        long long sphere_tests = SumCounters(compact_counters, &BvhTraceCounters::sphere_tests);
+        std::vector<BvhTraceCounters> bvh_counters;
+        double bvh_ms = TimeRays(ray_count, &bvh_counters, [&](int i, BvhTraceCounters* counters)
+        {
+            bvh_hits[i] = BvhClosestHit(bvh, rays[i], 1.0f, INFINITY, counters);
+        });
+
+        long long other_hits = 0;
+        for (int i = 0; i < ray_count; i++)
+        {
+            int id = compact_hits[i].sphere < 0 ? -1 : compact.SceneIndex(compact_hits[i].sphere);
+            other_hits += id != bvh_hits[i].sphere;
+        }
+        float center_error = 0.0f;
+        float radius_error = 1.0f;
+        for (int i = 0; i < sphere_count; i++)
+        {
+            Sphere decoded = compact.GetSphere(i);
+            const Sphere& original = spheres[compact.SceneIndex(i)];
+            center_error = fmaxf(center_error, fmaxf(fabsf(decoded.center.x - original.center.x),
+                fmaxf(fabsf(decoded.center.y - original.center.y), fabsf(decoded.center.z - original.center.z))));
+            radius_error = fmaxf(radius_error, fmaxf(decoded.radius / original.radius, original.radius / decoded.radius));
+        }
+
+        size_t bvh_bytes = sizeof(Sphere) * (size_t)sphere_count + bvh.nodes.size() * sizeof(BvhNode) + bvh.spheres.size() * sizeof(BvhSphere) +
+            bvh.sphere_ids.size() * sizeof(int);
+        printf("  %-12s %10.2f %10.2f %10.3f %10.3f %10.3f %10.2f %10.2f %10.2f %20s %20s %9.3f%%\n", scene_distribution_names[dist], build_ms,
+            generated_ms, (double)compact.StorageBytes() / sphere_count, (double)compact.TreeBytes() / sphere_count, (double)bvh_bytes / sphere_count,
+            (double)ray_count / (compact_ms * 1000.0), (double)ray_count / (bvh_ms * 1000.0), (double)sphere_tests / ray_count,
+            TextFormat("%.2e / %.2e", center_error, compact.CenterError()),
+            TextFormat("%.3f%% / %.3f%%", 100.0f * (radius_error - 1.0f), 100.0f * (compact.RadiusError() - 1.0f)),
+            100.0 * (double)other_hits / ray_count);
+    }
+}
+
+// The same scenes stored in generation order and sorted along each curve: every path that gathers
+// spheres by index, timed, and how far apart in memory consecutive spheres of the BVH's leaves are.
+static void BenchSceneOrder()
+{
+    const int sphere_count = 1000000;
+    const SceneDistribution distributions[] = { SCENE_UNIFORM, SCENE_CLUSTERED };
+
+    std::vector<Ray> rays = CanvasRays(1, false);
+    std::vector<Color> colors(rays.size());
+    int ray_count = (int)rays.size();
+
+    printf("scene order, %d spheres, %d workers\n", sphere_count, WorkerCount());
+    printf("  %-20s %10s %10s %10s %10s %10s %10s %10s %10s %12s\n", "scene, order", "sort ms", "sah build", "lbvh build", "bvh trace",
+        "hash build", "hash trace", "compact", "compact tr", "leaf gap");
+    for (SceneDistribution dist : distributions)
+    {
+        std::vector<Sphere> spheres;
+        GenerateSpheres(dist, sphere_count, 1, &spheres);
+        for (int curve = 0; curve < SCENE_CURVE_COUNT; curve++)
+        {
+            Scene ordered(spheres.data(), sphere_count);
+            std::vector<int> remap;
+            double start = NowMs();
+            SortSceneSpatially(&ordered, (SceneCurve)curve, &remap);
+            double sort_ms = NowMs() - start;
+            SceneSnapshots snapshots;
+            snapshots.Publish(ordered);
+            int reader = RegisterBenchReader(&snapshots);
+            const SceneSnapshot* snapshot = snapshots.Pin(reader);
+
+            // Handles and the remap table both have to lead back to the sphere that was generated.
+            long long lost = 0;
+            for (int i = 0; i < sphere_count; i++)
+            {
+                Sphere sp = ordered.GetSphere(remap[i]);
+                lost += sp.center.x != spheres[i].center.x || sp.radius != spheres[i].radius || ordered.IndexOf(ordered.HandleAt(remap[i])) != remap[i];
+            }
+
+            Bvh bvh;
+            start = NowMs();
+            BuildBvh(BVH_BUILD_SAH, *snapshot, &bvh);
+            double sah_ms = NowMs() - start;
+            Bvh lbvh;
+            start = NowMs();
+            BuildBvh(BVH_BUILD_LBVH, *snapshot, &lbvh);
+            double lbvh_ms = NowMs() - start;
+
+            // Traced as DrawSceneBvh does, looking the hit sphere's color up in the snapshot.
+            std::vector<BvhTraceCounters> bvh_counters;
+            double bvh_ms = TimeRays(ray_count, &bvh_counters, [&](int i, BvhTraceCounters* counters)
+            {
+                RayHit hit = BvhClosestHit(bvh, rays[i], 1.0f, INFINITY, counters);
+                colors[i] = hit.sphere < 0 ? BACKGROUND_COLOR : snapshot->GetSphere(hit.sphere).color;
+            });
+
+            SpatialHashGrid grid;
+            grid.Build(*snapshot);
+            start = NowMs();
+            grid.Build(*snapshot);
+            double hash_build_ms = NowMs() - start;
+            std::vector<SpatialHashCounters> hash_counters;
+            double hash_trace_ms = TimeRays(ray_count, &hash_counters, [&](int i, SpatialHashCounters* counters)
+            {
+                RayHit hit = grid.ClosestHit(rays[i], 1.0f, INFINITY, counters);
+                colors[i] = hit.sphere < 0 ? BACKGROUND_COLOR : snapshot->GetSphere(hit.sphere).color;
+            });
+
+            CompactScene compact;
+            start = NowMs();
+            compact.Build(*snapshot, false);
+            double compact_ms = NowMs() - start;
+            double compact_trace_ms = TimeRays(ray_count, &bvh_counters, [&](int i, BvhTraceCounters* counters)
+            {
+                compact.ClosestHit(rays[i], 1.0f, INFINITY, counters);
+            });
+
+            double gap = 0.0;
+            for (size_t i = 1; i < bvh.sphere_ids.size(); i++)
+            {
+                gap += fabs((double)bvh.sphere_ids[i] - (double)bvh.sphere_ids[i - 1]);
+            }
+            gap /= (double)(bvh.sphere_ids.size() - 1);
+
+            printf("  %-20s %10.2f %10.2f %10.2f %10.2f %10.2f %10.2f %10.2f %10.2f %12.1f", TextFormat("%s, %s", scene_distribution_names[dist],
+                scene_curve_names[curve]), sort_ms, sah_ms, lbvh_ms, bvh_ms, hash_build_ms, hash_trace_ms, compact_ms, compact_trace_ms, gap);
+            printf(lost > 0 ? "   %lld spheres lost\n" : "\n", lost);
+            bench_mismatches += lost;
+            snapshots.Unpin(reader);
+            snapshots.UnregisterReader(reader);
+        }
+    }
+}
+
+// A fixed near scene in front of the same distant clusters filled ever more densely, traced
+// exactly and with the aggregates: frame time, and how far the filtered colors land from the exact ones.
+static void BenchBvhLod()
+{
+    const int near_count = 2000;
+    const int cluster_count = 1000;
+    const int cluster_sizes[] = { 0, 10, 100, 1000, 4000 };
+
+    std::vector<Ray> rays = CanvasRays(1, false);
+    int ray_count = (int)rays.size();
+    std::vector<RayHit> exact_hits(rays.size());
+    std::vector<BvhLodSample> samples(rays.size());
+    float footprint = BvhLodPixelFootprint();
+
+    printf("bvh lod, %d near spheres, %d clusters at 400-1000, %d workers\n", near_count, cluster_count, WorkerCount());
+    printf("  %-12s %10s %10s %10s %10s %10s %10s %10s %12s\n", "far spheres", "build ms", "lod ms", "exact ms", "lod frame",
+        "nodes/ray", "exact n/r", "tests/ray", "color error");
+    for (int cluster_size : cluster_sizes)
+    {
+        std::mt19937 rng(1);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        std::vector<Sphere> spheres;
+        for (int i = 0; i < near_count; i++)
+        {
+            Vector3 center = Vector3{ unit(rng) * 8.0f - 4.0f, unit(rng) * 8.0f - 4.0f, 4.0f + unit(rng) * 12.0f };
+            Color color = Color{ (unsigned char)(unit(rng) * 255.0f), (unsigned char)(unit(rng) * 255.0f), 128, 255 };
+            spheres.push_back(Sphere{ center, 0.05f + unit(rng) * 0.2f, color });
+        }
+        // Clusters 3 units across, a few pixels on screen, always in the same places.
+        std::mt19937 cluster_rng(2);
+        for (int c = 0; c < cluster_count; c++)
+        {
+            float z = 400.0f + unit(cluster_rng) * 600.0f;
+            Vector3 origin = Vector3{ (unit(cluster_rng) - 0.5f) * z, (unit(cluster_rng) - 0.5f) * z, z };
+            Color color = Color{ 64, (unsigned char)(unit(cluster_rng) * 255.0f), 200, 255 };
+            for (int i = 0; i < cluster_size; i++)
+            {
+                Vector3 offset = Vector3{ unit(rng) - 0.5f, unit(rng) - 0.5f, unit(rng) - 0.5f };
+                Vector3 center = Vector3{ origin.x + 3.0f * offset.x, origin.y + 3.0f * offset.y, origin.z + 3.0f * offset.z };
+                spheres.push_back(Sphere{ center, 0.02f + unit(rng) * 0.03f, color });
+            }
+        }
+        BenchScene fixture(spheres, true);
+        const SceneSnapshot* snapshot = &fixture.Snapshot();
+
+        Bvh bvh;
+        BuildBvh(BVH_BUILD_SAH, *snapshot, &bvh);
+        BvhLod lod;
+        double start = NowMs();
+        BuildBvhLod(bvh, *snapshot, &lod);
+        double build_ms = NowMs() - start;
+
+        std::vector<BvhTraceCounters> lod_counters;
+        double lod_ms = TimeRays(ray_count, &lod_counters, [&](int i, BvhTraceCounters* counters)
+        {
+            samples[i] = BvhLodTrace(bvh, lod, rays[i], 1.0f, INFINITY, footprint, counters);
+        });
+        std::vector<BvhTraceCounters> exact_counters;
+        double exact_ms = TimeRays(ray_count, &exact_counters, [&](int i, BvhTraceCounters* counters)
+        {
+            exact_hits[i] = BvhClosestHit(bvh, rays[i], 1.0f, INFINITY, counters);
+        });
+        long long lod_nodes = SumCounters(lod_counters, &BvhTraceCounters::nodes_visited);
+        long long lod_tests = SumCounters(lod_counters, &BvhTraceCounters::sphere_tests);
+        long long exact_nodes = SumCounters(exact_counters, &BvhTraceCounters::nodes_visited);
+
+        // Mean distance per channel between the filtered and exact colors.
+        double color_error = 0.0;
+        for (int i = 0; i < ray_count; i++)
+        {
+            Color exact = exact_hits[i].sphere < 0 ? BACKGROUND_COLOR : snapshot->GetSphere(exact_hits[i].sphere).color;
+            Color behind = samples[i].hit.sphere < 0 ? BACKGROUND_COLOR : snapshot->GetSphere(samples[i].hit.sphere).color;
+            Color shaded = BvhLodShade(samples[i], behind);
+            color_error += (fabs((double)shaded.r - exact.r) + fabs((double)shaded.g - exact.g) + fabs((double)shaded.b - exact.b)) / 3.0;
+        }
+
+        printf("  %-12d %10.2f %10.2f %10.2f %9.0f%% %10.2f %10.2f %10.2f %12.2f\n", cluster_count * cluster_size, build_ms, lod_ms, exact_ms, 100.0 * lod_ms / exact_ms,
+            (double)lod_nodes / ray_count, (double)exact_nodes / ray_count, (double)lod_tests / ray_count, color_error / ray_count);
+    }
+}
+
+// A wall of large spheres in front of a field of small ones, and an open scene: how much of
+// each the center cell's set keeps, what building and storing the sets costs, and brute force
+// over the set against brute force over the scene, which must find the same spheres.
+static void BenchPvs()
+{
+    const int field_count = 50000;
+    const int step = 8;
+    const char* path = "bench.pvs";
+    const char* scene_names[] = { "wall", "uniform" };
+
+    std::vector<Ray> rays = CanvasRays(step, false);
+    int ray_count = (int)rays.size();
+    std::vector<RayHit> all_hits(rays.size());
+    std::vector<RayHit> set_hits(rays.size());
+
+    printf("pvs, %d^3 cells over %.2f, %d planes of %d^2, %d workers, every %dth pixel\n", PVS_CELLS_PER_AXIS, PVS_REGION_SIZE, PVS_PLANES, PVS_MAP_SIZE,
+        WorkerCount(), step);
+    printf("  %-10s %10s %10s %10s %10s %10s %12s %10s %10s %10s\n", "scene", "spheres", "build ms", "save ms", "load ms", "KB", "center set",
+        "all ms", "set ms", "mismatch");
+    for (int kind = 0; kind < 2; kind++)
+    {
+        std::vector<Sphere> spheres;
+        if (kind == 0)
+        {
+            // Overlapping spheres wider than the view at z = 8, and the field behind them.
+            for (int y = -6; y <= 6; y++)
+            {
+                for (int x = -6; x <= 6; x++)
+                {
+                    spheres.push_back(Sphere{ Vector3{ 1.2f * x, 1.2f * y, 8.0f }, 1.0f, RED });
+                }
+            }
+            std::mt19937 rng(1);
+            std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+            for (int i = 0; i < field_count; i++)
+            {
+                float z = 10.0f + unit(rng) * 50.0f;
+                Vector3 center = Vector3{ (unit(rng) - 0.5f) * z, (unit(rng) - 0.5f) * z, z };
+                spheres.push_back(Sphere{ center, 0.05f + unit(rng) * 0.3f, BLUE });
+            }
+        }
+        else
+        {
+            GenerateSpheres(SCENE_UNIFORM, field_count, 1, &spheres);
+        }
+        BenchScene fixture(spheres, true);
+        const SceneSnapshot* snapshot = &fixture.Snapshot();
+
+        PotentiallyVisibleSet built;
+        double start = NowMs();
+        built.Build(*snapshot);
+        double build_ms = NowMs() - start;
+        unsigned long long key = PvsKey(*snapshot);
+        start = NowMs();
+        bool saved = built.Save(path, key);
+        double save_ms = NowMs() - start;
+        PotentiallyVisibleSet loaded;
+        start = NowMs();
+        bool hit = saved && loaded.Load(path, key, snapshot->count);
+        double load_ms = NowMs() - start;
+        if (!hit)
+        {
+            printf("  could not save and load %s\n", path);
+            bench_mismatches++;
+            break;
+        }
+
+        int cell = loaded.CellAt(CAMERA_ORIGIN);
+        const int* set = loaded.CellSpheres(cell);
+        int set_count = loaded.CellSphereCount(cell);
+        auto closest = [&](Ray r, const int* candidates, int count)
+        {
+            RayHit best = { -1, INFINITY };
+            for (int k = 0; k < count; k++)
+            {
+                int i = candidates == NULL ? k : candidates[k];
+                RayIntersection t = IntersectRaySphere(r, snapshot->GetSphere(i));
+                if (t.t1 >= 1.0f && t.t1 < best.t)
+                {
+                    best = RayHit{ i, t.t1 };
+                }
+                if (t.t2 >= 1.0f && t.t2 < best.t)
+                {
+                    best = RayHit{ i, t.t2 };
+                }
+            }
+            return best;
+        };
+        start = NowMs();
+        ParallelFor(0, ray_count, 64, [&](int, int begin, int end)
+        {
+            for (int i = begin; i < end; i++)
+            {
+                all_hits[i] = closest(rays[i], NULL, snapshot->count);
+            }
+        });
+        double all_ms = NowMs() - start;
+        start = NowMs();
+        ParallelFor(0, ray_count, 64, [&](int, int begin, int end)
+        {
+            for (int i = begin; i < end; i++)
+            {
+                set_hits[i] = closest(rays[i], set, set_count);
+            }
+        });
+        double set_ms = NowMs() - start;
+
+        int mismatches = 0;
+        for (int i = 0; i < ray_count; i++)
+        {
+            mismatches += all_hits[i].sphere != set_hits[i].sphere;
+        }
+        double kilobytes = (double)(sizeof(PvsFileHeader) + (PVS_CELLS_PER_AXIS * PVS_CELLS_PER_AXIS * PVS_CELLS_PER_AXIS + 1 + loaded.EntryCount()) * sizeof(int)) / 1024.0;
+        printf("  %-10s %10d %10.1f %10.2f %10.2f %10.1f %5d %5.1f%% %10.1f %10.1f %10d\n", scene_names[kind], snapshot->count, build_ms, save_ms, load_ms,
+            kilobytes, set_count, 100.0 * set_count / snapshot->count, all_ms, set_ms, mismatches);
+        bench_mismatches += mismatches;
+    }
+    remove(path);
+}
+
+// Shadow rays from every primary hit towards the default lights, through the any-hit query with
+// and without the per-light occluder cache, against the closest-hit primary rays that found the
+// hits. Every 16th shadow ray is checked against all spheres, and the cached answers against the
+// uncached ones.
+static void BenchShadowRays()
+{
+    const int count = 50000;
+
+    const std::vector<Ray> camera_rays = CanvasRays(1, false);
+    const int pixel_count = (int)camera_rays.size();
+
+    printf("shadow rays, %d spheres, default lights, %d workers\n", count, WorkerCount());
+    printf("  %-12s %10s %10s %12s %12s %12s %10s %10s\n", "scene", "primary", "shadow", "primary Mr/s", "any Mr/s", "cached Mr/s", "cache hit",
+        "mismatch");
+    for (int distribution = 0; distribution < SCENE_DISTRIBUTION_COUNT; distribution++)
+    {
+        BenchScene fixture((SceneDistribution)distribution, count, true);
+        const SceneSnapshot* snapshot = &fixture.Snapshot();
+        Bvh bvh;
+        BuildBvh(BVH_BUILD_SAH, *snapshot, &bvh);
+
+        std::vector<RayHit> hits(pixel_count);
+        std::vector<BvhTraceCounters> primary_counters;
+        double primary_ms = TimeRays(pixel_count, &primary_counters, [&](int i, BvhTraceCounters* counters)
+        {
+            hits[i] = BvhClosestHit(bvh, camera_rays[i], 1.0f, INFINITY, counters);
+        });
+
+        // In pixel order, as DrawSceneLit casts them.
+        struct ShadowRay
+        {
+            Vector3 p;
+            Vector3 l;
+            float tmax;
+            int light;
+        };
+        std::vector<ShadowRay> rays;
+        for (int i = 0; i < pixel_count; i++)
+        {
+            if (hits[i].sphere < 0)
+            {
+                continue;
+            }
+            const Ray& r = camera_rays[i];
+            Sphere sp = snapshot->GetSphere(hits[i].sphere);
+            Vector3 p = Vector3{ r.position.x + hits[i].t * r.direction.x, r.position.y + hits[i].t * r.direction.y, r.position.z + hits[i].t * r.direction.z };
+            for (int k = 0; k < (int)lights.size(); k++)
+            {
+                Vector3 l = lights[k].vector;
+                float tmax = INFINITY;
+                if (lights[k].type == LIGHT_AMBIENT)
+                {
+                    continue;
+                }
+                if (lights[k].type == LIGHT_POINT)
+                {
+                    l = Vector3{ l.x - p.x, l.y - p.y, l.z - p.z };
+                    tmax = 1.0f;
+                }
+                if ((p.x - sp.center.x) * l.x + (p.y - sp.center.y) * l.y + (p.z - sp.center.z) * l.z > 0.0f)
+                {
+                    rays.push_back(ShadowRay{ p, l, tmax, k });
+                }
+            }
+        }
+        int ray_count = (int)rays.size();
+
+        std::vector<unsigned char> blocked(rays.size());
+        std::vector<ShadowCounters> shadow_counters;
+        double any_ms = TimeRays(ray_count, &shadow_counters, [&](int i, ShadowCounters* counters)
+        {
+            blocked[i] = InShadow(bvh, *snapshot, rays[i].p, rays[i].l, rays[i].tmax, rays[i].light, NULL, counters);
+        });
+
+        // Each chunk starts with an empty cache of its own, as a worker of DrawSceneLit does.
+        std::vector<unsigned char> cached_blocked(rays.size());
+        std::atomic<long long> cache_hits(0);
+        double start = NowMs();
+        ParallelFor(0, ray_count, CANVAS_WIDTH, [&](int, int begin, int end)
+        {
+            ShadowCounters counters = { 0 };
+            ShadowCache cache;
+            ResetShadowCache(&cache, (int)lights.size());
+            for (int i = begin; i < end; i++)
+            {
+                cached_blocked[i] = InShadow(bvh, *snapshot, rays[i].p, rays[i].l, rays[i].tmax, rays[i].light, &cache, &counters);
+            }
+            cache_hits += counters.cache_hits;
+        });
+        double cached_ms = NowMs() - start;
+
+        int mismatches = 0;
+        for (int i = 0; i < ray_count; i++)
+        {
+            mismatches += blocked[i] != cached_blocked[i];
+        }
+        for (int i = 0; i < ray_count; i += 16)
+        {
+            float a = rays[i].l.x * rays[i].l.x + rays[i].l.y * rays[i].l.y + rays[i].l.z * rays[i].l.z;
+            bool expected = false;
+            for (int k = 0; k < snapshot->count && !expected; k++)
+            {
+                expected = BvhSphereBlocks(snapshot->GetSphere(k), rays[i].p, rays[i].l, a, SHADOW_EPSILON, rays[i].tmax);
+            }
+            mismatches += expected != (blocked[i] != 0);
+        }
+
+        printf("  %-12s %10d %10d %12.2f %12.2f %12.2f %9.1f%% %10d\n", scene_distribution_names[distribution], pixel_count, ray_count,
+            pixel_count / (primary_ms * 1000.0), ray_count / (any_ms * 1000.0), ray_count / (cached_ms * 1000.0),
+            100.0 * (double)cache_hits / (ray_count > 0 ? ray_count : 1), mismatches);
+        bench_mismatches += mismatches;
+    }
+}
+
+// Lighting every primary hit against every light, against culling the lights to the screen tiles
+// first and lighting against the tile's list, for growing numbers of small point lights spread
+// through the view, and for the most of them packed into one corner of it.
+static void BenchTiledLights()
+{
+    const int count = 50000;
+    struct LightSet
+    {
+        int count;
+        bool corner;
+    };
+    const LightSet sets[] = { { 256, false }, { 1024, false }, { 4096, false }, { 4096, true } };
+
+    BenchScene fixture(SCENE_UNIFORM, count, true);
+    const SceneSnapshot* snapshot = &fixture.Snapshot();
+    Bvh bvh;
+    BuildBvh(BVH_BUILD_SAH, *snapshot, &bvh);
+
+    const std::vector<Ray> camera_rays = CanvasRays(1, false);
+    const int pixel_count = (int)camera_rays.size();
+    std::vector<RayHit> hits(pixel_count);
+    std::vector<BvhTraceCounters> primary_counters;
+    TimeRays(pixel_count, &primary_counters, [&](int i, BvhTraceCounters* counters)
+    {
+        hits[i] = BvhClosestHit(bvh, camera_rays[i], 1.0f, INFINITY, counters);
+    });
+
+    // Intensity at every hit, lit by all the lights or by its tile's.
+    std::vector<float> all_intensity(pixel_count);
+    std::vector<float> tiled_intensity(pixel_count);
+    auto light_canvas = [&](const TileLights* tiles, float* intensity)
+    {
+        ParallelFor(0, CANVAS_HEIGHT, 8, [&](int, int begin, int end)
+        {
+            ShadowCounters counters = { 0 };
+            ShadowCache cache;
+            ResetShadowCache(&cache, (int)lights.size());
+            for (int row = begin; row < end; row++)
+            {
+                for (int column = 0; column < CANVAS_WIDTH; column++)
+                {
+                    const RayHit& hit = hits[row * CANVAS_WIDTH + column];
+                    if (hit.sphere < 0)
+                    {
+                        continue;
+                    }
+                    const Ray& r = camera_rays[row * CANVAS_WIDTH + column];
+                    Sphere sp = snapshot->GetSphere(hit.sphere);
+                    Vector3 p = Vector3{ r.position.x + hit.t * r.direction.x, r.position.y + hit.t * r.direction.y, r.position.z + hit.t * r.direction.z };
+                    Vector3 n = Vector3{ p.x - sp.center.x, p.y - sp.center.y, p.z - sp.center.z };
+                    int tile = (row / TILE_SIZE) * TILE_COUNT_X + column / TILE_SIZE;
+                    intensity[row * CANVAS_WIDTH + column] = tiles == NULL ?
+                        ComputeLighting(bvh, *snapshot, p, n, NULL, 0, &cache, &counters) :
+                        ComputeLighting(bvh, *snapshot, p, n, tiles->lights.data() + tiles->first[tile], tiles->first[tile + 1] - tiles->first[tile], &cache, &counters);
+                }
+            }
+        });
+    };
+
+    std::vector<Light> saved_lights = lights;
+    static TileLights tiles;
+    printf("tiled light culling, %d spheres, %dx%d tiles, lights of range %.1f, %d workers\n", count, TILE_SIZE, TILE_SIZE, LIGHT_GENERATED_RANGE,
+        WorkerCount());
+    printf("  %-8s %-8s %10s %10s %10s %12s %10s\n", "lights", "placed", "all ms", "cull ms", "tiled ms", "lights/hit", "mismatch");
+    for (const LightSet& set : sets)
+    {
+        lights.clear();
+        GeneratePointLights(set.count, 1, &lights);
+        if (set.corner)
+        {
+            // Squeezed into the left eighth of the view, at the same depths.
+            for (Light& light : lights)
+            {
+                light.vector.x = light.vector.x / 8.0f - 0.4375f * VIEWPORT_WIDTH / CAMERA_ORIGIN_DISTANCE * light.vector.z;
+            }
+        }
+
+        double start = NowMs();
+        light_canvas(NULL, all_intensity.data());
+        double all_ms = NowMs() - start;
+        start = NowMs();
+        CullLights(hits.data(), &tiles);
+        double cull_ms = NowMs() - start;
+        light_canvas(&tiles, tiled_intensity.data());
+        double tiled_ms = NowMs() - start;
+
+        long long listed = 0;
+        int hit_count = 0;
+        int mismatches = 0;
+        for (int i = 0; i < pixel_count; i++)
+        {
+            if (hits[i].sphere < 0)
+            {
+                continue;
+            }
+            int tile = (i / CANVAS_WIDTH / TILE_SIZE) * TILE_COUNT_X + i % CANVAS_WIDTH / TILE_SIZE;
+            listed += tiles.first[tile + 1] - tiles.first[tile];
+            hit_count++;
+            mismatches += all_intensity[i] != tiled_intensity[i];
+        }
+        printf("  %-8d %-8s %10.1f %10.2f %10.1f %12.1f %10d\n", set.count, set.corner ? "corner" : "spread", all_ms, cull_ms, tiled_ms,
+            (double)listed / (hit_count > 0 ? hit_count : 1), mismatches);
+        bench_mismatches += mismatches;
+    }
+    lights = saved_lights;
+}
+
+// One path per pixel through the wavefront stages, against the same paths followed one at a time
+// depth-first, which should give the same radiance bit for bit.
+static void BenchPathTracer()
+{
+    const int count = 50000;
+    const int pixel_count = CANVAS_WIDTH * CANVAS_HEIGHT;
+    std::vector<Vector3> wave_radiance(pixel_count);
+    std::vector<Vector3> recursive_radiance(pixel_count);
+    std::vector<RayHit> primary_hits(pixel_count);
+    PathQueues queues;
+    InitPathQueues(&queues);
+
+    printf("path tracer, %d spheres, default lights, queues of %d paths (%.1f MB), %d workers\n", count, PATH_QUEUE_CAPACITY,
+        PathQueueBytes(queues) / (1024.0 * 1024.0), WorkerCount());
+    printf("  %-12s %10s %10s %10s %10s %12s %12s %10s %10s\n", "scene", "rays", "shadow", "bounces", "roulette", "wavefront ms", "recursive ms",
+        "Mrays/s", "mismatch");
+    for (int distribution = 0; distribution < SCENE_DISTRIBUTION_COUNT; distribution++)
+    {
+        BenchScene fixture((SceneDistribution)distribution, count, true);
+        const SceneSnapshot* snapshot = &fixture.Snapshot();
+        Bvh bvh;
+        BuildBvh(BVH_BUILD_SAH, *snapshot, &bvh);
+
+        PathStats wave_stats = { 0 };
+        double start = NowMs();
+        TracePathCanvas(bvh, *snapshot, 0, &queues, wave_radiance.data(), primary_hits.data(), &wave_stats);
+        double wave_ms = NowMs() - start;
+
+        std::vector<PathStats> recursive_stats;
+        double recursive_ms = TimeRays(pixel_count, &recursive_stats, [&](int i, PathStats* stats)
+        {
+            recursive_radiance[i] = TracePathRecursive(bvh, *snapshot, i, 0, stats);
+        });
+
+        int mismatches = 0;
+        for (int i = 0; i < pixel_count; i++)
+        {
+            mismatches += memcmp(&wave_radiance[i], &recursive_radiance[i], sizeof(Vector3)) != 0;
+        }
+        long long rays = wave_stats.extension_rays + wave_stats.shadow_rays;
+        printf("  %-12s %10lld %10lld %10.2f %9.1f%% %12.1f %12.1f %10.2f %10d\n", scene_distribution_names[distribution], wave_stats.extension_rays,
+            wave_stats.shadow_rays, (double)wave_stats.extension_rays / wave_stats.paths, 100.0 * wave_stats.roulette_kills / wave_stats.paths, wave_ms,
+            recursive_ms, rays / (wave_ms * 1000.0), mismatches);
+        bench_mismatches += mismatches;
+    }
+}
+
+// Rays per second at each bounce of the path tracer with the coherence sort of secondary and
+// shadow rays off and on, the sort's own time included in the bounces it runs at; the image
+// should come out the same either way.
+static void BenchRaySort()
+{
+    struct SceneSize
+    {
+        SceneDistribution distribution;
+        int count;
+    };
+    const SceneSize scenes[] = { { SCENE_UNIFORM, 50000 }, { SCENE_CLUSTERED, 50000 }, { SCENE_MIXED_SIZES, 50000 }, { SCENE_UNIFORM, 1000000 } };
+    const int depths = 6;
+    const int pixel_count = CANVAS_WIDTH * CANVAS_HEIGHT;
+    std::vector<Vector3> radiance[2] = { std::vector<Vector3>(pixel_count), std::vector<Vector3>(pixel_count) };
+    std::vector<RayHit> primary_hits(pixel_count);
+    PathQueues queues;
+    InitPathQueues(&queues);
+    bool saved_sort = path_sort_rays;
+
+    printf("ray sort, Mrays/s by bounce, default lights, %d workers\n", WorkerCount());
+    printf("  %-10s %8s %5s", "scene", "spheres", "sort");
+    for (int depth = 0; depth < depths; depth++)
+    {
+        printf(" %7s%d", "bounce ", depth);
+    }
+    printf(" %9s %9s %9s\n", "sort ms", "total ms", "mismatch");
+    for (const SceneSize& size : scenes)
+    {
+        BenchScene fixture(size.distribution, size.count, true);
+        const SceneSnapshot* snapshot = &fixture.Snapshot();
+        Bvh bvh;
+        BuildBvh(BVH_BUILD_SAH, *snapshot, &bvh);
+
+        for (int sort = 0; sort < 2; sort++)
+        {
+            path_sort_rays = sort == 1;
+            PathStats stats = { 0 };
+            double start = NowMs();
+            TracePathCanvas(bvh, *snapshot, 0, &queues, radiance[sort].data(), primary_hits.data(), &stats);
+            double total_ms = NowMs() - start;
+
+            int mismatches = 0;
+            for (int i = 0; i < pixel_count && sort == 1; i++)
+            {
+                mismatches += memcmp(&radiance[0][i], &radiance[1][i], sizeof(Vector3)) != 0;
+            }
+            printf("  %-10s %8d %5s", scene_distribution_names[size.distribution], snapshot->count, sort == 1 ? "on" : "off");
+            for (int depth = 0; depth < depths; depth++)
+            {
+                printf(" %8.2f", stats.depth_ms[depth] > 0.0 ? stats.depth_rays[depth] / (stats.depth_ms[depth] * 1000.0) : 0.0);
+            }
+            printf(" %9.1f %9.1f %9d\n", stats.sort_ms, total_ms, mismatches);
+            bench_mismatches += mismatches;
+        }
+    }
+    path_sort_rays = saved_sort;
+}
+
+// The cost model's pick against every strategy actually timed on scenes of growing size. Frames
+// are timed once the renderer has built what it keeps between frames, and bvh builds separately.
+static void BenchAccelSelection()
+{
+    struct SceneSize
+    {
+        SceneDistribution distribution;
+        int count;
+    };
+    const SceneSize scenes[] =
+    {
+        { SCENE_UNIFORM, 4 }, { SCENE_UNIFORM, 64 }, { SCENE_UNIFORM, 512 }, { SCENE_CLUSTERED, 512 }, { SCENE_UNIFORM, 4096 },
+        { SCENE_CLUSTERED, 4096 }, { SCENE_CORRIDOR, 4096 }, { SCENE_MIXED_SIZES, 32768 }, { SCENE_UNIFORM, 262144 },
+        { SCENE_CLUSTERED, 262144 },
+    };
+    // Strategies predicted slower than this are not timed, unless picked.
+    const double max_timed_ms = 2000.0;
+
+    AccelCostModel model = accel_cost_model;
+    double start = NowMs();
+    CalibrateAccelCostModel(&model);
+    printf("acceleration strategy selection, model calibrated in %.0f ms (see the log), %s builds\n", NowMs() - start, bvh_builder_names[bvh_builder]);
+    printf("  %-18s %7s %7s %7s %18s %18s %26s %26s %8s %8s %7s\n", "scene", "radius", "cv", "clust", "brute pred/ms", "culling pred/ms",
+        "bvh pred/ms (build)", "hash pred/ms (build)", "picked", "fastest", "loss");
+
+    const char* cache_path = bvh_cache_path;
+    bvh_cache_path = "";
+    Image img = GenImageColor(CANVAS_WIDTH, CANVAS_HEIGHT, BACKGROUND_COLOR);
+    for (const SceneSize& size : scenes)
+    {
+        std::vector<Sphere> spheres;
+        GenerateSpheres(size.distribution, size.count, 1, &spheres);
+        scene.Clear();
+        for (const Sphere& sp : spheres)
+        {
+            scene.Add(sp);
+        }
+        PublishScene();
+        BeginSceneFrame();
+        SceneStatistics stats;
+        AnalyzeScene(*frame_scene, &stats);
+        AccelChoice choice = ChooseAccelStrategy(model, stats, ACCEL_AUTO);
+
+        double measured[ACCEL_STRATEGY_COUNT];
+        double measured_build[ACCEL_STRATEGY_COUNT] = { 0 };
+        int fastest = -1;
+        for (int s = 0; s < ACCEL_STRATEGY_COUNT; s++)
+        {
+            measured[s] = INFINITY;
+            if (s != choice.strategy && choice.frame_ms[s] + choice.build_ms[s] / ACCEL_BUILD_FRAMES > max_timed_ms)
+            {
+                continue;
+            }
+            if (s == ACCEL_BVH)
+            {
+                Bvh bvh;
+                start = NowMs();
+                BuildBvh(bvh_builder, *frame_scene, &bvh);
+                measured_build[s] = NowMs() - start;
+            }
+            if (s == ACCEL_SPATIAL_HASH)
+            {
+                SpatialHashGrid grid;
+                start = NowMs();
+                grid.Build(*frame_scene);
+                measured_build[s] = NowMs() - start;
+            }
+            for (int repeat = 0; repeat <= 3; repeat++)
+            {
+                ResetRenderStats();
+                start = NowMs();
+                DrawScene(&img, accel_strategy_modes[s]);
+                double elapsed = NowMs() - start;
+                measured[s] = repeat > 0 && elapsed < measured[s] ? elapsed : measured[s];
+            }
+            double amortized = measured[s] + measured_build[s] / ACCEL_BUILD_FRAMES;
+            if (fastest < 0 || amortized < measured[fastest] + measured_build[fastest] / ACCEL_BUILD_FRAMES)
+            {
+                fastest = s;
+            }
+        }
+
+        // Several cells per row, more than TextFormat keeps buffers for.
+        char cells[ACCEL_STRATEGY_COUNT][32];
+        for (int s = 0; s < ACCEL_STRATEGY_COUNT; s++)
+        {
+            int length = measured[s] == INFINITY ? snprintf(cells[s], sizeof(cells[s]), "%.1f/-", choice.frame_ms[s]) :
+                snprintf(cells[s], sizeof(cells[s]), "%.1f/%.1f", choice.frame_ms[s], measured[s]);
+            if ((s == ACCEL_BVH || s == ACCEL_SPATIAL_HASH) && length > 0 && length < (int)sizeof(cells[s]))
+            {
+                snprintf(cells[s] + length, sizeof(cells[s]) - length, " (%.0f/%.0f)", choice.build_ms[s], measured_build[s]);
+            }
+        }
+        int picked = choice.strategy;
+        double loss = (measured[picked] + measured_build[picked] / ACCEL_BUILD_FRAMES) /
+            (measured[fastest] + measured_build[fastest] / ACCEL_BUILD_FRAMES);
+        printf("  %-18s %7.3f %7.2f %7.2f %18s %18s %26s %26s %8s %8s %6.2fx\n",
+            TextFormat("%s %d", scene_distribution_names[size.distribution], size.count), stats.radius_mean, stats.radius_cv,
+            stats.clustering, cells[ACCEL_BRUTE_FORCE], cells[ACCEL_TILE_CULLING], cells[ACCEL_BVH], cells[ACCEL_SPATIAL_HASH],
+            accel_strategy_names[picked], accel_strategy_names[fastest], loss);
+    }
+    UnloadImage(img);
+    bvh_cache_path = cache_path;
+
+    scene.Clear();
+    for (const Sphere& sp : DEFAULT_SCENE)
+    {
+        scene.Add(sp);
+    }
+    PublishScene();
+    BeginSceneFrame();
+}
+
+int RunBenchmarks()
+{
+    BeginSceneFrame();
+    all_objects.resize(scene.Count());
+    for (int i = 0; i < scene.Count(); i++)
+    {
+        all_objects[i] = i;
+    }
+
+    std::vector<Ray> rays = CanvasRays(1, true);
+
+    printf("tracing kernels: %s (cpu supports up to %s), precision: %s\n\n", isa_names[trace_kernels->isa], isa_names[DetectIsa()],
+        precision_names[precision_tier]);
+
+    std::vector<RayHit> baseline;
+    BenchKernels(rays, &baseline);
+    printf("\n");
+    BenchTraceKernels(baseline);
+    printf("\n");
+    BenchPrecisionTiers(rays);
+    BenchValidation();
+    printf("\n");
+    BenchSceneEdits();
+    printf("\n");
+    BenchSnapshotConsistency();
+    printf("\n");
+    BenchBvhBuilders();
+    printf("\n");
+    BenchWideBvh();
+    printf("\n");
+    BenchPacketBvh();
+    printf("\n");
+    BenchInstancing();
+    printf("\n");
+    BenchOutOfCore();
+    printf("\n");
+    BenchBvhCache();
+    printf("\n");
+    BenchSpatialHash();
+    printf("\n");
+    BenchCompactScene();
+    printf("\n");
+    BenchSceneOrder();
+    printf("\n");
+    BenchBvhLod();
+    printf("\n");
+    BenchPvs();
+    printf("\n");
+    BenchShadowRays();
+    printf("\n");
+    BenchTiledLights();
+    printf("\n");
+    BenchPathTracer();
+    printf("\n");
+    BenchRaySort();
+    printf("\n");
+    BenchAccelSelection();
+    printf("\n");
+    BenchRenderModes();
+
+    if (bench_mismatches > 0)
+    {
+        printf("\n%lld mismatches against the references\n", bench_mismatches);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,13 @@
+/**********************************************************************************************
+*
+*   Microbenchmarks, run with --bench instead of opening the window
+*
+**********************************************************************************************/
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+// Returns non-zero if any bench found results that disagree with its reference.
+int RunBenchmarks();
+
+#endif //BENCHMARK_H
@@ -0,0 +1,851 @@
+#include "bvh.h"
+#include "bvh_cache.h"
+#include "parallel.h"
+#include "render_stats.h"
+#include "validation.h"
+#include <algorithm>
+#include <atomic>
+#include <float.h>
+#include <future>
+#include <math.h>
+#include <memory>
+#include <string.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+const char* bvh_builder_names[BVH_BUILDER_COUNT] = { "sah", "lbvh" };
+BvhBuilder bvh_builder = BVH_BUILD_SAH;
+
+// Ranges at least this long are reduced in parallel, and SAH subtrees at least this big become tasks.
+#define BVH_PARALLEL_MIN_SPHERES 65536
+#define BVH_TASK_MIN_SPHERES 16384
+
+bool ParseBvhBuilder(const char* name, BvhBuilder* builder)
+{
+    for (int i = 0; i < BVH_BUILDER_COUNT; i++)
+    {
+        if (strcmp(name, bvh_builder_names[i]) == 0)
+        {
+            *builder = (BvhBuilder)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+struct Aabb
+{
+    Vector3 min;
+    Vector3 max;
+};
+
+static Aabb EmptyAabb()
+{
+    return Aabb{ Vector3{ INFINITY, INFINITY, INFINITY }, Vector3{ -INFINITY, -INFINITY, -INFINITY } };
+}
+
+static void GrowAabb(Aabb* box, const Aabb& other)
+{
+    box->min = Vector3{ other.min.x < box->min.x ? other.min.x : box->min.x, other.min.y < box->min.y ? other.min.y : box->min.y,
+        other.min.z < box->min.z ? other.min.z : box->min.z };
+    box->max = Vector3{ other.max.x > box->max.x ? other.max.x : box->max.x, other.max.y > box->max.y ? other.max.y : box->max.y,
+        other.max.z > box->max.z ? other.max.z : box->max.z };
+}
+
+static void GrowAabb(Aabb* box, Vector3 p)
+{
+    GrowAabb(box, Aabb{ p, p });
+}
+
+static float HalfArea(const Aabb& box)
+{
+    float dx = box.max.x - box.min.x;
+    float dy = box.max.y - box.min.y;
+    float dz = box.max.z - box.min.z;
+    if (dx < 0.0f || dy < 0.0f || dz < 0.0f)
+    {
+        return 0.0f;
+    }
+    return dx * dy + dy * dz + dz * dx;
+}
+
+static float Axis(Vector3 v, int axis)
+{
+    return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+// The spheres both builders work on.
+struct BuildInput
+{
+    const Vector3* centers;
+    const float* radii;
+    int count;
+};
+
+static Aabb SphereAabb(const BuildInput& input, int i)
+{
+    Vector3 c = input.centers[i];
+    Vector3 co = Vector3{ CAMERA_ORIGIN.x - c.x, CAMERA_ORIGIN.y - c.y, CAMERA_ORIGIN.z - c.z };
+    float r = sqrtf(input.radii[i] * input.radii[i] + BVH_GRAZING_PAD * (co.x * co.x + co.y * co.y + co.z * co.z));
+    return Aabb{ Vector3{ c.x - r, c.y - r, c.z - r }, Vector3{ c.x + r, c.y + r, c.z + r } };
+}
+
+/***************************  Binned SAH  ***************************/
+
+struct SahBins
+{
+    Aabb bounds[3][BVH_SAH_BINS];
+    int counts[3][BVH_SAH_BINS];
+};
+
+struct SahBuilder
+{
+    const BuildInput* input;
+    int* order;
+    BvhNode* nodes;
+    std::atomic<int> node_count;
+    int task_depth;
+};
+
+static int BinIndex(float c, float cmin, float scale)
+{
+    int bin = (int)((c - cmin) * scale);
+    return bin < 0 ? 0 : (bin >= BVH_SAH_BINS ? BVH_SAH_BINS - 1 : bin);
+}
+
+static void ChunkBounds(const SahBuilder& b, int begin, int end, Aabb* bounds, Aabb* centroid_bounds)
+{
+    *bounds = EmptyAabb();
+    *centroid_bounds = EmptyAabb();
+    for (int i = begin; i < end; i++)
+    {
+        GrowAabb(bounds, SphereAabb(*b.input, b.order[i]));
+        GrowAabb(centroid_bounds, b.input->centers[b.order[i]]);
+    }
+}
+
+static void RangeBounds(const SahBuilder& b, int begin, int end, Aabb* bounds, Aabb* centroid_bounds)
+{
+    if (end - begin < 2 * BVH_PARALLEL_MIN_SPHERES)
+    {
+        ChunkBounds(b, begin, end, bounds, centroid_bounds);
+        return;
+    }
+
+    std::vector<Aabb> partial_bounds(WorkerCount());
+    std::vector<Aabb> partial_centroids(WorkerCount());
+    int workers = ParallelFor(begin, end, BVH_PARALLEL_MIN_SPHERES, [&](int w, int chunk_begin, int chunk_end)
+    {
+        ChunkBounds(b, chunk_begin, chunk_end, &partial_bounds[w], &partial_centroids[w]);
+    });
+    *bounds = partial_bounds[0];
+    *centroid_bounds = partial_centroids[0];
+    for (int w = 1; w < workers; w++)
+    {
+        GrowAabb(bounds, partial_bounds[w]);
+        GrowAabb(centroid_bounds, partial_centroids[w]);
+    }
+}
+
+static void ChunkBins(const SahBuilder& b, int begin, int end, const Aabb& centroid_bounds, const float* scale, SahBins* bins)
+{
+    for (int axis = 0; axis < 3; axis++)
+    {
+        for (int bin = 0; bin < BVH_SAH_BINS; bin++)
+        {
+            bins->bounds[axis][bin] = EmptyAabb();
+            bins->counts[axis][bin] = 0;
+        }
+    }
+    for (int i = begin; i < end; i++)
+    {
+        int sphere = b.order[i];
+        Aabb box = SphereAabb(*b.input, sphere);
+        for (int axis = 0; axis < 3; axis++)
+        {
+            int bin = BinIndex(Axis(b.input->centers[sphere], axis), Axis(centroid_bounds.min, axis), scale[axis]);
+            GrowAabb(&bins->bounds[axis][bin], box);
+            bins->counts[axis][bin]++;
+        }
+    }
+}
+
+static void FillBins(const SahBuilder& b, int begin, int end, const Aabb& centroid_bounds, SahBins* bins)
+{
+    float scale[3];
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float extent = Axis(centroid_bounds.max, axis) - Axis(centroid_bounds.min, axis);
+        scale[axis] = extent > 0.0f ? (float)BVH_SAH_BINS / extent : 0.0f;
+    }
+    if (end - begin < 2 * BVH_PARALLEL_MIN_SPHERES)
+    {
+        ChunkBins(b, begin, end, centroid_bounds, scale, bins);
+        return;
+    }
+
+    std::vector<SahBins> partial(WorkerCount());
+    int workers = ParallelFor(begin, end, BVH_PARALLEL_MIN_SPHERES, [&](int w, int chunk_begin, int chunk_end)
+    {
+        ChunkBins(b, chunk_begin, chunk_end, centroid_bounds, scale, &partial[w]);
+    });
+    *bins = partial[0];
+    for (int w = 1; w < workers; w++)
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            for (int bin = 0; bin < BVH_SAH_BINS; bin++)
+            {
+                GrowAabb(&bins->bounds[axis][bin], partial[w].bounds[axis][bin]);
+                bins->counts[axis][bin] += partial[w].counts[axis][bin];
+            }
+        }
+    }
+}
+
+static void BuildSahNode(SahBuilder& b, int node, int begin, int end, int depth)
+{
+    Aabb bounds, centroid_bounds;
+    RangeBounds(b, begin, end, &bounds, &centroid_bounds);
+    BvhNode& n = b.nodes[node];
+    n.min = bounds.min;
+    n.max = bounds.max;
+
+    int count = end - begin;
+    if (count == 1)
+    {
+        n.first = begin;
+        n.count = 1;
+        return;
+    }
+
+    // Cost of every plane between bins, as sum of (half area * spheres) over both sides.
+    int best_axis = -1;
+    int best_bin = 0;
+    float best_cost = INFINITY;
+    if (depth < BVH_MAX_DEPTH)
+    {
+        SahBins bins;
+        FillBins(b, begin, end, centroid_bounds, &bins);
+        for (int axis = 0; axis < 3; axis++)
+        {
+            if (Axis(centroid_bounds.max, axis) - Axis(centroid_bounds.min, axis) <= 0.0f)
+            {
+                continue;
+            }
+            float left_cost[BVH_SAH_BINS];
+            Aabb box = EmptyAabb();
+            int spheres = 0;
+            for (int bin = 0; bin < BVH_SAH_BINS - 1; bin++)
+            {
+                GrowAabb(&box, bins.bounds[axis][bin]);
+                spheres += bins.counts[axis][bin];
+                left_cost[bin] = HalfArea(box) * (float)spheres;
+            }
+            box = EmptyAabb();
+            spheres = 0;
+            for (int bin = BVH_SAH_BINS - 1; bin > 0; bin--)
+            {
+                GrowAabb(&box, bins.bounds[axis][bin]);
+                spheres += bins.counts[axis][bin];
+                float cost = left_cost[bin - 1] + HalfArea(box) * (float)spheres;
+                if (cost < best_cost)
+                {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_bin = bin;
+                }
+            }
+        }
+    }
+
+    // A node visit costs about as much as one sphere test.
+    float leaf_cost = HalfArea(bounds) * (float)count;
+    float split_cost = HalfArea(bounds) + best_cost;
+    if (count <= BVH_MAX_LEAF_SIZE && leaf_cost <= split_cost)
+    {
+        n.first = begin;
+        n.count = count;
+        return;
+    }
+
+    int mid = begin + count / 2;
+    if (best_axis >= 0)
+    {
+        float cmin = Axis(centroid_bounds.min, best_axis);
+        float scale = (float)BVH_SAH_BINS / (Axis(centroid_bounds.max, best_axis) - cmin);
+        const BuildInput& input = *b.input;
+        int* split = std::partition(b.order + begin, b.order + end, [&](int sphere)
+        {
+            return BinIndex(Axis(input.centers[sphere], best_axis), cmin, scale) < best_bin;
+        });
+        mid = (int)(split - b.order);
+    }
+    if (best_axis < 0 || mid == begin || mid == end)
+    {
+        // No usable plane (coincident centers, or too deep): split the range in half as it is.
+        mid = begin + count / 2;
+    }
+
+    int left = b.node_count.fetch_add(2);
+    n.first = left;
+    n.count = 0;
+    if (count >= BVH_TASK_MIN_SPHERES && depth < b.task_depth)
+    {
+        std::future<void> task = std::async(std::launch::async, [&b, left, begin, mid, depth]()
+        {
+            BuildSahNode(b, left, begin, mid, depth + 1);
+        });
+        BuildSahNode(b, left + 1, mid, end, depth + 1);
+        task.get();
+    }
+    else
+    {
+        BuildSahNode(b, left, begin, mid, depth + 1);
+        BuildSahNode(b, left + 1, mid, end, depth + 1);
+    }
+}
+
+static void BuildSah(const BuildInput& input, std::vector<int>* order, std::vector<BvhNode>* nodes)
+{
+    int count = input.count;
+    order->resize(count);
+    for (int i = 0; i < count; i++)
+    {
+        (*order)[i] = i;
+    }
+    nodes->resize(2 * (size_t)count - 1);
+
+    // Enough task levels to give every worker a few subtrees.
+    int task_depth = 0;
+    while ((1 << task_depth) < 4 * WorkerCount())
+    {
+        task_depth++;
+    }
+    if (WorkerCount() == 1)
+    {
+        task_depth = 0;
+    }
+
+    SahBuilder b;
+    b.input = &input;
+    b.order = order->data();
+    b.nodes = nodes->data();
+    b.node_count = 1;
+    b.task_depth = task_depth;
+    BuildSahNode(b, 0, 0, count, 0);
+    nodes->resize(b.node_count.load());
+}
+
+/***************************  LBVH  ***************************/
+
+static int CountLeadingZeros(unsigned int v)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    return _BitScanReverse(&index, v) ? 31 - (int)index : 32;
+#else
+    return v != 0 ? __builtin_clz(v) : 32;
+#endif
+}
+
+// Spreads the low 10 bits of v out to every third bit.
+static unsigned int ExpandBits(unsigned int v)
+{
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+unsigned int MortonCode(float x, float y, float z)
+{
+    unsigned int ix = (unsigned int)(x < 0.0f ? 0.0f : (x > 1023.0f ? 1023.0f : x));
+    unsigned int iy = (unsigned int)(y < 0.0f ? 0.0f : (y > 1023.0f ? 1023.0f : y));
+    unsigned int iz = (unsigned int)(z < 0.0f ? 0.0f : (z > 1023.0f ? 1023.0f : z));
+    return (ExpandBits(ix) << 2) | (ExpandBits(iy) << 1) | ExpandBits(iz);
+}
+
+// Each worker histograms its own chunk, and the prefix over (digit, worker) gives every worker its
+// own output positions, keeping the sort stable. Every pass swaps the scratch arrays with keys and
+// values, so after the four of them each vector is back with the buffer it came in with.
+void RadixSortKeys(std::vector<unsigned int>* keys, std::vector<int>* values, RadixSortScratch* scratch)
+{
+    int count = (int)keys->size();
+    std::vector<unsigned int>& key_tmp = scratch->keys;
+    std::vector<int>& value_tmp = scratch->values;
+    std::vector<int>& histograms = scratch->histograms;
+    key_tmp.resize(count);
+    value_tmp.resize(count);
+    histograms.resize((size_t)WorkerCount() * 256);
+
+    for (int shift = 0; shift < 32; shift += 8)
+    {
+        const unsigned int* in_keys = keys->data();
+        const int* in_values = values->data();
+        int workers = ParallelFor(0, count, BVH_PARALLEL_MIN_SPHERES, [&](int w, int begin, int end)
+        {
+            int* h = &histograms[(size_t)w * 256];
+            memset(h, 0, 256 * sizeof(int));
+            for (int i = begin; i < end; i++)
+            {
+                h[(in_keys[i] >> shift) & 0xFF]++;
+            }
+        });
+
+        int sum = 0;
+        for (int digit = 0; digit < 256; digit++)
+        {
+            for (int w = 0; w < workers; w++)
+            {
+                int c = histograms[(size_t)w * 256 + digit];
+                histograms[(size_t)w * 256 + digit] = sum;
+                sum += c;
+            }
+        }
+
+        ParallelFor(0, count, BVH_PARALLEL_MIN_SPHERES, [&](int w, int begin, int end)
+        {
+            int* offsets = &histograms[(size_t)w * 256];
+            for (int i = begin; i < end; i++)
+            {
+                int slot = offsets[(in_keys[i] >> shift) & 0xFF]++;
+                key_tmp[slot] = in_keys[i];
+                value_tmp[slot] = in_values[i];
+            }
+        });
+        keys->swap(key_tmp);
+        values->swap(value_tmp);
+    }
+}
+
+void RadixSortKeys(std::vector<unsigned int>* keys, std::vector<int>* values)
+{
+    RadixSortScratch scratch;
+    RadixSortKeys(keys, values, &scratch);
+}
+
+// Internal node of the Karras hierarchy. Children >= 0 are internal nodes, children < 0 are
+// leaf ~k, the k-th sphere in Morton order.
+struct LbvhNode
+{
+    int left;
+    int right;
+    int first; // Morton-order range covered
+    int last;
+    int parent;
+};
+
+struct LbvhContext
+{
+    const unsigned int* codes;
+    int count;
+};
+
+// Length of the common prefix of two codes, extended by their indices to make every key unique.
+static int CommonPrefix(const LbvhContext& ctx, int i, int j)
+{
+    if (j < 0 || j >= ctx.count)
+    {
+        return -1;
+    }
+    unsigned int a = ctx.codes[i];
+    unsigned int b = ctx.codes[j];
+    if (a == b)
+    {
+        return 32 + CountLeadingZeros((unsigned int)i ^ (unsigned int)j);
+    }
+    return CountLeadingZeros(a ^ b);
+}
+
+static void BuildLbvhNode(const LbvhContext& ctx, int i, LbvhNode* internal, int* leaf_parent)
+{
+    // The node's range extends from i in the direction of the longer common prefix.
+    int d = CommonPrefix(ctx, i, i + 1) - CommonPrefix(ctx, i, i - 1) >= 0 ? 1 : -1;
+    int prefix_min = CommonPrefix(ctx, i, i - d);
+    int length_max = 2;
+    while (CommonPrefix(ctx, i, i + length_max * d) > prefix_min)
+    {
+        length_max *= 2;
+    }
+    int length = 0;
+    for (int t = length_max / 2; t >= 1; t /= 2)
+    {
+        if (CommonPrefix(ctx, i, i + (length + t) * d) > prefix_min)
+        {
+            length += t;
+        }
+    }
+    int j = i + length * d;
+
+    // The split is where the prefix shared by the whole range ends.
+    int prefix_node = CommonPrefix(ctx, i, j);
+    int split = 0;
+    int step = length;
+    do
+    {
+        step = (step + 1) >> 1;
+        if (CommonPrefix(ctx, i, i + (split + step) * d) > prefix_node)
+        {
+            split += step;
+        }
+    } while (step > 1);
+    int gamma = i + split * d + (d < 0 ? d : 0);
+
+    LbvhNode& n = internal[i];
+    n.first = i < j ? i : j;
+    n.last = i < j ? j : i;
+    if (n.first == gamma)
+    {
+        n.left = ~gamma;
+        leaf_parent[gamma] = i;
+    }
+    else
+    {
+        n.left = gamma;
+        internal[gamma].parent = i;
+    }
+    if (n.last == gamma + 1)
+    {
+        n.right = ~(gamma + 1);
+        leaf_parent[gamma + 1] = i;
+    }
+    else
+    {
+        n.right = gamma + 1;
+        internal[gamma + 1].parent = i;
+    }
+}
+
+static void BuildLbvh(const BuildInput& input, std::vector<int>* order, std::vector<BvhNode>* nodes)
+{
+    int count = input.count;
+    order->resize(count);
+    nodes->clear();
+    if (count == 1)
+    {
+        (*order)[0] = 0;
+        Aabb box = SphereAabb(input, 0);
+        nodes->push_back(BvhNode{ box.min, 0, box.max, 1 });
+        return;
+    }
+
+    // Morton codes of the centers, quantized to 1024 steps per axis of their bounds.
+    Aabb centroid_bounds = EmptyAabb();
+    for (int i = 0; i < count; i++)
+    {
+        GrowAabb(&centroid_bounds, input.centers[i]);
+    }
+    Vector3 scale;
+    scale.x = centroid_bounds.max.x > centroid_bounds.min.x ? 1023.0f / (centroid_bounds.max.x - centroid_bounds.min.x) : 0.0f;
+    scale.y = centroid_bounds.max.y > centroid_bounds.min.y ? 1023.0f / (centroid_bounds.max.y - centroid_bounds.min.y) : 0.0f;
+    scale.z = centroid_bounds.max.z > centroid_bounds.min.z ? 1023.0f / (centroid_bounds.max.z - centroid_bounds.min.z) : 0.0f;
+    std::vector<unsigned int> codes(count);
+    ParallelFor(0, count, BVH_PARALLEL_MIN_SPHERES, [&](int, int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            Vector3 c = input.centers[i];
+            codes[i] = MortonCode((c.x - centroid_bounds.min.x) * scale.x, (c.y - centroid_bounds.min.y) * scale.y,
+                (c.z - centroid_bounds.min.z) * scale.z);
+            (*order)[i] = i;
+        }
+    });
+    RadixSortKeys(&codes, order);
+
+    // Every internal node is independent of the others given the sorted codes.
+    std::vector<LbvhNode> internal(count - 1);
+    std::vector<int> leaf_parent(count);
+    internal[0].parent = -1;
+    LbvhContext ctx = { codes.data(), count };
+    ParallelFor(0, count - 1, BVH_PARALLEL_MIN_SPHERES / 4, [&](int, int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            BuildLbvhNode(ctx, i, internal.data(), leaf_parent.data());
+        }
+    });
+
+    // Bounds bottom-up: each leaf walks towards the root, and the second child to arrive at a
+    // node is the one that merges both children's bounds and carries on.
+    std::vector<Aabb> internal_bounds(count - 1);
+    std::unique_ptr<std::atomic<int>[]> arrivals(new std::atomic<int>[count - 1]);
+    for (int i = 0; i < count - 1; i++)
+    {
+        arrivals[i].store(0);
+    }
+    auto child_bounds = [&](int child)
+    {
+        return child < 0 ? SphereAabb(input, (*order)[~child]) : internal_bounds[child];
+    };
+    ParallelFor(0, count, BVH_PARALLEL_MIN_SPHERES, [&](int, int begin, int end)
+    {
+        for (int leaf = begin; leaf < end; leaf++)
+        {
+            int node = leaf_parent[leaf];
+            while (node >= 0 && arrivals[node].fetch_add(1) == 1)
+            {
+                Aabb box = child_bounds(internal[node].left);
+                GrowAabb(&box, child_bounds(internal[node].right));
+                internal_bounds[node] = box;
+                node = internal[node].parent;
+            }
+        }
+    });
+
+    // Flatten into the shared layout, collapsing subtrees small enough for a leaf.
+    nodes->reserve(2 * (size_t)count - 1);
+    nodes->push_back(BvhNode{});
+    struct Pending
+    {
+        int child;
+        int node;
+    };
+    std::vector<Pending> stack;
+    stack.push_back(Pending{ 0, 0 });
+    while (!stack.empty())
+    {
+        Pending p = stack.back();
+        stack.pop_back();
+        Aabb box = child_bounds(p.child);
+        BvhNode n = { box.min, 0, box.max, 0 };
+        if (p.child < 0)
+        {
+            n.first = ~p.child;
+            n.count = 1;
+        }
+        else if (internal[p.child].last - internal[p.child].first + 1 <= BVH_MAX_LEAF_SIZE)
+        {
+            n.first = internal[p.child].first;
+            n.count = internal[p.child].last - internal[p.child].first + 1;
+        }
+        else
+        {
+            n.first = (int)nodes->size();
+            nodes->push_back(BvhNode{});
+            nodes->push_back(BvhNode{});
+            stack.push_back(Pending{ internal[p.child].right, n.first + 1 });
+            stack.push_back(Pending{ internal[p.child].left, n.first });
+        }
+        (*nodes)[p.node] = n;
+    }
+}
+
+/***************************  Build and trace  ***************************/
+
+void BuildBvhNodes(BvhBuilder builder, const std::vector<Vector3>& centers, const std::vector<float>& radii,
+    std::vector<BvhNode>* nodes, std::vector<int>* order)
+{
+    nodes->clear();
+    order->clear();
+    if (centers.empty())
+    {
+        return;
+    }
+
+    BuildInput input = { centers.data(), radii.data(), (int)centers.size() };
+    if (builder == BVH_BUILD_LBVH)
+    {
+        BuildLbvh(input, order, nodes);
+    }
+    else
+    {
+        BuildSah(input, order, nodes);
+    }
+}
+
+void BuildBvh(BvhBuilder builder, const SceneSnapshot& source, Bvh* bvh)
+{
+    bvh->scene_version = source.version;
+    bvh->builder = builder;
+
+    // Gathered out of the snapshot's chunks once, for the builder and the folded spheres.
+    std::vector<Vector3> centers(source.count);
+    std::vector<float> radii(source.count);
+    ParallelFor(0, source.count, BVH_PARALLEL_MIN_SPHERES, [&](int, int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            Sphere sp = source.GetSphere(i);
+            centers[i] = sp.center;
+            radii[i] = sp.radius;
+        }
+    });
+    std::vector<BvhNode> nodes;
+    std::vector<int> sphere_ids;
+    BuildBvhNodes(builder, centers, radii, &nodes, &sphere_ids);
+
+    // Leaves index the spheres in tree order, so store them that way.
+    std::vector<BvhSphere> spheres(source.count);
+    ParallelFor(0, source.count, BVH_PARALLEL_MIN_SPHERES, [&](int, int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            int id = sphere_ids[i];
+            Vector3 center = centers[id];
+            float r = radii[id];
+            Vector3 co = Vector3{ CAMERA_ORIGIN.x - center.x, CAMERA_ORIGIN.y - center.y, CAMERA_ORIGIN.z - center.z };
+            spheres[i] = BvhSphere{ co, (co.x * co.x + co.y * co.y + co.z * co.z) - r * r };
+        }
+    });
+    bvh->nodes.Own(std::move(nodes));
+    bvh->spheres.Own(std::move(spheres));
+    bvh->sphere_ids.Own(std::move(sphere_ids));
+    bvh->storage.reset();
+}
+
+float BvhSahCost(const Bvh& bvh)
+{
+    if (bvh.nodes.empty())
+    {
+        return 0.0f;
+    }
+    double cost = 0.0;
+    for (const BvhNode& n : bvh.nodes)
+    {
+        cost += (double)HalfArea(Aabb{ n.min, n.max }) * (n.count > 0 ? (double)n.count : 1.0);
+    }
+    return (float)(cost / (double)HalfArea(Aabb{ bvh.nodes[0].min, bvh.nodes[0].max }));
+}
+
+// Walks the nodes a ray from o enters within [tmin, *far], calling leaf(first, count) on every
+// leaf reached until it returns true. Children are tested before they are pushed, so only boxes
+// the ray enters before *far go on the stack, the nearer one last so it is popped first; leaf may
+// lower *far as it finds hits, and boxes behind them are then skipped.
+template <typename Leaf>
+static void BvhWalk(const Bvh& bvh, Vector3 o, Vector3 d, float tmin, const float* far, BvhTraceCounters* counters, Leaf leaf)
+{
+    if (bvh.nodes.empty())
+    {
+        return;
+    }
+    Vector3 inv_d = Vector3{ 1.0f / d.x, 1.0f / d.y, 1.0f / d.z };
+
+    int stack[BVH_STACK_SIZE];
+    int stack_size = 0;
+    if (BvhSlabEntry(bvh.nodes[0], o, d, inv_d, tmin, *far) != INFINITY)
+    {
+        stack[stack_size++] = 0;
+    }
+    while (stack_size > 0)
+    {
+        const BvhNode& n = bvh.nodes[stack[--stack_size]];
+        counters->nodes_visited++;
+        if (n.count > 0)
+        {
+            if (leaf(n.first, n.count))
+            {
+                return;
+            }
+            continue;
+        }
+
+        float t_left = BvhSlabEntry(bvh.nodes[n.first], o, d, inv_d, tmin, *far);
+        float t_right = BvhSlabEntry(bvh.nodes[n.first + 1], o, d, inv_d, tmin, *far);
+        int near_child = t_left <= t_right ? n.first : n.first + 1;
+        int far_child = t_left <= t_right ? n.first + 1 : n.first;
+        float t_near = t_left <= t_right ? t_left : t_right;
+        float t_far = t_left <= t_right ? t_right : t_left;
+        if (t_far != INFINITY)
+        {
+            stack[stack_size++] = far_child;
+        }
+        if (t_near != INFINITY)
+        {
+            stack[stack_size++] = near_child;
+        }
+    }
+}
+
+RayHit BvhClosestHit(const Bvh& bvh, Ray r, float tmin, float tmax, BvhTraceCounters* counters)
+{
+    RayHit closest = { -1, INFINITY };
+    Vector3 d = r.direction;
+    float a = d.x * d.x + d.y * d.y + d.z * d.z;
+    float two_a = 2.0f * a;
+    float far = tmax;
+    BvhWalk(bvh, CAMERA_ORIGIN, d, tmin, &far, counters, [&](int first, int count)
+    {
+        for (int i = first; i < first + count; i++)
+        {
+            BvhTestSphere(bvh.spheres[i], bvh.sphere_ids[i], d, a, two_a, tmin, tmax, &closest);
+        }
+        counters->sphere_tests += count;
+        far = closest.t < tmax ? closest.t : tmax;
+        return false;
+    });
+    return closest;
+}
+
+// No closest t to narrow the range by, so boxes are only tested against [tmin, tmax], and the
+// nearer child still goes first: occluders near the origin are found with less work.
+bool BvhAnyHit(const Bvh& bvh, const SceneSnapshot& source, Ray r, float tmin, float tmax, int* occluder, BvhTraceCounters* counters)
+{
+    Vector3 o = r.position;
+    Vector3 d = r.direction;
+    float a = d.x * d.x + d.y * d.y + d.z * d.z;
+    bool blocked = false;
+    BvhWalk(bvh, o, d, tmin, &tmax, counters, [&](int first, int count)
+    {
+        for (int i = first; i < first + count; i++)
+        {
+            counters->sphere_tests++;
+            if (BvhSphereBlocks(source.GetSphere(bvh.sphere_ids[i]), o, d, a, tmin, tmax))
+            {
+                *occluder = bvh.sphere_ids[i];
+                blocked = true;
+                return true;
+            }
+        }
+        return false;
+    });
+    return blocked;
+}
+
+RayHit BvhClosestHitFrom(const Bvh& bvh, const SceneSnapshot& source, Ray r, float tmin, float tmax, BvhTraceCounters* counters)
+{
+    RayHit closest = { -1, INFINITY };
+    Vector3 o = r.position;
+    Vector3 d = r.direction;
+    float a = d.x * d.x + d.y * d.y + d.z * d.z;
+    float far = tmax;
+    BvhWalk(bvh, o, d, tmin, &far, counters, [&](int first, int count)
+    {
+        for (int i = first; i < first + count; i++)
+        {
+            BvhTestSphereFrom(source.GetSphere(bvh.sphere_ids[i]), bvh.sphere_ids[i], o, d, a, tmin, tmax, &closest);
+        }
+        counters->sphere_tests += count;
+        far = closest.t < tmax ? closest.t : tmax;
+        return false;
+    });
+    return closest;
+}
+
+void DrawSceneBvh(Image* img, Bvh* bvh)
+{
+    if (bvh->scene_version != frame_scene->version || bvh->builder != bvh_builder)
+    {
+        BuildBvhCached(bvh_builder, *frame_scene, bvh);
+    }
+
+    BvhTraceCounters counters = { 0 };
+    for (int y = -CANVAS_HEIGHT / 2; y < CANVAS_HEIGHT / 2; y++)
+    {
+        for (int x = -CANVAS_WIDTH / 2; x < CANVAS_WIDTH / 2; x++)
+        {
+            Vector2Int canvas_pos = { x,y };
+            long long tests_before = counters.sphere_tests;
+            RayHit hit = BvhClosestHit(*bvh, CanvasRay(canvas_pos), 1.0f, INFINITY, &counters);
+            Color col = hit.sphere < 0 ? BACKGROUND_COLOR : frame_scene->GetSphere(hit.sphere).color;
+            CaptureHit(x, y, hit);
+            render_stats.primary_rays++;
+            canvas_pos = CanvasToScreen(canvas_pos);
+            RecordPixelCost(canvas_pos.x, canvas_pos.y, (int)(counters.sphere_tests - tests_before));
+            SetPixel(img, canvas_pos.x, canvas_pos.y, col);
+        }
+    }
+    render_stats.intersection_tests += counters.sphere_tests;
+}
@@ -0,0 +1,274 @@
+/**********************************************************************************************
+*
+*   Bounding volume hierarchy over the scene's spheres
+*
+*   Two builders fill the same flat layout:
+*     - binned SAH: top-down, evaluating BVH_SAH_BINS candidate planes per axis with the surface
+*       area heuristic. Subtrees are built as parallel tasks and large nodes bin in parallel.
+*       Slower to build, cheaper to trace.
+*     - LBVH: sphere centers are quantized to 30-bit Morton codes and radix sorted, then every
+*       internal node is found independently from the sorted codes (Karras 2012) and bounds are
+*       fitted bottom-up. Every step is a parallel pass, which makes it the one for rebuilds.
+*
+*   Nodes are 32 bytes. Children are stored next to each other, so an interior node only keeps
+*   the index of its left child; leaves keep a range of the reordered sphere array instead.
+*
+*   Like IntersectRaySphere, closest-hit traversal assumes rays start at CAMERA_ORIGIN; the
+*   any-hit query for shadow rays and the closest-hit query for secondary rays take rays from
+*   anywhere.
+*
+**********************************************************************************************/
+
+#ifndef BVH_H
+#define BVH_H
+
+#include "raytracer.h"
+#include "scene_snapshot.h"
+#include <float.h>
+#include <math.h>
+#include <memory>
+#include <vector>
+
+#define BVH_SAH_BINS 16
+#define BVH_MAX_LEAF_SIZE 4
+
+// Past this depth the SAH builder falls back to median splits, which bounds the depth of any tree
+// by BVH_MAX_DEPTH + log2(N), and with it the traversal stack.
+#define BVH_MAX_DEPTH 96
+#define BVH_STACK_SIZE 128
+
+// The rounded discriminant in IntersectRaySphere reports hits on rays passing up to about
+// sqrt(r^2 + k * FLT_EPSILON * |co|^2) from the center, a few percent of the radius for small far
+// spheres. Boxes are grown to that radius so the tree finds the same grazing hits as a plain loop.
+#define BVH_GRAZING_PAD (16.0f * FLT_EPSILON)
+
+enum BvhBuilder
+{
+    BVH_BUILD_SAH,
+    BVH_BUILD_LBVH,
+    BVH_BUILDER_COUNT
+};
+
+extern const char* bvh_builder_names[BVH_BUILDER_COUNT];
+
+// Builder used by the bvh render mode, set with --bvh=<name>.
+extern BvhBuilder bvh_builder;
+
+bool ParseBvhBuilder(const char* name, BvhBuilder* builder);
+
+struct BvhNode
+{
+    Vector3 min;
+    int first; // interior: left child, the right one follows it; leaf: first sphere
+    Vector3 max;
+    int count; // sphere count of a leaf, 0 for interior nodes
+};
+
+// A sphere with the ray-independent terms of the quadratic folded, as in StaticSphere.
+struct BvhSphere
+{
+    Vector3 co; // CAMERA_ORIGIN - center
+    float c;    // co.co - r*r
+};
+
+// Narrows [*t0, *t1] to the ray's overlap with one slab. A ray parallel to the slab is inside it
+// for all t or for none, including when it runs exactly along one of its planes.
+inline void BvhClipSlab(float lo, float hi, float origin, float d, float inv_d, float* t0, float* t1)
+{
+    if (d == 0.0f)
+    {
+        if (origin < lo || origin > hi)
+        {
+            *t0 = INFINITY;
+        }
+        return;
+    }
+    float ta = (lo - origin) * inv_d;
+    float tb = (hi - origin) * inv_d;
+    float t_near = ta < tb ? ta : tb;
+    float t_far = ta < tb ? tb : ta;
+    *t0 = t_near > *t0 ? t_near : *t0;
+    *t1 = t_far < *t1 ? t_far : *t1;
+}
+
+// Entry distance of a ray from origin into the box, or INFINITY if it misses [tmin, tmax].
+inline float BvhSlabEntry(const BvhNode& n, Vector3 origin, Vector3 d, Vector3 inv_d, float tmin, float tmax)
+{
+    float t0 = tmin;
+    float t1 = tmax;
+    BvhClipSlab(n.min.x, n.max.x, origin.x, d.x, inv_d.x, &t0, &t1);
+    BvhClipSlab(n.min.y, n.max.y, origin.y, d.y, inv_d.y, &t0, &t1);
+    BvhClipSlab(n.min.z, n.max.z, origin.z, d.z, inv_d.z, &t0, &t1);
+    return t0 <= t1 ? t0 : INFINITY;
+}
+
+// The same for a ray from CAMERA_ORIGIN.
+inline float BvhSlabEntry(const BvhNode& n, Vector3 d, Vector3 inv_d, float tmin, float tmax)
+{
+    return BvhSlabEntry(n, CAMERA_ORIGIN, d, inv_d, tmin, tmax);
+}
+
+// Roots of the quadratic of IntersectRaySphere, by its arithmetic, for a sphere folded against the
+// ray's origin; false if the ray misses it.
+inline bool BvhSphereRoots(const BvhSphere& sp, Vector3 d, float a, float two_a, float* t1, float* t2)
+{
+    float b = 2.0f * (sp.co.x * d.x + sp.co.y * d.y + sp.co.z * d.z);
+    float discriminant = (b * b) - (4.0f * a * sp.c);
+    if (discriminant < 0.0f)
+    {
+        return false;
+    }
+    float root = sqrtf(discriminant);
+    *t1 = (-b + root) / two_a;
+    *t2 = (-b - root) / two_a;
+    return true;
+}
+
+// The sphere folded against any origin, as StoreSphereSoA folds it against CAMERA_ORIGIN.
+inline BvhSphere BvhFoldSphere(const Sphere& sp, Vector3 origin)
+{
+    Vector3 co = Vector3{ origin.x - sp.center.x, origin.y - sp.center.y, origin.z - sp.center.z };
+    return BvhSphere{ co, (co.x * co.x + co.y * co.y + co.z * co.z) - sp.radius * sp.radius };
+}
+
+// Same arithmetic as IntersectRaySphere and the closest-hit update in raytracer.cpp. An exact tie
+// goes to the lower id, the sphere that update keeps scanning in scene order, whatever order a
+// structure tests its spheres in.
+inline void BvhTestSphere(const BvhSphere& sp, int id, Vector3 d, float a, float two_a, float tmin, float tmax, RayHit* closest)
+{
+    float t1, t2;
+    if (!BvhSphereRoots(sp, d, a, two_a, &t1, &t2))
+    {
+        return;
+    }
+    if (t1 >= tmin && t1 <= tmax && (t1 < closest->t || (t1 == closest->t && id < closest->sphere)))
+    {
+        closest->t = t1;
+        closest->sphere = id;
+    }
+    if (t2 >= tmin && t2 <= tmax && (t2 < closest->t || (t2 == closest->t && id < closest->sphere)))
+    {
+        closest->t = t2;
+        closest->sphere = id;
+    }
+}
+
+// Whether a ray from anywhere hits the sphere for some t in [tmin, tmax].
+inline bool BvhSphereBlocks(const Sphere& sp, Vector3 origin, Vector3 d, float a, float tmin, float tmax)
+{
+    float t1, t2;
+    if (!BvhSphereRoots(BvhFoldSphere(sp, origin), d, a, 2.0f * a, &t1, &t2))
+    {
+        return false;
+    }
+    return (t1 >= tmin && t1 <= tmax) || (t2 >= tmin && t2 <= tmax);
+}
+
+// The closest-hit update of BvhTestSphere for a ray from anywhere.
+inline void BvhTestSphereFrom(const Sphere& sp, int id, Vector3 origin, Vector3 d, float a, float tmin, float tmax, RayHit* closest)
+{
+    BvhTestSphere(BvhFoldSphere(sp, origin), id, d, a, 2.0f * a, tmin, tmax, closest);
+}
+
+// Read-only array that either owns its items or borrows them from memory kept alive elsewhere,
+// such as a mapped cache file (see bvh_cache.h).
+template <typename T>
+class BvhArray
+{
+public:
+    BvhArray() = default;
+    BvhArray(const BvhArray& other) { *this = other; }
+    BvhArray& operator=(const BvhArray& other)
+    {
+        if (this != &other)
+        {
+            owned = other.owned;
+            items = other.items == other.owned.data() ? owned.data() : other.items;
+            count = other.count;
+        }
+        return *this;
+    }
+
+    void Own(std::vector<T>&& source)
+    {
+        owned = std::move(source);
+        items = owned.data();
+        count = owned.size();
+    }
+    void Borrow(const T* source, size_t source_count)
+    {
+        owned = std::vector<T>();
+        items = source;
+        count = source_count;
+    }
+
+    const T& operator[](size_t i) const { return items[i]; }
+    const T* data() const { return items; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const T* begin() const { return items; }
+    const T* end() const { return items + count; }
+
+private:
+    std::vector<T> owned;
+    const T* items = nullptr;
+    size_t count = 0;
+};
+
+struct Bvh
+{
+    BvhArray<BvhNode> nodes;       // nodes[0] is the root
+    BvhArray<BvhSphere> spheres;   // in leaf order
+    BvhArray<int> sphere_ids;      // dense scene index of each entry of spheres
+    std::shared_ptr<const void> storage; // keeps borrowed arrays alive, empty when they are owned
+    unsigned long long scene_version;
+    BvhBuilder builder;
+};
+
+struct BvhTraceCounters
+{
+    long long nodes_visited;
+    long long sphere_tests;
+};
+
+void BuildBvh(BvhBuilder builder, const SceneSnapshot& source, Bvh* bvh);
+
+// Just the tree, over any spheres: order receives the index into centers of every leaf entry.
+void BuildBvhNodes(BvhBuilder builder, const std::vector<Vector3>& centers, const std::vector<float>& radii,
+    std::vector<BvhNode>* nodes, std::vector<int>* order);
+
+// 30-bit Morton code of a point already scaled to [0, 1023] on every axis; clamped to it.
+unsigned int MortonCode(float x, float y, float z);
+
+// Buffers of RadixSortKeys, kept by callers that sort every frame so passes don't allocate.
+struct RadixSortScratch
+{
+    std::vector<unsigned int> keys;
+    std::vector<int> values;
+    std::vector<int> histograms; // 256 counts per worker
+};
+
+// Stable LSD radix sort of keys, 8 bits per pass, moving values along; split across workers.
+void RadixSortKeys(std::vector<unsigned int>* keys, std::vector<int>* values);
+void RadixSortKeys(std::vector<unsigned int>* keys, std::vector<int>* values, RadixSortScratch* scratch);
+
+// Expected cost of a random ray by the surface area heuristic, in sphere tests, counting a node
+// visit as one test. Lower is better.
+float BvhSahCost(const Bvh& bvh);
+
+// Closest hit, with the same arithmetic per sphere as ClosestHit.
+RayHit BvhClosestHit(const Bvh& bvh, Ray r, float tmin, float tmax, BvhTraceCounters* counters);
+
+// Any hit of a ray from anywhere, for shadow rays: returns at the first sphere found in
+// [tmin, tmax], whose dense index goes to *occluder, without looking for the closest. Spheres
+// are read from source, the snapshot the tree was built from, as the tree's folded copies only
+// hold for rays from CAMERA_ORIGIN.
+bool BvhAnyHit(const Bvh& bvh, const SceneSnapshot& source, Ray r, float tmin, float tmax, int* occluder, BvhTraceCounters* counters);
+
+// Closest hit of a ray from anywhere, for secondary rays, reading spheres from source like BvhAnyHit.
+RayHit BvhClosestHitFrom(const Bvh& bvh, const SceneSnapshot& source, Ray r, float tmin, float tmax, BvhTraceCounters* counters);
+
+// Traces the canvas through a BVH of frame_scene, rebuilt whenever the snapshot changes.
+void DrawSceneBvh(Image* img, Bvh* bvh);
+
+#endif //BVH_H
@@ -0,0 +1,158 @@
+#include "bvh_cache.h"
+#include "mapped_file.h"
+#include "parallel.h"
+#include <stdio.h>
+#include <string.h>
+
+const char* bvh_cache_path = "scene.bvhcache";
+
+static const char BVH_CACHE_MAGIC[8] = { 'C', 'G', 'F', 'S', 'B', 'V', 'H', 'C' };
+
+// FNV-1a over 32-bit words rather than bytes: four times fewer multiplies, and sphere data is
+// all floats anyway.
+#define HASH_OFFSET 14695981039346656037ull
+#define HASH_PRIME 1099511628211ull
+
+static unsigned long long HashWords(unsigned long long h, const void* data, size_t count)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < count; i++)
+    {
+        unsigned int word;
+        memcpy(&word, bytes + 4 * i, sizeof(word));
+        h = (h ^ word) * HASH_PRIME;
+    }
+    return h;
+}
+
+unsigned long long HashSceneSpheres(const void* settings, size_t settings_size, const SceneSnapshot& source)
+{
+    unsigned long long key = HashWords(HASH_OFFSET, settings, settings_size / 4);
+    key = HashWords(key, &source.count, 1);
+
+    int chunk_count = (source.count + SNAPSHOT_CHUNK_SIZE - 1) / SNAPSHOT_CHUNK_SIZE;
+    std::vector<unsigned long long> chunk_keys(chunk_count);
+    ParallelFor(0, chunk_count, 16, [&](int, int begin, int end)
+    {
+        for (int c = begin; c < end; c++)
+        {
+            const SnapshotChunk& chunk = *source.chunks[c];
+            size_t count = c == chunk_count - 1 ? (size_t)(source.count - c * SNAPSHOT_CHUNK_SIZE) : SNAPSHOT_CHUNK_SIZE;
+            unsigned long long h = HashWords(HASH_OFFSET, chunk.center_x, count);
+            h = HashWords(h, chunk.center_y, count);
+            h = HashWords(h, chunk.center_z, count);
+            chunk_keys[c] = HashWords(h, chunk.radius, count);
+        }
+    });
+    return HashWords(key, chunk_keys.data(), chunk_keys.size() * 2);
+}
+
+unsigned long long BvhCacheKey(BvhBuilder builder, const SceneSnapshot& source)
+{
+    struct Settings
+    {
+        int version;
+        int builder;
+        int sah_bins;
+        int max_leaf_size;
+        int max_depth;
+        int node_size;
+        int sphere_size;
+        Vector3 camera_origin; // spheres are stored relative to it
+    };
+    Settings settings = { BVH_CACHE_VERSION, builder, BVH_SAH_BINS, BVH_MAX_LEAF_SIZE, BVH_MAX_DEPTH, (int)sizeof(BvhNode), (int)sizeof(BvhSphere),
+        CAMERA_ORIGIN };
+    return HashSceneSpheres(&settings, sizeof(settings), source);
+}
+
+bool SaveBvhCache(const char* path, unsigned long long key, const Bvh& bvh)
+{
+    // Written aside and renamed over the old file, which a Bvh may still have mapped.
+    char temp_path[512];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    FILE* out = NULL;
+    if (fopen_s(&out, temp_path, "wb") != 0 || out == NULL)
+    {
+        return false;
+    }
+    BvhCacheHeader header = {};
+    memcpy(header.magic, BVH_CACHE_MAGIC, sizeof(BVH_CACHE_MAGIC));
+    header.version = BVH_CACHE_VERSION;
+    header.builder = bvh.builder;
+    header.key = key;
+    header.node_count = (int)bvh.nodes.size();
+    header.sphere_count = (int)bvh.spheres.size();
+    bool written = fwrite(&header, sizeof(header), 1, out) == 1 &&
+        fwrite(bvh.nodes.data(), sizeof(BvhNode), bvh.nodes.size(), out) == bvh.nodes.size() &&
+        fwrite(bvh.spheres.data(), sizeof(BvhSphere), bvh.spheres.size(), out) == bvh.spheres.size() &&
+        fwrite(bvh.sphere_ids.data(), sizeof(int), bvh.sphere_ids.size(), out) == bvh.sphere_ids.size();
+    written = fclose(out) == 0 && written;
+    remove(path);
+    if (!written || rename(temp_path, path) != 0)
+    {
+        remove(temp_path);
+        return false;
+    }
+    return true;
+}
+
+bool LoadBvhCache(const char* path, unsigned long long key, int sphere_count, Bvh* bvh)
+{
+    MappedFile file;
+    if (!OpenMappedFile(path, &file))
+    {
+        return false;
+    }
+    size_t size = (size_t)file.size;
+    const unsigned char* data = size >= sizeof(BvhCacheHeader) ? (const unsigned char*)MapFileRange(file, 0, size) : NULL;
+    CloseMappedFile(&file); // the view keeps the file open
+    if (data == NULL)
+    {
+        return false;
+    }
+
+    BvhCacheHeader header;
+    memcpy(&header, data, sizeof(header));
+    unsigned long long expected_size = sizeof(BvhCacheHeader) + (unsigned long long)header.node_count * sizeof(BvhNode) +
+        (unsigned long long)header.sphere_count * (sizeof(BvhSphere) + sizeof(int));
+    if (memcmp(header.magic, BVH_CACHE_MAGIC, sizeof(BVH_CACHE_MAGIC)) != 0 || header.version != BVH_CACHE_VERSION || header.key != key ||
+        header.sphere_count != sphere_count || header.node_count <= 0 || size != expected_size || header.builder < 0 || header.builder >= BVH_BUILDER_COUNT)
+    {
+        UnmapFileRange(data, size);
+        return false;
+    }
+
+    // Traced in place: pages come in as traversal first touches them.
+    const BvhNode* nodes = (const BvhNode*)(data + sizeof(BvhCacheHeader));
+    const BvhSphere* spheres = (const BvhSphere*)(nodes + header.node_count);
+    const int* sphere_ids = (const int*)(spheres + header.sphere_count);
+    bvh->storage = std::shared_ptr<const void>(data, [size](const void* view) { UnmapFileRange(view, size); });
+    bvh->nodes.Borrow(nodes, header.node_count);
+    bvh->spheres.Borrow(spheres, header.sphere_count);
+    bvh->sphere_ids.Borrow(sphere_ids, header.sphere_count);
+    bvh->builder = (BvhBuilder)header.builder;
+    return true;
+}
+
+void BuildBvhCached(BvhBuilder builder, const SceneSnapshot& source, Bvh* bvh)
+{
+    if (source.count < BVH_CACHE_MIN_SPHERES || bvh_cache_path == NULL || bvh_cache_path[0] == '\0')
+    {
+        BuildBvh(builder, source, bvh);
+        return;
+    }
+
+    char path[512];
+    snprintf(path, sizeof(path), "%s.%s", bvh_cache_path, bvh_builder_names[builder]);
+    unsigned long long key = BvhCacheKey(builder, source);
+    if (LoadBvhCache(path, key, source.count, bvh))
+    {
+        bvh->scene_version = source.version;
+        return;
+    }
+    BuildBvh(builder, source, bvh);
+    if (!SaveBvhCache(path, key, *bvh))
+    {
+        TraceLog(LOG_WARNING, "Could not write the BVH cache '%s'", path);
+    }
+}
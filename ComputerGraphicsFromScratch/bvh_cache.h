@@ -0,0 +1,57 @@
+/**********************************************************************************************
+*
+*   On-disk cache of built BVHs
+*
+*   A built tree is written next to the scene, under a key hashing every sphere's center and
+*   radius together with the builder and the settings that shape its output. The next time the
+*   same scene is built with the same builder, the file is memory mapped, checked against the
+*   key and traced in place: loading costs a hash of the spheres, and pages of the tree only come
+*   in as rays first reach them.
+*
+*   Sphere data is hashed a snapshot chunk at a time in parallel, and the chunk hashes combined
+*   in order, so the key doesn't depend on the number of workers.
+*
+*   Anything that changes which tree a builder produces for the same spheres must bump
+*   BVH_CACHE_VERSION, or stale trees will be loaded.
+*
+**********************************************************************************************/
+
+#ifndef BVH_CACHE_H
+#define BVH_CACHE_H
+
+#include "bvh.h"
+
+#define BVH_CACHE_VERSION 1
+
+// Smaller scenes build faster than a cache file is written, so they are never cached.
+#define BVH_CACHE_MIN_SPHERES 65536
+
+// Cache files are <path>.<builder>, set with --bvh-cache=<path>; empty turns caching off.
+extern const char* bvh_cache_path;
+
+struct BvhCacheHeader
+{
+    char magic[8];
+    int version;
+    int builder;
+    unsigned long long key;
+    int node_count;
+    int sphere_count;
+};
+
+// Hash of every sphere's center and radius, in dense order, seeded with settings (a whole number
+// of 32-bit words). Shared with the other files kept next to the scene (see pvs.h).
+unsigned long long HashSceneSpheres(const void* settings, size_t settings_size, const SceneSnapshot& source);
+
+unsigned long long BvhCacheKey(BvhBuilder builder, const SceneSnapshot& source);
+
+bool SaveBvhCache(const char* path, unsigned long long key, const Bvh& bvh);
+
+// False, leaving bvh untouched, unless the file holds a tree of sphere_count spheres under key.
+// The loaded bvh borrows its arrays from the mapping, which lives as long as bvh->storage.
+bool LoadBvhCache(const char* path, unsigned long long key, int sphere_count, Bvh* bvh);
+
+// BuildBvh, through the cache file of bvh_cache_path for large enough scenes.
+void BuildBvhCached(BvhBuilder builder, const SceneSnapshot& source, Bvh* bvh);
+
+#endif //BVH_CACHE_H
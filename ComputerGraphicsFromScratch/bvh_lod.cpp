@@ -0,0 +1,282 @@
+#include "bvh_lod.h"
+#include "bvh_cache.h"
+#include "parallel.h"
+#include "renderer.h"
+#include <math.h>
+
+#define BVH_LOD_MIN_CHUNK 4096
+
+// Summed cross-section of the spheres below a node, their colors weighted by it, and their bounds.
+struct LodSums
+{
+    float area;
+    float r, g, b;
+    Vector3 min, max;
+};
+
+static LodSums EmptySums()
+{
+    return LodSums{ 0.0f, 0.0f, 0.0f, 0.0f, Vector3{ INFINITY, INFINITY, INFINITY }, Vector3{ -INFINITY, -INFINITY, -INFINITY } };
+}
+
+// Mean area of the box's projection over all directions: a quarter of its surface area.
+static float MeanProjectedArea(const BvhNode& n)
+{
+    float dx = n.max.x - n.min.x;
+    float dy = n.max.y - n.min.y;
+    float dz = n.max.z - n.min.z;
+    return 0.5f * (dx * dy + dy * dz + dz * dx);
+}
+
+static BvhLodNode Aggregate(const BvhNode& n, const LodSums& sums)
+{
+    BvhLodNode out;
+    float box_area = MeanProjectedArea(n);
+    out.coverage = box_area > 0.0f ? fminf(sums.area / box_area, 1.0f) : 1.0f;
+    float scale = sums.area > 0.0f ? 1.0f / sums.area : 0.0f;
+    out.color = Color{ (unsigned char)fminf(sums.r * scale + 0.5f, 255.0f), (unsigned char)fminf(sums.g * scale + 0.5f, 255.0f),
+        (unsigned char)fminf(sums.b * scale + 0.5f, 255.0f), 255 };
+    // Node boxes are padded for grazing hits, far out by more than a small sphere's radius, so the
+    // size seen on screen is taken from the spheres' own bounds.
+    float dx = sums.max.x - sums.min.x;
+    float dy = sums.max.y - sums.min.y;
+    float dz = sums.max.z - sums.min.z;
+    out.size = sums.area > 0.0f ? sqrtf(dx * dx + dy * dy + dz * dz) : 0.0f;
+    return out;
+}
+
+void BuildBvhLod(const Bvh& bvh, const SceneSnapshot& source, BvhLod* lod)
+{
+    lod->scene_version = bvh.scene_version;
+    int node_count = (int)bvh.nodes.size();
+    lod->nodes.resize(node_count);
+    if (node_count == 0)
+    {
+        return;
+    }
+
+    // Leaves read their spheres, which is most of the work, in parallel.
+    std::vector<LodSums> sums(node_count);
+    ParallelFor(0, node_count, BVH_LOD_MIN_CHUNK, [&](int, int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            const BvhNode& n = bvh.nodes[i];
+            LodSums s = EmptySums();
+            for (int k = n.first; k < n.first + n.count; k++)
+            {
+                Sphere sp = source.GetSphere(bvh.sphere_ids[k]);
+                float area = PI * sp.radius * sp.radius;
+                s.area += area;
+                s.r += area * sp.color.r;
+                s.g += area * sp.color.g;
+                s.b += area * sp.color.b;
+                s.min = Vector3{ fminf(s.min.x, sp.center.x - sp.radius), fminf(s.min.y, sp.center.y - sp.radius), fminf(s.min.z, sp.center.z - sp.radius) };
+                s.max = Vector3{ fmaxf(s.max.x, sp.center.x + sp.radius), fmaxf(s.max.y, sp.center.y + sp.radius), fmaxf(s.max.z, sp.center.z + sp.radius) };
+            }
+            sums[i] = s;
+        }
+    });
+
+    // Interior nodes in reverse depth-first order, so both children are done before their parent;
+    // the builders don't agree on how nodes are numbered.
+    std::vector<int> order;
+    order.reserve(node_count);
+    order.push_back(0);
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        const BvhNode& n = bvh.nodes[order[i]];
+        if (n.count == 0)
+        {
+            order.push_back(n.first);
+            order.push_back(n.first + 1);
+        }
+    }
+    for (int i = (int)order.size() - 1; i >= 0; i--)
+    {
+        int node = order[i];
+        const BvhNode& n = bvh.nodes[node];
+        if (n.count == 0)
+        {
+            const LodSums& left = sums[n.first];
+            const LodSums& right = sums[n.first + 1];
+            sums[node] = LodSums{ left.area + right.area, left.r + right.r, left.g + right.g, left.b + right.b,
+                Vector3{ fminf(left.min.x, right.min.x), fminf(left.min.y, right.min.y), fminf(left.min.z, right.min.z) },
+                Vector3{ fmaxf(left.max.x, right.max.x), fmaxf(left.max.y, right.max.y), fmaxf(left.max.z, right.max.z) } };
+        }
+    }
+
+    ParallelFor(0, node_count, BVH_LOD_MIN_CHUNK, [&](int, int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            lod->nodes[i] = Aggregate(bvh.nodes[i], sums[i]);
+        }
+    });
+}
+
+float BvhLodPixelFootprint()
+{
+    Vector3 step = CanvasToViewport(Vector2Int{ 1, 1 });
+    return fminf(step.x, step.y) / CAMERA_ORIGIN_DISTANCE;
+}
+
+struct LodLayer
+{
+    float t;
+    float coverage;
+    Color color;
+};
+
+// Layers sorted by distance, and the distance past which they hide everything.
+struct LodLayers
+{
+    LodLayer items[BVH_LOD_MAX_LAYERS];
+    int count;
+    float opaque_t;
+};
+
+static void AddLayer(LodLayers* layers, float t, const BvhLodNode& node)
+{
+    if (layers->count == BVH_LOD_MAX_LAYERS)
+    {
+        if (t >= layers->items[BVH_LOD_MAX_LAYERS - 1].t)
+        {
+            return;
+        }
+        layers->count--;
+    }
+    int i = layers->count++;
+    while (i > 0 && layers->items[i - 1].t > t)
+    {
+        layers->items[i] = layers->items[i - 1];
+        i--;
+    }
+    layers->items[i] = LodLayer{ t, node.coverage, node.color };
+
+    float transmittance = 1.0f;
+    for (int k = 0; k < layers->count; k++)
+    {
+        transmittance *= 1.0f - layers->items[k].coverage;
+        if (transmittance < BVH_LOD_MIN_TRANSMITTANCE)
+        {
+            layers->count = k + 1;
+            layers->opaque_t = layers->items[k].t;
+            return;
+        }
+    }
+}
+
+BvhLodSample BvhLodTrace(const Bvh& bvh, const BvhLod& lod, Ray r, float tmin, float tmax, float footprint, BvhTraceCounters* counters)
+{
+    RayHit closest = { -1, INFINITY };
+    LodLayers layers;
+    layers.count = 0;
+    layers.opaque_t = INFINITY;
+
+    if (!bvh.nodes.empty())
+    {
+        Vector3 d = r.direction;
+        float a = d.x * d.x + d.y * d.y + d.z * d.z;
+        float two_a = 2.0f * a;
+        Vector3 inv_d = Vector3{ 1.0f / d.x, 1.0f / d.y, 1.0f / d.z };
+
+        // A box entered at t is at least t |d| away, so its diagonal spans at most size / (t |d|).
+        float pixel_per_t = BVH_LOD_PIXEL_SCALE * footprint * sqrtf(a);
+
+        int stack[BVH_STACK_SIZE];
+        int stack_size = 0;
+        float t_root = BvhSlabEntry(bvh.nodes[0], d, inv_d, tmin, tmax);
+        if (t_root != INFINITY)
+        {
+            if (lod.nodes[0].size < pixel_per_t * t_root)
+            {
+                AddLayer(&layers, t_root, lod.nodes[0]);
+            }
+            else
+            {
+                stack[stack_size++] = 0;
+            }
+        }
+        while (stack_size > 0)
+        {
+            const BvhNode& n = bvh.nodes[stack[--stack_size]];
+            counters->nodes_visited++;
+            if (n.count > 0)
+            {
+                for (int i = n.first; i < n.first + n.count; i++)
+                {
+                    BvhTestSphere(bvh.spheres[i], bvh.sphere_ids[i], d, a, two_a, tmin, tmax, &closest);
+                }
+                counters->sphere_tests += n.count;
+                continue;
+            }
+
+            // As in BvhClosestHit, with children small enough on screen taken as a layer instead.
+            float far = closest.t < tmax ? closest.t : tmax;
+            far = layers.opaque_t < far ? layers.opaque_t : far;
+            float t_left = BvhSlabEntry(bvh.nodes[n.first], d, inv_d, tmin, far);
+            float t_right = BvhSlabEntry(bvh.nodes[n.first + 1], d, inv_d, tmin, far);
+            if (t_left != INFINITY && lod.nodes[n.first].size < pixel_per_t * t_left)
+            {
+                AddLayer(&layers, t_left, lod.nodes[n.first]);
+                t_left = INFINITY;
+            }
+            if (t_right != INFINITY && lod.nodes[n.first + 1].size < pixel_per_t * t_right)
+            {
+                AddLayer(&layers, t_right, lod.nodes[n.first + 1]);
+                t_right = INFINITY;
+            }
+            int near_child = t_left <= t_right ? n.first : n.first + 1;
+            int far_child = t_left <= t_right ? n.first + 1 : n.first;
+            float t_near = t_left <= t_right ? t_left : t_right;
+            float t_far = t_left <= t_right ? t_right : t_left;
+            if (t_far != INFINITY)
+            {
+                stack[stack_size++] = far_child;
+            }
+            if (t_near != INFINITY)
+            {
+                stack[stack_size++] = near_child;
+            }
+        }
+    }
+
+    // Only the layers in front of the exact hit show.
+    BvhLodSample sample = { closest, 0.0f, 0.0f, 0.0f, 1.0f };
+    for (int k = 0; k < layers.count && layers.items[k].t < closest.t; k++)
+    {
+        const LodLayer& layer = layers.items[k];
+        float weight = sample.transmittance * layer.coverage;
+        sample.r += weight * layer.color.r;
+        sample.g += weight * layer.color.g;
+        sample.b += weight * layer.color.b;
+        sample.transmittance -= weight;
+    }
+    return sample;
+}
+
+Color BvhLodShade(const BvhLodSample& sample, Color behind)
+{
+    float t = sample.transmittance;
+    return Color{ (unsigned char)fminf(sample.r + t * behind.r + 0.5f, 255.0f), (unsigned char)fminf(sample.g + t * behind.g + 0.5f, 255.0f),
+        (unsigned char)fminf(sample.b + t * behind.b + 0.5f, 255.0f), 255 };
+}
+
+void DrawSceneBvhLod(Image* img, Bvh* bvh, BvhLod* lod)
+{
+    if (bvh->scene_version != frame_scene->version || bvh->builder != bvh_builder)
+    {
+        BuildBvhCached(bvh_builder, *frame_scene, bvh);
+        BuildBvhLod(*bvh, *frame_scene, lod);
+    }
+
+    float footprint = BvhLodPixelFootprint();
+    DrawCanvasParallel(img, [&](int, Vector2Int canvas_pos, CanvasPixel* pixel)
+    {
+        BvhTraceCounters counters = { 0 };
+        BvhLodSample sample = BvhLodTrace(*bvh, *lod, CanvasRay(canvas_pos), 1.0f, INFINITY, footprint, &counters);
+        Color behind = sample.hit.sphere < 0 ? BACKGROUND_COLOR : frame_scene->GetSphere(sample.hit.sphere).color;
+        *pixel = CanvasPixel{ sample.hit, BvhLodShade(sample, behind), (int)counters.sphere_tests, 0 };
+    });
+}
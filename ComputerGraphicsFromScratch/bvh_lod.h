@@ -0,0 +1,80 @@
+/**********************************************************************************************
+*
+*   Level of detail for far clusters of a BVH
+*
+*   Past some distance a whole subtree of the BVH projects to less than a pixel, yet a ray that
+*   reaches it still walks it down to its leaves, so the cost of a frame grows with how many
+*   spheres are out there even though they can only ever show as a handful of pixels. This keeps
+*   an aggregate per node of a built Bvh instead:
+*     - color: the average color of the spheres below, weighted by their cross-section
+*     - coverage: the chance a ray through the node's box hits any of them, their summed mean
+*       cross-section over the box's (a quarter of its surface area, by Cauchy's formula),
+*       clamped to 1; overlaps between spheres are counted twice, so this errs on the opaque side
+*     - size: the diagonal of the spheres' own bounds; the node's box is padded for grazing hits
+*       (see BVH_GRAZING_PAD), far out by more than a small sphere's radius
+*   A ray stops at a node whose size, seen from where it enters the box, is smaller than
+*   BVH_LOD_PIXEL_SCALE pixels (the canvas step through CanvasToViewport), and composites the
+*   aggregate as a partly transparent layer. Layers are kept in order of distance and blended
+*   front to back with the exact hit behind them; once they let through less than
+*   BVH_LOD_MIN_TRANSMITTANCE, nothing past them is traversed. A dense far field therefore costs
+*   a few layers per ray however many spheres it holds.
+*
+*   The result is lossy by design: hit ids are only those of spheres close enough to be traced
+*   exactly, and colors in the far field are filtered.
+*
+**********************************************************************************************/
+
+#ifndef BVH_LOD_H
+#define BVH_LOD_H
+
+#include "bvh.h"
+#include "scene_snapshot.h"
+#include <vector>
+
+// Nodes whose diagonal spans less than this many pixels are drawn as their aggregate.
+#define BVH_LOD_PIXEL_SCALE 1.0f
+
+// Aggregate layers kept per ray; past that the farthest is dropped.
+#define BVH_LOD_MAX_LAYERS 4
+
+// Layers letting through less light than this hide everything behind them.
+#define BVH_LOD_MIN_TRANSMITTANCE (1.0f / 64.0f)
+
+struct BvhLodNode
+{
+    Color color;
+    float coverage;
+    float size; // diagonal of the spheres' bounds, 0 for an empty node
+};
+
+struct BvhLod
+{
+    std::vector<BvhLodNode> nodes; // parallel to the Bvh's nodes
+    unsigned long long scene_version = 0;
+};
+
+// What a ray saw: the closest exact hit, and the aggregates in front of it, premultiplied.
+struct BvhLodSample
+{
+    RayHit hit;
+    float r, g, b;
+    float transmittance; // share of the exact hit (or the background) that shows through
+};
+
+// Aggregates of every node of bvh, whose spheres are read from source, the snapshot it was built from.
+void BuildBvhLod(const Bvh& bvh, const SceneSnapshot& source, BvhLod* lod);
+
+// Angle a canvas pixel subtends at the center of the viewport, in radians.
+float BvhLodPixelFootprint();
+
+// Closest hit, stopping at nodes smaller than footprint as seen along the ray.
+BvhLodSample BvhLodTrace(const Bvh& bvh, const BvhLod& lod, Ray r, float tmin, float tmax, float footprint, BvhTraceCounters* counters);
+
+// Color of a sample with behind, the color of its exact hit or the background, showing through.
+Color BvhLodShade(const BvhLodSample& sample, Color behind);
+
+// Traces the canvas through a BVH of frame_scene and its aggregates, both rebuilt whenever the
+// snapshot changes, rows split across workers.
+void DrawSceneBvhLod(Image* img, Bvh* bvh, BvhLod* lod);
+
+#endif //BVH_LOD_H
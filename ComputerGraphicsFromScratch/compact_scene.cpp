@@ -0,0 +1,551 @@
+#include "compact_scene.h"
+#include "parallel.h"
+#include "renderer.h"
+#include "validation.h"
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+#include <numeric>
+#include <string.h>
+
+#define COMPACT_MIN_CHUNK 16384
+#define COMPACT_MIN_GROUPS 256
+
+#define COMPACT_POSITION_MAX ((1u << COMPACT_POSITION_BITS) - 1)
+#define COMPACT_RADIUS_SHIFT (3 * COMPACT_POSITION_BITS)
+#define COMPACT_COLOR_SHIFT (COMPACT_RADIUS_SHIFT + COMPACT_RADIUS_BITS)
+#define COMPACT_RECORD_MASK ((1ull << COMPACT_RECORD_BITS) - 1)
+
+// Two records fill 15 bytes exactly, and one starting half way through a byte still ends within
+// the 8 bytes loaded for it.
+static_assert(COMPACT_RECORD_BITS == 60, "records are stored in pairs of 15 bytes");
+
+CompactScene compact_scene;
+
+static unsigned long long LoadRecord(const unsigned char* records, int index)
+{
+    size_t bit = (size_t)index * COMPACT_RECORD_BITS;
+    unsigned long long word;
+    memcpy(&word, records + (bit >> 3), sizeof(word));
+    return (word >> (bit & 7)) & COMPACT_RECORD_MASK;
+}
+
+static void StorePair(unsigned char* pair, unsigned long long first, unsigned long long second)
+{
+    unsigned long long low = first | (second << COMPACT_RECORD_BITS);
+    unsigned long long high = second >> (64 - COMPACT_RECORD_BITS);
+    memcpy(pair, &low, sizeof(low));
+    memcpy(pair + sizeof(low), &high, 15 - sizeof(low));
+}
+
+static Vector3 DecodeCenter(const CompactGroup& g, unsigned long long bits)
+{
+    return Vector3{ g.origin.x + (float)(unsigned int)(bits & COMPACT_POSITION_MAX) * g.step.x,
+        g.origin.y + (float)(unsigned int)((bits >> COMPACT_POSITION_BITS) & COMPACT_POSITION_MAX) * g.step.y,
+        g.origin.z + (float)(unsigned int)((bits >> (2 * COMPACT_POSITION_BITS)) & COMPACT_POSITION_MAX) * g.step.z };
+}
+
+static int RadiusCode(unsigned long long bits)
+{
+    return (int)((bits >> COMPACT_RADIUS_SHIFT) & ((1u << COMPACT_RADIUS_BITS) - 1));
+}
+
+static int ColorCode(unsigned long long bits)
+{
+    return (int)((bits >> COMPACT_COLOR_SHIFT) & (COMPACT_PALETTE_SIZE - 1));
+}
+
+static unsigned int QuantizePosition(float value, float origin, float inv_step)
+{
+    float q = (value - origin) * inv_step + 0.5f;
+    return q <= 0.0f ? 0u : (q >= (float)COMPACT_POSITION_MAX ? COMPACT_POSITION_MAX : (unsigned int)q);
+}
+
+/***************************  Palettes  ***************************/
+
+struct RadiusRange
+{
+    int begin;
+    int end;
+    float min;
+    float max;
+};
+
+static void MeasureRange(const std::vector<float>& radii, const std::vector<int>& order, RadiusRange* range)
+{
+    range->min = INFINITY;
+    range->max = 0.0f;
+    for (int i = range->begin; i < range->end; i++)
+    {
+        range->min = fminf(range->min, radii[order[i]]);
+        range->max = fmaxf(range->max, radii[order[i]]);
+    }
+}
+
+// Log scale quantization that adapts to the radii there are: the range with the largest ratio of
+// largest to smallest radius is split at its geometric middle until there are as many ranges as
+// codes or every range holds a single radius. A radius decodes to the geometric middle of its
+// range, so it is off by at most the square root of that range's ratio, which is returned. Gaps
+// between sizes cost no codes, and a scene with few enough radii keeps them all exactly.
+static float CutRadii(const std::vector<float>& radii, float* table, std::vector<unsigned char>* codes)
+{
+    int count = (int)radii.size();
+    std::vector<int> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    std::vector<RadiusRange> ranges(1, RadiusRange{ 0, count, 0.0f, 0.0f });
+    MeasureRange(radii, order, &ranges[0]);
+    while ((int)ranges.size() < (1 << COMPACT_RADIUS_BITS))
+    {
+        int widest = 0;
+        for (int r = 1; r < (int)ranges.size(); r++)
+        {
+            widest = ranges[r].max * ranges[widest].min > ranges[widest].max * ranges[r].min ? r : widest;
+        }
+        RadiusRange range = ranges[widest];
+        if (range.max <= range.min)
+        {
+            break;
+        }
+        // Below the middle on one side; the smallest radius always is, the largest never.
+        float middle = sqrtf(range.min) * sqrtf(range.max);
+        int* split = std::partition(order.data() + range.begin, order.data() + range.end, [&](int i) { return radii[i] < middle; });
+        int split_index = (int)(split - order.data());
+        ranges[widest] = RadiusRange{ range.begin, split_index, 0.0f, 0.0f };
+        ranges.push_back(RadiusRange{ split_index, range.end, 0.0f, 0.0f });
+        MeasureRange(radii, order, &ranges[widest]);
+        MeasureRange(radii, order, &ranges.back());
+    }
+
+    codes->resize(count);
+    float error = 1.0f;
+    for (int r = 0; r < (int)ranges.size(); r++)
+    {
+        table[r] = sqrtf(ranges[r].min) * sqrtf(ranges[r].max);
+        error = fmaxf(error, ranges[r].min > 0.0f ? sqrtf(ranges[r].max / ranges[r].min) : 1.0f);
+        for (int i = ranges[r].begin; i < ranges[r].end; i++)
+        {
+            (*codes)[order[i]] = (unsigned char)r;
+        }
+    }
+    return error;
+}
+
+static int ColorChannel(Color c, int channel)
+{
+    return channel == 0 ? c.r : (channel == 1 ? c.g : (channel == 2 ? c.b : c.a));
+}
+
+struct PaletteBox
+{
+    int begin;
+    int end;
+    int channel; // widest one
+    int range;
+};
+
+static void MeasureBox(const std::vector<Color>& colors, const std::vector<int>& order, PaletteBox* box)
+{
+    int lo[4] = { 255, 255, 255, 255 };
+    int hi[4] = { 0, 0, 0, 0 };
+    for (int i = box->begin; i < box->end; i++)
+    {
+        Color c = colors[order[i]];
+        for (int channel = 0; channel < 4; channel++)
+        {
+            int v = ColorChannel(c, channel);
+            lo[channel] = v < lo[channel] ? v : lo[channel];
+            hi[channel] = v > hi[channel] ? v : hi[channel];
+        }
+    }
+    box->channel = 0;
+    box->range = -1;
+    for (int channel = 0; channel < 4; channel++)
+    {
+        if (hi[channel] - lo[channel] > box->range)
+        {
+            box->channel = channel;
+            box->range = hi[channel] - lo[channel];
+        }
+    }
+}
+
+// Median cut: the box with the widest channel is split at that channel's median until there are
+// COMPACT_PALETTE_SIZE boxes or every box holds a single color. Splits go by value, so equal
+// colors always share a box and a scene with few enough colors keeps them all exactly. Every
+// color is mapped to the mean of its box.
+static int CutPalette(const std::vector<Color>& colors, Color* palette, std::vector<unsigned char>* indices)
+{
+    int count = (int)colors.size();
+    if (count == 0)
+    {
+        return 0;
+    }
+    std::vector<int> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    std::vector<PaletteBox> boxes(1, PaletteBox{ 0, count, 0, 0 });
+    MeasureBox(colors, order, &boxes[0]);
+    while ((int)boxes.size() < COMPACT_PALETTE_SIZE)
+    {
+        int widest = 0;
+        for (int b = 1; b < (int)boxes.size(); b++)
+        {
+            widest = boxes[b].range > boxes[widest].range ? b : widest;
+        }
+        PaletteBox box = boxes[widest];
+        if (box.range == 0)
+        {
+            break;
+        }
+
+        int channel = box.channel;
+        int* first = order.data() + box.begin;
+        int* last = order.data() + box.end;
+        int* mid = first + (box.end - box.begin) / 2;
+        std::nth_element(first, mid, last, [&](int a, int b) { return ColorChannel(colors[a], channel) < ColorChannel(colors[b], channel); });
+        int median = ColorChannel(colors[*mid], channel);
+        // Below the median on one side, unless nothing is, then up to it; the box has more than one
+        // value on this channel, so neither side is empty.
+        int* split = std::partition(first, last, [&](int i) { return ColorChannel(colors[i], channel) < median; });
+        if (split == first)
+        {
+            split = std::partition(first, last, [&](int i) { return ColorChannel(colors[i], channel) <= median; });
+        }
+
+        int split_index = (int)(split - order.data());
+        boxes[widest] = PaletteBox{ box.begin, split_index, 0, 0 };
+        boxes.push_back(PaletteBox{ split_index, box.end, 0, 0 });
+        MeasureBox(colors, order, &boxes[widest]);
+        MeasureBox(colors, order, &boxes.back());
+    }
+
+    indices->resize(count);
+    for (int b = 0; b < (int)boxes.size(); b++)
+    {
+        unsigned long long sums[4] = { 0, 0, 0, 0 };
+        for (int i = boxes[b].begin; i < boxes[b].end; i++)
+        {
+            Color c = colors[order[i]];
+            sums[0] += c.r;
+            sums[1] += c.g;
+            sums[2] += c.b;
+            sums[3] += c.a;
+            (*indices)[order[i]] = (unsigned char)b;
+        }
+        unsigned long long n = (unsigned long long)(boxes[b].end - boxes[b].begin);
+        palette[b] = Color{ (unsigned char)((sums[0] + n / 2) / n), (unsigned char)((sums[1] + n / 2) / n),
+            (unsigned char)((sums[2] + n / 2) / n), (unsigned char)((sums[3] + n / 2) / n) };
+    }
+    return (int)boxes.size();
+}
+
+/***************************  Build  ***************************/
+
+struct CompactBounds
+{
+    Vector3 min;
+    Vector3 max;
+};
+
+static unsigned int HighestBit(unsigned int v)
+{
+    v |= v >> 1;
+    v |= v >> 2;
+    v |= v >> 4;
+    v |= v >> 8;
+    v |= v >> 16;
+    return v ^ (v >> 1);
+}
+
+// Leaves [begin, end) in Morton order, split where the highest bit in which the codes of their
+// first spheres differ flips, as the LBVH builder's hierarchy does, and in the middle where the
+// codes are all the same. The leaves are already filled in.
+static void BuildCompactTree(const std::vector<BvhNode>& leaves, const std::vector<unsigned int>& leaf_codes, int node, int begin, int end,
+    int* node_count, std::vector<BvhNode>* nodes)
+{
+    if (end - begin == 1)
+    {
+        (*nodes)[node] = leaves[begin];
+        return;
+    }
+    int left = *node_count;
+    *node_count += 2;
+    int mid = begin + (end - begin) / 2;
+    unsigned int differing = leaf_codes[begin] ^ leaf_codes[end - 1];
+    if (differing != 0)
+    {
+        unsigned int bit = HighestBit(differing);
+        mid = (int)(std::partition_point(leaf_codes.begin() + begin, leaf_codes.begin() + end, [&](unsigned int code) { return (code & bit) == 0; }) -
+            leaf_codes.begin());
+    }
+    BuildCompactTree(leaves, leaf_codes, left, begin, mid, node_count, nodes);
+    BuildCompactTree(leaves, leaf_codes, left + 1, mid, end, node_count, nodes);
+    const BvhNode& a = (*nodes)[left];
+    const BvhNode& b = (*nodes)[left + 1];
+    (*nodes)[node] = BvhNode{ Vector3{ fminf(a.min.x, b.min.x), fminf(a.min.y, b.min.y), fminf(a.min.z, b.min.z) }, left,
+        Vector3{ fmaxf(a.max.x, b.max.x), fmaxf(a.max.y, b.max.y), fmaxf(a.max.z, b.max.z) }, 0 };
+}
+
+void CompactScene::Build(const SceneSnapshot& source, bool keep_ids)
+{
+    scene_version = source.version;
+    BuildFrom(source, source.count, keep_ids);
+}
+
+void CompactScene::Build(const SphereGenerator& source, bool keep_ids)
+{
+    scene_version = 0;
+    BuildFrom(source, source.Count(), keep_ids);
+}
+
+// Reads source only through GetSphere, several times over, so a generator serves as well as a
+// snapshot.
+template <typename Source>
+void CompactScene::BuildFrom(const Source& source, int source_count, bool keep_ids)
+{
+    count = source_count;
+    int group_count = (count + COMPACT_GROUP_SIZE - 1) / COMPACT_GROUP_SIZE;
+    records.assign((size_t)(count + 1) / 2 * 15, 0);
+    groups.resize(group_count);
+    nodes.clear();
+    ids.clear();
+    palette_size = 0;
+    center_error = 0.0f;
+    radius_error = 1.0f;
+    if (count == 0)
+    {
+        return;
+    }
+
+    // Bounds of the centers, for the Morton codes.
+    std::vector<CompactBounds> worker_bounds(WorkerCount());
+    int workers = ParallelFor(0, count, COMPACT_MIN_CHUNK, [&](int worker, int begin, int end)
+    {
+        CompactBounds b = { Vector3{ INFINITY, INFINITY, INFINITY }, Vector3{ -INFINITY, -INFINITY, -INFINITY } };
+        for (int i = begin; i < end; i++)
+        {
+            Vector3 c = source.GetSphere(i).center;
+            b.min = Vector3{ fminf(b.min.x, c.x), fminf(b.min.y, c.y), fminf(b.min.z, c.z) };
+            b.max = Vector3{ fmaxf(b.max.x, c.x), fmaxf(b.max.y, c.y), fmaxf(b.max.z, c.z) };
+        }
+        worker_bounds[worker] = b;
+    });
+    CompactBounds bounds = worker_bounds[0];
+    for (int w = 1; w < workers; w++)
+    {
+        const CompactBounds& b = worker_bounds[w];
+        bounds.min = Vector3{ fminf(bounds.min.x, b.min.x), fminf(bounds.min.y, b.min.y), fminf(bounds.min.z, b.min.z) };
+        bounds.max = Vector3{ fmaxf(bounds.max.x, b.max.x), fmaxf(bounds.max.y, b.max.y), fmaxf(bounds.max.z, b.max.z) };
+    }
+
+    // Storage order: Morton order of the centers, quantized to 1024 steps per axis of their bounds
+    // as the LBVH builder does.
+    Vector3 scale;
+    scale.x = bounds.max.x > bounds.min.x ? 1023.0f / (bounds.max.x - bounds.min.x) : 0.0f;
+    scale.y = bounds.max.y > bounds.min.y ? 1023.0f / (bounds.max.y - bounds.min.y) : 0.0f;
+    scale.z = bounds.max.z > bounds.min.z ? 1023.0f / (bounds.max.z - bounds.min.z) : 0.0f;
+    std::vector<unsigned int> codes(count);
+    std::vector<int> order(count);
+    ParallelFor(0, count, COMPACT_MIN_CHUNK, [&](int, int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            Sphere sp = source.GetSphere(i);
+            codes[i] = MortonCode((sp.center.x - bounds.min.x) * scale.x, (sp.center.y - bounds.min.y) * scale.y,
+                (sp.center.z - bounds.min.z) * scale.z);
+            order[i] = i;
+        }
+    });
+    RadixSortKeys(&codes, &order);
+
+    std::vector<Color> colors(count);
+    std::vector<float> sorted_radii(count);
+    ParallelFor(0, count, COMPACT_MIN_CHUNK, [&](int, int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            Sphere sp = source.GetSphere(order[i]);
+            colors[i] = sp.color;
+            sorted_radii[i] = sp.radius;
+        }
+    });
+    std::vector<unsigned char> color_codes;
+    std::vector<unsigned char> radius_codes;
+    palette_size = CutPalette(colors, palette, &color_codes);
+    radius_error = CutRadii(sorted_radii, radii, &radius_codes);
+    colors = std::vector<Color>();
+    sorted_radii = std::vector<float>();
+
+    // Every group is quantized over its own centers' bounds, and every leaf bounds its decoded
+    // spheres grown by the grazing pad, as BVH leaves do.
+    int leaf_count = (count + COMPACT_LEAF_SIZE - 1) / COMPACT_LEAF_SIZE;
+    std::vector<BvhNode> leaves(leaf_count);
+    std::vector<float> group_errors(group_count);
+    ParallelFor(0, group_count, COMPACT_MIN_GROUPS, [&](int, int begin, int end)
+    {
+        Sphere spheres[COMPACT_GROUP_SIZE];
+        unsigned long long bits[COMPACT_GROUP_SIZE];
+        for (int g = begin; g < end; g++)
+        {
+            int first = g * COMPACT_GROUP_SIZE;
+            int n = count - first < COMPACT_GROUP_SIZE ? count - first : COMPACT_GROUP_SIZE;
+            Vector3 lo = Vector3{ INFINITY, INFINITY, INFINITY };
+            Vector3 hi = Vector3{ -INFINITY, -INFINITY, -INFINITY };
+            for (int k = 0; k < n; k++)
+            {
+                spheres[k] = source.GetSphere(order[first + k]);
+                Vector3 c = spheres[k].center;
+                lo = Vector3{ fminf(lo.x, c.x), fminf(lo.y, c.y), fminf(lo.z, c.z) };
+                hi = Vector3{ fmaxf(hi.x, c.x), fmaxf(hi.y, c.y), fmaxf(hi.z, c.z) };
+            }
+            CompactGroup& group = groups[g];
+            group.origin = lo;
+            group.step = Vector3{ (hi.x - lo.x) / (float)COMPACT_POSITION_MAX, (hi.y - lo.y) / (float)COMPACT_POSITION_MAX,
+                (hi.z - lo.z) / (float)COMPACT_POSITION_MAX };
+            Vector3 inv_step = Vector3{ group.step.x > 0.0f ? 1.0f / group.step.x : 0.0f, group.step.y > 0.0f ? 1.0f / group.step.y : 0.0f,
+                group.step.z > 0.0f ? 1.0f / group.step.z : 0.0f };
+            float largest = fmaxf(fmaxf(fabsf(lo.x), fabsf(hi.x)), fmaxf(fmaxf(fabsf(lo.y), fabsf(hi.y)), fmaxf(fabsf(lo.z), fabsf(hi.z))));
+            // Half a step, plus the rounding of the decode's multiply-add.
+            group_errors[g] = 0.5f * fmaxf(group.step.x, fmaxf(group.step.y, group.step.z)) + 2.0f * FLT_EPSILON * largest;
+
+            for (int k = 0; k < COMPACT_GROUP_SIZE; k++)
+            {
+                bits[k] = 0;
+                if (k >= n)
+                {
+                    continue;
+                }
+                BvhNode& leaf = leaves[(first + k) / COMPACT_LEAF_SIZE];
+                if (k % COMPACT_LEAF_SIZE == 0)
+                {
+                    int leaf_size = n - k < COMPACT_LEAF_SIZE ? n - k : COMPACT_LEAF_SIZE;
+                    leaf = BvhNode{ Vector3{ INFINITY, INFINITY, INFINITY }, first + k, Vector3{ -INFINITY, -INFINITY, -INFINITY }, leaf_size };
+                }
+                const Sphere& sp = spheres[k];
+                bits[k] = (unsigned long long)QuantizePosition(sp.center.x, lo.x, inv_step.x) |
+                    ((unsigned long long)QuantizePosition(sp.center.y, lo.y, inv_step.y) << COMPACT_POSITION_BITS) |
+                    ((unsigned long long)QuantizePosition(sp.center.z, lo.z, inv_step.z) << (2 * COMPACT_POSITION_BITS)) |
+                    ((unsigned long long)radius_codes[first + k] << COMPACT_RADIUS_SHIFT) | ((unsigned long long)color_codes[first + k] << COMPACT_COLOR_SHIFT);
+
+                Vector3 c = DecodeCenter(group, bits[k]);
+                float r = radii[RadiusCode(bits[k])];
+                Vector3 co = Vector3{ CAMERA_ORIGIN.x - c.x, CAMERA_ORIGIN.y - c.y, CAMERA_ORIGIN.z - c.z };
+                float pad = sqrtf(r * r + BVH_GRAZING_PAD * (co.x * co.x + co.y * co.y + co.z * co.z));
+                leaf.min = Vector3{ fminf(leaf.min.x, c.x - pad), fminf(leaf.min.y, c.y - pad), fminf(leaf.min.z, c.z - pad) };
+                leaf.max = Vector3{ fmaxf(leaf.max.x, c.x + pad), fmaxf(leaf.max.y, c.y + pad), fmaxf(leaf.max.z, c.z + pad) };
+            }
+            // Groups start on an even sphere, so their pairs are their own.
+            for (int k = 0; k < n; k += 2)
+            {
+                StorePair(&records[(size_t)(first + k) / 2 * 15], bits[k], bits[k + 1]);
+            }
+        }
+    });
+    center_error = *std::max_element(group_errors.begin(), group_errors.end());
+
+    std::vector<unsigned int> leaf_codes(leaf_count);
+    for (int l = 0; l < leaf_count; l++)
+    {
+        leaf_codes[l] = codes[(size_t)l * COMPACT_LEAF_SIZE];
+    }
+    codes = std::vector<unsigned int>();
+    nodes.resize(2 * (size_t)leaf_count - 1);
+    int node_count = 1;
+    BuildCompactTree(leaves, leaf_codes, 0, 0, leaf_count, &node_count, &nodes);
+
+    if (keep_ids)
+    {
+        ids = std::move(order);
+    }
+}
+
+/***************************  Trace  ***************************/
+
+Sphere CompactScene::GetSphere(int index) const
+{
+    unsigned long long bits = LoadRecord(records.data(), index);
+    return Sphere{ DecodeCenter(groups[index / COMPACT_GROUP_SIZE], bits), radii[RadiusCode(bits)], palette[ColorCode(bits)] };
+}
+
+size_t CompactScene::StorageBytes() const
+{
+    return records.size() + groups.size() * sizeof(CompactGroup) + sizeof(radii) + sizeof(palette);
+}
+
+RayHit CompactScene::ClosestHit(Ray r, float tmin, float tmax, BvhTraceCounters* counters) const
+{
+    RayHit closest = { -1, INFINITY };
+    if (nodes.empty())
+    {
+        return closest;
+    }
+
+    Vector3 d = r.direction;
+    float a = d.x * d.x + d.y * d.y + d.z * d.z;
+    float two_a = 2.0f * a;
+    Vector3 inv_d = Vector3{ 1.0f / d.x, 1.0f / d.y, 1.0f / d.z };
+    const unsigned char* data = records.data();
+
+    int stack[BVH_STACK_SIZE];
+    int stack_size = 0;
+    if (BvhSlabEntry(nodes[0], d, inv_d, tmin, tmax) != INFINITY)
+    {
+        stack[stack_size++] = 0;
+    }
+    while (stack_size > 0)
+    {
+        const BvhNode& n = nodes[stack[--stack_size]];
+        counters->nodes_visited++;
+        if (n.count > 0)
+        {
+            // Decoded and folded here, with the same arithmetic BuildBvh folds with.
+            const CompactGroup& g = groups[n.first / COMPACT_GROUP_SIZE];
+            for (int i = n.first; i < n.first + n.count; i++)
+            {
+                unsigned long long bits = LoadRecord(data, i);
+                Vector3 c = DecodeCenter(g, bits);
+                float radius = radii[RadiusCode(bits)];
+                Vector3 co = Vector3{ CAMERA_ORIGIN.x - c.x, CAMERA_ORIGIN.y - c.y, CAMERA_ORIGIN.z - c.z };
+                BvhSphere sp = { co, (co.x * co.x + co.y * co.y + co.z * co.z) - radius * radius };
+                BvhTestSphere(sp, i, d, a, two_a, tmin, tmax, &closest);
+            }
+            counters->sphere_tests += n.count;
+            continue;
+        }
+
+        float far = closest.t < tmax ? closest.t : tmax;
+        float t_left = BvhSlabEntry(nodes[n.first], d, inv_d, tmin, far);
+        float t_right = BvhSlabEntry(nodes[n.first + 1], d, inv_d, tmin, far);
+        int near_child = t_left <= t_right ? n.first : n.first + 1;
+        int far_child = t_left <= t_right ? n.first + 1 : n.first;
+        float t_near = t_left <= t_right ? t_left : t_right;
+        float t_far = t_left <= t_right ? t_right : t_left;
+        if (t_far != INFINITY)
+        {
+            stack[stack_size++] = far_child;
+        }
+        if (t_near != INFINITY)
+        {
+            stack[stack_size++] = near_child;
+        }
+    }
+    return closest;
+}
+
+void DrawSceneCompact(Image* img, CompactScene* compact)
+{
+    // Scene indices are only kept while validating, which compares hits by them.
+    bool validating = captured_hits != NULL;
+    if (scene_storage != STORAGE_COMPACT && (compact->scene_version != frame_scene->version || (validating && !compact->HasIds())))
+    {
+        compact->Build(*frame_scene, validating);
+    }
+
+    DrawCanvasParallel(img, [&](int, Vector2Int canvas_pos, CanvasPixel* pixel)
+    {
+        BvhTraceCounters counters = { 0 };
+        RayHit hit = compact->ClosestHit(CanvasRay(canvas_pos), 1.0f, INFINITY, &counters);
+        Color col = hit.sphere < 0 ? BACKGROUND_COLOR : compact->GetSphere(hit.sphere).color;
+        RayHit scene_hit = { validating && hit.sphere >= 0 ? compact->SceneIndex(hit.sphere) : -1, hit.t };
+        *pixel = CanvasPixel{ scene_hit, col, (int)counters.sphere_tests, 0 };
+    });
+}
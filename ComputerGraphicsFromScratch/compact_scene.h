@@ -0,0 +1,116 @@
+/**********************************************************************************************
+*
+*   Compact quantized sphere storage
+*
+*   At 10^8 spheres a Sphere's 20 bytes, and the folded copy the BVH keeps, no longer fit in
+*   memory. This stores every sphere in COMPACT_RECORD_BITS instead:
+*     - center: 16 bits per axis, quantized over the bounds of the centers of its group, a run of
+*       COMPACT_GROUP_SIZE spheres along a Morton curve, so neighbours share a small box
+*     - radius: 6 bits, an index into 64 radii that split the scene's log radius range where it
+*       is widest, so sizes the scene doesn't use cost no codes (exact for up to 64 radii)
+*     - color: 6 bits, an index into a palette of up to 64 colors, cut from the scene's colors
+*       by median cut (exact when the scene has no more than that)
+*   Records are packed back to back, two to 15 bytes, and each group adds its 24-byte frame:
+*   7.875 bytes per sphere in all. A record is decoded in the intersection loop with one
+*   unaligned 8-byte load, a shift and a multiply-add per axis.
+*
+*   Error bounds:
+*     - a center is off by at most half a step of its group's box, extent / 131070 per axis; no
+*       group is wider than the scene, so that is at most 2^-17 of the scene's extent
+*     - a radius is off by at most the square root of its range's ratio of largest to smallest,
+*       (max / min)^(1/128) of the scene's when its radii are spread evenly in log space
+*   The exact bounds of a built scene are kept with it (see CenterError and RadiusError).
+*
+*   Tracing walks a binary tree over leaves of COMPACT_LEAF_SIZE spheres in Morton order, each
+*   node bounding the decoded spheres below it, and tests every sphere of each leaf it reaches.
+*   The tree is the only acceleration data: two 32-byte nodes per leaf, about 4 bytes per sphere.
+*
+*   Built from frame_scene, the compact scene is one more copy of spheres that are all in memory
+*   already. With --storage=compact it is the scene's storage instead: a generated scene is read
+*   straight into it from a SphereGenerator (see procedural_scene.h), one sphere at a time in
+*   each pass, and the Scene and its snapshots stay empty. The build itself still holds about
+*   16 bytes per sphere for the Morton sort and the palette and radius cuts, then frees them.
+*
+**********************************************************************************************/
+
+#ifndef COMPACT_SCENE_H
+#define COMPACT_SCENE_H
+
+#include "bvh.h"
+#include "procedural_scene.h"
+#include "scene_snapshot.h"
+#include <vector>
+
+#define COMPACT_GROUP_SIZE 64
+
+// Spheres per leaf of the tree; divides COMPACT_GROUP_SIZE, so leaves share their group's frame.
+#define COMPACT_LEAF_SIZE 16
+#define COMPACT_POSITION_BITS 16
+#define COMPACT_RADIUS_BITS 6
+#define COMPACT_COLOR_BITS 6
+#define COMPACT_RECORD_BITS (3 * COMPACT_POSITION_BITS + COMPACT_RADIUS_BITS + COMPACT_COLOR_BITS)
+#define COMPACT_PALETTE_SIZE (1 << COMPACT_COLOR_BITS)
+
+// Quantization frame of a group: a center decodes to origin + q * step per axis.
+struct CompactGroup
+{
+    Vector3 origin;
+    Vector3 step;
+};
+
+class CompactScene
+{
+public:
+    // ids keeps the scene index of every sphere, 4 more bytes each, for validation only.
+    void Build(const SceneSnapshot& source, bool keep_ids);
+
+    // The same from a generator, whose indices the ids then are; scene_version is left 0.
+    void Build(const SphereGenerator& source, bool keep_ids);
+
+    int Count() const { return count; }
+    bool HasIds() const { return !ids.empty(); }
+
+    // Spheres are numbered in storage order, which is not the scene's.
+    Sphere GetSphere(int index) const;
+    int SceneIndex(int index) const { return ids.empty() ? -1 : ids[index]; }
+
+    // Closest hit with the decoded spheres, with the same arithmetic per sphere as ClosestHit;
+    // the hit's sphere is in storage order.
+    RayHit ClosestHit(Ray r, float tmin, float tmax, BvhTraceCounters* counters) const;
+
+    // Largest error a center can have on any axis, and largest factor a radius can be off by.
+    float CenterError() const { return center_error; }
+    float RadiusError() const { return radius_error; }
+    int PaletteSize() const { return palette_size; }
+
+    // Records, group frames and palette; and the tree.
+    size_t StorageBytes() const;
+    size_t TreeBytes() const { return nodes.size() * sizeof(BvhNode); }
+
+    unsigned long long scene_version = 0;
+
+private:
+    int count = 0;
+    std::vector<unsigned char> records; // COMPACT_RECORD_BITS each, two to 15 bytes
+    std::vector<CompactGroup> groups;
+    float radii[1 << COMPACT_RADIUS_BITS] = { 0 }; // decoded radius of every code
+    Color palette[COMPACT_PALETTE_SIZE] = {};
+    int palette_size = 0;
+    std::vector<BvhNode> nodes; // leaves' first is their first sphere
+    std::vector<int> ids;
+    float center_error = 0.0f;
+    float radius_error = 1.0f;
+
+    template <typename Source>
+    void BuildFrom(const Source& source, int source_count, bool keep_ids);
+};
+
+// The compact render mode's scene: a copy of frame_scene, or with --storage=compact the only one.
+extern CompactScene compact_scene;
+
+// Rebuilds the compact scene whenever frame_scene changes, unless it is the scene's storage, then
+// traces the canvas through it, rows split across workers. Colors come from the palette, so they
+// can differ from the scene's.
+void DrawSceneCompact(Image* img, CompactScene* compact);
+
+#endif //COMPACT_SCENE_H
@@ -0,0 +1,71 @@
+#include "cpu_dispatch.h"
+#include <intrin.h>
+#include <immintrin.h>
+#include <string.h>
+
+const char* isa_names[ISA_COUNT] = { "scalar", "sse2", "avx2", "avx512" };
+
+static IsaLevel QueryIsa()
+{
+    int info[4];
+    __cpuid(info, 0);
+    int max_leaf = info[0];
+
+    __cpuid(info, 1);
+    bool sse2 = (info[3] & (1 << 26)) != 0;
+    bool fma = (info[2] & (1 << 12)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    if (!sse2)
+    {
+        return ISA_SCALAR;
+    }
+    if (!osxsave || !avx || max_leaf < 7)
+    {
+        return ISA_SSE2;
+    }
+
+    // The OS has to save the wider registers on context switches, or using them is unsafe.
+    unsigned long long xcr0 = _xgetbv(0);
+    bool os_avx = (xcr0 & 0x6) == 0x6;       // XMM, YMM
+    bool os_avx512 = (xcr0 & 0xE6) == 0xE6;  // and opmask, ZMM
+    if (!os_avx)
+    {
+        return ISA_SSE2;
+    }
+
+    __cpuidex(info, 7, 0);
+    bool avx2 = (info[1] & (1 << 5)) != 0;
+    bool avx512 = (info[1] & (1 << 16)) != 0   // F
+        && (info[1] & (1 << 17)) != 0          // DQ
+        && (info[1] & (1 << 30)) != 0          // BW
+        && (info[1] & (1u << 31)) != 0;        // VL
+    if (!avx2 || !fma)
+    {
+        return ISA_SSE2;
+    }
+    if (!avx512 || !os_avx512)
+    {
+        return ISA_AVX2;
+    }
+    return ISA_AVX512;
+}
+
+IsaLevel DetectIsa()
+{
+    static IsaLevel detected = QueryIsa();
+    return detected;
+}
+
+bool ParseIsa(const char* name, IsaLevel* isa)
+{
+    for (int i = 0; i < ISA_COUNT; i++)
+    {
+        if (strcmp(name, isa_names[i]) == 0)
+        {
+            *isa = (IsaLevel)i;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,28 @@
+/**********************************************************************************************
+*
+*   CPU feature detection for picking ISA-specific kernels at startup
+*
+**********************************************************************************************/
+
+#ifndef CPU_DISPATCH_H
+#define CPU_DISPATCH_H
+
+// Ordered from least to most capable; a CPU supporting one level supports all below it.
+enum IsaLevel
+{
+    ISA_SCALAR,
+    ISA_SSE2,
+    ISA_AVX2,   // AVX2 + FMA
+    ISA_AVX512, // AVX-512 F/DQ/BW/VL
+    ISA_COUNT
+};
+
+extern const char* isa_names[ISA_COUNT];
+
+// Highest level both the CPU and the OS (saved register state) support. Detected once and cached.
+IsaLevel DetectIsa();
+
+// Parses one of isa_names; returns false for anything else.
+bool ParseIsa(const char* name, IsaLevel* isa);
+
+#endif //CPU_DISPATCH_H
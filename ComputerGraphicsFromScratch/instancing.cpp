@@ -0,0 +1,265 @@
+#include "instancing.h"
+#include <math.h>
+
+static void GrowBox(BvhNode* n, Vector3 min, Vector3 max)
+{
+    n->min = Vector3{ fminf(n->min.x, min.x), fminf(n->min.y, min.y), fminf(n->min.z, min.z) };
+    n->max = Vector3{ fmaxf(n->max.x, max.x), fmaxf(n->max.y, max.y), fmaxf(n->max.z, max.z) };
+}
+
+int InstancedScene::AddCluster(const std::vector<Sphere>& spheres)
+{
+    std::vector<Vector3> centers(spheres.size());
+    std::vector<float> radii(spheres.size());
+    for (size_t i = 0; i < spheres.size(); i++)
+    {
+        centers[i] = spheres[i].center;
+        radii[i] = spheres[i].radius;
+    }
+
+    SphereCluster cluster;
+    BuildBvhNodes(BVH_BUILD_SAH, centers, radii, &cluster.nodes, &cluster.sphere_ids);
+    cluster.centers.resize(spheres.size());
+    cluster.radii.resize(spheres.size());
+    cluster.colors.resize(spheres.size());
+    for (size_t i = 0; i < spheres.size(); i++)
+    {
+        int id = cluster.sphere_ids[i];
+        cluster.centers[i] = centers[id];
+        cluster.radii[i] = radii[id];
+        cluster.colors[id] = spheres[id].color;
+    }
+
+    clusters.push_back(cluster);
+    return (int)clusters.size() - 1;
+}
+
+int InstancedScene::AddInstance(const SphereInstance& instance)
+{
+    instances.push_back(instance);
+    transforms.push_back(InstanceTransform{ QuaternionInvert(instance.rotation), 1.0f / instance.scale });
+    top_rebuild = true;
+    return (int)instances.size() - 1;
+}
+
+void InstancedScene::MoveInstance(int instance, Vector3 position, Quaternion rotation)
+{
+    instances[instance].position = position;
+    instances[instance].rotation = rotation;
+    transforms[instance].inverse_rotation = QuaternionInvert(rotation);
+    top_refit = true;
+}
+
+// The root box carries the builder's padding, so the world box keeps that margin.
+void InstancedScene::InstanceBounds(int instance, Vector3* min, Vector3* max) const
+{
+    const SphereInstance& inst = instances[instance];
+    const SphereCluster& cluster = clusters[inst.cluster];
+    if (cluster.nodes.empty())
+    {
+        *min = *max = inst.position;
+        return;
+    }
+
+    const BvhNode& root = cluster.nodes[0];
+    Vector3 center = Vector3Scale(Vector3Add(root.min, root.max), 0.5f * inst.scale);
+    Vector3 half = Vector3Scale(Vector3Subtract(root.max, root.min), 0.5f * inst.scale);
+    center = Vector3Add(inst.position, Vector3RotateByQuaternion(center, inst.rotation));
+
+    // Each rotated axis of the box adds its half extent to every world axis it leans along.
+    Vector3 ax = Vector3RotateByQuaternion(Vector3{ half.x, 0.0f, 0.0f }, inst.rotation);
+    Vector3 ay = Vector3RotateByQuaternion(Vector3{ 0.0f, half.y, 0.0f }, inst.rotation);
+    Vector3 az = Vector3RotateByQuaternion(Vector3{ 0.0f, 0.0f, half.z }, inst.rotation);
+    Vector3 extent = { fabsf(ax.x) + fabsf(ay.x) + fabsf(az.x), fabsf(ax.y) + fabsf(ay.y) + fabsf(az.y), fabsf(ax.z) + fabsf(ay.z) + fabsf(az.z) };
+    *min = Vector3Subtract(center, extent);
+    *max = Vector3Add(center, extent);
+}
+
+void InstancedScene::RebuildTop()
+{
+    // The builder takes spheres: the one around each box places it, and the refit after tightens it.
+    std::vector<Vector3> centers(instances.size());
+    std::vector<float> radii(instances.size());
+    for (size_t i = 0; i < instances.size(); i++)
+    {
+        Vector3 min, max;
+        InstanceBounds((int)i, &min, &max);
+        centers[i] = Vector3Scale(Vector3Add(min, max), 0.5f);
+        radii[i] = Vector3Distance(max, centers[i]);
+    }
+    BuildBvhNodes(BVH_BUILD_SAH, centers, radii, &top_nodes, &top_order);
+    RefitTop();
+}
+
+void InstancedScene::RefitTop()
+{
+    // Children always follow their parent, so walking backwards visits them first.
+    for (int i = (int)top_nodes.size() - 1; i >= 0; i--)
+    {
+        BvhNode& n = top_nodes[i];
+        n.min = Vector3{ INFINITY, INFINITY, INFINITY };
+        n.max = Vector3{ -INFINITY, -INFINITY, -INFINITY };
+        if (n.count == 0)
+        {
+            GrowBox(&n, top_nodes[n.first].min, top_nodes[n.first].max);
+            GrowBox(&n, top_nodes[n.first + 1].min, top_nodes[n.first + 1].max);
+            continue;
+        }
+        for (int k = n.first; k < n.first + n.count; k++)
+        {
+            Vector3 min, max;
+            InstanceBounds(top_order[k], &min, &max);
+            GrowBox(&n, min, max);
+        }
+    }
+}
+
+void InstancedScene::Update()
+{
+    if (top_rebuild)
+    {
+        RebuildTop();
+    }
+    else if (top_refit)
+    {
+        RefitTop();
+    }
+    top_rebuild = false;
+    top_refit = false;
+}
+
+InstanceHit InstancedScene::ClosestHit(Ray r, float tmin, float tmax, BvhTraceCounters* counters) const
+{
+    InstanceHit closest = { -1, -1, INFINITY };
+    if (top_nodes.empty())
+    {
+        return closest;
+    }
+
+    Vector3 d = r.direction;
+    Vector3 inv_d = Vector3{ 1.0f / d.x, 1.0f / d.y, 1.0f / d.z };
+    int stack[BVH_STACK_SIZE];
+    int stack_size = 0;
+    if (BvhSlabEntry(top_nodes[0], d, inv_d, tmin, tmax) != INFINITY)
+    {
+        stack[stack_size++] = 0;
+    }
+    while (stack_size > 0)
+    {
+        const BvhNode& n = top_nodes[stack[--stack_size]];
+        counters->nodes_visited++;
+        if (n.count == 0)
+        {
+            float far = closest.t < tmax ? closest.t : tmax;
+            float t_left = BvhSlabEntry(top_nodes[n.first], d, inv_d, tmin, far);
+            float t_right = BvhSlabEntry(top_nodes[n.first + 1], d, inv_d, tmin, far);
+            int near_child = t_left <= t_right ? n.first : n.first + 1;
+            int far_child = t_left <= t_right ? n.first + 1 : n.first;
+            if ((t_left <= t_right ? t_right : t_left) != INFINITY)
+            {
+                stack[stack_size++] = far_child;
+            }
+            if ((t_left <= t_right ? t_left : t_right) != INFINITY)
+            {
+                stack[stack_size++] = near_child;
+            }
+            continue;
+        }
+
+        for (int k = n.first; k < n.first + n.count; k++)
+        {
+            int instance = top_order[k];
+            const SphereInstance& inst = instances[instance];
+            const InstanceTransform& transform = transforms[instance];
+            const SphereCluster& cluster = clusters[inst.cluster];
+            if (cluster.nodes.empty())
+            {
+                continue;
+            }
+
+            Vector3 o = Vector3Scale(Vector3RotateByQuaternion(Vector3Subtract(CAMERA_ORIGIN, inst.position), transform.inverse_rotation), transform.inverse_scale);
+            Vector3 ld = Vector3Scale(Vector3RotateByQuaternion(d, transform.inverse_rotation), transform.inverse_scale);
+            Vector3 inv_ld = Vector3{ 1.0f / ld.x, 1.0f / ld.y, 1.0f / ld.z };
+            float a = ld.x * ld.x + ld.y * ld.y + ld.z * ld.z;
+            float two_a = 2.0f * a;
+
+            // Whatever is already closer bounds this instance too.
+            RayHit local = { -1, closest.t };
+            int local_stack[BVH_STACK_SIZE];
+            int local_size = 0;
+            if (BvhSlabEntry(cluster.nodes[0], o, ld, inv_ld, tmin, local.t < tmax ? local.t : tmax) != INFINITY)
+            {
+                local_stack[local_size++] = 0;
+            }
+            while (local_size > 0)
+            {
+                const BvhNode& c = cluster.nodes[local_stack[--local_size]];
+                counters->nodes_visited++;
+                if (c.count > 0)
+                {
+                    for (int i = c.first; i < c.first + c.count; i++)
+                    {
+                        Vector3 co = Vector3Subtract(o, cluster.centers[i]);
+                        BvhSphere sp = { co, (co.x * co.x + co.y * co.y + co.z * co.z) - cluster.radii[i] * cluster.radii[i] };
+                        BvhTestSphere(sp, i, ld, a, two_a, tmin, tmax, &local);
+                    }
+                    counters->sphere_tests += c.count;
+                    continue;
+                }
+                float far = local.t < tmax ? local.t : tmax;
+                float t_left = BvhSlabEntry(cluster.nodes[c.first], o, ld, inv_ld, tmin, far);
+                float t_right = BvhSlabEntry(cluster.nodes[c.first + 1], o, ld, inv_ld, tmin, far);
+                int near_child = t_left <= t_right ? c.first : c.first + 1;
+                int far_child = t_left <= t_right ? c.first + 1 : c.first;
+                if ((t_left <= t_right ? t_right : t_left) != INFINITY)
+                {
+                    local_stack[local_size++] = far_child;
+                }
+                if ((t_left <= t_right ? t_left : t_right) != INFINITY)
+                {
+                    local_stack[local_size++] = near_child;
+                }
+            }
+            if (local.sphere >= 0)
+            {
+                closest = InstanceHit{ instance, cluster.sphere_ids[local.sphere], local.t };
+            }
+        }
+    }
+    return closest;
+}
+
+Color InstancedScene::HitColor(InstanceHit hit) const
+{
+    return hit.instance < 0 ? BACKGROUND_COLOR : clusters[instances[hit.instance].cluster].colors[hit.sphere];
+}
+
+void InstancedScene::Flatten(std::vector<Sphere>* spheres) const
+{
+    spheres->clear();
+    for (const SphereInstance& inst : instances)
+    {
+        const SphereCluster& cluster = clusters[inst.cluster];
+        size_t base = spheres->size();
+        spheres->resize(base + cluster.centers.size());
+        for (size_t i = 0; i < cluster.centers.size(); i++)
+        {
+            int id = cluster.sphere_ids[i];
+            Vector3 center = Vector3Add(inst.position, Vector3RotateByQuaternion(Vector3Scale(cluster.centers[i], inst.scale), inst.rotation));
+            (*spheres)[base + id] = Sphere{ center, cluster.radii[i] * inst.scale, cluster.colors[id] };
+        }
+    }
+}
+
+size_t InstancedScene::MemoryBytes() const
+{
+    size_t bytes = 0;
+    for (const SphereCluster& cluster : clusters)
+    {
+        bytes += cluster.nodes.size() * sizeof(BvhNode) + cluster.centers.size() * sizeof(Vector3) + cluster.radii.size() * sizeof(float) +
+            cluster.colors.size() * sizeof(Color) + cluster.sphere_ids.size() * sizeof(int);
+    }
+    bytes += instances.size() * (sizeof(SphereInstance) + sizeof(InstanceTransform));
+    bytes += top_nodes.size() * sizeof(BvhNode) + top_order.size() * sizeof(int);
+    return bytes;
+}
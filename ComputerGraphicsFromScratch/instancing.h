@@ -0,0 +1,99 @@
+/**********************************************************************************************
+*
+*   Instanced clusters of spheres (two-level BVH)
+*
+*   A cluster is a group of spheres in its own local space with its own BVH, the bottom level,
+*   built once when the cluster is added. An instance places a cluster in the world with a
+*   position, a rotation and a uniform scale. The top level is a BVH over the instances only,
+*   each bounded by the world box around its cluster's rotated root box.
+*
+*   A ray reaching an instance in the top level is carried into the cluster's space instead of
+*   the spheres being carried out of it:
+*       origin' = R^-1 (origin - position) / scale,   direction' = R^-1 direction / scale
+*   Both are divided by the same scale, so t along the local ray is t along the world ray and
+*   hits from different instances compare directly.
+*
+*   Memory grows with the spheres of the distinct clusters plus a fixed cost per instance, not
+*   with the spheres in the world. Moving an instance never touches a bottom level: the top
+*   level is refitted in place, and only rebuilt when instances are added.
+*
+**********************************************************************************************/
+
+#ifndef INSTANCING_H
+#define INSTANCING_H
+
+#include "bvh.h"
+#include <raymath.h>
+#include <vector>
+
+struct SphereCluster
+{
+    std::vector<BvhNode> nodes;     // local space, nodes[0] is the root
+    std::vector<Vector3> centers;   // local space, in leaf order
+    std::vector<float> radii;
+    std::vector<Color> colors;      // in the order the spheres were added
+    std::vector<int> sphere_ids;    // index in the spheres the cluster was added from
+};
+
+struct SphereInstance
+{
+    int cluster;
+    Vector3 position;
+    Quaternion rotation; // unit length
+    float scale;
+};
+
+struct InstanceHit
+{
+    int instance; // -1 for a miss
+    int sphere;   // index within the instance's cluster, as passed to AddCluster
+    float t;
+};
+
+class InstancedScene
+{
+public:
+    int AddCluster(const std::vector<Sphere>& spheres);
+    int AddInstance(const SphereInstance& instance);
+    void MoveInstance(int instance, Vector3 position, Quaternion rotation);
+
+    int ClusterCount() const { return (int)clusters.size(); }
+    int InstanceCount() const { return (int)instances.size(); }
+    const SphereCluster& GetCluster(int cluster) const { return clusters[cluster]; }
+    const SphereInstance& GetInstance(int instance) const { return instances[instance]; }
+
+    // Brings the top level up to date: rebuilt after AddInstance, refitted after MoveInstance.
+    void Update();
+
+    // Closest hit of a ray from CAMERA_ORIGIN. Needs Update() after any edit.
+    InstanceHit ClosestHit(Ray r, float tmin, float tmax, BvhTraceCounters* counters) const;
+
+    Color HitColor(InstanceHit hit) const;
+
+    // Every sphere of every instance in world space, for comparison with a flat scene.
+    void Flatten(std::vector<Sphere>* spheres) const;
+
+    size_t MemoryBytes() const;
+
+private:
+    // What a ray needs to enter an instance, kept next to the top level.
+    struct InstanceTransform
+    {
+        Quaternion inverse_rotation;
+        float inverse_scale;
+    };
+
+    std::vector<SphereCluster> clusters;
+    std::vector<SphereInstance> instances;
+    std::vector<InstanceTransform> transforms;
+    std::vector<BvhNode> top_nodes;
+    std::vector<int> top_order; // instance of every leaf entry of the top level
+    bool top_rebuild = false;
+    bool top_refit = false;
+
+    void InstanceBounds(int instance, Vector3* min, Vector3* max) const;
+    void RebuildTop();
+    void RefitTop();
+};
+
+#endif //INSTANCING_H
@@ -0,0 +1,271 @@
+#include "lighting.h"
+#include "bvh_cache.h"
+#include "parallel.h"
+#include "renderer.h"
+#include <math.h>
+#include <random>
+#include <raymath.h>
+
+std::vector<Light> lights(DEFAULT_LIGHTS, DEFAULT_LIGHTS + DEFAULT_LIGHT_COUNT);
+
+void GeneratePointLights(int count, unsigned int seed, std::vector<Light>* out)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    for (int i = 0; i < count; i++)
+    {
+        float z = LIGHT_GENERATED_NEAR + unit(rng) * (LIGHT_GENERATED_FAR - LIGHT_GENERATED_NEAR);
+        float x = (unit(rng) - 0.5f) * VIEWPORT_WIDTH / CAMERA_ORIGIN_DISTANCE * z;
+        float y = (unit(rng) - 0.5f) * VIEWPORT_HEIGHT / CAMERA_ORIGIN_DISTANCE * z;
+        out->push_back(Light{ LIGHT_POINT, LIGHT_GENERATED_INTENSITY, Vector3Add(CAMERA_ORIGIN, Vector3{ x, y, z }), LIGHT_GENERATED_RANGE });
+    }
+}
+
+void ResetShadowCache(ShadowCache* cache, int light_count)
+{
+    cache->last_occluder.assign(light_count, -1);
+}
+
+bool InShadow(const Bvh& bvh, const SceneSnapshot& source, Vector3 p, Vector3 l, float tmax, int light, ShadowCache* cache,
+    ShadowCounters* counters)
+{
+    counters->shadow_rays++;
+    if (cache != NULL && cache->last_occluder[light] >= 0)
+    {
+        float a = l.x * l.x + l.y * l.y + l.z * l.z;
+        counters->traversal.sphere_tests++;
+        if (BvhSphereBlocks(source.GetSphere(cache->last_occluder[light]), p, l, a, SHADOW_EPSILON, tmax))
+        {
+            counters->cache_hits++;
+            return true;
+        }
+    }
+    int occluder = -1;
+    if (!BvhAnyHit(bvh, source, Ray{ p, l }, SHADOW_EPSILON, tmax, &occluder, &counters->traversal))
+    {
+        return false;
+    }
+    if (cache != NULL)
+    {
+        cache->last_occluder[light] = occluder;
+    }
+    return true;
+}
+
+// Lights without a range reach every hit of the canvas.
+static bool LightHasRange(const Light& light)
+{
+    return light.type == LIGHT_POINT && light.range > 0.0f;
+}
+
+void CullLights(const RayHit* hits, TileLights* tiles)
+{
+    // Depth range of every tile's hits. Primary rays have direction.z == CAMERA_ORIGIN_DISTANCE,
+    // so a hit's depth is its t scaled by it.
+    ParallelFor(0, TILE_COUNT_Y, 4, [&](int, int begin, int end)
+    {
+        for (int ty = begin; ty < end; ty++)
+        {
+            for (int tx = 0; tx < TILE_COUNT_X; tx++)
+            {
+                float z_min = INFINITY;
+                float z_max = -INFINITY;
+                for (int row = ty * TILE_SIZE; row < (ty + 1) * TILE_SIZE; row++)
+                {
+                    for (int column = tx * TILE_SIZE; column < (tx + 1) * TILE_SIZE; column++)
+                    {
+                        const RayHit& hit = hits[row * CANVAS_WIDTH + column];
+                        if (hit.sphere >= 0)
+                        {
+                            z_min = fminf(z_min, hit.t * CAMERA_ORIGIN_DISTANCE);
+                            z_max = fmaxf(z_max, hit.t * CAMERA_ORIGIN_DISTANCE);
+                        }
+                    }
+                }
+                tiles->z_min[ty * TILE_COUNT_X + tx] = z_min;
+                tiles->z_max[ty * TILE_COUNT_X + tx] = z_max;
+            }
+        }
+    });
+
+    // A light reaches a hit only if the hit is inside its sphere of influence, so only if the
+    // pixel's ray meets that sphere, and only at a depth within its range of the light's.
+    // Bounds are worked out once, then counted and filled like BinSpheres.
+    int light_count = (int)lights.size();
+    std::vector<CanvasRect> bounds(light_count);
+    std::vector<unsigned char> on_screen(light_count);
+    for (int i = 0; i < light_count; i++)
+    {
+        const Light& light = lights[i];
+        if (!LightHasRange(light))
+        {
+            bounds[i] = CanvasRect{ -CANVAS_WIDTH / 2, -CANVAS_HEIGHT / 2, CANVAS_WIDTH / 2 - 1, CANVAS_HEIGHT / 2 - 1 };
+            on_screen[i] = 1;
+            continue;
+        }
+        on_screen[i] = SphereCanvasBounds(Sphere{ light.vector, light.range, WHITE }, &bounds[i]);
+    }
+    auto reaches = [&](int i, int tile)
+    {
+        if (tiles->z_min[tile] > tiles->z_max[tile])
+        {
+            return false;
+        }
+        if (!LightHasRange(lights[i]))
+        {
+            return true;
+        }
+        float z = lights[i].vector.z - CAMERA_ORIGIN.z;
+        return z - lights[i].range <= tiles->z_max[tile] && z + lights[i].range >= tiles->z_min[tile];
+    };
+
+    int counts[TILE_COUNT] = { 0 };
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (int i = 0; i < light_count; i++)
+        {
+            if (!on_screen[i])
+            {
+                continue;
+            }
+            int tx0 = (bounds[i].x0 + CANVAS_WIDTH / 2) / TILE_SIZE;
+            int tx1 = (bounds[i].x1 + CANVAS_WIDTH / 2) / TILE_SIZE;
+            int ty0 = (bounds[i].y0 + CANVAS_HEIGHT / 2) / TILE_SIZE;
+            int ty1 = (bounds[i].y1 + CANVAS_HEIGHT / 2) / TILE_SIZE;
+            for (int ty = ty0; ty <= ty1; ty++)
+            {
+                for (int tx = tx0; tx <= tx1; tx++)
+                {
+                    int tile = ty * TILE_COUNT_X + tx;
+                    if (!reaches(i, tile))
+                    {
+                        continue;
+                    }
+                    if (pass == 0)
+                    {
+                        counts[tile]++;
+                    }
+                    else
+                    {
+                        tiles->lights[counts[tile]++] = i;
+                    }
+                }
+            }
+        }
+        if (pass == 0)
+        {
+            tiles->first[0] = 0;
+            for (int t = 0; t < TILE_COUNT; t++)
+            {
+                tiles->first[t + 1] = tiles->first[t] + counts[t];
+                counts[t] = tiles->first[t];
+            }
+            tiles->lights.resize(tiles->first[TILE_COUNT]);
+        }
+    }
+}
+
+float ComputeLighting(const Bvh& bvh, const SceneSnapshot& source, Vector3 p, Vector3 n, const int* light_ids, int light_count, ShadowCache* cache,
+    ShadowCounters* counters)
+{
+    float intensity = 0.0f;
+    float n_length = sqrtf(n.x * n.x + n.y * n.y + n.z * n.z);
+    int count = light_ids == NULL ? (int)lights.size() : light_count;
+    for (int k = 0; k < count; k++)
+    {
+        int i = light_ids == NULL ? k : light_ids[k];
+        const Light& light = lights[i];
+        if (light.type == LIGHT_AMBIENT)
+        {
+            intensity += light.intensity;
+            continue;
+        }
+
+        // Point lights are reached at t = 1 along l, directional ones never.
+        Vector3 l = light.vector;
+        float tmax = INFINITY;
+        float falloff = 1.0f;
+        if (light.type == LIGHT_POINT)
+        {
+            l = Vector3{ light.vector.x - p.x, light.vector.y - p.y, light.vector.z - p.z };
+            tmax = 1.0f;
+            if (light.range > 0.0f)
+            {
+                // Smoothly down to exactly 0 at the range, so culling past it changes nothing.
+                float d2 = (l.x * l.x + l.y * l.y + l.z * l.z) / (light.range * light.range);
+                if (d2 >= 1.0f)
+                {
+                    continue;
+                }
+                falloff = (1.0f - d2) * (1.0f - d2);
+            }
+        }
+        float n_dot_l = n.x * l.x + n.y * l.y + n.z * l.z;
+        if (n_dot_l <= 0.0f || InShadow(bvh, source, p, l, tmax, i, cache, counters))
+        {
+            continue;
+        }
+        intensity += falloff * light.intensity * n_dot_l / (n_length * sqrtf(l.x * l.x + l.y * l.y + l.z * l.z));
+    }
+    return intensity;
+}
+
+Color ScaleColor(Color c, float intensity)
+{
+    return Color{ (unsigned char)fminf(c.r * intensity, 255.0f), (unsigned char)fminf(c.g * intensity, 255.0f),
+        (unsigned char)fminf(c.b * intensity, 255.0f), c.a };
+}
+
+void DrawSceneLit(Image* img, Bvh* bvh, TileLights* tiles)
+{
+    if (bvh->scene_version != frame_scene->version || bvh->builder != bvh_builder)
+    {
+        BuildBvhCached(bvh_builder, *frame_scene, bvh);
+    }
+
+    // Primary hits first, as culling needs every tile's depth range, then lighting.
+    static std::vector<RayHit> hits(CANVAS_WIDTH * CANVAS_HEIGHT);
+    static std::vector<int> tests(CANVAS_WIDTH * CANVAS_HEIGHT);
+    ParallelFor(0, CANVAS_HEIGHT, 8, [&](int, int begin, int end)
+    {
+        for (int row = begin; row < end; row++)
+        {
+            for (int column = 0; column < CANVAS_WIDTH; column++)
+            {
+                BvhTraceCounters counters = { 0 };
+                Vector2Int canvas_pos = { column - CANVAS_WIDTH / 2, row - CANVAS_HEIGHT / 2 };
+                hits[row * CANVAS_WIDTH + column] = BvhClosestHit(*bvh, CanvasRay(canvas_pos), 1.0f, INFINITY, &counters);
+                tests[row * CANVAS_WIDTH + column] = (int)counters.sphere_tests;
+            }
+        }
+    });
+
+    CullLights(hits.data(), tiles);
+
+    std::vector<ShadowCache> caches(WorkerCount());
+    for (ShadowCache& cache : caches)
+    {
+        ResetShadowCache(&cache, (int)lights.size());
+    }
+    DrawCanvasParallel(img, [&](int worker, Vector2Int canvas_pos, CanvasPixel* pixel)
+    {
+        int row = canvas_pos.y + CANVAS_HEIGHT / 2;
+        int column = canvas_pos.x + CANVAS_WIDTH / 2;
+        const RayHit& hit = hits[row * CANVAS_WIDTH + column];
+        int primary_tests = tests[row * CANVAS_WIDTH + column];
+        if (hit.sphere < 0)
+        {
+            *pixel = CanvasPixel{ hit, BACKGROUND_COLOR, primary_tests, 0 };
+            return;
+        }
+        ShadowCounters shadow = { 0 };
+        int tile = (row / TILE_SIZE) * TILE_COUNT_X + column / TILE_SIZE;
+        Ray r = CanvasRay(canvas_pos);
+        Sphere sp = frame_scene->GetSphere(hit.sphere);
+        Vector3 p = Vector3{ r.position.x + hit.t * r.direction.x, r.position.y + hit.t * r.direction.y, r.position.z + hit.t * r.direction.z };
+        Vector3 n = Vector3{ p.x - sp.center.x, p.y - sp.center.y, p.z - sp.center.z };
+        float intensity = ComputeLighting(*bvh, *frame_scene, p, n, tiles->lights.data() + tiles->first[tile],
+            tiles->first[tile + 1] - tiles->first[tile], &caches[worker], &shadow);
+        *pixel = CanvasPixel{ hit, ScaleColor(sp.color, intensity), primary_tests + (int)shadow.traversal.sphere_tests, (int)shadow.shadow_rays };
+    });
+}
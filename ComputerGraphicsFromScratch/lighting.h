@@ -0,0 +1,115 @@
+/**********************************************************************************************
+*
+*   Diffuse lighting with shadows
+*
+*   Chapter 3 and 4 lighting on top of the traced hits: an ambient term, and point and
+*   directional lights that count where N.L is positive and no sphere sits between the hit and
+*   the light. Every lit hit costs one shadow ray per light, so those soon outnumber primary rays.
+*   They only need a yes or no, and go through BvhAnyHit, which stops at the first sphere in the
+*   way.
+*
+*   Neighbouring pixels mostly see a light past the same sphere, so each worker keeps, for every
+*   light, the sphere that last blocked it, and tests that one before walking the tree: a lit
+*   region behind an occluder then costs one sphere test per light per pixel.
+*
+*   Point lights can be given a range past which they fade out, so a scene can hold thousands of
+*   small ones. Every frame, once the primary hits are in, each of those is binned into the
+*   screen tiles (see tile_binning.h) its sphere of influence covers and whose hits it can reach
+*   in depth, and hits are only shaded against their tile's list: the cost follows how many
+*   lights overlap a tile, not how many the scene holds.
+*
+**********************************************************************************************/
+
+#ifndef LIGHTING_H
+#define LIGHTING_H
+
+#include "bvh.h"
+#include "scene_snapshot.h"
+#include "tile_binning.h"
+#include <vector>
+
+// Shadow rays start this far along from the hit, so they don't find the sphere they leave.
+#define SHADOW_EPSILON 0.001f
+
+enum LightType
+{
+    LIGHT_AMBIENT,
+    LIGHT_POINT,
+    LIGHT_DIRECTIONAL
+};
+
+struct Light
+{
+    LightType type;
+    float intensity;
+    Vector3 vector; // point: position; directional: direction towards the light
+    float range;    // point: distance it fades out at, 0 for the book's lights that never do
+};
+
+constexpr Light DEFAULT_LIGHTS[] =
+{
+    Light{ LIGHT_AMBIENT, 0.2f, Vector3{ 0.0f, 0.0f, 0.0f }, 0.0f },
+    Light{ LIGHT_POINT, 0.6f, Vector3{ 2.0f, 1.0f, 0.0f }, 0.0f },
+    Light{ LIGHT_DIRECTIONAL, 0.2f, Vector3{ 1.0f, 4.0f, 4.0f }, 0.0f }
+};
+constexpr int DEFAULT_LIGHT_COUNT = sizeof(DEFAULT_LIGHTS) / sizeof(DEFAULT_LIGHTS[0]);
+
+// Lights of the scene, the defaults until replaced.
+extern std::vector<Light> lights;
+
+// Range, intensity and depths of generated point lights.
+#define LIGHT_GENERATED_RANGE 1.0f
+#define LIGHT_GENERATED_INTENSITY 0.5f
+#define LIGHT_GENERATED_NEAR 4.0f
+#define LIGHT_GENERATED_FAR 40.0f
+
+// Appends count small point lights scattered through the view, for --lights=<count>.
+void GeneratePointLights(int count, unsigned int seed, std::vector<Light>* out);
+
+struct ShadowCounters
+{
+    long long shadow_rays;
+    long long cache_hits; // rays answered by the cached occluder alone
+    BvhTraceCounters traversal;
+};
+
+// Last sphere that blocked each light, or -1. One per worker: it is read and written on every
+// shadow ray.
+struct ShadowCache
+{
+    std::vector<int> last_occluder;
+};
+
+void ResetShadowCache(ShadowCache* cache, int light_count);
+
+// Whether a sphere blocks the ray from p along l for t in [SHADOW_EPSILON, tmax], trying the
+// light's cached occluder first when cache is not NULL.
+bool InShadow(const Bvh& bvh, const SceneSnapshot& source, Vector3 p, Vector3 l, float tmax, int light, ShadowCache* cache,
+    ShadowCounters* counters);
+
+// Lights that may reach some hit of each tile, stored compactly like TileBins: tile i owns
+// lights[first[i] .. first[i+1]), in ascending order. Lights without a range are in every list.
+struct TileLights
+{
+    int first[TILE_COUNT + 1];
+    std::vector<int> lights;
+    float z_min[TILE_COUNT]; // depth range of the tile's hits, empty (z_min > z_max) without any
+    float z_max[TILE_COUNT];
+};
+
+// Bins the lights against the tiles, given the primary hits of the whole canvas, the hit of canvas
+// point (x, y) at (y + CANVAS_HEIGHT / 2) * CANVAS_WIDTH + x + CANVAS_WIDTH / 2.
+void CullLights(const RayHit* hits, TileLights* tiles);
+
+// Light intensity at p, on a surface with normal n, from the lights listed in light_ids, or all
+// of them when it is NULL.
+float ComputeLighting(const Bvh& bvh, const SceneSnapshot& source, Vector3 p, Vector3 n, const int* light_ids, int light_count, ShadowCache* cache,
+    ShadowCounters* counters);
+
+Color ScaleColor(Color c, float intensity);
+
+// Traces the canvas through a BVH of frame_scene, rebuilt whenever the snapshot changes, culls the
+// lights against its tiles and lights every hit, rows split across workers.
+void DrawSceneLit(Image* img, Bvh* bvh, TileLights* tiles);
+
+#endif //LIGHTING_H
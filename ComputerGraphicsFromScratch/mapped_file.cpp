@@ -0,0 +1,95 @@
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#	define WIN32_LEAN_AND_MEAN
+#endif // WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+bool OpenMappedFile(const char* path, MappedFile* mapped)
+{
+    *mapped = MappedFile{ NULL, NULL, 0 };
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+    LARGE_INTEGER size;
+    HANDLE mapping = GetFileSizeEx(file, &size) && size.QuadPart > 0 ? CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+    if (mapping == NULL)
+    {
+        CloseHandle(file);
+        return false;
+    }
+    *mapped = MappedFile{ file, mapping, (unsigned long long)size.QuadPart };
+    return true;
+}
+
+void CloseMappedFile(MappedFile* mapped)
+{
+    if (mapped->mapping != NULL)
+    {
+        CloseHandle(mapped->mapping);
+    }
+    if (mapped->file != NULL)
+    {
+        CloseHandle(mapped->file);
+    }
+    *mapped = MappedFile{ NULL, NULL, 0 };
+}
+
+const void* MapFileRange(const MappedFile& mapped, unsigned long long offset, size_t size)
+{
+    return MapViewOfFile(mapped.mapping, FILE_MAP_READ, (DWORD)(offset >> 32), (DWORD)(offset & 0xffffffffull), size);
+}
+
+void UnmapFileRange(const void* view, size_t size)
+{
+    UnmapViewOfFile(view);
+}
+
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// The descriptor is kept in file, offset by one so a zeroed MappedFile holds none.
+bool OpenMappedFile(const char* path, MappedFile* mapped)
+{
+    *mapped = MappedFile{ NULL, NULL, 0 };
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size <= 0)
+    {
+        close(fd);
+        return false;
+    }
+    *mapped = MappedFile{ (void*)(size_t)(fd + 1), NULL, (unsigned long long)info.st_size };
+    return true;
+}
+
+void CloseMappedFile(MappedFile* mapped)
+{
+    if (mapped->file != NULL)
+    {
+        close((int)(size_t)mapped->file - 1);
+    }
+    *mapped = MappedFile{ NULL, NULL, 0 };
+}
+
+const void* MapFileRange(const MappedFile& mapped, unsigned long long offset, size_t size)
+{
+    void* view = mmap(NULL, size, PROT_READ, MAP_SHARED, (int)(size_t)mapped.file - 1, (off_t)offset);
+    return view == MAP_FAILED ? NULL : view;
+}
+
+void UnmapFileRange(const void* view, size_t size)
+{
+    munmap((void*)view, size);
+}
+#endif // _WIN32
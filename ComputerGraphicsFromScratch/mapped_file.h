@@ -0,0 +1,34 @@
+/**********************************************************************************************
+*
+*   Read-only memory mapped files
+*
+*   Views of a file's ranges that the OS pages in on first touch and can drop again under
+*   memory pressure, without ever counting against the heap. Kept free of raylib so the
+*   platform headers it needs stay in its own translation unit.
+*
+**********************************************************************************************/
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <stddef.h>
+
+// Offsets of mapped ranges must be multiples of this (the allocation granularity on Windows,
+// a whole number of pages elsewhere).
+#define MAPPED_FILE_ALIGNMENT 65536
+
+struct MappedFile
+{
+    void* file;
+    void* mapping;
+    unsigned long long size;
+};
+
+bool OpenMappedFile(const char* path, MappedFile* mapped);
+void CloseMappedFile(MappedFile* mapped);
+
+// Maps size bytes from offset, which must be a multiple of MAPPED_FILE_ALIGNMENT. NULL on failure.
+const void* MapFileRange(const MappedFile& mapped, unsigned long long offset, size_t size);
+void UnmapFileRange(const void* view, size_t size);
+
+#endif //MAPPED_FILE_H
@@ -0,0 +1,704 @@
+#include "out_of_core_bvh.h"
+#include "bvh_cache.h"
+#include "parallel.h"
+#include "render_stats.h"
+#include "renderer.h"
+#include "tile_binning.h"
+#include "validation.h"
+#include <math.h>
+#include <queue>
+#include <stdio.h>
+#include <string.h>
+
+const char* out_of_core_path = "scene.treelets";
+size_t out_of_core_cap = (size_t)256 << 20;
+size_t out_of_core_build_budget = (size_t)1 << 30;
+OutOfCoreBvh out_of_core;
+
+// Streamed scenes are cut into slabs along the top OOC_BUCKET_BITS of their spheres' Morton codes.
+#define OOC_BUCKET_BITS 12
+#define OOC_BUCKET_COUNT (1 << OOC_BUCKET_BITS)
+
+// Bytes per sphere while a pass gathers its slabs, and while one slab's tree is built and laid
+// out: its centers, radii, colors and ids, the builder's order and nodes, and the folded spheres.
+#define OOC_GATHER_SPHERE_BYTES (sizeof(Sphere) + sizeof(int))
+#define OOC_BUILD_SPHERE_BYTES 128
+
+#define OOC_MIN_CHUNK 16384
+
+static const char OOC_MAGIC[8] = { 'C', 'G', 'F', 'S', 'T', 'R', 'E', 'E' };
+
+static float HalfArea(const BvhNode& n)
+{
+    float dx = n.max.x - n.min.x;
+    float dy = n.max.y - n.min.y;
+    float dz = n.max.z - n.min.z;
+    return dx * dy + dy * dz + dz * dx;
+}
+
+/***************************  Writing  ***************************/
+
+// Places the tree into treelets. Runs twice with the same decisions: first without a file, to
+// learn where every root lands, then writing blocks whose links point there. The tree's own links,
+// to treelets already written, are copied as they are.
+struct TreeletLayout
+{
+    const Bvh* bvh;
+    const Color* colors; // of bvh.spheres
+    int first_treelet;   // treelets in the file before these
+    std::vector<int> roots;        // source node of every subtree started in some treelet
+    std::vector<int> root_treelet; // where each of roots was placed
+    std::vector<int> root_node;
+    int treelet_count;
+};
+
+static bool LayoutTreelets(TreeletLayout* layout, FILE* out)
+{
+    struct Pending
+    {
+        float area;
+        int slot;
+        int source;
+        bool operator<(const Pending& other) const { return area < other.area; }
+    };
+
+    const Bvh& bvh = *layout->bvh;
+    const size_t root_cost = sizeof(BvhNode) + BVH_MAX_LEAF_SIZE * sizeof(OocSphere);
+    std::vector<unsigned char> block(OOC_TREELET_BYTES);
+    std::vector<BvhNode> nodes;
+    std::vector<OocSphere> spheres;
+    std::vector<int> links; // slots of the links made here
+    bool placing = out == NULL;
+    layout->roots.assign(1, 0);
+    if (placing)
+    {
+        layout->root_treelet.assign(1, -1);
+        layout->root_node.assign(1, -1);
+    }
+    layout->treelet_count = 0;
+    size_t next_root = 0;
+    while (next_root < layout->roots.size())
+    {
+        int treelet = layout->first_treelet + layout->treelet_count++;
+        nodes.clear();
+        spheres.clear();
+        links.clear();
+        size_t used = sizeof(OocTreeletHeader);
+
+        // Start pending roots while a node with a full leaf still fits.
+        while (next_root < layout->roots.size() && used + root_cost <= OOC_TREELET_BYTES)
+        {
+            int root = (int)next_root++;
+            if (placing)
+            {
+                layout->root_treelet[root] = treelet;
+                layout->root_node[root] = (int)nodes.size();
+            }
+            std::priority_queue<Pending> frontier;
+            frontier.push(Pending{ HalfArea(bvh.nodes[layout->roots[root]]), (int)nodes.size(), layout->roots[root] });
+            nodes.push_back(BvhNode{});
+            used += sizeof(BvhNode);
+
+            while (!frontier.empty())
+            {
+                Pending p = frontier.top();
+                frontier.pop();
+                const BvhNode& n = bvh.nodes[p.source];
+                if (n.count < 0)
+                {
+                    nodes[p.slot] = n;
+                    continue;
+                }
+                size_t cost = n.count > 0 ? n.count * sizeof(OocSphere) : 2 * sizeof(BvhNode);
+                if (used + cost > OOC_TREELET_BYTES)
+                {
+                    int link = (int)layout->roots.size();
+                    layout->roots.push_back(p.source);
+                    if (placing)
+                    {
+                        layout->root_treelet.push_back(-1);
+                        layout->root_node.push_back(-1);
+                    }
+                    nodes[p.slot] = BvhNode{ n.min, link, n.max, OOC_LINK_COUNT(0) };
+                    links.push_back(p.slot);
+                    continue;
+                }
+                used += cost;
+                if (n.count > 0)
+                {
+                    nodes[p.slot] = BvhNode{ n.min, (int)spheres.size(), n.max, n.count };
+                    for (int s = n.first; s < n.first + n.count; s++)
+                    {
+                        spheres.push_back(OocSphere{ bvh.spheres[s], bvh.sphere_ids[s], layout->colors[s] });
+                    }
+                    continue;
+                }
+                int child = (int)nodes.size();
+                nodes[p.slot] = BvhNode{ n.min, child, n.max, 0 };
+                nodes.push_back(BvhNode{});
+                nodes.push_back(BvhNode{});
+                frontier.push(Pending{ HalfArea(bvh.nodes[n.first]), child, n.first });
+                frontier.push(Pending{ HalfArea(bvh.nodes[n.first + 1]), child + 1, n.first + 1 });
+            }
+        }
+        if (placing)
+        {
+            continue;
+        }
+
+        // Links hold the index of their root until here; the first pass learned where it went.
+        for (int slot : links)
+        {
+            BvhNode& n = nodes[slot];
+            int link = n.first;
+            n.first = layout->root_treelet[link];
+            n.count = OOC_LINK_COUNT(layout->root_node[link]);
+        }
+        memset(block.data(), 0, block.size());
+        OocTreeletHeader header = { (int)nodes.size(), (int)spheres.size() };
+        memcpy(block.data(), &header, sizeof(header));
+        memcpy(block.data() + sizeof(header), nodes.data(), nodes.size() * sizeof(BvhNode));
+        memcpy(block.data() + sizeof(header) + nodes.size() * sizeof(BvhNode), spheres.data(), spheres.size() * sizeof(OocSphere));
+        if (fwrite(block.data(), 1, block.size(), out) != block.size())
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool WriteHeaderBlock(FILE* out, int treelet_count, int node_count, int sphere_count, int root_treelet, int root_node)
+{
+    std::vector<unsigned char> block(OOC_TREELET_BYTES, 0);
+    OocFileHeader header = {};
+    memcpy(header.magic, OOC_MAGIC, sizeof(OOC_MAGIC));
+    header.version = OOC_FILE_VERSION;
+    header.treelet_count = treelet_count;
+    header.node_count = node_count;
+    header.sphere_count = sphere_count;
+    header.root_treelet = root_treelet;
+    header.root_node = root_node;
+    memcpy(block.data(), &header, sizeof(header));
+    return fwrite(block.data(), 1, block.size(), out) == block.size();
+}
+
+bool WriteOutOfCoreBvh(const Bvh& bvh, const SceneSnapshot& source, const char* path)
+{
+    if (bvh.nodes.empty())
+    {
+        return false;
+    }
+    std::vector<Color> colors(bvh.spheres.size());
+    for (size_t s = 0; s < colors.size(); s++)
+    {
+        colors[s] = source.GetSphere(bvh.sphere_ids[s]).color;
+    }
+    TreeletLayout layout = { &bvh, colors.data(), 0 };
+    LayoutTreelets(&layout, NULL);
+
+    FILE* out = NULL;
+    if (fopen_s(&out, path, "wb") != 0 || out == NULL)
+    {
+        return false;
+    }
+    bool written = WriteHeaderBlock(out, layout.treelet_count, (int)bvh.nodes.size(), (int)bvh.spheres.size(), 0, 0) &&
+        LayoutTreelets(&layout, out);
+    return fclose(out) == 0 && written;
+}
+
+/***************************  Streaming  ***************************/
+
+struct OocBounds
+{
+    Vector3 min;
+    Vector3 max;
+};
+
+// A run of Morton buckets whose spheres get a tree of their own.
+struct OocSlab
+{
+    int bucket_begin;
+    int bucket_end;
+    int count;
+};
+
+static int OocBucket(Vector3 c, Vector3 lo, Vector3 scale)
+{
+    return (int)(MortonCode((c.x - lo.x) * scale.x, (c.y - lo.y) * scale.y, (c.z - lo.z) * scale.z) >> (30 - OOC_BUCKET_BITS));
+}
+
+// Builds a tree over one slab's spheres alone, as BuildBvh would over a scene of just them, and
+// appends it to out after the treelets already there. *link receives a link to its root.
+static bool AppendSlab(BvhBuilder builder, const Sphere* slab, const int* ids, int count, FILE* out, int* treelet_count, int* node_count,
+    BvhNode* link)
+{
+    std::vector<Vector3> centers(count);
+    std::vector<float> radii(count);
+    for (int i = 0; i < count; i++)
+    {
+        centers[i] = slab[i].center;
+        radii[i] = slab[i].radius;
+    }
+    std::vector<BvhNode> nodes;
+    std::vector<int> order;
+    BuildBvhNodes(builder, centers, radii, &nodes, &order);
+
+    // Folded with the same arithmetic as BuildBvh, so hits come out the same as through a tree of
+    // the whole scene.
+    std::vector<BvhSphere> spheres(count);
+    std::vector<int> sphere_ids(count);
+    std::vector<Color> colors(count);
+    ParallelFor(0, count, OOC_MIN_CHUNK, [&](int, int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            int k = order[i];
+            Vector3 co = Vector3{ CAMERA_ORIGIN.x - centers[k].x, CAMERA_ORIGIN.y - centers[k].y, CAMERA_ORIGIN.z - centers[k].z };
+            spheres[i] = BvhSphere{ co, (co.x * co.x + co.y * co.y + co.z * co.z) - radii[k] * radii[k] };
+            sphere_ids[i] = ids[k];
+            colors[i] = slab[k].color;
+        }
+    });
+    centers = std::vector<Vector3>();
+    radii = std::vector<float>();
+
+    Bvh bvh;
+    bvh.nodes.Own(std::move(nodes));
+    bvh.spheres.Own(std::move(spheres));
+    bvh.sphere_ids.Own(std::move(sphere_ids));
+    TreeletLayout layout = { &bvh, colors.data(), *treelet_count };
+    LayoutTreelets(&layout, NULL);
+    if (!LayoutTreelets(&layout, out))
+    {
+        return false;
+    }
+    *link = BvhNode{ bvh.nodes[0].min, layout.root_treelet[0], bvh.nodes[0].max, OOC_LINK_COUNT(layout.root_node[0]) };
+    *treelet_count += layout.treelet_count;
+    *node_count += (int)bvh.nodes.size();
+    return true;
+}
+
+// Binary tree over links [begin, end), split in the middle: the slabs are consecutive runs of the
+// Morton curve already, so halves of them are compact too.
+static void BuildSlabTree(const std::vector<BvhNode>& links, int node, int begin, int end, std::vector<BvhNode>* nodes)
+{
+    if (end - begin == 1)
+    {
+        (*nodes)[node] = links[begin];
+        return;
+    }
+    int left = (int)nodes->size();
+    nodes->resize(nodes->size() + 2);
+    int mid = begin + (end - begin) / 2;
+    BuildSlabTree(links, left, begin, mid, nodes);
+    BuildSlabTree(links, left + 1, mid, end, nodes);
+    const BvhNode& a = (*nodes)[left];
+    const BvhNode& b = (*nodes)[left + 1];
+    (*nodes)[node] = BvhNode{ Vector3{ fminf(a.min.x, b.min.x), fminf(a.min.y, b.min.y), fminf(a.min.z, b.min.z) }, left,
+        Vector3{ fmaxf(a.max.x, b.max.x), fmaxf(a.max.y, b.max.y), fmaxf(a.max.z, b.max.z) }, 0 };
+}
+
+bool WriteOutOfCoreScene(const SphereGenerator& source, BvhBuilder builder, const char* path, size_t budget)
+{
+    int count = source.Count();
+    if (count == 0)
+    {
+        return false;
+    }
+
+    // Bounds of the centers, for the Morton codes, quantized as the LBVH builder does.
+    std::vector<OocBounds> worker_bounds(WorkerCount());
+    int workers = ParallelFor(0, count, OOC_MIN_CHUNK, [&](int worker, int begin, int end)
+    {
+        OocBounds b = { Vector3{ INFINITY, INFINITY, INFINITY }, Vector3{ -INFINITY, -INFINITY, -INFINITY } };
+        for (int i = begin; i < end; i++)
+        {
+            Vector3 c = source.GetSphere(i).center;
+            b.min = Vector3{ fminf(b.min.x, c.x), fminf(b.min.y, c.y), fminf(b.min.z, c.z) };
+            b.max = Vector3{ fmaxf(b.max.x, c.x), fmaxf(b.max.y, c.y), fmaxf(b.max.z, c.z) };
+        }
+        worker_bounds[worker] = b;
+    });
+    OocBounds bounds = worker_bounds[0];
+    for (int w = 1; w < workers; w++)
+    {
+        const OocBounds& b = worker_bounds[w];
+        bounds.min = Vector3{ fminf(bounds.min.x, b.min.x), fminf(bounds.min.y, b.min.y), fminf(bounds.min.z, b.min.z) };
+        bounds.max = Vector3{ fmaxf(bounds.max.x, b.max.x), fmaxf(bounds.max.y, b.max.y), fmaxf(bounds.max.z, b.max.z) };
+    }
+    Vector3 scale;
+    scale.x = bounds.max.x > bounds.min.x ? 1023.0f / (bounds.max.x - bounds.min.x) : 0.0f;
+    scale.y = bounds.max.y > bounds.min.y ? 1023.0f / (bounds.max.y - bounds.min.y) : 0.0f;
+    scale.z = bounds.max.z > bounds.min.z ? 1023.0f / (bounds.max.z - bounds.min.z) : 0.0f;
+
+    // Spheres of every bucket in every worker's chunk. ParallelFor splits the same range the same
+    // way each time, so a later pass knows where each worker's spheres of a bucket go.
+    std::vector<int> worker_counts((size_t)workers * OOC_BUCKET_COUNT, 0);
+    ParallelFor(0, count, OOC_MIN_CHUNK, [&](int worker, int begin, int end)
+    {
+        int* counts = &worker_counts[(size_t)worker * OOC_BUCKET_COUNT];
+        for (int i = begin; i < end; i++)
+        {
+            counts[OocBucket(source.GetSphere(i).center, bounds.min, scale)]++;
+        }
+    });
+
+    // Slabs of consecutive buckets, as many spheres as half the budget builds a tree over; a
+    // bucket larger than that is a slab of its own. Passes gather as many slabs as fit the other half.
+    size_t slab_limit = budget / 2 / OOC_BUILD_SPHERE_BYTES > 0 ? budget / 2 / OOC_BUILD_SPHERE_BYTES : 1;
+    size_t pass_limit = budget / 2 / OOC_GATHER_SPHERE_BYTES > 0 ? budget / 2 / OOC_GATHER_SPHERE_BYTES : 1;
+    std::vector<OocSlab> slabs;
+    for (int b = 0; b < OOC_BUCKET_COUNT; b++)
+    {
+        int bucket_count = 0;
+        for (int w = 0; w < workers; w++)
+        {
+            bucket_count += worker_counts[(size_t)w * OOC_BUCKET_COUNT + b];
+        }
+        if (slabs.empty() || (slabs.back().count > 0 && (size_t)slabs.back().count + bucket_count > slab_limit))
+        {
+            slabs.push_back(OocSlab{ b, b, 0 });
+        }
+        slabs.back().bucket_end = b + 1;
+        slabs.back().count += bucket_count;
+    }
+
+    FILE* out = NULL;
+    if (fopen_s(&out, path, "wb") != 0 || out == NULL)
+    {
+        return false;
+    }
+    // The header goes first but is only known at the end; its block is filled in then.
+    bool written = WriteHeaderBlock(out, 0, 0, 0, 0, 0);
+    int treelet_count = 0;
+    int node_count = 0;
+    std::vector<BvhNode> links;
+    std::vector<Sphere> gathered;
+    std::vector<int> gathered_ids;
+    std::vector<int> next((size_t)workers * OOC_BUCKET_COUNT);
+    for (size_t first = 0; first < slabs.size() && written;)
+    {
+        size_t last = first + 1;
+        size_t total = (size_t)slabs[first].count;
+        while (last < slabs.size() && total + slabs[last].count <= pass_limit)
+        {
+            total += slabs[last++].count;
+        }
+        int bucket_begin = slabs[first].bucket_begin;
+        int bucket_end = slabs[last - 1].bucket_end;
+
+        // Bucket by bucket, worker by worker, so every slab's spheres are contiguous.
+        int offset = 0;
+        for (int b = bucket_begin; b < bucket_end; b++)
+        {
+            for (int w = 0; w < workers; w++)
+            {
+                next[(size_t)w * OOC_BUCKET_COUNT + b] = offset;
+                offset += worker_counts[(size_t)w * OOC_BUCKET_COUNT + b];
+            }
+        }
+        gathered.resize(total);
+        gathered_ids.resize(total);
+        ParallelFor(0, count, OOC_MIN_CHUNK, [&](int worker, int begin, int end)
+        {
+            int* slots = &next[(size_t)worker * OOC_BUCKET_COUNT];
+            for (int i = begin; i < end; i++)
+            {
+                Sphere sp = source.GetSphere(i);
+                int b = OocBucket(sp.center, bounds.min, scale);
+                if (b >= bucket_begin && b < bucket_end)
+                {
+                    int slot = slots[b]++;
+                    gathered[slot] = sp;
+                    gathered_ids[slot] = i;
+                }
+            }
+        });
+
+        int slab_begin = 0;
+        for (size_t slab = first; slab < last && written; slab++)
+        {
+            BvhNode link;
+            written = AppendSlab(builder, gathered.data() + slab_begin, gathered_ids.data() + slab_begin, slabs[slab].count, out, &treelet_count,
+                &node_count, &link);
+            links.push_back(link);
+            slab_begin += slabs[slab].count;
+        }
+        first = last;
+    }
+    gathered = std::vector<Sphere>();
+    gathered_ids = std::vector<int>();
+
+    // One slab is traced from its own root; more get a tree of links to theirs.
+    int root_treelet = links.empty() ? 0 : links[0].first;
+    int root_node = links.empty() ? 0 : OOC_LINK_NODE(links[0].count);
+    if (written && links.size() > 1)
+    {
+        std::vector<BvhNode> nodes(1);
+        BuildSlabTree(links, 0, 0, (int)links.size(), &nodes);
+        Bvh top;
+        top.nodes.Own(std::move(nodes));
+        TreeletLayout layout = { &top, NULL, treelet_count };
+        LayoutTreelets(&layout, NULL);
+        written = LayoutTreelets(&layout, out);
+        root_treelet = layout.root_treelet[0];
+        root_node = layout.root_node[0];
+        treelet_count += layout.treelet_count;
+        node_count += (int)top.nodes.size();
+    }
+    if (written)
+    {
+        rewind(out);
+        written = WriteHeaderBlock(out, treelet_count, node_count, count, root_treelet, root_node);
+    }
+    return fclose(out) == 0 && written;
+}
+
+/***************************  Tracing  ***************************/
+
+bool OutOfCoreBvh::Open(const char* path, size_t cap)
+{
+    Close();
+    if (!OpenMappedFile(path, &file))
+    {
+        return false;
+    }
+    const void* first = MapFileRange(file, 0, OOC_TREELET_BYTES);
+    if (first == NULL)
+    {
+        CloseMappedFile(&file);
+        return false;
+    }
+    OocFileHeader header;
+    memcpy(&header, first, sizeof(header));
+    UnmapFileRange(first, OOC_TREELET_BYTES);
+    if (memcmp(header.magic, OOC_MAGIC, sizeof(OOC_MAGIC)) != 0 || header.version != OOC_FILE_VERSION || header.treelet_count <= 0 ||
+        file.size != ((unsigned long long)header.treelet_count + 1) * OOC_TREELET_BYTES || header.root_treelet < 0 ||
+        header.root_treelet >= header.treelet_count || header.root_node < 0)
+    {
+        CloseMappedFile(&file);
+        return false;
+    }
+
+    treelets.assign(header.treelet_count, TreeletView{ NULL, 0 });
+    resident.clear();
+    resident_cap = cap / OOC_TREELET_BYTES > 0 ? (int)(cap / OOC_TREELET_BYTES) : 1;
+    root_treelet = header.root_treelet;
+    root_node = header.root_node;
+    return true;
+}
+
+void OutOfCoreBvh::Close()
+{
+    for (int treelet : resident)
+    {
+        UnmapFileRange(treelets[treelet].data, OOC_TREELET_BYTES);
+    }
+    resident.clear();
+    treelets.clear();
+    CloseMappedFile(&file);
+}
+
+const unsigned char* OutOfCoreBvh::Acquire(int treelet, OutOfCoreCounters* counters)
+{
+    TreeletView& view = treelets[treelet];
+    view.last_use = ++clock;
+    if (view.data != NULL)
+    {
+        return view.data;
+    }
+
+    if ((int)resident.size() >= resident_cap)
+    {
+        int oldest = 0;
+        for (int i = 1; i < (int)resident.size(); i++)
+        {
+            if (treelets[resident[i]].last_use < treelets[resident[oldest]].last_use)
+            {
+                oldest = i;
+            }
+        }
+        UnmapFileRange(treelets[resident[oldest]].data, OOC_TREELET_BYTES);
+        treelets[resident[oldest]].data = NULL;
+        resident[oldest] = resident.back();
+        resident.pop_back();
+        counters->treelet_evictions++;
+    }
+    view.data = (const unsigned char*)MapFileRange(file, ((unsigned long long)treelet + 1) * OOC_TREELET_BYTES, OOC_TREELET_BYTES);
+    if (view.data != NULL)
+    {
+        resident.push_back(treelet);
+        counters->treelet_maps++;
+    }
+    return view.data;
+}
+
+RayHit OutOfCoreBvh::ClosestHit(Ray r, float tmin, float tmax, Color* color, OutOfCoreCounters* counters)
+{
+    RayHit closest = { -1, INFINITY };
+    *color = BACKGROUND_COLOR;
+    if (treelets.empty())
+    {
+        return closest;
+    }
+
+    Vector3 d = r.direction;
+    float a = d.x * d.x + d.y * d.y + d.z * d.z;
+    float two_a = 2.0f * a;
+    Vector3 inv_d = Vector3{ 1.0f / d.x, 1.0f / d.y, 1.0f / d.z };
+
+    // A link and the root it leads to repeat the same bounds, so a path can be twice as deep.
+    struct StackEntry
+    {
+        int treelet;
+        int node;
+    };
+    StackEntry stack[2 * BVH_STACK_SIZE];
+    int stack_size = 0;
+    stack[stack_size++] = StackEntry{ root_treelet, root_node };
+    bool root = true;
+    while (stack_size > 0)
+    {
+        StackEntry entry = stack[--stack_size];
+        const unsigned char* data = Acquire(entry.treelet, counters);
+        if (data == NULL)
+        {
+            continue;
+        }
+        const BvhNode* nodes = (const BvhNode*)(data + sizeof(OocTreeletHeader));
+        const BvhNode& n = nodes[entry.node];
+        if (root)
+        {
+            root = false;
+            if (BvhSlabEntry(n, d, inv_d, tmin, tmax) == INFINITY)
+            {
+                break;
+            }
+        }
+        counters->nodes_visited++;
+        if (n.count < 0)
+        {
+            stack[stack_size++] = StackEntry{ n.first, OOC_LINK_NODE(n.count) };
+            continue;
+        }
+        if (n.count > 0)
+        {
+            const OocTreeletHeader* header = (const OocTreeletHeader*)data;
+            const OocSphere* spheres = (const OocSphere*)(nodes + header->node_count);
+            for (int i = n.first; i < n.first + n.count; i++)
+            {
+                float before = closest.t;
+                BvhTestSphere(spheres[i].sphere, spheres[i].id, d, a, two_a, tmin, tmax, &closest);
+                if (closest.t != before)
+                {
+                    *color = spheres[i].color;
+                }
+            }
+            counters->sphere_tests += n.count;
+            continue;
+        }
+
+        // As in BvhClosestHit: only children entered before the closest hit, the nearer one last.
+        float far = closest.t < tmax ? closest.t : tmax;
+        float t_left = BvhSlabEntry(nodes[n.first], d, inv_d, tmin, far);
+        float t_right = BvhSlabEntry(nodes[n.first + 1], d, inv_d, tmin, far);
+        int near_child = t_left <= t_right ? n.first : n.first + 1;
+        int far_child = t_left <= t_right ? n.first + 1 : n.first;
+        if ((t_left <= t_right ? t_right : t_left) != INFINITY)
+        {
+            stack[stack_size++] = StackEntry{ entry.treelet, far_child };
+        }
+        if ((t_left <= t_right ? t_left : t_right) != INFINITY)
+        {
+            stack[stack_size++] = StackEntry{ entry.treelet, near_child };
+        }
+    }
+    return closest;
+}
+
+/***************************  Rendering  ***************************/
+
+void HilbertTileOrder(std::vector<int>* tiles)
+{
+    int side = 1;
+    while (side < TILE_COUNT_X || side < TILE_COUNT_Y)
+    {
+        side *= 2;
+    }
+    tiles->clear();
+    for (int i = 0; i < side * side; i++)
+    {
+        // Walks the curve's index two bits at a time from the finest level up (Hilbert's d2xy).
+        int x = 0;
+        int y = 0;
+        for (int s = 1, t = i; s < side; s *= 2, t /= 4)
+        {
+            int rx = 1 & (t / 2);
+            int ry = 1 & (t ^ rx);
+            if (ry == 0)
+            {
+                if (rx == 1)
+                {
+                    x = s - 1 - x;
+                    y = s - 1 - y;
+                }
+                int swap = x;
+                x = y;
+                y = swap;
+            }
+            x += s * rx;
+            y += s * ry;
+        }
+        if (x < TILE_COUNT_X && y < TILE_COUNT_Y)
+        {
+            tiles->push_back(y * TILE_COUNT_X + x);
+        }
+    }
+}
+
+void DrawSceneOutOfCore(Image* img, Bvh* bvh, OutOfCoreBvh* ooc)
+{
+    if (ooc->failed)
+    {
+        return;
+    }
+    bool stale = bvh->scene_version != frame_scene->version || bvh->builder != bvh_builder || !ooc->IsOpen();
+    if (scene_storage != STORAGE_TREELETS && stale)
+    {
+        ooc->Close();
+        BuildBvhCached(bvh_builder, *frame_scene, bvh);
+        if (!WriteOutOfCoreBvh(*bvh, *frame_scene, out_of_core_path) || !ooc->Open(out_of_core_path, out_of_core_cap))
+        {
+            TraceLog(LOG_WARNING, "Could not write treelets to '%s', turning the out of core mode off", out_of_core_path);
+            ooc->failed = true;
+            return;
+        }
+    }
+
+    static std::vector<int> tiles;
+    if (tiles.empty())
+    {
+        HilbertTileOrder(&tiles);
+    }
+    OutOfCoreCounters counters = { 0 };
+    for (int tile : tiles)
+    {
+        CanvasRect rect = TileCanvasRect(tile % TILE_COUNT_X, tile / TILE_COUNT_X);
+        for (int y = rect.y0; y <= rect.y1; y++)
+        {
+            for (int x = rect.x0; x <= rect.x1; x++)
+            {
+                Vector2Int canvas_pos = { x,y };
+                long long tests_before = counters.sphere_tests;
+                Color col;
+                RayHit hit = ooc->ClosestHit(CanvasRay(canvas_pos), 1.0f, INFINITY, &col, &counters);
+                CaptureHit(x, y, hit);
+                render_stats.primary_rays++;
+                canvas_pos = CanvasToScreen(canvas_pos);
+                RecordPixelCost(canvas_pos.x, canvas_pos.y, (int)(counters.sphere_tests - tests_before));
+                SetPixel(img, canvas_pos.x, canvas_pos.y, col);
+            }
+        }
+    }
+    render_stats.intersection_tests += counters.sphere_tests;
+}
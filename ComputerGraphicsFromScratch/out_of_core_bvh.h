@@ -0,0 +1,143 @@
+/**********************************************************************************************
+*
+*   Out-of-core BVH in page-aligned treelets
+*
+*   Lays a BVH out on disk as treelets: connected pieces of the tree that each fill one
+*   OOC_TREELET_BYTES block, together with every sphere their leaves reference. A treelet is
+*   grown from its root by always expanding the pending node with the largest surface, the one
+*   a random ray most likely enters next, until the block is full. Children that did not fit
+*   become links, nodes that only hold the bounds of a subtree rooted elsewhere. Once a root's
+*   whole subtree is in, the block takes the next pending root, so small subtrees share blocks.
+*
+*   Tracing maps treelets on first use and unmaps the least recently used one whenever more than
+*   the resident cap are mapped, so only the part of the scene the current rays touch takes up
+*   memory. Tiles are traced along a Hilbert curve: neighbouring tiles see mostly the same
+*   geometry, so the treelets one tile mapped are usually still resident for the next.
+*
+*   The out of core render mode writes frame_scene's tree, built in memory (see bvh.h), so it
+*   only shows the tracing side. With --storage=treelets the file is the scene's storage instead
+*   and no Scene or Bvh is ever resident. A --scene is streamed into it from its generator (see
+*   procedural_scene.h): one pass bins the spheres' Morton codes, cutting the scene into slabs
+*   of consecutive codes small enough to build in --ooc-build-mb=<n>, then each later pass
+*   collects as many slabs as fit, builds a tree over each alone and appends its treelets. A
+*   small tree over the slabs' roots goes last, and the header says where it starts. Without a
+*   --scene, the file already at --ooc-file is opened as it is. Tracing needs no more than the
+*   resident cap either way, however many spheres the file holds.
+*
+**********************************************************************************************/
+
+#ifndef OUT_OF_CORE_BVH_H
+#define OUT_OF_CORE_BVH_H
+
+#include "bvh.h"
+#include "mapped_file.h"
+#include "procedural_scene.h"
+#include <vector>
+
+#define OOC_TREELET_BYTES MAPPED_FILE_ALIGNMENT
+#define OOC_FILE_VERSION 2
+
+// A node with a negative count is a link: its subtree's root is node OOC_LINK_NODE(count) of
+// treelet first.
+#define OOC_LINK_COUNT(node) (-1 - (node))
+#define OOC_LINK_NODE(count) (-1 - (count))
+
+// Path the out of core render mode writes frame_scene's treelets to, set with --ooc-file=<path>.
+extern const char* out_of_core_path;
+
+// Bytes of treelets the out of core render mode keeps mapped, set with --ooc-cap-mb=<n>.
+extern size_t out_of_core_cap;
+
+// Bytes WriteOutOfCoreScene may hold while streaming a scene into treelets, set with
+// --ooc-build-mb=<n>.
+extern size_t out_of_core_build_budget;
+
+struct OocFileHeader
+{
+    char magic[8];
+    int version;
+    int treelet_count;
+    int node_count;
+    int sphere_count;
+    int root_treelet; // where tracing starts
+    int root_node;
+};
+
+// Leaves' first and interior nodes' first both index the same treelet.
+struct OocTreeletHeader
+{
+    int node_count;
+    int sphere_count;
+    int reserved[6]; // keeps the nodes after it 32-byte aligned
+};
+
+struct OocSphere
+{
+    BvhSphere sphere;
+    int id; // dense scene index
+    Color color;
+};
+
+struct OutOfCoreCounters
+{
+    long long nodes_visited;
+    long long sphere_tests;
+    long long treelet_maps;      // treelets mapped, first uses and re-maps after eviction alike
+    long long treelet_evictions;
+};
+
+// Writes bvh as treelets, with the colors of source's spheres. False if the file can't be written.
+bool WriteOutOfCoreBvh(const Bvh& bvh, const SceneSnapshot& source, const char* path);
+
+// Streams source's spheres into treelets through trees of builder, holding about budget bytes at
+// most whatever the count, unless 1/4096th of the Morton curve alone holds more than that; ids are
+// the generator's indices. False if the file can't be written.
+bool WriteOutOfCoreScene(const SphereGenerator& source, BvhBuilder builder, const char* path, size_t budget);
+
+class OutOfCoreBvh
+{
+public:
+    ~OutOfCoreBvh() { Close(); }
+
+    bool Open(const char* path, size_t resident_cap);
+    void Close();
+    bool IsOpen() const { return file.file != NULL; }
+    int TreeletCount() const { return (int)treelets.size(); }
+    int ResidentCount() const { return (int)resident.size(); }
+
+    // Closest hit, with the same arithmetic per sphere as ClosestHit; *color is the hit sphere's.
+    RayHit ClosestHit(Ray r, float tmin, float tmax, Color* color, OutOfCoreCounters* counters);
+
+    // Set once writing or opening the render mode's file failed, which then isn't tried again.
+    bool failed = false;
+
+private:
+    struct TreeletView
+    {
+        const unsigned char* data; // NULL while not mapped
+        unsigned long long last_use;
+    };
+
+    MappedFile file = {};
+    std::vector<TreeletView> treelets;
+    std::vector<int> resident;
+    int resident_cap = 1;
+    int root_treelet = 0;
+    int root_node = 0;
+    unsigned long long clock = 0;
+
+    const unsigned char* Acquire(int treelet, OutOfCoreCounters* counters);
+};
+
+// Canvas tiles in the order of a Hilbert curve over the tile grid.
+void HilbertTileOrder(std::vector<int>* tiles);
+
+// The out of core render mode's file: frame_scene's, or with --storage=treelets the scene's only copy.
+extern OutOfCoreBvh out_of_core;
+
+// Writes frame_scene's BVH to out_of_core_path whenever the snapshot changes, unless the file is
+// the scene's storage, then traces the canvas tile by tile through it with at most
+// out_of_core_cap bytes of it mapped. Draws nothing once writing or opening it has failed.
+void DrawSceneOutOfCore(Image* img, Bvh* bvh, OutOfCoreBvh* ooc);
+
+#endif //OUT_OF_CORE_BVH_H
@@ -0,0 +1,160 @@
+#include "packet_bvh.h"
+#include "bvh_cache.h"
+#include "render_stats.h"
+#include "validation.h"
+#include <math.h>
+#include <raymath.h>
+
+void BuildTilePacket(int tile_x, int tile_y, RayPacket* packet)
+{
+    packet->rect = TileCanvasRect(tile_x, tile_y);
+    packet->beam = BuildBeam(packet->rect);
+    int i = 0;
+    for (int y = packet->rect.y0; y <= packet->rect.y1; y++)
+    {
+        for (int x = packet->rect.x0; x <= packet->rect.x1; x++)
+        {
+            Vector3 d = CanvasRay(Vector2Int{ x, y }).direction;
+            packet->direction[i] = d;
+            packet->inv_direction[i] = Vector3{ 1.0f / d.x, 1.0f / d.y, 1.0f / d.z };
+            i++;
+        }
+    }
+}
+
+// False only if the box lies entirely outside one of the beam's side planes: its corner furthest
+// along the inward normal is behind it, by more than rounding could account for.
+static bool BeamMayHitBox(const Beam& beam, const BvhNode& n)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        Vector3 normal = beam.side_normals[i];
+        Vector3 p = Vector3{ (normal.x >= 0.0f ? n.max.x : n.min.x) - CAMERA_ORIGIN.x, (normal.y >= 0.0f ? n.max.y : n.min.y) - CAMERA_ORIGIN.y,
+            (normal.z >= 0.0f ? n.max.z : n.min.z) - CAMERA_ORIGIN.z };
+        if (Vector3DotProduct(normal, p) < -1e-5f * (fabsf(p.x) + fabsf(p.y) + fabsf(p.z)))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool RayEntersNode(const RayPacket& packet, int i, const BvhNode& n, float tmin, float tmax)
+{
+    float far = packet.hits[i].t < tmax ? packet.hits[i].t : tmax;
+    return BvhSlabEntry(n, packet.direction[i], packet.inv_direction[i], tmin, far) != INFINITY;
+}
+
+void TracePacket(const Bvh& bvh, RayPacket* packet, float tmin, float tmax, PacketTraceCounters* counters)
+{
+    for (int i = 0; i < PACKET_RAYS; i++)
+    {
+        packet->hits[i] = RayHit{ -1, INFINITY };
+        packet->sphere_tests[i] = 0;
+    }
+    if (bvh.nodes.empty())
+    {
+        return;
+    }
+
+    struct StackEntry
+    {
+        int node;
+        int first;
+        int last;
+    };
+    StackEntry stack[BVH_STACK_SIZE];
+    int stack_size = 0;
+    stack[stack_size++] = StackEntry{ 0, 0, PACKET_RAYS - 1 };
+    Vector3 axis = packet->beam.axis;
+    while (stack_size > 0)
+    {
+        StackEntry entry = stack[--stack_size];
+        const BvhNode& n = bvh.nodes[entry.node];
+        counters->node_fetches++;
+        if (!BeamMayHitBox(packet->beam, n))
+        {
+            counters->frustum_culls++;
+            continue;
+        }
+
+        int first = entry.first;
+        while (first <= entry.last && !RayEntersNode(*packet, first, n, tmin, tmax))
+        {
+            first++;
+        }
+        counters->ray_box_tests += first - entry.first + (first <= entry.last ? 1 : 0);
+        if (first > entry.last)
+        {
+            continue;
+        }
+        int last = entry.last;
+        while (last > first && !RayEntersNode(*packet, last, n, tmin, tmax))
+        {
+            last--;
+        }
+        counters->ray_box_tests += entry.last - last + (last > first ? 1 : 0);
+
+        if (n.count > 0)
+        {
+            for (int i = first; i <= last; i++)
+            {
+                Vector3 d = packet->direction[i];
+                float a = d.x * d.x + d.y * d.y + d.z * d.z;
+                float two_a = 2.0f * a;
+                for (int s = n.first; s < n.first + n.count; s++)
+                {
+                    BvhTestSphere(bvh.spheres[s], bvh.sphere_ids[s], d, a, two_a, tmin, tmax, &packet->hits[i]);
+                }
+                packet->sphere_tests[i] += n.count;
+            }
+            counters->sphere_tests += (long long)(last - first + 1) * n.count;
+            continue;
+        }
+
+        // Nearer child along the beam's axis first.
+        const BvhNode& left = bvh.nodes[n.first];
+        const BvhNode& right = bvh.nodes[n.first + 1];
+        float left_depth = Vector3DotProduct(axis, Vector3Add(left.min, left.max));
+        float right_depth = Vector3DotProduct(axis, Vector3Add(right.min, right.max));
+        int near_child = left_depth <= right_depth ? n.first : n.first + 1;
+        stack[stack_size++] = StackEntry{ near_child == n.first ? n.first + 1 : n.first, first, last };
+        stack[stack_size++] = StackEntry{ near_child, first, last };
+    }
+}
+
+void DrawSceneBvhPackets(Image* img, Bvh* bvh)
+{
+    if (bvh->scene_version != frame_scene->version || bvh->builder != bvh_builder)
+    {
+        BuildBvhCached(bvh_builder, *frame_scene, bvh);
+    }
+
+    static RayPacket packet;
+    PacketTraceCounters counters = { 0 };
+    for (int tile_y = 0; tile_y < TILE_COUNT_Y; tile_y++)
+    {
+        for (int tile_x = 0; tile_x < TILE_COUNT_X; tile_x++)
+        {
+            BuildTilePacket(tile_x, tile_y, &packet);
+            TracePacket(*bvh, &packet, 1.0f, INFINITY, &counters);
+
+            int i = 0;
+            for (int y = packet.rect.y0; y <= packet.rect.y1; y++)
+            {
+                for (int x = packet.rect.x0; x <= packet.rect.x1; x++)
+                {
+                    RayHit hit = packet.hits[i];
+                    Color col = hit.sphere < 0 ? BACKGROUND_COLOR : frame_scene->GetSphere(hit.sphere).color;
+                    CaptureHit(x, y, hit);
+                    Vector2Int screen = CanvasToScreen(Vector2Int{ x, y });
+                    RecordPixelCost(screen.x, screen.y, packet.sphere_tests[i]);
+                    SetPixel(img, screen.x, screen.y, col);
+                    i++;
+                }
+            }
+            render_stats.primary_rays += PACKET_RAYS;
+        }
+    }
+    render_stats.intersection_tests += counters.sphere_tests;
+}
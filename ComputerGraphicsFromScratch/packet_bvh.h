@@ -0,0 +1,52 @@
+/**********************************************************************************************
+*
+*   Packet traversal of the BVH for primary rays
+*
+*   The rays of a tile walk the hierarchy together. A node is first tested against the tile's
+*   beam (see BuildBeam): if the box lies outside one of its side planes, no ray of the packet
+*   can enter it, and it is rejected with a single test for all of them.
+*
+*   Otherwise the packet keeps a range [first, last] of rays still worth tracing below the node.
+*   The range is narrowed from both ends to the first and last rays that actually enter the box
+*   before their closest hit, so rays drop out as the packet spreads over smaller boxes than it
+*   covers, and those that already found something nearer stop pulling the rest along. While the
+*   packet stays coherent, a node costs one fetch and two ray tests for the whole tile.
+*
+**********************************************************************************************/
+
+#ifndef PACKET_BVH_H
+#define PACKET_BVH_H
+
+#include "bvh.h"
+#include "tile_binning.h"
+
+#define PACKET_RAYS (TILE_SIZE * TILE_SIZE)
+
+// Primary rays of one tile, row by row from its top-left pixel.
+struct RayPacket
+{
+    CanvasRect rect;
+    Beam beam;
+    Vector3 direction[PACKET_RAYS];
+    Vector3 inv_direction[PACKET_RAYS];
+    RayHit hits[PACKET_RAYS];
+    int sphere_tests[PACKET_RAYS];
+};
+
+struct PacketTraceCounters
+{
+    long long node_fetches;   // nodes visited by a packet, once for all its rays
+    long long frustum_culls;  // of those, rejected by the beam alone
+    long long ray_box_tests;  // slab tests of single rays while narrowing ranges
+    long long sphere_tests;
+};
+
+void BuildTilePacket(int tile_x, int tile_y, RayPacket* packet);
+
+// Fills packet->hits with the closest hit of every ray.
+void TracePacket(const Bvh& bvh, RayPacket* packet, float tmin, float tmax, PacketTraceCounters* counters);
+
+// Traces the canvas tile by tile through a BVH of frame_scene, rebuilt whenever the snapshot changes.
+void DrawSceneBvhPackets(Image* img, Bvh* bvh);
+
+#endif //PACKET_BVH_H
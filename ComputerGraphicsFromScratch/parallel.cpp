@@ -0,0 +1,109 @@
+#include "parallel.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+int worker_count_override = 0;
+
+// Set on the pool's threads, whose own ParallelFors can't wait for the pool they are part of.
+static thread_local bool on_pool_thread = false;
+
+// Threads 1 .. N-1 of the largest ParallelFor so far, each waiting for the next generation's job.
+class WorkerPool
+{
+public:
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& t : threads)
+        {
+            t.join();
+        }
+    }
+
+    bool Run(int workers, void (*call)(void* context, int worker), void* context)
+    {
+        bool idle = false;
+        if (on_pool_thread || !busy.compare_exchange_strong(idle, true))
+        {
+            return false;
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            while ((int)threads.size() < workers - 1)
+            {
+                threads.emplace_back(&WorkerPool::Work, this, (int)threads.size() + 1, generation);
+            }
+            job_call = call;
+            job_context = context;
+            job_workers = workers;
+            remaining = workers - 1;
+            generation++;
+        }
+        wake.notify_all();
+
+        call(context, 0);
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            done.wait(guard, [this]() { return remaining == 0; });
+        }
+        busy.store(false);
+        return true;
+    }
+
+private:
+    void Work(int worker, unsigned long long seen)
+    {
+        on_pool_thread = true;
+        for (;;)
+        {
+            void (*call)(void*, int);
+            void* context;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                wake.wait(guard, [&]() { return stopping || generation != seen; });
+                if (stopping)
+                {
+                    return;
+                }
+                seen = generation;
+                if (worker >= job_workers)
+                {
+                    continue;
+                }
+                call = job_call;
+                context = job_context;
+            }
+
+            call(context, worker);
+            std::lock_guard<std::mutex> guard(lock);
+            if (--remaining == 0)
+            {
+                done.notify_one();
+            }
+        }
+    }
+
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::vector<std::thread> threads;
+    std::atomic<bool> busy{ false };
+    bool stopping = false;
+    unsigned long long generation = 0;
+    void (*job_call)(void*, int) = NULL;
+    void* job_context = NULL;
+    int job_workers = 0;
+    int remaining = 0;                 // pool threads still running the job
+};
+
+bool RunOnWorkerPool(int workers, void (*call)(void* context, int worker), void* context)
+{
+    static WorkerPool pool;
+    return pool.Run(workers, call, context);
+}
@@ -0,0 +1,91 @@
+/**********************************************************************************************
+*
+*   Minimal fork-join helpers
+*
+*   ParallelFor splits a range into one contiguous chunk per worker, the calling thread taking
+*   the first chunk. The other chunks go to a pool of threads started on first use and kept for
+*   the life of the process, so a pass costs a wake-up rather than a thread start per worker:
+*   builds that run several short passes a frame, like the spatial hash grid's, would otherwise
+*   spend much of their time starting threads. A ParallelFor called while the pool is busy, from
+*   inside another one's body or from a second thread, runs its chunks on threads of its own as
+*   before instead of waiting for it.
+*
+**********************************************************************************************/
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <thread>
+#include <vector>
+
+// Workers every ParallelFor splits its range between, set with --workers=<count>; 0 for one per
+// hardware thread.
+extern int worker_count_override;
+
+inline int WorkerCount()
+{
+    if (worker_count_override > 0)
+    {
+        return worker_count_override;
+    }
+    unsigned int count = std::thread::hardware_concurrency();
+    return count > 0 ? (int)count : 1;
+}
+
+// Runs call(context, w) for w in [1, workers) on the pool, and call(context, 0) on this thread,
+// returning when all are done. Returns false, having run nothing, if the pool is in use.
+bool RunOnWorkerPool(int workers, void (*call)(void* context, int worker), void* context);
+
+// Calls body(worker, chunk_begin, chunk_end) for each worker's share of [begin, end). Ranges
+// shorter than min_chunk per worker use fewer workers, down to running inline.
+template <typename F>
+inline int ParallelFor(int begin, int end, int min_chunk, F body)
+{
+    int count = end - begin;
+    int workers = WorkerCount();
+    if (min_chunk > 0 && count / min_chunk < workers)
+    {
+        workers = count / min_chunk > 1 ? count / min_chunk : 1;
+    }
+    if (workers <= 1)
+    {
+        body(0, begin, end);
+        return 1;
+    }
+
+    struct Chunks
+    {
+        F* body;
+        int begin;
+        int count;
+        int workers;
+
+        static void Run(void* context, int w)
+        {
+            Chunks* c = (Chunks*)context;
+            int chunk_begin = c->begin + (int)((long long)c->count * w / c->workers);
+            int chunk_end = c->begin + (int)((long long)c->count * (w + 1) / c->workers);
+            (*c->body)(w, chunk_begin, chunk_end);
+        }
+    };
+    Chunks chunks = { &body, begin, count, workers };
+    if (RunOnWorkerPool(workers, Chunks::Run, &chunks))
+    {
+        return workers;
+    }
+
+    std::vector<std::thread> threads;
+    threads.reserve(workers - 1);
+    for (int w = 1; w < workers; w++)
+    {
+        threads.emplace_back(Chunks::Run, &chunks, w);
+    }
+    Chunks::Run(&chunks, 0);
+    for (std::thread& t : threads)
+    {
+        t.join();
+    }
+    return workers;
+}
+
+#endif //PARALLEL_H
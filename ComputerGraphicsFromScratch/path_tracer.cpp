@@ -0,0 +1,606 @@
+#include "path_tracer.h"
+#include "bvh_cache.h"
+#include "lighting.h"
+#include "parallel.h"
+#include "render_stats.h"
+#include "trace_kernels.h"
+#include "validation.h"
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <raymath.h>
+
+const char* path_material_names[PATH_MATERIAL_COUNT] = { "diffuse", "glossy", "mirror" };
+
+bool path_sort_rays = true;
+
+PathMaterial PathMaterialOf(int sphere)
+{
+    unsigned int h = (unsigned int)sphere * 2654435761u;
+    h = (h ^ (h >> 16)) & 7;
+    return h == 0 ? PATH_MIRROR : h <= 2 ? PATH_GLOSSY : PATH_DIFFUSE;
+}
+
+void InitPathQueues(PathQueues* queues)
+{
+    queues->rays.resize(PATH_QUEUE_CAPACITY);
+    queues->hits.resize(PATH_QUEUE_CAPACITY);
+    queues->order.resize(PATH_QUEUE_CAPACITY);
+    queues->extensions.resize(PATH_QUEUE_CAPACITY);
+    queues->shadows.resize(PATH_QUEUE_CAPACITY);
+    queues->sort_keys.reserve(PATH_QUEUE_CAPACITY);
+    queues->sort_values.reserve(PATH_QUEUE_CAPACITY);
+    queues->sort_scratch.keys.reserve(PATH_QUEUE_CAPACITY);
+    queues->sort_scratch.values.reserve(PATH_QUEUE_CAPACITY);
+    queues->sort_scratch.histograms.resize((size_t)WorkerCount() * 256);
+}
+
+size_t PathQueueBytes(const PathQueues& queues)
+{
+    return queues.rays.capacity() * sizeof(PathRay) + queues.hits.capacity() * sizeof(RayHit) + queues.order.capacity() * sizeof(int) +
+        queues.extensions.capacity() * sizeof(PathRay) + queues.shadows.capacity() * sizeof(PathShadowRay) +
+        queues.sort_keys.capacity() * sizeof(unsigned int) + queues.sort_values.capacity() * sizeof(int) +
+        queues.sort_scratch.keys.capacity() * sizeof(unsigned int) + queues.sort_scratch.values.capacity() * sizeof(int) +
+        queues.sort_scratch.histograms.capacity() * sizeof(int);
+}
+
+/***************************  Sampling  ***************************/
+
+// PCG hash of the pixel and sample, so neighbouring paths start from unrelated states.
+static unsigned int PathSeed(int pixel, unsigned int sample)
+{
+    unsigned int state = (unsigned int)pixel * 747796405u + sample * 2891336453u + 1u;
+    state = state * 747796405u + 2891336453u;
+    unsigned int word = ((state >> ((state >> 28) + 4)) ^ state) * 277803737u;
+    return ((word >> 22) ^ word) | 1u; // xorshift never leaves 0
+}
+
+static float PathRandom(unsigned int* state)
+{
+    unsigned int x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return (float)(x >> 8) * (1.0f / 16777216.0f);
+}
+
+// Direction around axis (unit length) at cos_theta from it, in a basis built as in Duff et al. 2017.
+static Vector3 PathAroundAxis(Vector3 axis, float cos_theta, float phi)
+{
+    float sign = copysignf(1.0f, axis.z);
+    float a = -1.0f / (sign + axis.z);
+    float b = axis.x * axis.y * a;
+    Vector3 tangent = Vector3{ 1.0f + sign * axis.x * axis.x * a, sign * b, -sign * axis.x };
+    Vector3 bitangent = Vector3{ b, sign + axis.y * axis.y * a, -axis.y };
+    float sin_theta = sqrtf(fmaxf(0.0f, 1.0f - cos_theta * cos_theta));
+    Vector3 d = Vector3Add(Vector3Scale(tangent, sin_theta * cosf(phi)), Vector3Scale(bitangent, sin_theta * sinf(phi)));
+    return Vector3Add(d, Vector3Scale(axis, cos_theta));
+}
+
+/***************************  Shading  ***************************/
+
+// Point and directional lights, the ones shadow rays are cast towards.
+static void CollectDirectLights(std::vector<int>* direct)
+{
+    direct->clear();
+    for (int i = 0; i < (int)lights.size(); i++)
+    {
+        if (lights[i].type != LIGHT_AMBIENT)
+        {
+            direct->push_back(i);
+        }
+    }
+}
+
+static Vector3 PathSky(Vector3 throughput)
+{
+    return Vector3{ throughput.x * BACKGROUND_COLOR.r / 255.0f, throughput.y * BACKGROUND_COLOR.g / 255.0f, throughput.z * BACKGROUND_COLOR.b / 255.0f };
+}
+
+// The surface at a hit, one ray at a time, as the surface_hits kernels find it for a batch.
+static SurfaceHit PathSurface(const SceneSnapshot& source, const PathRay& ray, RayHit hit)
+{
+    Sphere sp = source.GetSphere(hit.sphere);
+    Vector3 p = Vector3Add(ray.origin, Vector3Scale(ray.direction, hit.t));
+    Vector3 n = Vector3Normalize(Vector3Subtract(p, sp.center));
+    Vector3 d = Vector3Normalize(ray.direction);
+    if (Vector3DotProduct(n, d) > 0.0f)
+    {
+        n = Vector3Negate(n);
+    }
+    return SurfaceHit{ p, n, d };
+}
+
+// One bounce of a path that hit a sphere of the given material: the shadow ray towards a light
+// picked at random, and the ray that carries the path on. Either has pixel -1 when there is none.
+template <int MATERIAL>
+static void ShadePath(const SceneSnapshot& source, const std::vector<int>& direct, const PathRay& ray, RayHit hit, const SurfaceHit& surface,
+    PathRay* extension, PathShadowRay* shadow, PathStats* stats)
+{
+    extension->pixel = -1;
+    shadow->pixel = -1;
+    stats->material_hits[MATERIAL]++;
+
+    Sphere sp = source.GetSphere(hit.sphere);
+    Vector3 p = surface.point;
+    Vector3 n = surface.normal;
+    Vector3 d = surface.direction;
+    Vector3 albedo = Vector3{ sp.color.r / 255.0f, sp.color.g / 255.0f, sp.color.b / 255.0f };
+    unsigned int rng = ray.rng;
+
+    // The book's diffuse and specular terms for one light, divided by the chance of picking it.
+    if (MATERIAL != PATH_MIRROR && !direct.empty())
+    {
+        int count = (int)direct.size();
+        int pick = (int)(PathRandom(&rng) * count);
+        const Light& light = lights[direct[pick < count ? pick : count - 1]];
+        Vector3 l = light.vector;
+        float tmax = INFINITY;
+        float falloff = 1.0f;
+        if (light.type == LIGHT_POINT)
+        {
+            l = Vector3Subtract(light.vector, p);
+            tmax = 1.0f;
+            if (light.range > 0.0f)
+            {
+                float d2 = Vector3DotProduct(l, l) / (light.range * light.range);
+                falloff = d2 < 1.0f ? (1.0f - d2) * (1.0f - d2) : 0.0f;
+            }
+        }
+        float n_dot_l = Vector3DotProduct(n, l);
+        if (n_dot_l > 0.0f && falloff > 0.0f)
+        {
+            float l_length = Vector3Length(l);
+            float intensity = light.intensity * falloff * n_dot_l / l_length;
+            if (MATERIAL == PATH_GLOSSY)
+            {
+                Vector3 r = Vector3Subtract(Vector3Scale(n, 2.0f * n_dot_l), l);
+                float r_dot_v = -Vector3DotProduct(r, d);
+                if (r_dot_v > 0.0f)
+                {
+                    intensity += light.intensity * falloff * powf(r_dot_v / l_length, PATH_GLOSSY_EXPONENT);
+                }
+            }
+            float weight = intensity * (float)count;
+            Vector3 contribution = Vector3{ ray.throughput.x * albedo.x * weight, ray.throughput.y * albedo.y * weight, ray.throughput.z * albedo.z * weight };
+            *shadow = PathShadowRay{ p, l, tmax, contribution, ray.pixel };
+        }
+    }
+
+    if (ray.depth + 1 >= PATH_MAX_DEPTH)
+    {
+        return;
+    }
+    float u = PathRandom(&rng);
+    float v = PathRandom(&rng);
+    Vector3 direction;
+    if (MATERIAL == PATH_DIFFUSE)
+    {
+        direction = PathAroundAxis(n, sqrtf(1.0f - u), 2.0f * PI * v); // cosine weighted
+    }
+    else
+    {
+        Vector3 mirror = Vector3Subtract(d, Vector3Scale(n, 2.0f * Vector3DotProduct(n, d)));
+        direction = MATERIAL == PATH_MIRROR ? mirror : PathAroundAxis(mirror, powf(u, 1.0f / (PATH_GLOSSY_EXPONENT + 1.0f)), 2.0f * PI * v);
+        if (Vector3DotProduct(direction, n) <= 0.0f)
+        {
+            return;
+        }
+    }
+
+    // Once a few bounces in, paths carrying little light go on only with a chance in proportion
+    // to it, and carry that much more when they do.
+    Vector3 throughput = Vector3Multiply(ray.throughput, albedo);
+    if (ray.depth + 1 >= PATH_ROULETTE_DEPTH)
+    {
+        float survival = fminf(fmaxf(throughput.x, fmaxf(throughput.y, throughput.z)), 0.95f);
+        if (PathRandom(&rng) >= survival)
+        {
+            stats->roulette_kills++;
+            return;
+        }
+        throughput = Vector3Scale(throughput, 1.0f / survival);
+    }
+    *extension = PathRay{ p, direction, throughput, ray.pixel, ray.depth + 1, rng };
+}
+
+static void ShadePathHit(PathMaterial material, const SceneSnapshot& source, const std::vector<int>& direct, const PathRay& ray, RayHit hit,
+    PathRay* extension, PathShadowRay* shadow, PathStats* stats)
+{
+    SurfaceHit surface = PathSurface(source, ray, hit);
+    switch (material)
+    {
+    case PATH_GLOSSY:
+        ShadePath<PATH_GLOSSY>(source, direct, ray, hit, surface, extension, shadow, stats);
+        break;
+    case PATH_MIRROR:
+        ShadePath<PATH_MIRROR>(source, direct, ray, hit, surface, extension, shadow, stats);
+        break;
+    default:
+        ShadePath<PATH_DIFFUSE>(source, direct, ray, hit, surface, extension, shadow, stats);
+        break;
+    }
+}
+
+static PathRay CameraPathRay(int pixel, unsigned int sample)
+{
+    Ray r = CanvasRay(Vector2Int{ pixel % CANVAS_WIDTH - CANVAS_WIDTH / 2, pixel / CANVAS_WIDTH - CANVAS_HEIGHT / 2 });
+    return PathRay{ r.position, r.direction, Vector3{ 1.0f, 1.0f, 1.0f }, pixel, 0, PathSeed(pixel, sample) };
+}
+
+// Camera rays go through the tree's folded spheres, the same arithmetic as the other modes.
+static RayHit PathClosestHit(const Bvh& bvh, const SceneSnapshot& source, const PathRay& ray, BvhTraceCounters* counters)
+{
+    if (ray.depth == 0)
+    {
+        return BvhClosestHit(bvh, Ray{ ray.origin, ray.direction }, 1.0f, INFINITY, counters);
+    }
+    return BvhClosestHitFrom(bvh, source, Ray{ ray.origin, ray.direction }, PATH_EPSILON, INFINITY, counters);
+}
+
+static void AddPathStats(PathStats* total, const PathStats& part)
+{
+    total->paths += part.paths;
+    total->extension_rays += part.extension_rays;
+    total->shadow_rays += part.shadow_rays;
+    total->roulette_kills += part.roulette_kills;
+    for (int m = 0; m < PATH_MATERIAL_COUNT; m++)
+    {
+        total->material_hits[m] += part.material_hits[m];
+    }
+    total->traversal.nodes_visited += part.traversal.nodes_visited;
+    total->traversal.sphere_tests += part.traversal.sphere_tests;
+    for (int depth = 0; depth < PATH_MAX_DEPTH; depth++)
+    {
+        total->depth_rays[depth] += part.depth_rays[depth];
+        total->depth_ms[depth] += part.depth_ms[depth];
+    }
+    total->sort_ms += part.sort_ms;
+}
+
+/***************************  Wavefront  ***************************/
+
+static double PathNowMs()
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Direction octant in the top 3 bits, then the origin's Morton code within the scene's bounds,
+// down to 29 bits.
+static unsigned int PathRayKey(Vector3 origin, Vector3 direction, Vector3 lo, Vector3 scale)
+{
+    unsigned int octant = (direction.x < 0.0f ? 1u : 0u) | (direction.y < 0.0f ? 2u : 0u) | (direction.z < 0.0f ? 4u : 0u);
+    unsigned int morton = MortonCode((origin.x - lo.x) * scale.x, (origin.y - lo.y) * scale.y, (origin.z - lo.z) * scale.z);
+    return (octant << 29) | (morton >> 1);
+}
+
+// Lower corner of the tree's bounds, and the scale that takes them to the Morton grid.
+static void PathSortFrame(const Bvh& bvh, Vector3* lo, Vector3* scale)
+{
+    const BvhNode& root = bvh.nodes[0];
+    *lo = root.min;
+    *scale = Vector3{ 1023.0f / fmaxf(root.max.x - root.min.x, FLT_MIN), 1023.0f / fmaxf(root.max.y - root.min.y, FLT_MIN),
+        1023.0f / fmaxf(root.max.z - root.min.z, FLT_MIN) };
+}
+
+// Reorders rays[0 .. count) by PathRayKey, through the extension queue, which is free until shading.
+static void SortPathRays(const Bvh& bvh, int count, PathQueues* queues)
+{
+    Vector3 lo, scale;
+    PathSortFrame(bvh, &lo, &scale);
+    queues->sort_keys.resize(count);
+    queues->sort_values.resize(count);
+    ParallelFor(0, count, 4096, [&](int, int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            queues->sort_keys[i] = PathRayKey(queues->rays[i].origin, queues->rays[i].direction, lo, scale);
+            queues->sort_values[i] = i;
+        }
+    });
+    RadixSortKeys(&queues->sort_keys, &queues->sort_values, &queues->sort_scratch);
+    ParallelFor(0, count, 4096, [&](int, int begin, int end)
+    {
+        for (int k = begin; k < end; k++)
+        {
+            queues->extensions[k] = queues->rays[queues->sort_values[k]];
+        }
+    });
+    queues->rays.swap(queues->extensions);
+}
+
+// Lists the shadow rays written at [begin, end) of the shadow queue in sort_values, sorted by
+// PathRayKey when there are enough of them and sorting is on.
+static void ListShadowRays(const Bvh& bvh, int begin, int end, PathQueues* queues)
+{
+    queues->sort_values.clear();
+    for (int j = begin; j < end; j++)
+    {
+        if (queues->shadows[j].pixel >= 0)
+        {
+            queues->sort_values.push_back(j);
+        }
+    }
+    int count = (int)queues->sort_values.size();
+    if (!path_sort_rays || count < PATH_SORT_MIN_RAYS)
+    {
+        return;
+    }
+    Vector3 lo, scale;
+    PathSortFrame(bvh, &lo, &scale);
+    queues->sort_keys.resize(count);
+    ParallelFor(0, count, 4096, [&](int, int chunk_begin, int chunk_end)
+    {
+        for (int k = chunk_begin; k < chunk_end; k++)
+        {
+            const PathShadowRay& s = queues->shadows[queues->sort_values[k]];
+            queues->sort_keys[k] = PathRayKey(s.origin, s.direction, lo, scale);
+        }
+    });
+    RadixSortKeys(&queues->sort_keys, &queues->sort_values, &queues->sort_scratch);
+}
+
+// Shading stage of one material, over its range of the sorted queue, writing each path's rays at
+// its position there. The surfaces are found a batch at a time by the selected kernels.
+template <int MATERIAL>
+static void ShadeQueueRange(const SceneSnapshot& source, const std::vector<int>& direct, int begin, int end, PathQueues* queues,
+    std::vector<PathStats>* worker_stats)
+{
+    ParallelFor(begin, end, 256, [&](int worker, int chunk_begin, int chunk_end)
+    {
+        Ray batch[PATH_RAY_BATCH];
+        RayHit batch_hits[PATH_RAY_BATCH];
+        SurfaceHit surfaces[PATH_RAY_BATCH];
+        for (int j = chunk_begin; j < chunk_end; j += PATH_RAY_BATCH)
+        {
+            int batch_count = chunk_end - j < PATH_RAY_BATCH ? chunk_end - j : PATH_RAY_BATCH;
+            for (int k = 0; k < batch_count; k++)
+            {
+                const PathRay& ray = queues->rays[queues->order[j + k]];
+                batch[k] = Ray{ ray.origin, ray.direction };
+                batch_hits[k] = queues->hits[queues->order[j + k]];
+            }
+            trace_kernels->surface_hits(source, batch, batch_hits, batch_count, surfaces);
+            for (int k = 0; k < batch_count; k++)
+            {
+                ShadePath<MATERIAL>(source, direct, queues->rays[queues->order[j + k]], batch_hits[k], surfaces[k], &queues->extensions[j + k],
+                    &queues->shadows[j + k], &(*worker_stats)[worker]);
+            }
+        }
+    });
+}
+
+void TracePathWave(const Bvh& bvh, const SceneSnapshot& source, int pixel_begin, int pixel_end, unsigned int sample, PathQueues* queues,
+    Vector3* radiance, RayHit* primary_hits, PathStats* stats)
+{
+    if (queues->rays.size() < PATH_QUEUE_CAPACITY)
+    {
+        InitPathQueues(queues);
+    }
+    int count = pixel_end - pixel_begin < PATH_QUEUE_CAPACITY ? pixel_end - pixel_begin : PATH_QUEUE_CAPACITY;
+    std::vector<int> direct;
+    CollectDirectLights(&direct);
+    std::vector<PathStats> worker_stats(WorkerCount(), PathStats{ 0 });
+
+    ParallelFor(0, count, 1024, [&](int, int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            queues->rays[i] = CameraPathRay(pixel_begin + i, sample);
+            radiance[pixel_begin + i] = Vector3{ 0.0f, 0.0f, 0.0f };
+        }
+    });
+    stats->paths += count;
+
+    for (int depth = 0; count > 0; depth++)
+    {
+        double start = PathNowMs();
+        if (depth > 0 && path_sort_rays && count >= PATH_SORT_MIN_RAYS)
+        {
+            SortPathRays(bvh, count, queues);
+            stats->sort_ms += PathNowMs() - start;
+        }
+        // Every ray of the queue is at the same depth, so camera rays are never batched with others.
+        float tmin = depth == 0 ? 1.0f : PATH_EPSILON;
+        ParallelFor(0, count, 256, [&](int worker, int begin, int end)
+        {
+            Ray batch[PATH_RAY_BATCH];
+            for (int i = begin; i < end; i += PATH_RAY_BATCH)
+            {
+                int batch_count = end - i < PATH_RAY_BATCH ? end - i : PATH_RAY_BATCH;
+                for (int k = 0; k < batch_count; k++)
+                {
+                    batch[k] = Ray{ queues->rays[i + k].origin, queues->rays[i + k].direction };
+                }
+                trace_kernels->bvh_closest_hits(bvh, source, batch, batch_count, tmin, INFINITY, &queues->hits[i], &worker_stats[worker].traversal);
+            }
+        });
+        stats->extension_rays += count;
+        stats->depth_rays[depth] += count;
+        stats->depth_ms[depth] += PathNowMs() - start;
+
+        // Misses end here, taking in the sky; hits are counted by material, then placed.
+        int first[PATH_MATERIAL_COUNT + 1] = { 0 };
+        int misses = 0;
+        for (int i = 0; i < count; i++)
+        {
+            const PathRay& ray = queues->rays[i];
+            const RayHit& hit = queues->hits[i];
+            if (ray.depth == 0)
+            {
+                primary_hits[ray.pixel] = hit;
+            }
+            if (hit.sphere < 0)
+            {
+                radiance[ray.pixel] = Vector3Add(radiance[ray.pixel], PathSky(ray.throughput));
+                misses++;
+                continue;
+            }
+            first[PathMaterialOf(hit.sphere) + 1]++;
+        }
+        first[0] = misses;
+        for (int m = 0; m < PATH_MATERIAL_COUNT; m++)
+        {
+            first[m + 1] += first[m];
+        }
+        int next[PATH_MATERIAL_COUNT];
+        for (int m = 0; m < PATH_MATERIAL_COUNT; m++)
+        {
+            next[m] = first[m];
+        }
+        for (int i = 0; i < count; i++)
+        {
+            if (queues->hits[i].sphere >= 0)
+            {
+                queues->order[next[PathMaterialOf(queues->hits[i].sphere)]++] = i;
+            }
+        }
+
+        ShadeQueueRange<PATH_DIFFUSE>(source, direct, first[PATH_DIFFUSE], first[PATH_DIFFUSE + 1], queues, &worker_stats);
+        ShadeQueueRange<PATH_GLOSSY>(source, direct, first[PATH_GLOSSY], first[PATH_GLOSSY + 1], queues, &worker_stats);
+        ShadeQueueRange<PATH_MIRROR>(source, direct, first[PATH_MIRROR], first[PATH_MIRROR + 1], queues, &worker_stats);
+
+        // Every path of the wave is a different pixel, so the shadow stage adds to them without
+        // contention.
+        start = PathNowMs();
+        ListShadowRays(bvh, misses, count, queues);
+        int shadow_count = (int)queues->sort_values.size();
+        if (path_sort_rays)
+        {
+            stats->sort_ms += PathNowMs() - start;
+        }
+        ParallelFor(0, shadow_count, 256, [&](int worker, int begin, int end)
+        {
+            Ray batch[PATH_RAY_BATCH];
+            float tmax[PATH_RAY_BATCH];
+            bool blocked[PATH_RAY_BATCH];
+            for (int k = begin; k < end; k += PATH_RAY_BATCH)
+            {
+                int batch_count = end - k < PATH_RAY_BATCH ? end - k : PATH_RAY_BATCH;
+                for (int j = 0; j < batch_count; j++)
+                {
+                    const PathShadowRay& s = queues->shadows[queues->sort_values[k + j]];
+                    batch[j] = Ray{ s.origin, s.direction };
+                    tmax[j] = s.tmax;
+                }
+                trace_kernels->bvh_any_hits(bvh, source, batch, tmax, batch_count, PATH_EPSILON, blocked, &worker_stats[worker].traversal);
+                for (int j = 0; j < batch_count; j++)
+                {
+                    const PathShadowRay& s = queues->shadows[queues->sort_values[k + j]];
+                    if (!blocked[j])
+                    {
+                        radiance[s.pixel] = Vector3Add(radiance[s.pixel], s.contribution);
+                    }
+                }
+            }
+            worker_stats[worker].shadow_rays += end - begin;
+        });
+        stats->depth_rays[depth] += shadow_count;
+        stats->depth_ms[depth] += PathNowMs() - start;
+
+        int survivors = 0;
+        for (int j = misses; j < count; j++)
+        {
+            if (queues->extensions[j].pixel >= 0)
+            {
+                queues->rays[survivors++] = queues->extensions[j];
+            }
+        }
+        count = survivors;
+    }
+
+    for (const PathStats& part : worker_stats)
+    {
+        AddPathStats(stats, part);
+    }
+}
+
+void TracePathCanvas(const Bvh& bvh, const SceneSnapshot& source, unsigned int sample, PathQueues* queues, Vector3* radiance, RayHit* primary_hits,
+    PathStats* stats)
+{
+    for (int begin = 0; begin < CANVAS_WIDTH * CANVAS_HEIGHT; begin += PATH_QUEUE_CAPACITY)
+    {
+        int end = begin + PATH_QUEUE_CAPACITY < CANVAS_WIDTH * CANVAS_HEIGHT ? begin + PATH_QUEUE_CAPACITY : CANVAS_WIDTH * CANVAS_HEIGHT;
+        TracePathWave(bvh, source, begin, end, sample, queues, radiance, primary_hits, stats);
+    }
+}
+
+Vector3 TracePathRecursive(const Bvh& bvh, const SceneSnapshot& source, int pixel, unsigned int sample, PathStats* stats)
+{
+    std::vector<int> direct;
+    CollectDirectLights(&direct);
+    Vector3 radiance = Vector3{ 0.0f, 0.0f, 0.0f };
+    PathRay ray = CameraPathRay(pixel, sample);
+    stats->paths++;
+    while (true)
+    {
+        RayHit hit = PathClosestHit(bvh, source, ray, &stats->traversal);
+        stats->extension_rays++;
+        if (hit.sphere < 0)
+        {
+            radiance = Vector3Add(radiance, PathSky(ray.throughput));
+            break;
+        }
+        PathRay extension;
+        PathShadowRay shadow;
+        ShadePathHit(PathMaterialOf(hit.sphere), source, direct, ray, hit, &extension, &shadow, stats);
+        int occluder = -1;
+        if (shadow.pixel >= 0)
+        {
+            stats->shadow_rays++;
+            if (!BvhAnyHit(bvh, source, Ray{ shadow.origin, shadow.direction }, PATH_EPSILON, shadow.tmax, &occluder, &stats->traversal))
+            {
+                radiance = Vector3Add(radiance, shadow.contribution);
+            }
+        }
+        if (extension.pixel < 0)
+        {
+            break;
+        }
+        ray = extension;
+    }
+    return radiance;
+}
+
+void DrawScenePathTraced(Image* img, Bvh* bvh, PathQueues* queues)
+{
+    static std::vector<Vector3> accumulated(CANVAS_WIDTH * CANVAS_HEIGHT);
+    static std::vector<Vector3> radiance(CANVAS_WIDTH * CANVAS_HEIGHT);
+    static std::vector<RayHit> primary_hits(CANVAS_WIDTH * CANVAS_HEIGHT);
+    static unsigned long long accumulated_version = 0;
+    static unsigned int samples = 0;
+    if (bvh->scene_version != frame_scene->version || bvh->builder != bvh_builder)
+    {
+        BuildBvhCached(bvh_builder, *frame_scene, bvh);
+    }
+    if (accumulated_version != frame_scene->version)
+    {
+        std::fill(accumulated.begin(), accumulated.end(), Vector3{ 0.0f, 0.0f, 0.0f });
+        accumulated_version = frame_scene->version;
+        samples = 0;
+    }
+
+    PathStats stats = { 0 };
+    TracePathCanvas(*bvh, *frame_scene, samples, queues, radiance.data(), primary_hits.data(), &stats);
+    samples++;
+
+    for (int row = 0; row < CANVAS_HEIGHT; row++)
+    {
+        for (int column = 0; column < CANVAS_WIDTH; column++)
+        {
+            int pixel = row * CANVAS_WIDTH + column;
+            accumulated[pixel] = Vector3Add(accumulated[pixel], radiance[pixel]);
+            Vector3 mean = Vector3Scale(accumulated[pixel], 255.0f / (float)samples);
+            Color col = Color{ (unsigned char)fminf(mean.x, 255.0f), (unsigned char)fminf(mean.y, 255.0f), (unsigned char)fminf(mean.z, 255.0f), 255 };
+            Vector2Int canvas_pos = { column - CANVAS_WIDTH / 2, row - CANVAS_HEIGHT / 2 };
+            CaptureHit(canvas_pos.x, canvas_pos.y, primary_hits[pixel]);
+            render_stats.primary_rays++;
+            Vector2Int screen = CanvasToScreen(canvas_pos);
+            SetPixel(img, screen.x, screen.y, col);
+        }
+    }
+    RecordUniformPixelCost((int)(stats.traversal.sphere_tests / (CANVAS_WIDTH * CANVAS_HEIGHT)));
+    render_stats.intersection_tests += stats.traversal.sphere_tests;
+    render_stats.shadow_rays += stats.shadow_rays;
+}
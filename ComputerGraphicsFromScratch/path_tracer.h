@@ -0,0 +1,149 @@
+/**********************************************************************************************
+*
+*   Wavefront path tracer
+*
+*   Paths bounce off the spheres until Russian roulette ends them, gathering the background as
+*   a sky of its color and, at every diffuse or glossy hit, one point or directional light
+*   picked at random (see lighting.h) through a shadow ray. Ambient lights are left out, as the
+*   bounces find that light themselves.
+*
+*   Rather than following one path at a time through a recursion whose branches differ from one
+*   pixel to the next, the paths of up to PATH_QUEUE_CAPACITY pixels advance together, one bounce
+*   at a time, in stages that each run a single loop over a whole queue:
+*     - intersect: closest hit of every ray of the queue through the BVH
+*     - sort: hit indices counted by material into one range per material, misses first
+*     - shade: one loop per material, each compiled for it alone, which add what is gathered to
+*       the pixels and write at most one extension ray and one shadow ray per path
+*     - shadow: the any-hit query over the shadow queue, adding the light of the unblocked ones
+*   The intersect and shadow stages, and the surface points and normals the shading starts from,
+*   go through the selected trace kernels PATH_RAY_BATCH rays at a time, the rays of a batch
+*   sharing node fetches and sphere tests in the lanes of one vector.
+*   Extension rays are compacted into the queue of the next bounce, so the memory in use is
+*   bounded by the queue capacity, whatever the resolution or the number of bounces.
+*
+*   Camera rays leave in pixel order and walk the tree together, but the rays of later bounces
+*   and shadow rays point every which way from wherever their paths got to. Unless turned off
+*   with --ray-sort=off, queues of those are first sorted by the octant of their direction, then
+*   by the Morton code of their origin, so rays that are intersected one after another go the
+*   same way from nearby and fetch mostly the same nodes.
+*
+*   The spheres only have a color, so each gets one of the materials below by a hash of its
+*   index. Every path draws its random numbers from its own state, seeded from its pixel and
+*   sample, so the image doesn't depend on the order paths are processed in: TracePathRecursive
+*   follows the same paths depth-first and gets the same result.
+*
+**********************************************************************************************/
+
+#ifndef PATH_TRACER_H
+#define PATH_TRACER_H
+
+#include "bvh.h"
+#include "scene_snapshot.h"
+#include <vector>
+
+// Paths in flight at once, and so the length of every queue.
+#define PATH_QUEUE_CAPACITY (1 << 17)
+
+// Bounces before Russian roulette starts, and a hard cap on path length.
+#define PATH_ROULETTE_DEPTH 2
+#define PATH_MAX_DEPTH 16
+
+// Rays handed to the batch kernels at once (see trace_kernels.h), a multiple of every variant's width.
+#define PATH_RAY_BATCH 16
+
+// Secondary and shadow rays start this far from the hit.
+#define PATH_EPSILON 0.001f
+
+// Secondary and shadow queues shorter than this are intersected as they are: too few rays to
+// share much of the tree.
+#define PATH_SORT_MIN_RAYS 4096
+
+// Phong exponent of the glossy lobe, sampled for bounces and used as the book's specular term
+// for lights.
+#define PATH_GLOSSY_EXPONENT 64.0f
+
+enum PathMaterial
+{
+    PATH_DIFFUSE,
+    PATH_GLOSSY,
+    PATH_MIRROR,
+    PATH_MATERIAL_COUNT
+};
+
+extern const char* path_material_names[PATH_MATERIAL_COUNT];
+
+// Whether secondary and shadow rays are sorted for coherence before they are intersected, set with
+// --ray-sort=<on|off>.
+extern bool path_sort_rays;
+
+// Material of a sphere, by a hash of its dense index: mostly diffuse, one in four glossy, one in
+// eight a mirror.
+PathMaterial PathMaterialOf(int sphere);
+
+struct PathRay
+{
+    Vector3 origin;
+    Vector3 direction;  // unit length, except for camera rays
+    Vector3 throughput; // fraction of the light along the ray that reaches the pixel
+    int pixel;          // (y + CANVAS_HEIGHT / 2) * CANVAS_WIDTH + x + CANVAS_WIDTH / 2
+    int depth;
+    unsigned int rng;
+};
+
+struct PathShadowRay
+{
+    Vector3 origin;
+    Vector3 direction;
+    float tmax;
+    Vector3 contribution; // added to the pixel if nothing blocks the ray
+    int pixel;            // -1 for none
+};
+
+struct PathStats
+{
+    long long paths;
+    long long extension_rays; // camera rays included
+    long long shadow_rays;
+    long long roulette_kills;
+    long long material_hits[PATH_MATERIAL_COUNT];
+    BvhTraceCounters traversal;
+    long long depth_rays[PATH_MAX_DEPTH]; // extension and shadow rays intersected at each bounce
+    double depth_ms[PATH_MAX_DEPTH];      // and the time spent on them, sorting included
+    double sort_ms;
+};
+
+// Queues of one wave, allocated once to PATH_QUEUE_CAPACITY.
+struct PathQueues
+{
+    std::vector<PathRay> rays;
+    std::vector<RayHit> hits;
+    std::vector<int> order; // indices into rays, grouped by material
+    std::vector<PathRay> extensions;
+    std::vector<PathShadowRay> shadows;
+    std::vector<unsigned int> sort_keys; // of the coherence sort
+    std::vector<int> sort_values;        // and its order; for the shadow stage, positions in shadows
+    RadixSortScratch sort_scratch;
+};
+
+void InitPathQueues(PathQueues* queues);
+
+// Bytes held by the queues.
+size_t PathQueueBytes(const PathQueues& queues);
+
+// Traces one path per pixel of [pixel_begin, pixel_end), at most PATH_QUEUE_CAPACITY of them, and
+// writes their radiance to radiance[pixel] and the camera rays' hits to primary_hits[pixel].
+void TracePathWave(const Bvh& bvh, const SceneSnapshot& source, int pixel_begin, int pixel_end, unsigned int sample, PathQueues* queues,
+    Vector3* radiance, RayHit* primary_hits, PathStats* stats);
+
+// The same for the whole canvas, wave after wave.
+void TracePathCanvas(const Bvh& bvh, const SceneSnapshot& source, unsigned int sample, PathQueues* queues, Vector3* radiance, RayHit* primary_hits,
+    PathStats* stats);
+
+// The path of one pixel and sample followed depth-first, one ray at a time, for comparison.
+Vector3 TracePathRecursive(const Bvh& bvh, const SceneSnapshot& source, int pixel, unsigned int sample, PathStats* stats);
+
+// Adds one sample per pixel to an average over the frames since frame_scene last changed, and
+// draws it. The BVH is rebuilt whenever the snapshot changes.
+void DrawScenePathTraced(Image* img, Bvh* bvh, PathQueues* queues);
+
+#endif //PATH_TRACER_H
@@ -0,0 +1,25 @@
+#include "precision.h"
+#include "render_stats.h"
+#include <string.h>
+
+const char* precision_names[PRECISION_COUNT] = { "float", "double", "fast" };
+PrecisionTier precision_tier = PRECISION_FLOAT;
+
+bool ParsePrecision(const char* name, PrecisionTier* tier)
+{
+    for (int i = 0; i < PRECISION_COUNT; i++)
+    {
+        if (strcmp(name, precision_names[i]) == 0)
+        {
+            *tier = (PrecisionTier)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+void SetPrecisionTier(PrecisionTier tier)
+{
+    precision_tier = tier;
+    render_stats.precision = precision_names[tier];
+}
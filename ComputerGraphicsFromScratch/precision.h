@@ -0,0 +1,136 @@
+/**********************************************************************************************
+*
+*   Precision tiers for the tracing core
+*
+*   The intersection math is templated on a policy that picks the arithmetic type and how square
+*   roots and divisions are done:
+*     - float:  the default, bit for bit the same as IntersectRaySphere.
+*     - double: for scenes far from the origin, where |CO|^2 - r^2 cancels catastrophically in float.
+*     - fast:   float with rsqrt/rcp estimates refined by one Newton step (~22 bits instead of 24),
+*               good enough for primary visibility.
+*
+*   The tier is chosen at runtime (P key, --precision=<name>); ClosestHit follows it.
+*
+**********************************************************************************************/
+
+#ifndef PRECISION_H
+#define PRECISION_H
+
+#include "raytracer.h"
+#include "scene_snapshot.h"
+#include <math.h>
+#include <xmmintrin.h>
+
+enum PrecisionTier
+{
+    PRECISION_FLOAT,
+    PRECISION_DOUBLE,
+    PRECISION_FAST,
+    PRECISION_COUNT
+};
+
+extern const char* precision_names[PRECISION_COUNT];
+extern PrecisionTier precision_tier;
+
+bool ParsePrecision(const char* name, PrecisionTier* tier);
+void SetPrecisionTier(PrecisionTier tier);
+
+struct PrecisionFloat
+{
+    typedef float Real;
+    static Real Sqrt(Real x) { return sqrtf(x); }
+    static Real Divide(Real a, Real b) { return a / b; }
+};
+
+struct PrecisionDouble
+{
+    typedef double Real;
+    static Real Sqrt(Real x) { return sqrt(x); }
+    static Real Divide(Real a, Real b) { return a / b; }
+};
+
+struct PrecisionFast
+{
+    typedef float Real;
+
+    // x * rsqrt(x), with the estimate refined by y' = y * (1.5 - 0.5 * x * y * y).
+    static Real Sqrt(Real x)
+    {
+        if (x <= 0.0f)
+        {
+            return 0.0f;
+        }
+        float y = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(x)));
+        y = y * (1.5f - 0.5f * x * y * y);
+        return x * y;
+    }
+
+    // a * rcp(b), with the estimate refined by y' = y * (2 - b * y).
+    static Real Divide(Real a, Real b)
+    {
+        float y = _mm_cvtss_f32(_mm_rcp_ss(_mm_set_ss(b)));
+        y = y * (2.0f - b * y);
+        return a * y;
+    }
+};
+
+template <typename Real>
+struct RayIntersectionT
+{
+    Real t1;
+    Real t2;
+};
+
+// IntersectRaySphere, in the policy's arithmetic. Operation order matches it exactly, so the float
+// policy reproduces its results.
+template <typename P>
+inline RayIntersectionT<typename P::Real> IntersectRaySphereT(Ray R, const Sphere& sp)
+{
+    typedef typename P::Real Real;
+    Real r = (Real)sp.radius;
+    Real co_x = (Real)CAMERA_ORIGIN.x - (Real)sp.center.x;
+    Real co_y = (Real)CAMERA_ORIGIN.y - (Real)sp.center.y;
+    Real co_z = (Real)CAMERA_ORIGIN.z - (Real)sp.center.z;
+    Real d_x = (Real)R.direction.x;
+    Real d_y = (Real)R.direction.y;
+    Real d_z = (Real)R.direction.z;
+
+    Real a = d_x * d_x + d_y * d_y + d_z * d_z;
+    Real b = (Real)2 * (co_x * d_x + co_y * d_y + co_z * d_z);
+    Real c = (co_x * co_x + co_y * co_y + co_z * co_z) - r * r;
+
+    Real discriminant = (b * b) - ((Real)4 * a * c);
+    if (discriminant < (Real)0)
+    {
+        return RayIntersectionT<Real>{ (Real)INFINITY, (Real)INFINITY };
+    }
+
+    Real root = P::Sqrt(discriminant);
+    Real two_a = (Real)2 * a;
+    return RayIntersectionT<Real>{ P::Divide(-b + root, two_a), P::Divide(-b - root, two_a) };
+}
+
+template <typename P>
+inline RayHit ClosestHitT(Ray r, float tmin, float tmax, const int* candidates, int candidate_count)
+{
+    typedef typename P::Real Real;
+    Real closest_t = (Real)INFINITY;
+    int closest_sphere = -1;
+    for (int i = 0; i < candidate_count; i++)
+    {
+        RayIntersectionT<Real> collision = IntersectRaySphereT<P>(r, frame_scene->GetSphere(candidates[i]));
+        if (collision.t1 >= tmin && collision.t1 <= tmax && collision.t1 < closest_t)
+        {
+            closest_t = collision.t1;
+            closest_sphere = candidates[i];
+        }
+        if (collision.t2 >= tmin && collision.t2 <= tmax && collision.t2 < closest_t)
+        {
+            closest_t = collision.t2;
+            closest_sphere = candidates[i];
+        }
+    }
+    return RayHit{ closest_sphere, (float)closest_t };
+}
+
+#endif //PRECISION_H
@@ -0,0 +1,134 @@
+#include "procedural_scene.h"
+#include "parallel.h"
+#include <math.h>
+#include <string.h>
+
+const char* scene_distribution_names[SCENE_DISTRIBUTION_COUNT] = { "uniform", "clustered", "corridor", "mixed" };
+
+#define SCENE_NEAR 4.0f
+#define SCENE_FAR 100.0f
+
+// Spheres per worker below which generating them isn't split further.
+#define SCENE_MIN_CHUNK 16384
+
+bool ParseSceneDistribution(const char* name, SceneDistribution* distribution)
+{
+    for (int i = 0; i < SCENE_DISTRIBUTION_COUNT; i++)
+    {
+        if (strcmp(name, scene_distribution_names[i]) == 0)
+        {
+            *distribution = (SceneDistribution)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// A point at depth z whose projection lands on the viewport, scaled by spread in [0, 1].
+static Vector3 InView(float u, float v, float z, float spread)
+{
+    float half_w = 0.5f * VIEWPORT_WIDTH / CAMERA_ORIGIN_DISTANCE * z * spread;
+    float half_h = 0.5f * VIEWPORT_HEIGHT / CAMERA_ORIGIN_DISTANCE * z * spread;
+    return Vector3{ (2.0f * u - 1.0f) * half_w, (2.0f * v - 1.0f) * half_h, z };
+}
+
+// PCG hash of the seed and index, so neighbouring spheres start from unrelated states.
+static unsigned int SceneSeed(unsigned int seed, unsigned int index)
+{
+    unsigned int state = index * 747796405u + seed * 2891336453u + 1u;
+    state = state * 747796405u + 2891336453u;
+    unsigned int word = ((state >> ((state >> 28) + 4)) ^ state) * 277803737u;
+    return ((word >> 22) ^ word) | 1u; // xorshift never leaves 0
+}
+
+// Uniform in [0, 1).
+static float SceneRandom(unsigned int* state)
+{
+    unsigned int x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return (float)(x >> 8) * (1.0f / 16777216.0f);
+}
+
+// Standard normal, by Box-Muller.
+static float SceneNormal(unsigned int* state)
+{
+    float u = 1.0f - SceneRandom(state);
+    float v = SceneRandom(state);
+    return sqrtf(-2.0f * logf(u)) * cosf(2.0f * PI * v);
+}
+
+SphereGenerator::SphereGenerator(SceneDistribution distribution, int count, unsigned int seed) : distribution(distribution), count(count), seed(seed)
+{
+    // Radii shrink with the cube root of the count, so the scene stays about equally cluttered.
+    float view_volume = (SCENE_FAR * SCENE_FAR * SCENE_FAR - SCENE_NEAR * SCENE_NEAR * SCENE_NEAR) / 3.0f;
+    base_radius = 0.25f * cbrtf(view_volume / (float)(count > 0 ? count : 1));
+
+    // The clusters come from the state past the last sphere's.
+    unsigned int rng = SceneSeed(seed, (unsigned int)count);
+    for (Vector3& c : clusters)
+    {
+        float u = SceneRandom(&rng);
+        float v = SceneRandom(&rng);
+        c = InView(u, v, SCENE_NEAR + 5.0f + SceneRandom(&rng) * (SCENE_FAR - SCENE_NEAR - 10.0f), 0.8f);
+    }
+}
+
+Sphere SphereGenerator::GetSphere(int index) const
+{
+    unsigned int rng = SceneSeed(seed, (unsigned int)index);
+    Sphere sp;
+    float z = SCENE_NEAR + cbrtf(SceneRandom(&rng)) * (SCENE_FAR - SCENE_NEAR);
+    sp.radius = base_radius * (0.5f + SceneRandom(&rng));
+    float u = SceneRandom(&rng);
+    float v = SceneRandom(&rng);
+    switch (distribution)
+    {
+    case SCENE_CLUSTERED:
+    {
+        const Vector3& c = clusters[(int)(u * SCENE_CLUSTER_COUNT)];
+        float spread = 0.05f * c.z;
+        float dx = SceneNormal(&rng);
+        float dy = SceneNormal(&rng);
+        float dz = SceneNormal(&rng);
+        sp.center = Vector3{ c.x + dx * spread, c.y + dy * spread, c.z + dz * spread };
+        sp.radius *= 0.5f;
+        break;
+    }
+    case SCENE_CORRIDOR:
+        sp.center = InView(u, v, z, 0.1f);
+        sp.radius *= 0.3f;
+        break;
+    case SCENE_MIXED_SIZES:
+        sp.center = InView(u, v, z, 1.0f);
+        if (index % 1000 == 0)
+        {
+            sp.radius *= 20.0f;
+        }
+        break;
+    default:
+        sp.center = InView(u, v, z, 1.0f);
+        break;
+    }
+    if (sp.center.z - sp.radius < SCENE_NEAR)
+    {
+        sp.center.z = SCENE_NEAR + sp.radius;
+    }
+    sp.color = ColorFromHSV(SceneRandom(&rng) * 360.0f, 0.7f, 0.9f);
+    return sp;
+}
+
+void GenerateSpheres(SceneDistribution distribution, int count, unsigned int seed, std::vector<Sphere>* spheres)
+{
+    SphereGenerator generator(distribution, count, seed);
+    spheres->resize(count);
+    ParallelFor(0, count, SCENE_MIN_CHUNK, [&](int, int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            (*spheres)[i] = generator.GetSphere(i);
+        }
+    });
+}
@@ -0,0 +1,57 @@
+/**********************************************************************************************
+*
+*   Procedural sphere scenes
+*
+*   Large scenes for the acceleration structures, all placed inside the camera's view so every
+*   sphere can be hit by some primary ray. The distributions differ in what they do to a spatial
+*   split: uniform is the easy case, clusters leave most of the volume empty, the corridor is long
+*   and thin along the view axis, and mixed sizes puts a few very large spheres among small ones.
+*
+*   Every sphere draws its random numbers from its own state, seeded from the scene's seed and
+*   its index, so a SphereGenerator makes any sphere on its own, in any order and as often as
+*   asked. Scenes too large to hold as Spheres are read from one in passes instead (see
+*   compact_scene.h).
+*
+**********************************************************************************************/
+
+#ifndef PROCEDURAL_SCENE_H
+#define PROCEDURAL_SCENE_H
+
+#include "raytracer.h"
+#include <vector>
+
+enum SceneDistribution
+{
+    SCENE_UNIFORM,
+    SCENE_CLUSTERED,
+    SCENE_CORRIDOR,
+    SCENE_MIXED_SIZES,
+    SCENE_DISTRIBUTION_COUNT
+};
+
+extern const char* scene_distribution_names[SCENE_DISTRIBUTION_COUNT];
+
+bool ParseSceneDistribution(const char* name, SceneDistribution* distribution);
+
+#define SCENE_CLUSTER_COUNT 32
+
+class SphereGenerator
+{
+public:
+    SphereGenerator(SceneDistribution distribution, int count, unsigned int seed);
+
+    int Count() const { return count; }
+    Sphere GetSphere(int index) const;
+
+private:
+    SceneDistribution distribution;
+    int count;
+    unsigned int seed;
+    float base_radius;
+    Vector3 clusters[SCENE_CLUSTER_COUNT];
+};
+
+// Every sphere of the generator's scene, in index order, made in parallel.
+void GenerateSpheres(SceneDistribution distribution, int count, unsigned int seed, std::vector<Sphere>* spheres);
+
+#endif //PROCEDURAL_SCENE_H
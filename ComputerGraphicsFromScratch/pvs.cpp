@@ -0,0 +1,540 @@
+#include "pvs.h"
+#include "bvh.h"
+#include "bvh_cache.h"
+#include "parallel.h"
+#include "render_stats.h"
+#include "validation.h"
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#define PVS_MIN_CHUNK 4096
+#define PVS_CELL_COUNT (PVS_CELLS_PER_AXIS * PVS_CELLS_PER_AXIS * PVS_CELLS_PER_AXIS)
+
+// Slope of the frustum's sides: a ray's x (or y) grows by this much per unit of z.
+#define PVS_SLOPE_X (0.5f * VIEWPORT_WIDTH / CAMERA_ORIGIN_DISTANCE)
+#define PVS_SLOPE_Y (0.5f * VIEWPORT_HEIGHT / CAMERA_ORIGIN_DISTANCE)
+
+const char* pvs_path = "scene.pvs";
+
+static const char PVS_MAGIC[8] = { 'C', 'G', 'F', 'S', 'P', 'V', 'S', 'F' };
+
+struct PvsCellBounds
+{
+    Vector3 min;
+    Vector3 max;
+    Vector3 center;
+    float radius; // of the ball around the cell
+};
+
+struct PvsOccluder
+{
+    Vector3 center;
+    float radius; // shrunk by the grazing pad
+    float score;  // sine of the angle it subtends from the cell's center
+};
+
+static float CellSize()
+{
+    return PVS_REGION_SIZE / PVS_CELLS_PER_AXIS;
+}
+
+static PvsCellBounds CellBounds(int cell)
+{
+    int ix = cell % PVS_CELLS_PER_AXIS;
+    int iy = (cell / PVS_CELLS_PER_AXIS) % PVS_CELLS_PER_AXIS;
+    int iz = cell / (PVS_CELLS_PER_AXIS * PVS_CELLS_PER_AXIS);
+    float size = CellSize();
+    float origin = -0.5f * PVS_REGION_SIZE;
+    PvsCellBounds bounds;
+    bounds.min = Vector3{ CAMERA_ORIGIN.x + origin + ix * size, CAMERA_ORIGIN.y + origin + iy * size, CAMERA_ORIGIN.z + origin + iz * size };
+    bounds.max = Vector3{ bounds.min.x + size, bounds.min.y + size, bounds.min.z + size };
+    bounds.center = Vector3{ bounds.min.x + 0.5f * size, bounds.min.y + 0.5f * size, bounds.min.z + 0.5f * size };
+    bounds.radius = 0.5f * size * sqrtf(3.0f);
+    return bounds;
+}
+
+static float Distance(Vector3 a, Vector3 b)
+{
+    float dx = a.x - b.x;
+    float dy = a.y - b.y;
+    float dz = a.z - b.z;
+    return sqrtf(dx * dx + dy * dy + dz * dz);
+}
+
+// Radius a ray from up to distance away may be reported to hit at, and the one it can't miss.
+static float GrownRadius(float r, float distance)
+{
+    return sqrtf(r * r + BVH_GRAZING_PAD * distance * distance);
+}
+
+static float ShrunkRadius(float r, float distance)
+{
+    float r2 = r * r - BVH_GRAZING_PAD * distance * distance;
+    return r2 > 0.0f ? sqrtf(r2) : 0.0f;
+}
+
+// True when no ray from any point of the cell can reach the sphere: past a side of the frustum,
+// or entirely in front of where the rays start.
+static bool OutsideFrustum(const PvsCellBounds& cell, Vector3 s, float r)
+{
+    if (s.z + r < cell.min.z + CAMERA_ORIGIN_DISTANCE)
+    {
+        return true;
+    }
+    // x - p.x <= k (z - p.z) inside the right side from camera p, so the sphere is outside it from
+    // the whole cell once it clears the plane of the camera that sees farthest to the right.
+    float margin_x = r * sqrtf(1.0f + PVS_SLOPE_X * PVS_SLOPE_X);
+    float margin_y = r * sqrtf(1.0f + PVS_SLOPE_Y * PVS_SLOPE_Y);
+    return (s.x - PVS_SLOPE_X * s.z) - (cell.max.x - PVS_SLOPE_X * cell.min.z) > margin_x ||
+        (-s.x - PVS_SLOPE_X * s.z) - (-cell.min.x - PVS_SLOPE_X * cell.min.z) > margin_x ||
+        (s.y - PVS_SLOPE_Y * s.z) - (cell.max.y - PVS_SLOPE_Y * cell.min.z) > margin_y ||
+        (-s.y - PVS_SLOPE_Y * s.z) - (-cell.min.y - PVS_SLOPE_Y * cell.min.z) > margin_y;
+}
+
+/***************************  Occlusion maps  ***************************/
+
+// Covered texels of one depth plane, and a summed-area table of the uncovered ones.
+struct OcclusionMap
+{
+    float z;
+    float x0, y0;
+    float texel_x, texel_y;
+    std::vector<unsigned char> covered;
+    std::vector<int> open_sums; // (PVS_MAP_SIZE + 1)^2, exclusive prefix sums
+};
+
+// Extent [*lo, *hi] on the plane at depth dz ahead of eye of the sphere's silhouette seen from
+// eye, along one axis; offset and depth are the sphere's position relative to eye in that
+// axis' plane. Unbounded sides are left as they are.
+static void SilhouetteRange(float offset, float depth, float r, float dz, float eye, float* lo, float* hi)
+{
+    float angle = atan2f(offset, depth);
+    float spread = asinf(fminf(r / sqrtf(offset * offset + depth * depth), 1.0f));
+    const float limit = 0.5f * PI - 1e-3f;
+    if (angle - spread > -limit)
+    {
+        *lo = fmaxf(*lo, eye + dz * tanf(angle - spread));
+    }
+    if (angle + spread < limit)
+    {
+        *hi = fminf(*hi, eye + dz * tanf(angle + spread));
+    }
+}
+
+// Marks the texels in the umbra of o, the region behind it inside the cone tangent to it and to
+// the cell's ball: hidden from every point of the cell.
+static void RasterizeUmbra(const PvsCellBounds& cell, const PvsOccluder& o, OcclusionMap* map)
+{
+    Vector3 v = Vector3{ o.center.x - cell.center.x, o.center.y - cell.center.y, o.center.z - cell.center.z };
+    float d = sqrtf(v.x * v.x + v.y * v.y + v.z * v.z);
+    Vector3 u = Vector3{ v.x / d, v.y / d, v.z / d };
+    float sin_a = (o.radius - cell.radius) / d;
+    float cos_a = sqrtf(1.0f - sin_a * sin_a);
+    float tangent = d - o.radius * sin_a; // along u, where the cone touches the occluder
+
+    // The umbra is inside the occluder's silhouette from the cell's center.
+    float dz = map->z - cell.center.z;
+    float lo_x = map->x0;
+    float hi_x = map->x0 + PVS_MAP_SIZE * map->texel_x;
+    float lo_y = map->y0;
+    float hi_y = map->y0 + PVS_MAP_SIZE * map->texel_y;
+    SilhouetteRange(v.x, v.z, o.radius, dz, cell.center.x, &lo_x, &hi_x);
+    SilhouetteRange(v.y, v.z, o.radius, dz, cell.center.y, &lo_y, &hi_y);
+    int x_begin = std::max((int)floorf((lo_x - map->x0) / map->texel_x), 0);
+    int x_end = std::min((int)ceilf((hi_x - map->x0) / map->texel_x), PVS_MAP_SIZE);
+    int y_begin = std::max((int)floorf((lo_y - map->y0) / map->texel_y), 0);
+    int y_end = std::min((int)ceilf((hi_y - map->y0) / map->texel_y), PVS_MAP_SIZE);
+
+    // A texel is covered when the ball around it is inside the cone and past the contact circle.
+    float half = 0.5f * sqrtf(map->texel_x * map->texel_x + map->texel_y * map->texel_y);
+    for (int y = y_begin; y < y_end; y++)
+    {
+        for (int x = x_begin; x < x_end; x++)
+        {
+            Vector3 w = Vector3{ map->x0 + (x + 0.5f) * map->texel_x - cell.center.x, map->y0 + (y + 0.5f) * map->texel_y - cell.center.y, dz };
+            float along = w.x * u.x + w.y * u.y + w.z * u.z;
+            Vector3 cross = Vector3{ w.y * u.z - w.z * u.y, w.z * u.x - w.x * u.z, w.x * u.y - w.y * u.x };
+            float off_axis = sqrtf(cross.x * cross.x + cross.y * cross.y + cross.z * cross.z);
+            if (along - half >= tangent && cell.radius + along * sin_a - off_axis * cos_a >= half)
+            {
+                map->covered[y * PVS_MAP_SIZE + x] = 1;
+            }
+        }
+    }
+}
+
+static void BuildOpenSums(OcclusionMap* map)
+{
+    const int stride = PVS_MAP_SIZE + 1;
+    for (int y = 0; y < PVS_MAP_SIZE; y++)
+    {
+        int row = 0;
+        for (int x = 0; x < PVS_MAP_SIZE; x++)
+        {
+            row += map->covered[y * PVS_MAP_SIZE + x] ? 0 : 1;
+            map->open_sums[(y + 1) * stride + x + 1] = map->open_sums[y * stride + x + 1] + row;
+        }
+    }
+}
+
+// Range [*lo, *hi] along one axis where lines from the cell's [cell_lo, cell_hi] to the sphere's
+// [s_lo, s_hi] cross the plane, given the range of how far along them it is.
+static void PenumbraRange(float cell_lo, float cell_hi, float s_lo, float s_hi, float t_lo, float t_hi, float* lo, float* hi)
+{
+    // p + (q - p) t is bilinear in (p, t) and (q, t), so its extremes are at the corners.
+    const float ps[2] = { cell_lo, cell_hi };
+    const float qs[2] = { s_lo, s_hi };
+    const float ts[2] = { t_lo, t_hi };
+    *lo = INFINITY;
+    *hi = -INFINITY;
+    for (float p : ps)
+    {
+        for (float q : qs)
+        {
+            for (float t : ts)
+            {
+                float x = p + (q - p) * t;
+                *lo = fminf(*lo, x);
+                *hi = fmaxf(*hi, x);
+            }
+        }
+    }
+}
+
+// True when every line from the cell to the sphere, which is behind the plane, crosses it on
+// covered texels only.
+static bool HiddenBehind(const PvsCellBounds& cell, const OcclusionMap& map, Vector3 s, float r)
+{
+    // How far along a line from the cell to the sphere the plane is: largest from the back of the
+    // cell to the front of the sphere, smallest the other way round.
+    float t_lo = (map.z - cell.max.z) / (s.z + r - cell.max.z);
+    float t_hi = (map.z - cell.min.z) / (s.z - r - cell.min.z);
+    float lo_x, hi_x, lo_y, hi_y;
+    PenumbraRange(cell.min.x, cell.max.x, s.x - r, s.x + r, t_lo, t_hi, &lo_x, &hi_x);
+    PenumbraRange(cell.min.y, cell.max.y, s.y - r, s.y + r, t_lo, t_hi, &lo_y, &hi_y);
+
+    // Lines leaving the map are outside every frustum of the cell; only the frustum test may
+    // drop a sphere for that, so a penumbra entirely off the map doesn't count as hidden.
+    int x_begin = std::max((int)floorf((lo_x - map.x0) / map.texel_x), 0);
+    int x_end = std::min((int)floorf((hi_x - map.x0) / map.texel_x) + 1, PVS_MAP_SIZE);
+    int y_begin = std::max((int)floorf((lo_y - map.y0) / map.texel_y), 0);
+    int y_end = std::min((int)floorf((hi_y - map.y0) / map.texel_y) + 1, PVS_MAP_SIZE);
+    if (x_begin >= x_end || y_begin >= y_end)
+    {
+        return false;
+    }
+    const int stride = PVS_MAP_SIZE + 1;
+    int open = map.open_sums[y_end * stride + x_end] - map.open_sums[y_begin * stride + x_end] -
+        map.open_sums[y_end * stride + x_begin] + map.open_sums[y_begin * stride + x_begin];
+    return open == 0;
+}
+
+/***************************  Build  ***************************/
+
+// Sets visible[i] for every sphere some ray from the cell may hit first.
+static void BuildCell(const PvsCellBounds& cell, const std::vector<Vector3>& centers, const std::vector<float>& radii,
+    std::vector<unsigned char>* visible, OcclusionMap* map)
+{
+    int count = (int)centers.size();
+    float near_z = cell.max.z + CAMERA_ORIGIN_DISTANCE;
+    std::vector<float> far_z(WorkerCount(), -INFINITY);
+    ParallelFor(0, count, PVS_MIN_CHUNK, [&](int worker, int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            float r = GrownRadius(radii[i], Distance(centers[i], cell.center) + cell.radius);
+            (*visible)[i] = !OutsideFrustum(cell, centers[i], r);
+            if ((*visible)[i])
+            {
+                far_z[worker] = fmaxf(far_z[worker], centers[i].z + r);
+            }
+        }
+    });
+    float far = *std::max_element(far_z.begin(), far_z.end());
+
+    // Occluders must be larger than the cell's ball, so their umbras widen behind them, and
+    // entirely past where the rays start.
+    std::vector<PvsOccluder> occluders;
+    for (int i = 0; i < count; i++)
+    {
+        float d = Distance(centers[i], cell.center);
+        float r = ShrunkRadius(radii[i], d + cell.radius);
+        if ((*visible)[i] && r > cell.radius && centers[i].z - r >= near_z)
+        {
+            occluders.push_back(PvsOccluder{ centers[i], r, r / d });
+        }
+    }
+    size_t kept = std::min(occluders.size(), (size_t)PVS_MAX_OCCLUDERS);
+    std::partial_sort(occluders.begin(), occluders.begin() + kept, occluders.end(),
+        [](const PvsOccluder& a, const PvsOccluder& b) { return a.score > b.score; });
+    occluders.resize(kept);
+
+    if (occluders.empty())
+    {
+        return;
+    }
+
+    // Half the planes go right behind occluders, where their umbras are widest, at the backs of
+    // evenly spaced quantiles of them by depth; the other half are spread evenly in log depth
+    // from there to the farthest sphere, where umbras from far apart have grown into each other.
+    std::vector<float> backs(occluders.size());
+    for (size_t i = 0; i < occluders.size(); i++)
+    {
+        backs[i] = occluders[i].center.z + occluders[i].radius;
+    }
+    std::sort(backs.begin(), backs.end());
+    std::vector<float> planes;
+    for (int plane = 1; plane <= PVS_PLANES / 2; plane++)
+    {
+        float z = backs[(plane * backs.size() + PVS_PLANES / 2 - 1) / (PVS_PLANES / 2) - 1];
+        if (planes.empty() || z > planes.back())
+        {
+            planes.push_back(z);
+        }
+    }
+    float near_depth = backs[0] - cell.min.z;
+    float far_depth = far - cell.min.z;
+    for (int plane = 1; plane <= PVS_PLANES - PVS_PLANES / 2 && far_depth > near_depth; plane++)
+    {
+        planes.push_back(cell.min.z + near_depth * powf(far_depth / near_depth, (float)plane / (PVS_PLANES - PVS_PLANES / 2 + 1)));
+    }
+    for (float plane_z : planes)
+    {
+        map->z = plane_z;
+        float reach = map->z - cell.min.z;
+        map->x0 = cell.min.x - PVS_SLOPE_X * reach;
+        map->y0 = cell.min.y - PVS_SLOPE_Y * reach;
+        map->texel_x = (cell.max.x - cell.min.x + 2.0f * PVS_SLOPE_X * reach) / PVS_MAP_SIZE;
+        map->texel_y = (cell.max.y - cell.min.y + 2.0f * PVS_SLOPE_Y * reach) / PVS_MAP_SIZE;
+        std::fill(map->covered.begin(), map->covered.end(), (unsigned char)0);
+
+        for (const PvsOccluder& o : occluders)
+        {
+            if (o.center.z + o.radius <= map->z)
+            {
+                RasterizeUmbra(cell, o, map);
+            }
+        }
+        BuildOpenSums(map);
+
+        ParallelFor(0, count, PVS_MIN_CHUNK, [&](int, int begin, int end)
+        {
+            for (int i = begin; i < end; i++)
+            {
+                if (!(*visible)[i])
+                {
+                    continue;
+                }
+                float r = GrownRadius(radii[i], Distance(centers[i], cell.center) + cell.radius);
+                if (centers[i].z - r >= map->z && HiddenBehind(cell, *map, centers[i], r))
+                {
+                    (*visible)[i] = 0;
+                }
+            }
+        });
+    }
+}
+
+void PotentiallyVisibleSet::Build(const SceneSnapshot& source)
+{
+    scene_version = source.version;
+    sphere_count = source.count;
+    std::vector<Vector3> centers(source.count);
+    std::vector<float> radii(source.count);
+    ParallelFor(0, source.count, PVS_MIN_CHUNK, [&](int, int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            Sphere sp = source.GetSphere(i);
+            centers[i] = sp.center;
+            radii[i] = sp.radius;
+        }
+    });
+
+    OcclusionMap map;
+    map.covered.resize(PVS_MAP_SIZE * PVS_MAP_SIZE);
+    map.open_sums.assign((PVS_MAP_SIZE + 1) * (PVS_MAP_SIZE + 1), 0);
+    std::vector<unsigned char> visible(source.count);
+    first.assign(1, 0);
+    spheres.clear();
+    for (int cell = 0; cell < PVS_CELL_COUNT; cell++)
+    {
+        BuildCell(CellBounds(cell), centers, radii, &visible, &map);
+        for (int i = 0; i < source.count; i++)
+        {
+            if (visible[i])
+            {
+                spheres.push_back(i);
+            }
+        }
+        first.push_back((int)spheres.size());
+    }
+}
+
+int PotentiallyVisibleSet::CellAt(Vector3 camera) const
+{
+    float size = CellSize();
+    float origin = -0.5f * PVS_REGION_SIZE;
+    int ix = (int)floorf((camera.x - CAMERA_ORIGIN.x - origin) / size);
+    int iy = (int)floorf((camera.y - CAMERA_ORIGIN.y - origin) / size);
+    int iz = (int)floorf((camera.z - CAMERA_ORIGIN.z - origin) / size);
+    if (first.size() != PVS_CELL_COUNT + 1 || ix < 0 || iy < 0 || iz < 0 ||
+        ix >= PVS_CELLS_PER_AXIS || iy >= PVS_CELLS_PER_AXIS || iz >= PVS_CELLS_PER_AXIS)
+    {
+        return -1;
+    }
+    return (iz * PVS_CELLS_PER_AXIS + iy) * PVS_CELLS_PER_AXIS + ix;
+}
+
+Vector3 PotentiallyVisibleSet::CellCenter(int cell) const
+{
+    return CellBounds(cell).center;
+}
+
+/***************************  Storage  ***************************/
+
+unsigned long long PvsKey(const SceneSnapshot& source)
+{
+    struct Settings
+    {
+        int version;
+        int cells_per_axis;
+        int planes;
+        int map_size;
+        int max_occluders;
+        float region_size;
+        float grazing_pad;
+        Vector3 camera_origin;
+        float viewport[3];
+    };
+    Settings settings = { PVS_VERSION, PVS_CELLS_PER_AXIS, PVS_PLANES, PVS_MAP_SIZE, PVS_MAX_OCCLUDERS, PVS_REGION_SIZE, BVH_GRAZING_PAD,
+        CAMERA_ORIGIN, { VIEWPORT_WIDTH, VIEWPORT_HEIGHT, CAMERA_ORIGIN_DISTANCE } };
+    return HashSceneSpheres(&settings, sizeof(settings), source);
+}
+
+bool PotentiallyVisibleSet::Save(const char* path, unsigned long long key) const
+{
+    FILE* out = NULL;
+    if (fopen_s(&out, path, "wb") != 0 || out == NULL)
+    {
+        return false;
+    }
+    PvsFileHeader header = {};
+    memcpy(header.magic, PVS_MAGIC, sizeof(PVS_MAGIC));
+    header.version = PVS_VERSION;
+    header.cell_count = PVS_CELL_COUNT;
+    header.key = key;
+    header.sphere_count = sphere_count;
+    header.entry_count = (int)spheres.size();
+    bool written = fwrite(&header, sizeof(header), 1, out) == 1 &&
+        fwrite(first.data(), sizeof(int), first.size(), out) == first.size() &&
+        fwrite(spheres.data(), sizeof(int), spheres.size(), out) == spheres.size();
+    written = fclose(out) == 0 && written;
+    if (!written)
+    {
+        remove(path);
+    }
+    return written;
+}
+
+bool PotentiallyVisibleSet::Load(const char* path, unsigned long long key, int sphere_count)
+{
+    FILE* in = NULL;
+    if (fopen_s(&in, path, "rb") != 0 || in == NULL)
+    {
+        return false;
+    }
+    PvsFileHeader header;
+    bool valid = fread(&header, sizeof(header), 1, in) == 1 && memcmp(header.magic, PVS_MAGIC, sizeof(PVS_MAGIC)) == 0 &&
+        header.version == PVS_VERSION && header.cell_count == PVS_CELL_COUNT && header.key == key && header.sphere_count == sphere_count && header.entry_count >= 0 &&
+        header.entry_count <= sphere_count * PVS_CELL_COUNT;
+    std::vector<int> loaded_first(PVS_CELL_COUNT + 1);
+    std::vector<int> loaded_spheres;
+    if (valid)
+    {
+        loaded_spheres.resize(header.entry_count);
+        valid = fread(loaded_first.data(), sizeof(int), loaded_first.size(), in) == loaded_first.size() &&
+            fread(loaded_spheres.data(), sizeof(int), loaded_spheres.size(), in) == loaded_spheres.size();
+    }
+    fclose(in);
+
+    // The key covers the spheres, but not a truncated or corrupt file.
+    for (int cell = 0; valid && cell < PVS_CELL_COUNT; cell++)
+    {
+        valid = loaded_first[cell] <= loaded_first[cell + 1];
+    }
+    valid = valid && loaded_first[0] == 0 && loaded_first[PVS_CELL_COUNT] == header.entry_count;
+    for (size_t i = 0; valid && i < loaded_spheres.size(); i++)
+    {
+        valid = loaded_spheres[i] >= 0 && loaded_spheres[i] < sphere_count;
+    }
+    if (!valid)
+    {
+        return false;
+    }
+    first.swap(loaded_first);
+    spheres.swap(loaded_spheres);
+    this->sphere_count = sphere_count;
+    return true;
+}
+
+void BuildPvsCached(const SceneSnapshot& source, PotentiallyVisibleSet* pvs)
+{
+    if (source.count < PVS_FILE_MIN_SPHERES || pvs_path == NULL || pvs_path[0] == '\0')
+    {
+        pvs->Build(source);
+        return;
+    }
+    unsigned long long key = PvsKey(source);
+    if (pvs->Load(pvs_path, key, source.count))
+    {
+        pvs->scene_version = source.version;
+        return;
+    }
+    pvs->Build(source);
+    if (!pvs->Save(pvs_path, key))
+    {
+        TraceLog(LOG_WARNING, "Could not write the visible sets '%s'", pvs_path);
+    }
+}
+
+/***************************  Rendering  ***************************/
+
+void DrawScenePvs(Image* img, PotentiallyVisibleSet* pvs)
+{
+    if (pvs->scene_version != frame_scene->version)
+    {
+        BuildPvsCached(*frame_scene, pvs);
+    }
+
+    int cell = pvs->CellAt(CAMERA_ORIGIN);
+    for (int y = -CANVAS_HEIGHT / 2; y < CANVAS_HEIGHT / 2; y++)
+    {
+        for (int x = -CANVAS_WIDTH / 2; x < CANVAS_WIDTH / 2; x++)
+        {
+            Vector2Int canvas_pos = { x,y };
+            Ray r = CanvasRay(canvas_pos);
+            RayHit hit;
+            int tests;
+            if (cell < 0)
+            {
+                hit = TraceRayHit(r, 1.0f, INFINITY);
+                tests = frame_scene->count;
+                render_stats.intersection_tests += tests;
+            }
+            else
+            {
+                hit = ClosestHit(r, 1.0f, INFINITY, pvs->CellSpheres(cell), pvs->CellSphereCount(cell));
+                tests = pvs->CellSphereCount(cell);
+            }
+            Color col = hit.sphere < 0 ? BACKGROUND_COLOR : frame_scene->GetSphere(hit.sphere).color;
+            CaptureHit(x, y, hit);
+            render_stats.primary_rays++;
+            canvas_pos = CanvasToScreen(canvas_pos);
+            RecordPixelCost(canvas_pos.x, canvas_pos.y, tests);
+            SetPixel(img, canvas_pos.x, canvas_pos.y, col);
+        }
+    }
+}
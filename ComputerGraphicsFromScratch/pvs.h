@@ -0,0 +1,103 @@
+/**********************************************************************************************
+*
+*   Precomputed potentially visible sets for a region of camera positions
+*
+*   A static scene seen from a bounded region (a kiosk, a fixed installation) hides most of its
+*   spheres behind a few large ones from everywhere in that region. This splits the region, a
+*   cube of PVS_REGION_SIZE around CAMERA_ORIGIN, into PVS_CELLS_PER_AXIS^3 cells and finds for
+*   every cell a conservative set of the spheres some primary ray from some point of the cell can
+*   hit first. Tracing then only tests the set of the cell the camera is in.
+*
+*   A sphere is left out of a cell's set when, from every point of the cell:
+*     - it is outside the view frustum, or in front of the near end of the rays (t = 1)
+*     - or it is hidden by extended projections (Durand et al. 2000): at up to PVS_PLANES
+*       depths, half right behind quantiles of the occluders and half spread out behind them,
+*       the umbra every large occluder in front casts from the whole cell (the region
+*       behind it inside the cone tangent to it and to the cell's bounding ball) is rasterized
+*       into an occlusion map, where neighbouring umbras fuse. A sphere behind the plane whose
+*       penumbra there (every line from the cell to it) lands on covered texels only is hidden.
+*   Radii are corrected by the grazing pad of BVH_GRAZING_PAD both ways, occluders shrunk and the
+*   rest grown, so rounding in the intersection test can't let a ray through a gap the sets
+*   assume closed.
+*
+*   The sets are stored next to the scene in --pvs-file=<path>, under a key hashing its spheres
+*   like the BVH cache (see bvh_cache.h), and loaded from there when the scene comes back.
+*
+**********************************************************************************************/
+
+#ifndef PVS_H
+#define PVS_H
+
+#include "raytracer.h"
+#include "scene_snapshot.h"
+#include <vector>
+
+#define PVS_VERSION 1
+
+// Edge of the cube of camera positions, centered on CAMERA_ORIGIN, and cells along each of its
+// axes; odd, so CAMERA_ORIGIN is at the center of a cell.
+#define PVS_REGION_SIZE 0.75f
+#define PVS_CELLS_PER_AXIS 3
+
+// Depths occluders are fused at, at most.
+#define PVS_PLANES 8
+
+// Texels per axis of an occlusion map.
+#define PVS_MAP_SIZE 256
+
+// Largest occluders, by the angle they subtend, rasterized per cell.
+#define PVS_MAX_OCCLUDERS 256
+
+// Smaller scenes are quicker to build the sets of than to read them back, so they are never stored.
+#define PVS_FILE_MIN_SPHERES 4096
+
+// Sets are written to this file, set with --pvs-file=<path>; empty turns it off.
+extern const char* pvs_path;
+
+struct PvsFileHeader
+{
+    char magic[8];
+    int version;
+    int cell_count;
+    unsigned long long key;
+    int sphere_count;
+    int entry_count;
+};
+
+class PotentiallyVisibleSet
+{
+public:
+    void Build(const SceneSnapshot& source);
+
+    bool Save(const char* path, unsigned long long key) const;
+
+    // False, leaving the sets untouched, unless the file holds sets of sphere_count spheres under key.
+    bool Load(const char* path, unsigned long long key, int sphere_count);
+
+    // Cell of a camera position, -1 outside the region.
+    int CellAt(Vector3 camera) const;
+    Vector3 CellCenter(int cell) const;
+
+    // Dense indices of the spheres visible from a cell, in ascending order.
+    const int* CellSpheres(int cell) const { return spheres.data() + first[cell]; }
+    int CellSphereCount(int cell) const { return first[cell + 1] - first[cell]; }
+    size_t EntryCount() const { return spheres.size(); }
+
+    unsigned long long scene_version = 0;
+
+private:
+    int sphere_count = 0;
+    std::vector<int> first; // per cell, then the end
+    std::vector<int> spheres;
+};
+
+unsigned long long PvsKey(const SceneSnapshot& source);
+
+// Build, through the file of pvs_path.
+void BuildPvsCached(const SceneSnapshot& source, PotentiallyVisibleSet* pvs);
+
+// Rebuilds the sets whenever frame_scene changes, then traces the canvas testing only the set of
+// the camera's cell, in the current precision tier; outside the region, every sphere.
+void DrawScenePvs(Image* img, PotentiallyVisibleSet* pvs);
+
+#endif //PVS_H
@@ -0,0 +1,139 @@
+#include "quadtree_preview.h"
+#include "render_stats.h"
+#include "scene_snapshot.h"
+#include "validation.h"
+
+#define SAMPLE_UNTRACED -2
+
+// Hit sphere of every pixel traced this frame, indexed by canvas position.
+static int samples[CANVAS_WIDTH * CANVAS_HEIGHT];
+
+static int SamplePixel(int x, int y, const int* candidates, int candidate_count)
+{
+    int* sample = &samples[(y + CANVAS_HEIGHT / 2) * CANVAS_WIDTH + (x + CANVAS_WIDTH / 2)];
+    if (*sample == SAMPLE_UNTRACED)
+    {
+        Vector2Int canvas_pos = { x, y };
+        RayHit hit = ClosestHit(CanvasRay(canvas_pos), 1.0f, INFINITY, candidates, candidate_count);
+        *sample = hit.sphere;
+        CaptureHit(x, y, hit);
+
+        Vector2Int screen_pos = CanvasToScreen(canvas_pos);
+        RecordPixelCost(screen_pos.x, screen_pos.y, candidate_count);
+        render_stats.primary_rays++;
+    }
+    return *sample;
+}
+
+static Color SampleColor(int sphere)
+{
+    return sphere < 0 ? BACKGROUND_COLOR : frame_scene->GetSphere(sphere).color;
+}
+
+static bool RectsOverlap(const CanvasRect& a, const CanvasRect& b)
+{
+    return a.x0 <= b.x1 && b.x0 <= a.x1 && a.y0 <= b.y1 && b.y0 <= a.y1;
+}
+
+// Edge check for a block whose corners all agree on one sphere (or on a miss). A sphere's silhouette
+// is convex, so corners inside it put the whole block inside it; what corners can't see is another,
+// possibly thin, sphere poking into the block. Any such sphere the block's beam may touch, and that
+// isn't entirely behind the agreed one, forces a split.
+static bool BlockIsUniform(const CanvasRect& block, int sphere, const TileBins& bins, const int* candidates, int candidate_count)
+{
+    if (sphere >= 0 && frame_scene->GetSphere(sphere).center.z - frame_scene->GetSphere(sphere).radius < CAMERA_ORIGIN_DISTANCE)
+    {
+        return false; // clipped by t = 1, the silhouette is no longer convex
+    }
+
+    Beam beam;
+    bool beam_built = false;
+    for (int i = 0; i < candidate_count; i++)
+    {
+        int other = candidates[i];
+        if (other == sphere || !RectsOverlap(bins.bounds[other], block))
+        {
+            continue;
+        }
+        if (sphere >= 0 && SphereInFrontOf(frame_scene->GetSphere(sphere), frame_scene->GetSphere(other)))
+        {
+            continue;
+        }
+        if (!beam_built)
+        {
+            beam = BuildBeam(block);
+            beam_built = true;
+        }
+        if (BeamMayHitSphere(beam, frame_scene->GetSphere(other)))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void DrawBlock(Image* img, CanvasRect block, const TileBins& bins, const int* candidates, int candidate_count)
+{
+    int corners[4] =
+    {
+        SamplePixel(block.x0, block.y0, candidates, candidate_count),
+        SamplePixel(block.x1, block.y0, candidates, candidate_count),
+        SamplePixel(block.x0, block.y1, candidates, candidate_count),
+        SamplePixel(block.x1, block.y1, candidates, candidate_count)
+    };
+
+    // Down to 2x2 every pixel is a corner, so each one gets its own sample.
+    if (block.x1 - block.x0 < 2)
+    {
+        for (int x = block.x0; x <= block.x1; x++)
+        {
+            for (int y = block.y0; y <= block.y1; y++)
+            {
+                Vector2Int screen_pos = CanvasToScreen(Vector2Int{ x, y });
+                SetPixel(img, screen_pos.x, screen_pos.y, SampleColor(SamplePixel(x, y, candidates, candidate_count)));
+            }
+        }
+        return;
+    }
+
+    if (corners[0] == corners[1] && corners[0] == corners[2] && corners[0] == corners[3]
+        && BlockIsUniform(block, corners[0], bins, candidates, candidate_count))
+    {
+        FillCanvasRect(img, block, SampleColor(corners[0]));
+        CaptureFill(block, corners[0]);
+        return;
+    }
+
+    int mid_x = (block.x0 + block.x1) / 2;
+    int mid_y = (block.y0 + block.y1) / 2;
+    DrawBlock(img, CanvasRect{ block.x0, block.y0, mid_x, mid_y }, bins, candidates, candidate_count);
+    DrawBlock(img, CanvasRect{ mid_x + 1, block.y0, block.x1, mid_y }, bins, candidates, candidate_count);
+    DrawBlock(img, CanvasRect{ block.x0, mid_y + 1, mid_x, block.y1 }, bins, candidates, candidate_count);
+    DrawBlock(img, CanvasRect{ mid_x + 1, mid_y + 1, block.x1, block.y1 }, bins, candidates, candidate_count);
+}
+
+void DrawScenePreview(Image* img, const TileBins& bins)
+{
+    for (int i = 0; i < CANVAS_WIDTH * CANVAS_HEIGHT; i++)
+    {
+        samples[i] = SAMPLE_UNTRACED;
+    }
+
+    for (int tile_y = 0; tile_y < TILE_COUNT_Y; tile_y++)
+    {
+        for (int tile_x = 0; tile_x < TILE_COUNT_X; tile_x++)
+        {
+            int tile = tile_y * TILE_COUNT_X + tile_x;
+            int candidate_count = bins.first[tile + 1] - bins.first[tile];
+            if (candidate_count == 0)
+            {
+                render_stats.tiles_empty++;
+                FillTile(img, tile_x, tile_y, BACKGROUND_COLOR);
+                CaptureFill(TileCanvasRect(tile_x, tile_y), -1);
+                continue;
+            }
+            render_stats.tiles_traced++;
+            DrawBlock(img, TileCanvasRect(tile_x, tile_y), bins, &bins.spheres[bins.first[tile]], candidate_count);
+        }
+    }
+}
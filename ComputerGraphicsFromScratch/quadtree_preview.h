@@ -0,0 +1,19 @@
+/**********************************************************************************************
+*
+*   Adaptive quadtree preview
+*
+*   Each binned tile is treated as the root of a quadtree. Only the corners of a block are traced;
+*   when they all hit the same sphere, or all miss, and an edge check finds no other sphere that
+*   could reach into the block, the block is filled with that one color. Otherwise it is split in
+*   four, down to single pixels. Corner samples are cached so that no pixel is traced twice.
+*
+**********************************************************************************************/
+
+#ifndef QUADTREE_PREVIEW_H
+#define QUADTREE_PREVIEW_H
+
+#include "tile_binning.h"
+
+void DrawScenePreview(Image* img, const TileBins& bins);
+
+#endif //QUADTREE_PREVIEW_H
@@ -0,0 +1,120 @@
+#include "raytracer.h"
+#include "precision.h"
+#include "render_stats.h"
+#include "scene_snapshot.h"
+#include <raymath.h>
+
+void SetPixel(Image* buf, int x, int y, Color c) {
+    ImageDrawPixel(buf, x, y, c);
+}
+
+RayIntersection IntersectRaySphere(Ray R, Sphere sp)
+{
+    float r = sp.radius;
+    Vector3 CO = Vector3Subtract(CAMERA_ORIGIN, sp.center);
+
+    float a = Vector3DotProduct(R.direction, R.direction);
+    float b = 2.0f * Vector3DotProduct(CO, R.direction);
+    float c = Vector3DotProduct(CO, CO) - r*r;
+
+    float discriminant = (b * b) - (4.0f * a * c);
+    if (discriminant < 0.0f)
+    {
+        return RayIntersection{ INFINITY, INFINITY };
+    }
+
+    RayIntersection collision;
+    collision.t1 = (-b + sqrtf(discriminant)) / (2.0f * a);
+    collision.t2 = (-b - sqrtf(discriminant)) / (2.0f * a);
+    return collision;
+}
+
+Vector2Int CanvasToScreen(Vector2Int canvas_point)
+ {
+    int sx = (CANVAS_WIDTH  / 2) + canvas_point.x;
+    int sy = (CANVAS_HEIGHT / 2) - canvas_point.y;
+    return Vector2Int{ sx, sy };
+}
+
+Vector3 CanvasToViewport(Vector2Int canvas_point)
+{
+    float vx = (float)canvas_point.x * (VIEWPORT_WIDTH / CANVAS_WIDTH);
+    float vy = (float)canvas_point.y * (VIEWPORT_HEIGHT / CANVAS_HEIGHT);
+    return Vector3{ vx, vy, CAMERA_ORIGIN_DISTANCE };
+}
+
+Ray CanvasRay(Vector2Int canvas_point)
+{
+    Vector3 viewport_pos = CanvasToViewport(canvas_point);
+    Vector3 ray_direction = Vector3Subtract(viewport_pos, CAMERA_ORIGIN);
+    return Ray{ CAMERA_ORIGIN, ray_direction };
+}
+
+static void ClosestIntersection(Ray r, float tmin, float tmax, int sphere, RayHit* closest)
+{
+    RayIntersection collision = IntersectRaySphere(r, frame_scene->GetSphere(sphere));
+
+    if (collision.t1 != INFINITY
+        && collision.t2 != INFINITY)
+    {
+        if (collision.t1 >= tmin
+            && collision.t1 <= tmax
+            && collision.t1 < closest->t)
+        {
+            closest->t = collision.t1;
+            closest->sphere = sphere;
+        }
+        if (collision.t2 >= tmin
+            && collision.t2 <= tmax
+            && collision.t2 < closest->t)
+        {
+            closest->t = collision.t2;
+            closest->sphere = sphere;
+        }
+    }
+}
+
+RayHit TraceRayHit(Ray r, float tmin, float tmax)
+{
+    RayHit closest = { -1, INFINITY };
+    for (int i = 0; i < frame_scene->count; i++)
+    {
+        ClosestIntersection(r, tmin, tmax, i, &closest);
+    }
+    return closest;
+}
+
+Color TraceRay(Image* img, Ray r, float tmin, float tmax)
+{
+    render_stats.intersection_tests += frame_scene->count;
+    RayHit closest = TraceRayHit(r, tmin, tmax);
+    if (closest.sphere < 0)
+    {
+        return BACKGROUND_COLOR;
+    }
+    return frame_scene->GetSphere(closest.sphere).color;
+}
+
+RayHit ClosestHit(Ray r, float tmin, float tmax, const int* candidates, int candidate_count)
+{
+    render_stats.intersection_tests += candidate_count;
+    switch (precision_tier)
+    {
+    case PRECISION_DOUBLE:
+        return ClosestHitT<PrecisionDouble>(r, tmin, tmax, candidates, candidate_count);
+    case PRECISION_FAST:
+        return ClosestHitT<PrecisionFast>(r, tmin, tmax, candidates, candidate_count);
+    default:
+        return ClosestHitT<PrecisionFloat>(r, tmin, tmax, candidates, candidate_count);
+    }
+}
+
+Color TraceRayCandidates(Ray r, float tmin, float tmax, const int* candidates, int candidate_count)
+{
+    RayHit closest = ClosestHit(r, tmin, tmax, candidates, candidate_count);
+    if (closest.sphere < 0)
+    {
+        return BACKGROUND_COLOR;
+    }
+    return frame_scene->GetSphere(closest.sphere).color;
+}
@@ -0,0 +1,76 @@
+/**********************************************************************************************
+*
+*   Raytracer core: scene, camera/canvas conversions and ray-sphere intersection
+*
+**********************************************************************************************/
+
+#ifndef RAYTRACER_H
+#define RAYTRACER_H
+
+#include <raylib.h>
+
+#define CAMERA_ORIGIN_DISTANCE 1.0f
+#define VIEWPORT_WIDTH 1.0f
+#define VIEWPORT_HEIGHT 1.0f
+#define CANVAS_WIDTH 800
+#define CANVAS_HEIGHT 800
+#define BACKGROUND_COLOR WHITE
+
+struct Vector2Int
+{
+    int x;
+    int y;
+};
+
+struct Sphere
+{
+    Vector3 center;
+    float radius;
+    Color color;
+};
+
+struct RayIntersection
+{
+    float t1;
+    float t2;
+};
+
+// Closest hit of a ray; sphere is a dense index into the scene (see scene.h), -1 when nothing was hit.
+struct RayHit
+{
+    int sphere;
+    float t;
+};
+
+constexpr Vector3 CAMERA_ORIGIN = { 0 };
+constexpr Vector3 CAMERA_LOOK_DIRECTION = { 0, 0, 1 };
+
+// The scene embedded in the program. The runtime scene starts out as a copy of it, and the compile-time
+// scene in static_scene.h is built from it directly.
+constexpr Sphere DEFAULT_SCENE[] =
+{
+        Sphere{ Vector3{ 0.0f, -1.0f, 3.0f }, 1.0f , RED},
+        Sphere{ Vector3{ 2.0f, 0.0f, 4.0f }, 1.0f , BLUE },
+        Sphere{ Vector3{ -2.0f, 0.0f, 4.0f }, 1.0f , GREEN }
+};
+constexpr int DEFAULT_SCENE_COUNT = sizeof(DEFAULT_SCENE) / sizeof(DEFAULT_SCENE[0]);
+
+void SetPixel(Image* buf, int x, int y, Color c);
+
+RayIntersection IntersectRaySphere(Ray R, Sphere sp);
+
+Vector2Int CanvasToScreen(Vector2Int canvas_point);
+Vector3 CanvasToViewport(Vector2Int canvas_point);
+
+// Primary ray through a canvas point, as built by DrawScene.
+Ray CanvasRay(Vector2Int canvas_point);
+
+// Closest hit against every sphere in the scene. Always float, and kept as the plain reference.
+Color TraceRay(Image* img, Ray r, float tmin, float tmax);
+RayHit TraceRayHit(Ray r, float tmin, float tmax);
+
+// Closest hit against a subset of the scene, given as dense indices, in the current precision tier.
+RayHit ClosestHit(Ray r, float tmin, float tmax, const int* candidates, int candidate_count);
+Color TraceRayCandidates(Ray r, float tmin, float tmax, const int* candidates, int candidate_count);
+
+#endif //RAYTRACER_H
@@ -0,0 +1,89 @@
+#include "render_stats.h"
+#include "raytracer.h"
+#include <string.h>
+
+RenderStats render_stats = { 0 };
+
+static int pixel_cost[CANVAS_WIDTH * CANVAS_HEIGHT];
+
+void ResetRenderStats()
+{
+    const char* mode = render_stats.mode;
+    const char* isa = render_stats.isa;
+    const char* precision = render_stats.precision;
+    render_stats = RenderStats{ 0 };
+    render_stats.mode = mode;
+    render_stats.isa = isa;
+    render_stats.precision = precision;
+    memset(pixel_cost, 0, sizeof(pixel_cost));
+}
+
+void DrawRenderStats(int x, int y)
+{
+    const int font_size = 10;
+    const int line = font_size + 2;
+    const long long pixels = (long long)CANVAS_WIDTH * CANVAS_HEIGHT;
+    double traced = (double)render_stats.primary_rays / (double)pixels;
+
+    DrawRectangle(x - 4, y - 4, 330, 5 * line + 8, Fade(BLACK, 0.6f));
+    if (render_stats.strategy != NULL)
+    {
+        DrawText(TextFormat("mode: %s (%s), kernels: %s, precision: %s", render_stats.mode, render_stats.strategy, render_stats.isa,
+            render_stats.precision), x, y, font_size, RAYWHITE);
+        DrawText(TextFormat("frame: %.2f ms, predicted %.2f ms", render_stats.frame_ms, render_stats.predicted_ms), x, y + line, font_size, RAYWHITE);
+    }
+    else
+    {
+        DrawText(TextFormat("mode: %s, kernels: %s, precision: %s", render_stats.mode, render_stats.isa, render_stats.precision), x, y, font_size, RAYWHITE);
+        DrawText(TextFormat("frame: %.2f ms", render_stats.frame_ms), x, y + line, font_size, RAYWHITE);
+    }
+    DrawText(TextFormat("tiles: %d empty, %d covered, %d traced",
+        render_stats.tiles_empty, render_stats.tiles_covered, render_stats.tiles_traced), x, y + 2 * line, font_size, RAYWHITE);
+    DrawText(TextFormat("primary rays: %lld (%.1f%% saved)",
+        render_stats.primary_rays, 100.0 * (1.0 - traced)), x, y + 3 * line, font_size, RAYWHITE);
+    DrawText(TextFormat("sphere tests: %lld, shadow rays: %lld", render_stats.intersection_tests, render_stats.shadow_rays), x, y + 4 * line, font_size, RAYWHITE);
+}
+
+void RecordPixelCost(int x, int y, int sphere_tests)
+{
+    if (x < 0 || x >= CANVAS_WIDTH || y < 0 || y >= CANVAS_HEIGHT)
+    {
+        return;
+    }
+    pixel_cost[y * CANVAS_WIDTH + x] += sphere_tests;
+}
+
+void RecordUniformPixelCost(int sphere_tests)
+{
+    for (int i = 0; i < CANVAS_WIDTH * CANVAS_HEIGHT; i++)
+    {
+        pixel_cost[i] += sphere_tests;
+    }
+}
+
+void DrawHeatmap(Image* img)
+{
+    int max_cost = 1;
+    for (int i = 0; i < CANVAS_WIDTH * CANVAS_HEIGHT; i++)
+    {
+        if (pixel_cost[i] > max_cost)
+        {
+            max_cost = pixel_cost[i];
+        }
+    }
+
+    for (int y = 0; y < CANVAS_HEIGHT; y++)
+    {
+        for (int x = 0; x < CANVAS_WIDTH; x++)
+        {
+            int cost = pixel_cost[y * CANVAS_WIDTH + x];
+            Color c = BLACK;
+            if (cost > 0)
+            {
+                float heat = (float)cost / (float)max_cost;
+                c = ColorFromHSV(240.0f * (1.0f - heat), 1.0f, 1.0f);
+            }
+            SetPixel(img, x, y, c);
+        }
+    }
+}
@@ -0,0 +1,44 @@
+/**********************************************************************************************
+*
+*   Per-frame render statistics, drawn as an overlay on top of the canvas, and a heatmap of how
+*   many sphere tests each pixel cost
+*
+**********************************************************************************************/
+
+#ifndef RENDER_STATS_H
+#define RENDER_STATS_H
+
+#include <raylib.h>
+
+struct RenderStats
+{
+    const char* mode;
+    const char* isa;       // tracing kernel variant in use
+    const char* precision; // precision tier of ClosestHit
+    const char* strategy;  // strategy the auto mode drew with, NULL in other modes
+    double predicted_ms;   // the auto mode's prediction for it
+    int tiles_empty;
+    int tiles_covered;
+    int tiles_traced;
+    long long primary_rays;
+    long long intersection_tests;
+    long long shadow_rays;
+    double frame_ms;
+};
+
+extern RenderStats render_stats;
+
+void ResetRenderStats();
+void DrawRenderStats(int x, int y);
+
+// Accumulates the sphere tests spent on a pixel, in screen coordinates.
+void RecordPixelCost(int x, int y, int sphere_tests);
+
+// Same cost for every pixel, for renderers that trace the whole canvas.
+void RecordUniformPixelCost(int sphere_tests);
+
+// Overwrites the image with the per-pixel cost of the last frame: black for pixels that were
+// filled without tracing, then blue through red up to the most expensive pixel.
+void DrawHeatmap(Image* img);
+
+#endif //RENDER_STATS_H
@@ -0,0 +1,231 @@
+#include "renderer.h"
+#include "accel_select.h"
+#include "bvh.h"
+#include "bvh_lod.h"
+#include "compact_scene.h"
+#include "lighting.h"
+#include "out_of_core_bvh.h"
+#include "packet_bvh.h"
+#include "path_tracer.h"
+#include "pvs.h"
+#include "quadtree_preview.h"
+#include "raytracer.h"
+#include "render_stats.h"
+#include "scene_snapshot.h"
+#include "spatial_hash.h"
+#include "static_scene.h"
+#include "tile_binning.h"
+#include "trace_kernels.h"
+#include "validation.h"
+#include "wide_bvh.h"
+#include <string.h>
+#include <vector>
+
+const char* render_mode_names[RENDER_MODE_COUNT] = { "tiled", "quadtree preview", "reference", "compile-time scene", "simd kernels", "bvh", "wide bvh", "bvh packets", "out of core bvh", "spatial hash", "compact", "bvh lod", "pvs", "lit", "path traced", "auto" };
+
+const char* scene_storage_names[STORAGE_COUNT] = { "spheres", "compact", "treelets" };
+SceneStorage scene_storage = STORAGE_SPHERES;
+
+bool ParseSceneStorage(const char* name, SceneStorage* storage)
+{
+    for (int i = 0; i < STORAGE_COUNT; i++)
+    {
+        if (strcmp(name, scene_storage_names[i]) == 0)
+        {
+            *storage = (SceneStorage)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+RenderMode StorageRenderMode(SceneStorage storage)
+{
+    return storage == STORAGE_COMPACT ? RENDER_COMPACT : (storage == STORAGE_TREELETS ? RENDER_OUT_OF_CORE : RENDER_AUTO);
+}
+
+static TileBins bins;
+static std::vector<int> visible;
+static SphereSoA sphere_soa;
+static HitBuffer hits;
+static Bvh bvh;
+static Bvh wide_source;
+static WideBvh wide_bvh;
+static Bvh packet_bvh;
+static Bvh out_of_core_source;
+static SpatialHashGrid spatial_hash;
+static Bvh lod_source;
+static BvhLod bvh_lod;
+static PotentiallyVisibleSet pvs;
+static TileLights tile_lights;
+static PathQueues path_queues;
+static std::vector<CanvasPixel> canvas_pixels(CANVAS_WIDTH * CANVAS_HEIGHT);
+
+CanvasPixel* CanvasPixelBuffer()
+{
+    return canvas_pixels.data();
+}
+
+void WriteCanvasPixels(Image* img)
+{
+    for (int row = 0; row < CANVAS_HEIGHT; row++)
+    {
+        for (int column = 0; column < CANVAS_WIDTH; column++)
+        {
+            const CanvasPixel& pixel = canvas_pixels[row * CANVAS_WIDTH + column];
+            Vector2Int canvas_pos = { column - CANVAS_WIDTH / 2, row - CANVAS_HEIGHT / 2 };
+            CaptureHit(canvas_pos.x, canvas_pos.y, pixel.hit);
+            render_stats.primary_rays++;
+            render_stats.intersection_tests += pixel.tests;
+            render_stats.shadow_rays += pixel.shadow_rays;
+            Vector2Int screen = CanvasToScreen(canvas_pos);
+            RecordPixelCost(screen.x, screen.y, pixel.tests);
+            SetPixel(img, screen.x, screen.y, pixel.color);
+        }
+    }
+}
+
+void DrawSceneReference(Image* img)
+{
+    for (int x = -CANVAS_WIDTH / 2; x < CANVAS_WIDTH / 2; x++)
+    {
+        for (int y = -CANVAS_HEIGHT / 2; y < CANVAS_HEIGHT / 2; y++)
+        {
+            Vector2Int canvas_pos = { x,y };
+            Ray r = CanvasRay(canvas_pos);
+
+            RayHit hit = TraceRayHit(r, 1.0f, INFINITY);
+            render_stats.intersection_tests += frame_scene->count;
+            Color col = hit.sphere < 0 ? BACKGROUND_COLOR : frame_scene->GetSphere(hit.sphere).color;
+            CaptureHit(x, y, hit);
+            render_stats.primary_rays++;
+            canvas_pos = CanvasToScreen(canvas_pos);
+            RecordPixelCost(canvas_pos.x, canvas_pos.y, frame_scene->count);
+            SetPixel(img, canvas_pos.x, canvas_pos.y, col);
+        }
+    }
+}
+
+void DrawSceneTiled(Image* img)
+{
+    visible.resize(frame_scene->count);
+
+    for (int tile_y = 0; tile_y < TILE_COUNT_Y; tile_y++)
+    {
+        for (int tile_x = 0; tile_x < TILE_COUNT_X; tile_x++)
+        {
+            int tile = tile_y * TILE_COUNT_X + tile_x;
+            int candidate_count = bins.first[tile + 1] - bins.first[tile];
+            if (candidate_count == 0)
+            {
+                render_stats.tiles_empty++;
+                FillTile(img, tile_x, tile_y, BACKGROUND_COLOR);
+                CaptureFill(TileCanvasRect(tile_x, tile_y), -1);
+                continue;
+            }
+            const int* candidates = &bins.spheres[bins.first[tile]];
+
+            int visible_count = 0;
+            int covering_sphere = -1;
+            TileCoverage coverage = ClassifyTileBeam(tile_x, tile_y, candidates, candidate_count,
+                visible.data(), &visible_count, &covering_sphere);
+            if (coverage == TILE_EMPTY)
+            {
+                render_stats.tiles_empty++;
+                FillTile(img, tile_x, tile_y, BACKGROUND_COLOR);
+                CaptureFill(TileCanvasRect(tile_x, tile_y), -1);
+                continue;
+            }
+            if (coverage == TILE_COVERED)
+            {
+                render_stats.tiles_covered++;
+                FillTile(img, tile_x, tile_y, frame_scene->GetSphere(covering_sphere).color);
+                CaptureFill(TileCanvasRect(tile_x, tile_y), covering_sphere);
+                continue;
+            }
+            render_stats.tiles_traced++;
+
+            CanvasRect rect = TileCanvasRect(tile_x, tile_y);
+            for (int x = rect.x0; x <= rect.x1; x++)
+            {
+                for (int y = rect.y0; y <= rect.y1; y++)
+                {
+                    Vector2Int canvas_pos = { x,y };
+                    Ray r = CanvasRay(canvas_pos);
+
+                    RayHit hit = ClosestHit(r, 1.0f, INFINITY, visible.data(), visible_count);
+                    Color col = hit.sphere < 0 ? BACKGROUND_COLOR : frame_scene->GetSphere(hit.sphere).color;
+                    CaptureHit(x, y, hit);
+                    render_stats.primary_rays++;
+                    canvas_pos = CanvasToScreen(canvas_pos);
+                    RecordPixelCost(canvas_pos.x, canvas_pos.y, visible_count);
+                    SetPixel(img, canvas_pos.x, canvas_pos.y, col);
+                }
+            }
+        }
+    }
+}
+
+void DrawScene(Image* img, RenderMode mode)
+{
+    render_stats.mode = render_mode_names[mode];
+    switch (mode)
+    {
+    case RENDER_TILED:
+        BinSpheres(&bins);
+        DrawSceneTiled(img);
+        break;
+    case RENDER_PREVIEW:
+        BinSpheres(&bins);
+        DrawScenePreview(img, bins);
+        break;
+    case RENDER_STATIC:
+        DrawSceneStatic(img);
+        break;
+    case RENDER_KERNELS:
+        UpdateSphereSoA(*frame_scene, &sphere_soa);
+        ResizeHitBuffer(&hits);
+        DrawSceneKernels(img, *trace_kernels, sphere_soa, &hits);
+        if (captured_hits != NULL)
+        {
+            *captured_hits = hits;
+        }
+        break;
+    case RENDER_BVH:
+        DrawSceneBvh(img, &bvh);
+        break;
+    case RENDER_WIDE_BVH:
+        DrawSceneWideBvh(img, &wide_source, &wide_bvh);
+        break;
+    case RENDER_BVH_PACKETS:
+        DrawSceneBvhPackets(img, &packet_bvh);
+        break;
+    case RENDER_OUT_OF_CORE:
+        DrawSceneOutOfCore(img, &out_of_core_source, &out_of_core);
+        break;
+    case RENDER_SPATIAL_HASH:
+        DrawSceneSpatialHash(img, &spatial_hash);
+        break;
+    case RENDER_COMPACT:
+        DrawSceneCompact(img, &compact_scene);
+        break;
+    case RENDER_BVH_LOD:
+        DrawSceneBvhLod(img, &lod_source, &bvh_lod);
+        break;
+    case RENDER_PVS:
+        DrawScenePvs(img, &pvs);
+        break;
+    case RENDER_LIT:
+        DrawSceneLit(img, &bvh, &tile_lights);
+        break;
+    case RENDER_PATH:
+        DrawScenePathTraced(img, &bvh, &path_queues);
+        break;
+    case RENDER_AUTO:
+        DrawSceneAuto(img);
+        break;
+    default:
+        DrawSceneReference(img);
+        break;
+    }
+}
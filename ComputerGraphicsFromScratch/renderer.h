@@ -0,0 +1,95 @@
+/**********************************************************************************************
+*
+*   Renderers for the canvas, selectable per frame
+*
+**********************************************************************************************/
+
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include "parallel.h"
+#include "raytracer.h"
+#include <raylib.h>
+
+enum RenderMode
+{
+    RENDER_TILED,
+    RENDER_PREVIEW,
+    RENDER_REFERENCE,
+    RENDER_STATIC,
+    RENDER_KERNELS,
+    RENDER_BVH,
+    RENDER_WIDE_BVH,
+    RENDER_BVH_PACKETS,
+    RENDER_OUT_OF_CORE,
+    RENDER_SPATIAL_HASH,
+    RENDER_COMPACT,
+    RENDER_BVH_LOD,
+    RENDER_PVS,
+    RENDER_LIT,
+    RENDER_PATH,
+    RENDER_AUTO,
+    RENDER_MODE_COUNT
+};
+
+extern const char* render_mode_names[RENDER_MODE_COUNT];
+
+// Where the spheres are kept, set with --storage=<spheres|compact|treelets>: in the Scene and its
+// snapshots, which every mode reads, or only in the storage of one mode, then the only one that
+// can draw them.
+enum SceneStorage
+{
+    STORAGE_SPHERES,
+    STORAGE_COMPACT,
+    STORAGE_TREELETS,
+    STORAGE_COUNT
+};
+
+extern const char* scene_storage_names[STORAGE_COUNT];
+extern SceneStorage scene_storage;
+
+bool ParseSceneStorage(const char* name, SceneStorage* storage);
+
+// The mode the window opens in: auto for spheres, otherwise the only one that can draw the storage.
+RenderMode StorageRenderMode(SceneStorage storage);
+
+void DrawScene(Image* img, RenderMode mode);
+
+// One pixel of a canvas traced by DrawCanvasParallel, until it is written out.
+struct CanvasPixel
+{
+    RayHit hit;      // captured when validating
+    Color color;
+    int tests;       // sphere tests spent on the pixel, shadow rays included
+    int shadow_rays;
+};
+
+// Buffer of CANVAS_WIDTH * CANVAS_HEIGHT pixels kept across frames, row by row from the top.
+CanvasPixel* CanvasPixelBuffer();
+
+// Captures, counts and draws every pixel of the buffer, in order.
+void WriteCanvasPixels(Image* img);
+
+// Calls trace(worker, canvas_pos, &pixel) for every canvas pixel, rows split across workers, then
+// writes the pixels out on this thread: the pixel stats and hit capture aren't safe to update from
+// several threads, and traced into a buffer first the image comes out the same with any number of
+// workers.
+template <typename Trace>
+void DrawCanvasParallel(Image* img, Trace trace)
+{
+    CanvasPixel* pixels = CanvasPixelBuffer();
+    ParallelFor(0, CANVAS_HEIGHT, 8, [&](int worker, int begin, int end)
+    {
+        for (int row = begin; row < end; row++)
+        {
+            for (int column = 0; column < CANVAS_WIDTH; column++)
+            {
+                Vector2Int canvas_pos = { column - CANVAS_WIDTH / 2, row - CANVAS_HEIGHT / 2 };
+                trace(worker, canvas_pos, &pixels[row * CANVAS_WIDTH + column]);
+            }
+        }
+    });
+    WriteCanvasPixels(img);
+}
+
+#endif //RENDERER_H
@@ -0,0 +1,176 @@
+#include "scene.h"
+
+Scene scene(DEFAULT_SCENE, DEFAULT_SCENE_COUNT);
+
+Scene::Scene(const Sphere* spheres, int count)
+    : journal_base(0)
+{
+    for (int i = 0; i < count; i++)
+    {
+        Add(spheres[i]);
+    }
+}
+
+void Scene::Store(int index, const Sphere& sp)
+{
+    center_x[index] = sp.center.x;
+    center_y[index] = sp.center.y;
+    center_z[index] = sp.center.z;
+    radius[index] = sp.radius;
+    color[index] = sp.color;
+}
+
+void Scene::Record(SceneChangeType type, SceneHandle handle, int index, int moved_from)
+{
+    // Dropping the oldest half at once keeps recording amortized O(1).
+    if ((int)journal.size() >= SCENE_JOURNAL_CAPACITY)
+    {
+        int dropped = SCENE_JOURNAL_CAPACITY / 2;
+        journal.erase(journal.begin(), journal.begin() + dropped);
+        journal_base += dropped;
+    }
+    journal.push_back(SceneChange{ type, handle, index, moved_from });
+}
+
+SceneHandle Scene::Add(const Sphere& sp)
+{
+    int slot;
+    if (!free_slots.empty())
+    {
+        slot = free_slots.back();
+        free_slots.pop_back();
+    }
+    else
+    {
+        slot = (int)slot_index.size();
+        slot_index.push_back(-1);
+        slot_generation.push_back(0);
+    }
+
+    int index = Count();
+    center_x.push_back(0.0f);
+    center_y.push_back(0.0f);
+    center_z.push_back(0.0f);
+    radius.push_back(0.0f);
+    color.push_back(BLANK);
+    owner.push_back(slot);
+    Store(index, sp);
+
+    slot_index[slot] = index;
+    SceneHandle handle = { slot, slot_generation[slot] };
+    Record(SCENE_SPHERE_ADDED, handle, index, -1);
+    return handle;
+}
+
+bool Scene::Remove(SceneHandle handle)
+{
+    int index = IndexOf(handle);
+    if (index < 0)
+    {
+        return false;
+    }
+
+    slot_index[handle.slot] = -1;
+    slot_generation[handle.slot]++;
+    free_slots.push_back(handle.slot);
+    Record(SCENE_SPHERE_REMOVED, handle, index, -1);
+
+    int last = Count() - 1;
+    if (index != last)
+    {
+        Store(index, GetSphere(last));
+        owner[index] = owner[last];
+        slot_index[owner[index]] = index;
+        Record(SCENE_SPHERE_MOVED, HandleAt(index), index, last);
+    }
+
+    center_x.pop_back();
+    center_y.pop_back();
+    center_z.pop_back();
+    radius.pop_back();
+    color.pop_back();
+    owner.pop_back();
+    return true;
+}
+
+bool Scene::Update(SceneHandle handle, const Sphere& sp)
+{
+    int index = IndexOf(handle);
+    if (index < 0)
+    {
+        return false;
+    }
+    Store(index, sp);
+    Record(SCENE_SPHERE_UPDATED, handle, index, -1);
+    return true;
+}
+
+void Scene::Clear()
+{
+    while (Count() > 0)
+    {
+        Remove(HandleAt(Count() - 1));
+    }
+}
+
+void Scene::Reorder(const std::vector<int>& order)
+{
+    std::vector<float> moved(order.size());
+    std::vector<float>* fields[] = { &center_x, &center_y, &center_z, &radius };
+    for (std::vector<float>* field : fields)
+    {
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            moved[i] = (*field)[order[i]];
+        }
+        field->swap(moved);
+    }
+    std::vector<Color> moved_color(order.size());
+    std::vector<int> moved_owner(order.size());
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        moved_color[i] = color[order[i]];
+        moved_owner[i] = owner[order[i]];
+        slot_index[moved_owner[i]] = (int)i;
+    }
+    color.swap(moved_color);
+    owner.swap(moved_owner);
+
+    // Past the head, so even a consumer that was up to date finds its cursor dropped.
+    journal_base += journal.size() + 1;
+    journal.clear();
+}
+
+bool Scene::IsValid(SceneHandle handle) const
+{
+    return IndexOf(handle) >= 0;
+}
+
+int Scene::IndexOf(SceneHandle handle) const
+{
+    if (handle.slot < 0 || handle.slot >= (int)slot_index.size() || slot_generation[handle.slot] != handle.generation)
+    {
+        return -1;
+    }
+    return slot_index[handle.slot];
+}
+
+SceneHandle Scene::HandleAt(int index) const
+{
+    int slot = owner[index];
+    return SceneHandle{ slot, slot_generation[slot] };
+}
+
+bool Scene::ChangesSince(unsigned long long cursor, const SceneChange** changes, int* count) const
+{
+    if (cursor < journal_base)
+    {
+        *changes = NULL;
+        *count = 0;
+        return false;
+    }
+    size_t first = (size_t)(cursor - journal_base);
+    *changes = journal.data() + first;
+    *count = (int)(journal.size() - first);
+    return true;
+}
@@ -0,0 +1,114 @@
+/**********************************************************************************************
+*
+*   Scene container
+*
+*   Spheres live in dense arrays, one per field, so the i-th sphere of every array is the i-th
+*   live sphere. Removing one moves the last sphere into its place, which keeps the arrays dense
+*   and makes both adding and removing O(1), but means dense indices (the ones RayHit and the
+*   tile bins use) are only valid until the next removal.
+*
+*   Anything that must refer to a sphere across edits holds a SceneHandle instead: a slot in an
+*   indirection table plus the generation the slot had when the handle was issued. Slots are
+*   recycled, and bumping the generation on removal makes stale handles detectably invalid.
+*
+*   Every edit is also appended to a change journal. A consumer keeps a cursor into it and only
+*   replays what changed since its last update; once a consumer falls further behind than the
+*   journal keeps, it is told to rebuild from scratch instead. Reordering the dense arrays moves
+*   every sphere at once, so it drops the journal and every consumer rebuilds.
+*
+**********************************************************************************************/
+
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "raytracer.h"
+#include <vector>
+
+// Journal entries kept before the oldest half is dropped.
+#define SCENE_JOURNAL_CAPACITY 4096
+
+struct SceneHandle
+{
+    int slot;
+    unsigned int generation;
+};
+
+constexpr SceneHandle SCENE_INVALID_HANDLE = { -1, 0 };
+
+enum SceneChangeType
+{
+    SCENE_SPHERE_ADDED,   // appended at index
+    SCENE_SPHERE_REMOVED, // removed from index; a SCENE_SPHERE_MOVED into it may follow
+    SCENE_SPHERE_MOVED,   // moved from moved_from to index by a swap-remove
+    SCENE_SPHERE_UPDATED  // edited in place at index
+};
+
+struct SceneChange
+{
+    SceneChangeType type;
+    SceneHandle handle;
+    int index;
+    int moved_from;
+};
+
+class Scene
+{
+public:
+    Scene(const Sphere* spheres, int count);
+
+    SceneHandle Add(const Sphere& sp);
+    bool Remove(SceneHandle handle);
+    bool Update(SceneHandle handle, const Sphere& sp);
+    void Clear();
+
+    // Moves the sphere at dense index order[i] to index i, for a permutation order of the dense
+    // indices. Handles stay valid.
+    void Reorder(const std::vector<int>& order);
+
+    bool IsValid(SceneHandle handle) const;
+    int IndexOf(SceneHandle handle) const; // -1 for stale handles
+    SceneHandle HandleAt(int index) const;
+
+    int Count() const { return (int)radius.size(); }
+    Sphere GetSphere(int index) const
+    {
+        return Sphere{ Vector3{ center_x[index], center_y[index], center_z[index] }, radius[index], color[index] };
+    }
+
+    // The dense arrays, Count() entries each.
+    const float* CenterX() const { return center_x.data(); }
+    const float* CenterY() const { return center_y.data(); }
+    const float* CenterZ() const { return center_z.data(); }
+    const float* Radius() const { return radius.data(); }
+    const Color* Colors() const { return color.data(); }
+
+    // Position one past the newest journal entry; a consumer that is up to date holds this.
+    unsigned long long JournalHead() const { return journal_base + journal.size(); }
+
+    // Changes between cursor and JournalHead(). Returns false if some have already been dropped,
+    // in which case the consumer has to rebuild from the dense arrays.
+    bool ChangesSince(unsigned long long cursor, const SceneChange** changes, int* count) const;
+
+private:
+    void Record(SceneChangeType type, SceneHandle handle, int index, int moved_from);
+    void Store(int index, const Sphere& sp);
+
+    std::vector<float> center_x;
+    std::vector<float> center_y;
+    std::vector<float> center_z;
+    std::vector<float> radius;
+    std::vector<Color> color;
+    std::vector<int> owner;              // dense index -> slot
+
+    std::vector<int> slot_index;         // slot -> dense index, -1 when free
+    std::vector<unsigned int> slot_generation;
+    std::vector<int> free_slots;
+
+    std::vector<SceneChange> journal;
+    unsigned long long journal_base;     // journal position of journal[0]
+};
+
+// The scene being rendered, starting out as DEFAULT_SCENE.
+extern Scene scene;
+
+#endif //SCENE_H
@@ -0,0 +1,134 @@
+#include "scene_order.h"
+#include "bvh.h"
+#include "parallel.h"
+#include <math.h>
+#include <string.h>
+
+#define SCENE_ORDER_MIN_CHUNK 65536
+#define SCENE_ORDER_BITS 10
+
+const char* scene_curve_names[SCENE_CURVE_COUNT] = { "none", "morton", "hilbert" };
+SceneCurve scene_curve = SCENE_CURVE_HILBERT;
+
+bool ParseSceneCurve(const char* name, SceneCurve* curve)
+{
+    for (int i = 0; i < SCENE_CURVE_COUNT; i++)
+    {
+        if (strcmp(name, scene_curve_names[i]) == 0)
+        {
+            *curve = (SceneCurve)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+unsigned int HilbertCode(unsigned int x, unsigned int y, unsigned int z)
+{
+    unsigned int axes[3] = { x, y, z };
+
+    // Undo the excess work of the Gray code, from the top bit down: where an axis has the bit set,
+    // the bits below it in axis 0 are inverted, otherwise they are exchanged with that axis'.
+    for (unsigned int q = 1u << (SCENE_ORDER_BITS - 1); q > 1; q >>= 1)
+    {
+        unsigned int p = q - 1;
+        for (int i = 0; i < 3; i++)
+        {
+            if (axes[i] & q)
+            {
+                axes[0] ^= p;
+            }
+            else
+            {
+                unsigned int t = (axes[0] ^ axes[i]) & p;
+                axes[0] ^= t;
+                axes[i] ^= t;
+            }
+        }
+    }
+
+    // Gray encode.
+    axes[1] ^= axes[0];
+    axes[2] ^= axes[1];
+    unsigned int t = 0;
+    for (unsigned int q = 1u << (SCENE_ORDER_BITS - 1); q > 1; q >>= 1)
+    {
+        if (axes[2] & q)
+        {
+            t ^= q - 1;
+        }
+    }
+    for (int i = 0; i < 3; i++)
+    {
+        axes[i] ^= t;
+    }
+
+    // The index is the transposed axes read bit plane by bit plane, axis 0 most significant: the
+    // same interleaving as a Morton code.
+    return MortonCode((float)axes[0], (float)axes[1], (float)axes[2]);
+}
+
+void SpatialOrder(const Scene& source, SceneCurve curve, std::vector<int>* order)
+{
+    int count = source.Count();
+    order->resize(count);
+    for (int i = 0; i < count; i++)
+    {
+        (*order)[i] = i;
+    }
+    if (curve == SCENE_CURVE_NONE || count < 2)
+    {
+        return;
+    }
+
+    const float* xs = source.CenterX();
+    const float* ys = source.CenterY();
+    const float* zs = source.CenterZ();
+    Vector3 min = Vector3{ INFINITY, INFINITY, INFINITY };
+    Vector3 max = Vector3{ -INFINITY, -INFINITY, -INFINITY };
+    for (int i = 0; i < count; i++)
+    {
+        min = Vector3{ fminf(min.x, xs[i]), fminf(min.y, ys[i]), fminf(min.z, zs[i]) };
+        max = Vector3{ fmaxf(max.x, xs[i]), fmaxf(max.y, ys[i]), fmaxf(max.z, zs[i]) };
+    }
+
+    // Quantized to 1024 steps per axis of the bounds, as the LBVH builder does.
+    Vector3 scale;
+    scale.x = max.x > min.x ? 1023.0f / (max.x - min.x) : 0.0f;
+    scale.y = max.y > min.y ? 1023.0f / (max.y - min.y) : 0.0f;
+    scale.z = max.z > min.z ? 1023.0f / (max.z - min.z) : 0.0f;
+    std::vector<unsigned int> codes(count);
+    ParallelFor(0, count, SCENE_ORDER_MIN_CHUNK, [&](int, int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            float x = (xs[i] - min.x) * scale.x;
+            float y = (ys[i] - min.y) * scale.y;
+            float z = (zs[i] - min.z) * scale.z;
+            if (curve == SCENE_CURVE_MORTON)
+            {
+                codes[i] = MortonCode(x, y, z);
+            }
+            else
+            {
+                codes[i] = HilbertCode((unsigned int)fminf(x, 1023.0f), (unsigned int)fminf(y, 1023.0f), (unsigned int)fminf(z, 1023.0f));
+            }
+        }
+    });
+    RadixSortKeys(&codes, order);
+}
+
+void SortSceneSpatially(Scene* target, SceneCurve curve, std::vector<int>* remap)
+{
+    std::vector<int> order;
+    SpatialOrder(*target, curve, &order);
+    target->Reorder(order);
+    if (remap != NULL)
+    {
+        remap->resize(order.size());
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            (*remap)[order[i]] = (int)i;
+        }
+    }
+}
@@ -0,0 +1,51 @@
+/**********************************************************************************************
+*
+*   Spatial ordering of the scene's spheres
+*
+*   Spheres are stored in whatever order they were added, so neighbours in space are usually far
+*   apart in memory, and every structure that gathers them by index (the BVH builders, the
+*   spatial hash, the compact scene, the colors looked up per hit) misses the cache on nearly
+*   every one. Sorting the dense arrays along a space-filling curve once the scene is loaded puts
+*   spheres that are close in space close in memory:
+*     - Morton: interleaves the bits of the quantized center, cheap, but jumps across the box at
+*       every power-of-two boundary
+*     - Hilbert: every step moves to an adjacent cell, so no part of the order jumps (Skilling's
+*       transposition, 10 bits per axis)
+*
+*   Handles survive the reorder (see Scene::Reorder); dense indices don't, and the remap table
+*   tells the caller where each one went.
+*
+**********************************************************************************************/
+
+#ifndef SCENE_ORDER_H
+#define SCENE_ORDER_H
+
+#include "scene.h"
+#include <vector>
+
+enum SceneCurve
+{
+    SCENE_CURVE_NONE,
+    SCENE_CURVE_MORTON,
+    SCENE_CURVE_HILBERT,
+    SCENE_CURVE_COUNT
+};
+
+extern const char* scene_curve_names[SCENE_CURVE_COUNT];
+
+// Curve the scene is sorted along once loaded, set with --scene-order=<name>.
+extern SceneCurve scene_curve;
+
+bool ParseSceneCurve(const char* name, SceneCurve* curve);
+
+// 30-bit Hilbert index of a cell of a 1024^3 grid.
+unsigned int HilbertCode(unsigned int x, unsigned int y, unsigned int z);
+
+// Dense indices of source's spheres in curve order over the bounds of their centers; ties, and
+// SCENE_CURVE_NONE, keep the current order.
+void SpatialOrder(const Scene& source, SceneCurve curve, std::vector<int>* order);
+
+// Sorts target along curve. remap, if not NULL, receives the new dense index of every old one.
+void SortSceneSpatially(Scene* target, SceneCurve curve, std::vector<int>* remap);
+
+#endif //SCENE_ORDER_H
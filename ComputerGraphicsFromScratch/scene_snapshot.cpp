@@ -0,0 +1,177 @@
+#include "scene_snapshot.h"
+
+SceneSnapshots scene_snapshots;
+const SceneSnapshot* frame_scene = NULL;
+
+static int frame_reader = -1;
+
+SceneSnapshots::SceneSnapshots()
+    : current(NULL), journal_cursor(0), reclaimed(0)
+{
+    for (int i = 0; i < SNAPSHOT_MAX_READERS; i++)
+    {
+        hazards[i].store(NULL);
+        reader_used[i].store(false);
+    }
+}
+
+SceneSnapshots::~SceneSnapshots()
+{
+    for (const SceneSnapshot* snapshot : retired)
+    {
+        delete snapshot;
+    }
+    delete current.load();
+}
+
+static std::shared_ptr<const SnapshotChunk> CopyChunk(const Scene& source, int chunk)
+{
+    std::shared_ptr<SnapshotChunk> c = std::make_shared<SnapshotChunk>();
+    int first = chunk << SNAPSHOT_CHUNK_SHIFT;
+    int count = source.Count() - first < SNAPSHOT_CHUNK_SIZE ? source.Count() - first : SNAPSHOT_CHUNK_SIZE;
+    for (int i = 0; i < count; i++)
+    {
+        c->center_x[i] = source.CenterX()[first + i];
+        c->center_y[i] = source.CenterY()[first + i];
+        c->center_z[i] = source.CenterZ()[first + i];
+        c->radius[i] = source.Radius()[first + i];
+        c->color[i] = source.Colors()[first + i];
+    }
+    return c;
+}
+
+void SceneSnapshots::Publish(const Scene& source)
+{
+    const SceneSnapshot* previous = current.load();
+    SceneSnapshot* snapshot = new SceneSnapshot();
+    snapshot->version = previous != NULL ? previous->version + 1 : 1;
+    snapshot->count = source.Count();
+    int chunk_count = (source.Count() + SNAPSHOT_CHUNK_SIZE - 1) >> SNAPSHOT_CHUNK_SHIFT;
+
+    // Chunks the journal doesn't mention are shared with the previous snapshot as they are.
+    std::vector<bool> dirty(chunk_count, true);
+    const SceneChange* changes;
+    int change_count;
+    if (previous != NULL && source.ChangesSince(journal_cursor, &changes, &change_count))
+    {
+        snapshot->chunks = previous->chunks;
+        snapshot->chunks.resize(chunk_count);
+        for (int c = 0; c < chunk_count; c++)
+        {
+            dirty[c] = snapshot->chunks[c] == nullptr;
+        }
+        for (int i = 0; i < change_count; i++)
+        {
+            int chunk = changes[i].index >> SNAPSHOT_CHUNK_SHIFT;
+            if (chunk < chunk_count)
+            {
+                dirty[chunk] = true;
+            }
+        }
+    }
+    else
+    {
+        snapshot->chunks.resize(chunk_count);
+    }
+
+    for (int c = 0; c < chunk_count; c++)
+    {
+        if (dirty[c])
+        {
+            snapshot->chunks[c] = CopyChunk(source, c);
+        }
+    }
+    journal_cursor = source.JournalHead();
+
+    const SceneSnapshot* replaced = current.exchange(snapshot);
+    if (replaced != NULL)
+    {
+        retired.push_back(replaced);
+    }
+    Reclaim();
+}
+
+void SceneSnapshots::Reclaim()
+{
+    size_t kept = 0;
+    for (size_t i = 0; i < retired.size(); i++)
+    {
+        bool pinned = false;
+        for (int r = 0; r < SNAPSHOT_MAX_READERS; r++)
+        {
+            pinned = pinned || hazards[r].load() == retired[i];
+        }
+        if (pinned)
+        {
+            retired[kept++] = retired[i];
+            continue;
+        }
+        delete retired[i];
+        reclaimed++;
+    }
+    retired.resize(kept);
+}
+
+int SceneSnapshots::RegisterReader()
+{
+    for (int r = 0; r < SNAPSHOT_MAX_READERS; r++)
+    {
+        bool expected = false;
+        if (reader_used[r].compare_exchange_strong(expected, true))
+        {
+            return r;
+        }
+    }
+    return -1;
+}
+
+void SceneSnapshots::UnregisterReader(int reader)
+{
+    hazards[reader].store(NULL);
+    reader_used[reader].store(false);
+}
+
+const SceneSnapshot* SceneSnapshots::Pin(int reader)
+{
+    // If the writer swapped snapshots between the load and the hazard store, it may already have
+    // checked this slot and freed the one just loaded, so retry until the hazard is seen in time.
+    const SceneSnapshot* snapshot = current.load();
+    for (;;)
+    {
+        hazards[reader].store(snapshot);
+        const SceneSnapshot* check = current.load();
+        if (check == snapshot)
+        {
+            return snapshot;
+        }
+        snapshot = check;
+    }
+}
+
+void SceneSnapshots::Unpin(int reader)
+{
+    hazards[reader].store(NULL);
+}
+
+void PublishScene()
+{
+    scene_snapshots.Publish(scene);
+}
+
+void BeginSceneFrame()
+{
+    if (frame_reader < 0)
+    {
+        frame_reader = scene_snapshots.RegisterReader();
+        if (frame_reader < 0)
+        {
+            TraceLog(LOG_FATAL, "All %d scene snapshot reader slots are taken; the render thread can't pin a scene", SNAPSHOT_MAX_READERS);
+        }
+    }
+    frame_scene = scene_snapshots.Pin(frame_reader);
+    if (frame_scene == NULL)
+    {
+        PublishScene();
+        frame_scene = scene_snapshots.Pin(frame_reader);
+    }
+}
@@ -0,0 +1,98 @@
+/**********************************************************************************************
+*
+*   Lock-free scene snapshots
+*
+*   Renderers never read the editable Scene directly. The writer publishes immutable snapshots of it,
+*   and the render thread pins the newest one at the start of each frame and reads only that, so
+*   edits made mid-frame can't tear what it sees.
+*
+*   A snapshot stores the spheres in fixed-size chunks shared with the previous snapshot by
+*   reference count. Publishing replays the scene's change journal and copies only the chunks it
+*   touched, then swaps the new snapshot in with a single atomic exchange.
+*
+*   Readers pin with a hazard pointer: each one owns a slot, stores the snapshot it is about to use
+*   there and re-checks that it is still current. The writer keeps replaced snapshots on a retired
+*   list and frees each one once no slot points at it. Neither side ever waits on the other.
+*
+*   Only one thread may publish at a time; any number of registered readers may pin concurrently.
+*
+**********************************************************************************************/
+
+#ifndef SCENE_SNAPSHOT_H
+#define SCENE_SNAPSHOT_H
+
+#include "scene.h"
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#define SNAPSHOT_CHUNK_SHIFT 12
+#define SNAPSHOT_CHUNK_SIZE (1 << SNAPSHOT_CHUNK_SHIFT)
+#define SNAPSHOT_MAX_READERS 8
+
+struct SnapshotChunk
+{
+    float center_x[SNAPSHOT_CHUNK_SIZE];
+    float center_y[SNAPSHOT_CHUNK_SIZE];
+    float center_z[SNAPSHOT_CHUNK_SIZE];
+    float radius[SNAPSHOT_CHUNK_SIZE];
+    Color color[SNAPSHOT_CHUNK_SIZE];
+};
+
+struct SceneSnapshot
+{
+    unsigned long long version;
+    int count;
+    std::vector<std::shared_ptr<const SnapshotChunk>> chunks;
+
+    Sphere GetSphere(int index) const
+    {
+        const SnapshotChunk& c = *chunks[index >> SNAPSHOT_CHUNK_SHIFT];
+        int i = index & (SNAPSHOT_CHUNK_SIZE - 1);
+        return Sphere{ Vector3{ c.center_x[i], c.center_y[i], c.center_z[i] }, c.radius[i], c.color[i] };
+    }
+};
+
+class SceneSnapshots
+{
+public:
+    SceneSnapshots();
+    ~SceneSnapshots();
+
+    // Writer side. Publishes the scene's current state and frees retired snapshots no reader pins.
+    void Publish(const Scene& source);
+    void Reclaim();
+
+    // Reader side. A reader registers once for a slot, then pins and unpins through it; pinning
+    // again replaces the previous pin. Returns NULL before anything has been published.
+    // RegisterReader returns -1 once all SNAPSHOT_MAX_READERS slots are taken.
+    int RegisterReader();
+    void UnregisterReader(int reader);
+    const SceneSnapshot* Pin(int reader);
+    void Unpin(int reader);
+
+    int RetiredCount() const { return (int)retired.size(); }
+    unsigned long long ReclaimedCount() const { return reclaimed; }
+
+private:
+    std::atomic<const SceneSnapshot*> current;
+    std::atomic<const SceneSnapshot*> hazards[SNAPSHOT_MAX_READERS];
+    std::atomic<bool> reader_used[SNAPSHOT_MAX_READERS];
+
+    // Writer-only state.
+    std::vector<const SceneSnapshot*> retired;
+    unsigned long long journal_cursor;
+    unsigned long long reclaimed;
+};
+
+// Snapshots of the global scene, and the one the render thread pinned for the current frame.
+extern SceneSnapshots scene_snapshots;
+extern const SceneSnapshot* frame_scene;
+
+// Publishes the global scene; call after editing it.
+void PublishScene();
+
+// Pins the newest published scene as frame_scene, publishing first if nothing has been yet.
+void BeginSceneFrame();
+
+#endif //SCENE_SNAPSHOT_H
@@ -0,0 +1,612 @@
+#include "spatial_hash.h"
+#include "parallel.h"
+#include "renderer.h"
+#include <math.h>
+#include <string.h>
+#include <xmmintrin.h>
+
+#define SPATIAL_HASH_MIN_CHUNK 16384
+#define SPATIAL_HASH_EMPTY 0xFFFFFFFFu
+
+// Two passes sort the cell indices of grids up to 4M cells.
+#define SPATIAL_HASH_RADIX_BITS 11
+#define SPATIAL_HASH_RADIX_BUCKETS (1 << SPATIAL_HASH_RADIX_BITS)
+
+// Entries ahead of the one being inserted whose table slot is prefetched.
+#define SPATIAL_HASH_PREFETCH 64
+
+// Spheres go into the cells of their bounds grown by this fraction of a cell, so a ray stepping
+// into a neighbour cell a rounding error early or late still finds them.
+#define SPATIAL_HASH_CELL_PAD 1e-3f
+
+static unsigned int CellIndex(int x, int y, int z, const int* dims)
+{
+    return (unsigned int)x + (unsigned int)dims[0] * ((unsigned int)y + (unsigned int)dims[1] * (unsigned int)z);
+}
+
+static size_t BlockIndex(int x, int y, int z, const int* block_dims)
+{
+    return (size_t)(x >> SPATIAL_HASH_BLOCK_BITS) +
+        (size_t)block_dims[0] * ((size_t)(y >> SPATIAL_HASH_BLOCK_BITS) + (size_t)block_dims[1] * (size_t)(z >> SPATIAL_HASH_BLOCK_BITS));
+}
+
+static size_t CellBlockIndex(unsigned int cell, const int* dims, const int* block_dims)
+{
+    int x = (int)(cell % (unsigned int)dims[0]);
+    int y = (int)((cell / (unsigned int)dims[0]) % (unsigned int)dims[1]);
+    int z = (int)(cell / ((unsigned int)dims[0] * (unsigned int)dims[1]));
+    return BlockIndex(x, y, z, block_dims);
+}
+
+static unsigned int EntryCell(unsigned long long entry)
+{
+    return (unsigned int)(entry >> 32);
+}
+
+static int EntrySphere(unsigned long long entry)
+{
+    return (int)(unsigned int)entry;
+}
+
+// Neighbouring cells have neighbouring indices, so the bits are mixed before masking (murmur3's
+// finalizer).
+static unsigned int HashCell(unsigned int cell)
+{
+    cell ^= cell >> 16;
+    cell *= 0x85ebca6bu;
+    cell ^= cell >> 13;
+    cell *= 0xc2b2ae35u;
+    cell ^= cell >> 16;
+    return cell;
+}
+
+bool SpatialHashGrid::Grow(size_t* capacity, size_t count)
+{
+    if (count <= *capacity)
+    {
+        return false;
+    }
+    // Headroom, so a scene that grows a little every frame doesn't reallocate every frame.
+    *capacity = count + count / 4;
+    allocations++;
+    return true;
+}
+
+bool SpatialHashGrid::CellRange(int sphere, int* lo, int* hi) const
+{
+    const Vector3& co = spheres[sphere].co;
+    float center[3] = { CAMERA_ORIGIN.x - co.x, CAMERA_ORIGIN.y - co.y, CAMERA_ORIGIN.z - co.z };
+    float min[3] = { origin.x, origin.y, origin.z };
+    float r = bound_radii[sphere] + SPATIAL_HASH_CELL_PAD * cell_size;
+    float inv_cell = 1.0f / cell_size;
+    // Truncated rather than floored: only the pad reaches below the box, and cell 0 holds it
+    // either way.
+    for (int axis = 0; axis < 3; axis++)
+    {
+        int a = (int)((center[axis] - r - min[axis]) * inv_cell);
+        int b = (int)((center[axis] + r - min[axis]) * inv_cell);
+        lo[axis] = a < 0 ? 0 : a;
+        hi[axis] = b >= dims[axis] ? dims[axis] - 1 : b;
+        if (hi[axis] - lo[axis] >= SPATIAL_HASH_MAX_SPAN)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Multiply-shift rather than a mask, so the table needn't be a power of two and its size can
+// follow the occupied cells closely.
+static unsigned int HomeSlot(unsigned int cell, unsigned int table_size)
+{
+    return (unsigned int)(((unsigned long long)HashCell(cell) * table_size) >> 32);
+}
+
+int SpatialHashGrid::FindSlot(unsigned int cell) const
+{
+    unsigned int slot = HomeSlot(cell, table_size);
+    for (;;)
+    {
+        unsigned int k = table[slot].key.load(std::memory_order_relaxed);
+        if (k == cell)
+        {
+            return (int)slot;
+        }
+        if (k == SPATIAL_HASH_EMPTY)
+        {
+            return -1;
+        }
+        slot = slot + 1 < table_size ? slot + 1 : 0;
+    }
+}
+
+size_t SpatialHashGrid::MemoryBytes() const
+{
+    return sphere_capacity * (sizeof(BvhSphere) + sizeof(float) + sizeof(int)) + table_capacity * sizeof(HashSlot) +
+        entry_capacity * (2 * sizeof(unsigned long long) + sizeof(BvhSphere)) + (cell_bits_capacity + block_bits_capacity) * sizeof(unsigned int);
+}
+
+// Stable LSD radix sort of the entries by cell, one pass per SPATIAL_HASH_RADIX_BITS of the
+// largest cell index, each split across workers as RadixSortKeys in bvh.cpp does. Returns the
+// buffer holding the result.
+int SpatialHashGrid::SortEntries()
+{
+    unsigned int largest = (unsigned int)((long long)dims[0] * dims[1] * dims[2] - 1);
+    int in = 0;
+    for (int shift = 0; shift == 0 || (shift < 32 && (largest >> shift) != 0); shift += SPATIAL_HASH_RADIX_BITS)
+    {
+        const unsigned long long* in_items = entry_buffers[in].get();
+        unsigned long long* out_items = entry_buffers[1 - in].get();
+        int item_shift = 32 + shift;
+        int worker_count = ParallelFor(0, entry_count, SPATIAL_HASH_MIN_CHUNK, [&](int w, int begin, int end)
+        {
+            int* h = &histograms[(size_t)w * SPATIAL_HASH_RADIX_BUCKETS];
+            memset(h, 0, SPATIAL_HASH_RADIX_BUCKETS * sizeof(int));
+            for (int i = begin; i < end; i++)
+            {
+                h[(in_items[i] >> item_shift) & (SPATIAL_HASH_RADIX_BUCKETS - 1)]++;
+            }
+        });
+
+        int sum = 0;
+        for (int digit = 0; digit < SPATIAL_HASH_RADIX_BUCKETS; digit++)
+        {
+            for (int w = 0; w < worker_count; w++)
+            {
+                int c = histograms[(size_t)w * SPATIAL_HASH_RADIX_BUCKETS + digit];
+                histograms[(size_t)w * SPATIAL_HASH_RADIX_BUCKETS + digit] = sum;
+                sum += c;
+            }
+        }
+
+        ParallelFor(0, entry_count, SPATIAL_HASH_MIN_CHUNK, [&](int w, int begin, int end)
+        {
+            int* offsets = &histograms[(size_t)w * SPATIAL_HASH_RADIX_BUCKETS];
+            for (int i = begin; i < end; i++)
+            {
+                out_items[offsets[(in_items[i] >> item_shift) & (SPATIAL_HASH_RADIX_BUCKETS - 1)]++] = in_items[i];
+            }
+        });
+        in = 1 - in;
+    }
+    return in;
+}
+
+void SpatialHashGrid::Build(const SceneSnapshot& source)
+{
+    scene_version = source.version;
+    int count = source.count;
+    int worker_count = WorkerCount();
+    if ((int)workers.size() != worker_count)
+    {
+        workers.resize(worker_count);
+        histograms.resize((size_t)worker_count * SPATIAL_HASH_RADIX_BUCKETS);
+        allocations++;
+    }
+    if (Grow(&sphere_capacity, (size_t)count))
+    {
+        spheres.reset(new BvhSphere[sphere_capacity]);
+        bound_radii.reset(new float[sphere_capacity]);
+        oversized.reset(new int[sphere_capacity]);
+    }
+
+    /***************************  Bounds  ***************************/
+
+    for (WorkerSums& w : workers)
+    {
+        w = WorkerSums{ Vector3{ INFINITY, INFINITY, INFINITY }, Vector3{ -INFINITY, -INFINITY, -INFINITY }, 0.0, 0, 0, 0 };
+    }
+    ParallelFor(0, count, SPATIAL_HASH_MIN_CHUNK, [&](int worker, int begin, int end)
+    {
+        WorkerSums& w = workers[worker];
+        for (int i = begin; i < end; i++)
+        {
+            Sphere sp = source.GetSphere(i);
+            Vector3 c = sp.center;
+            Vector3 co = Vector3{ CAMERA_ORIGIN.x - c.x, CAMERA_ORIGIN.y - c.y, CAMERA_ORIGIN.z - c.z };
+            float co_squared = co.x * co.x + co.y * co.y + co.z * co.z;
+            spheres[i] = BvhSphere{ co, co_squared - sp.radius * sp.radius };
+            float r = sqrtf(sp.radius * sp.radius + BVH_GRAZING_PAD * co_squared);
+            bound_radii[i] = r;
+            w.min = Vector3{ fminf(w.min.x, c.x - r), fminf(w.min.y, c.y - r), fminf(w.min.z, c.z - r) };
+            w.max = Vector3{ fmaxf(w.max.x, c.x + r), fmaxf(w.max.y, c.y + r), fmaxf(w.max.z, c.z + r) };
+            w.radius_sum += r;
+        }
+    });
+    WorkerSums total = workers[0];
+    for (int w = 1; w < worker_count; w++)
+    {
+        total.min = Vector3{ fminf(total.min.x, workers[w].min.x), fminf(total.min.y, workers[w].min.y), fminf(total.min.z, workers[w].min.z) };
+        total.max = Vector3{ fmaxf(total.max.x, workers[w].max.x), fmaxf(total.max.y, workers[w].max.y), fmaxf(total.max.z, workers[w].max.z) };
+        total.radius_sum += workers[w].radius_sum;
+    }
+
+    /***************************  Clear  ***************************/
+
+    // Only the cells the last build occupied are cleared, so clearing costs what building did
+    // however sparse the grid's box is. Their bits are found through the last build's dims.
+    if (table != NULL)
+    {
+        ParallelFor(0, (int)table_size, SPATIAL_HASH_MIN_CHUNK, [&](int, int begin, int end)
+        {
+            for (int s = begin; s < end; s++)
+            {
+                unsigned int cell = table[s].key.load(std::memory_order_relaxed);
+                if (cell != SPATIAL_HASH_EMPTY)
+                {
+                    cell_bits[cell / 32].store(0, std::memory_order_relaxed);
+                    block_bits[CellBlockIndex(cell, dims, block_dims) / 32].store(0, std::memory_order_relaxed);
+                    table[s].key.store(SPATIAL_HASH_EMPTY, std::memory_order_relaxed);
+                }
+            }
+        });
+    }
+
+    sphere_count = count;
+    entry_count = 0;
+    occupied_cells = 0;
+    oversized_count = 0;
+    if (count == 0)
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            dims[axis] = 0;
+            block_dims[axis] = 0;
+        }
+        return;
+    }
+
+    // A few mean radii per cell keeps most spheres in one to eight cells. Cells grow until the
+    // bitmap fits its limit.
+    Vector3 extent = Vector3{ total.max.x - total.min.x, total.max.y - total.min.y, total.max.z - total.min.z };
+    float largest = fmaxf(extent.x, fmaxf(extent.y, extent.z));
+    cell_size = SPATIAL_HASH_CELL_RADII * (float)(total.radius_sum / count);
+    cell_size = fmaxf(cell_size, largest / (float)SPATIAL_HASH_MAX_CELLS);
+    if (!(cell_size > 0.0f))
+    {
+        cell_size = 1.0f;
+    }
+    for (;;)
+    {
+        dims[0] = (int)ceilf(extent.x / cell_size);
+        dims[1] = (int)ceilf(extent.y / cell_size);
+        dims[2] = (int)ceilf(extent.z / cell_size);
+        for (int axis = 0; axis < 3; axis++)
+        {
+            dims[axis] = dims[axis] > 0 ? dims[axis] : 1;
+        }
+        if ((long long)dims[0] * dims[1] * dims[2] <= SPATIAL_HASH_MAX_CELLS)
+        {
+            break;
+        }
+        cell_size *= 1.125f;
+    }
+    for (int axis = 0; axis < 3; axis++)
+    {
+        block_dims[axis] = (dims[axis] + (1 << SPATIAL_HASH_BLOCK_BITS) - 1) >> SPATIAL_HASH_BLOCK_BITS;
+    }
+    origin = total.min;
+
+    /***************************  Entries  ***************************/
+
+    for (WorkerSums& w : workers)
+    {
+        w.entries = 0;
+        w.oversized = 0;
+        w.occupied = 0;
+    }
+    ParallelFor(0, count, SPATIAL_HASH_MIN_CHUNK, [&](int worker, int begin, int end)
+    {
+        WorkerSums& w = workers[worker];
+        int lo[3];
+        int hi[3];
+        for (int i = begin; i < end; i++)
+        {
+            if (CellRange(i, lo, hi))
+            {
+                w.entries += (long long)(hi[0] - lo[0] + 1) * (hi[1] - lo[1] + 1) * (hi[2] - lo[2] + 1);
+            }
+            else
+            {
+                w.oversized++;
+            }
+        }
+    });
+    // The next pass splits the spheres the same way, so each worker's counts become where its
+    // entries and oversized spheres start, keeping both in scene order.
+    long long entries_total = 0;
+    for (WorkerSums& w : workers)
+    {
+        long long entries_first = entries_total;
+        entries_total += w.entries;
+        w.entries = entries_first;
+        int oversized_first = oversized_count;
+        oversized_count += w.oversized;
+        w.oversized = oversized_first;
+    }
+    entry_count = (int)entries_total;
+    if (Grow(&entry_capacity, (size_t)entry_count))
+    {
+        entry_buffers[0].reset(new unsigned long long[entry_capacity]);
+        entry_buffers[1].reset(new unsigned long long[entry_capacity]);
+        entry_spheres.reset(new BvhSphere[entry_capacity]);
+    }
+
+    ParallelFor(0, count, SPATIAL_HASH_MIN_CHUNK, [&](int worker, int begin, int end)
+    {
+        int lo[3];
+        int hi[3];
+        unsigned long long* items = entry_buffers[0].get() + workers[worker].entries;
+        int next_oversized = workers[worker].oversized;
+        for (int i = begin; i < end; i++)
+        {
+            if (!CellRange(i, lo, hi))
+            {
+                oversized[next_oversized++] = i;
+                continue;
+            }
+            for (int z = lo[2]; z <= hi[2]; z++)
+            {
+                for (int y = lo[1]; y <= hi[1]; y++)
+                {
+                    for (int x = lo[0]; x <= hi[0]; x++)
+                    {
+                        *items++ = (unsigned long long)CellIndex(x, y, z, dims) << 32 | (unsigned int)i;
+                    }
+                }
+            }
+        }
+    });
+
+    // Stable, so each cell lists its spheres in scene order, whatever the number of workers.
+    entries = entry_buffers[SortEntries()].get();
+
+    // Spheres are gathered into entry order: a ray testing a cell then reads them contiguously,
+    // rather than from wherever the scene keeps them.
+    ParallelFor(0, entry_count, SPATIAL_HASH_MIN_CHUNK, [&](int, int begin, int end)
+    {
+        for (int k = begin; k < end; k++)
+        {
+            entry_spheres[k] = spheres[EntrySphere(entries[k])];
+        }
+    });
+
+    /***************************  Table  ***************************/
+
+    // Runs are counted first, so the table is sized for exactly the occupied cells.
+    ParallelFor(0, entry_count, SPATIAL_HASH_MIN_CHUNK, [&](int worker, int begin, int end)
+    {
+        int runs = 0;
+        for (int i = begin; i < end; i++)
+        {
+            runs += i == 0 || EntryCell(entries[i]) != EntryCell(entries[i - 1]);
+        }
+        workers[worker].occupied = runs;
+    });
+    for (const WorkerSums& w : workers)
+    {
+        occupied_cells += w.occupied;
+    }
+
+    size_t slots = 2 * (size_t)occupied_cells + 1;
+    if (Grow(&table_capacity, slots))
+    {
+        table.reset(new HashSlot[table_capacity]);
+        for (size_t s = 0; s < table_capacity; s++)
+        {
+            table[s].key.store(SPATIAL_HASH_EMPTY, std::memory_order_relaxed);
+        }
+    }
+    table_size = (unsigned int)slots;
+    long long cell_count = (long long)dims[0] * dims[1] * dims[2];
+    long long block_count = (long long)block_dims[0] * block_dims[1] * block_dims[2];
+    if (Grow(&cell_bits_capacity, (size_t)((cell_count + 31) / 32)))
+    {
+        cell_bits.reset(new std::atomic<unsigned int>[cell_bits_capacity]);
+        for (size_t i = 0; i < cell_bits_capacity; i++)
+        {
+            cell_bits[i].store(0, std::memory_order_relaxed);
+        }
+    }
+    if (Grow(&block_bits_capacity, (size_t)((block_count + 31) / 32)))
+    {
+        block_bits.reset(new std::atomic<unsigned int>[block_bits_capacity]);
+        for (size_t i = 0; i < block_bits_capacity; i++)
+        {
+            block_bits[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // Each run is inserted by the worker its first entry falls to. Slots are random accesses
+    // into a table too large for the cache, so the slot of an entry further on is prefetched.
+    ParallelFor(0, entry_count, SPATIAL_HASH_MIN_CHUNK, [&](int, int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            if (i + SPATIAL_HASH_PREFETCH < end)
+            {
+                _mm_prefetch((const char*)&table[HomeSlot(EntryCell(entries[i + SPATIAL_HASH_PREFETCH]), table_size)], _MM_HINT_T0);
+            }
+            unsigned int cell = EntryCell(entries[i]);
+            if (i > 0 && cell == EntryCell(entries[i - 1]))
+            {
+                continue;
+            }
+            int run_end = i + 1;
+            while (run_end < entry_count && EntryCell(entries[run_end]) == cell)
+            {
+                run_end++;
+            }
+            unsigned int slot = HomeSlot(cell, table_size);
+            for (;;)
+            {
+                unsigned int empty = SPATIAL_HASH_EMPTY;
+                if (table[slot].key.compare_exchange_strong(empty, cell, std::memory_order_relaxed))
+                {
+                    break;
+                }
+                slot = slot + 1 < table_size ? slot + 1 : 0;
+            }
+            table[slot].first = i;
+            table[slot].count = run_end - i;
+            size_t block = CellBlockIndex(cell, dims, block_dims);
+            cell_bits[cell / 32].fetch_or(1u << (cell % 32), std::memory_order_relaxed);
+            block_bits[block / 32].fetch_or(1u << (block % 32), std::memory_order_relaxed);
+        }
+    });
+}
+
+// Distance along the ray to the plane it leaves cell c through, on one axis.
+static float CellExit(float box_min, float cell_size, int c, float o, float d, float inv_d)
+{
+    if (d > 0.0f)
+    {
+        return (box_min + (float)(c + 1) * cell_size - o) * inv_d;
+    }
+    if (d < 0.0f)
+    {
+        return (box_min + (float)c * cell_size - o) * inv_d;
+    }
+    return INFINITY;
+}
+
+static int MinAxis(const float* t)
+{
+    return t[0] < t[1] ? (t[0] < t[2] ? 0 : 2) : (t[1] < t[2] ? 1 : 2);
+}
+
+RayHit SpatialHashGrid::ClosestHit(Ray r, float tmin, float tmax, SpatialHashCounters* counters) const
+{
+    RayHit closest = { -1, INFINITY };
+    if (sphere_count == 0)
+    {
+        return closest;
+    }
+
+    Vector3 d = r.direction;
+    float a = d.x * d.x + d.y * d.y + d.z * d.z;
+    float two_a = 2.0f * a;
+    for (int i = 0; i < oversized_count; i++)
+    {
+        BvhTestSphere(spheres[oversized[i]], oversized[i], d, a, two_a, tmin, tmax, &closest);
+    }
+    counters->sphere_tests += oversized_count;
+    if (occupied_cells == 0)
+    {
+        return closest;
+    }
+
+    // Clipped to the grid's box, and to the closest oversized hit.
+    float o[3] = { CAMERA_ORIGIN.x, CAMERA_ORIGIN.y, CAMERA_ORIGIN.z };
+    float dir[3] = { d.x, d.y, d.z };
+    float inv_d[3] = { 1.0f / d.x, 1.0f / d.y, 1.0f / d.z };
+    float box_min[3] = { origin.x, origin.y, origin.z };
+    float t0 = tmin;
+    float t1 = closest.t < tmax ? closest.t : tmax;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        BvhClipSlab(box_min[axis], box_min[axis] + (float)dims[axis] * cell_size, o[axis], dir[axis], inv_d[axis], &t0, &t1);
+    }
+    if (t0 > t1)
+    {
+        return closest;
+    }
+
+    int cell[3];
+    int step[3];
+    float t_next[3];
+    for (int axis = 0; axis < 3; axis++)
+    {
+        int c = (int)floorf((o[axis] + dir[axis] * t0 - box_min[axis]) / cell_size);
+        cell[axis] = c < 0 ? 0 : (c >= dims[axis] ? dims[axis] - 1 : c);
+        step[axis] = dir[axis] > 0.0f ? 1 : (dir[axis] < 0.0f ? -1 : 0);
+        t_next[axis] = CellExit(box_min[axis], cell_size, cell[axis], o[axis], dir[axis], inv_d[axis]);
+    }
+
+    const int block_size = 1 << SPATIAL_HASH_BLOCK_BITS;
+    for (;;)
+    {
+        size_t block = BlockIndex(cell[0], cell[1], cell[2], block_dims);
+        if (!(block_bits[block / 32].load(std::memory_order_relaxed) & (1u << (block % 32))))
+        {
+            // Across the empty block, into the first cell past it. The cells on the other axes are
+            // kept within the block, so rounding can't send the ray back into it.
+            int first[3];
+            float t_block[3];
+            for (int axis = 0; axis < 3; axis++)
+            {
+                first[axis] = cell[axis] & ~(block_size - 1);
+                int exit_cell = step[axis] > 0 ? first[axis] + block_size - 1 : first[axis];
+                t_block[axis] = CellExit(box_min[axis], cell_size, exit_cell, o[axis], dir[axis], inv_d[axis]);
+            }
+            int exit_axis = MinAxis(t_block);
+            float t_exit = t_block[exit_axis];
+            if (t_exit > t1)
+            {
+                break;
+            }
+            for (int axis = 0; axis < 3; axis++)
+            {
+                if (axis == exit_axis)
+                {
+                    cell[axis] = step[axis] > 0 ? first[axis] + block_size : first[axis] - 1;
+                    continue;
+                }
+                int c = (int)floorf((o[axis] + dir[axis] * t_exit - box_min[axis]) / cell_size);
+                int last = first[axis] + block_size - 1 < dims[axis] - 1 ? first[axis] + block_size - 1 : dims[axis] - 1;
+                cell[axis] = c < first[axis] ? first[axis] : (c > last ? last : c);
+            }
+            if (cell[exit_axis] < 0 || cell[exit_axis] >= dims[exit_axis])
+            {
+                break;
+            }
+            for (int axis = 0; axis < 3; axis++)
+            {
+                t_next[axis] = CellExit(box_min[axis], cell_size, cell[axis], o[axis], dir[axis], inv_d[axis]);
+            }
+            continue;
+        }
+
+        int axis = MinAxis(t_next);
+        float t_exit = t_next[axis];
+        unsigned int index = CellIndex(cell[0], cell[1], cell[2], dims);
+        if (cell_bits[index / 32].load(std::memory_order_relaxed) & (1u << (index % 32)))
+        {
+            const HashSlot& slot = table[FindSlot(index)];
+            for (int k = slot.first; k < slot.first + slot.count; k++)
+            {
+                BvhTestSphere(entry_spheres[k], EntrySphere(entries[k]), d, a, two_a, tmin, tmax, &closest);
+            }
+            counters->cells_visited++;
+            counters->sphere_tests += slot.count;
+        }
+        // Any sphere hit before the cell's exit overlaps a cell visited so far.
+        if (closest.t <= t_exit || t_exit > t1)
+        {
+            break;
+        }
+        cell[axis] += step[axis];
+        if (cell[axis] < 0 || cell[axis] >= dims[axis])
+        {
+            break;
+        }
+        t_next[axis] = CellExit(box_min[axis], cell_size, cell[axis], o[axis], dir[axis], inv_d[axis]);
+    }
+    return closest;
+}
+
+void DrawSceneSpatialHash(Image* img, SpatialHashGrid* grid)
+{
+    if (grid->scene_version != frame_scene->version)
+    {
+        grid->Build(*frame_scene);
+    }
+
+    DrawCanvasParallel(img, [&](int, Vector2Int canvas_pos, CanvasPixel* pixel)
+    {
+        SpatialHashCounters counters = { 0 };
+        RayHit hit = grid->ClosestHit(CanvasRay(canvas_pos), 1.0f, INFINITY, &counters);
+        Color col = hit.sphere < 0 ? BACKGROUND_COLOR : frame_scene->GetSphere(hit.sphere).color;
+        *pixel = CanvasPixel{ hit, col, (int)counters.sphere_tests, 0 };
+    });
+}
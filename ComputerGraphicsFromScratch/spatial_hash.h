@@ -0,0 +1,132 @@
+/**********************************************************************************************
+*
+*   Spatial hash grid for fully dynamic scenes
+*
+*   When every sphere moves every frame, a refitted hierarchy loosens until it is no better than
+*   none, and a full BVH build costs N log N. This grid is rebuilt from scratch instead, with a
+*   handful of parallel O(N) passes:
+*     1. bounds of the (grazing-padded) spheres and their mean radius, which sets the cell size
+*     2. a (cell, sphere) entry for every cell each sphere overlaps
+*     3. a radix sort of the entries by cell, two or three passes for the cell counts that come up
+*     4. every run of one cell's entries is inserted into an open-addressed hash table (lock-free,
+*        by compare-and-swap) and marked in the bitmaps
+*   Only occupied cells take up table slots, so memory follows the spheres, not the volume, and
+*   the hashing's random accesses are made once per cell rather than once per entry. Spheres
+*   too large for the cells go to a short list every ray tests first instead.
+*
+*   Storage only grows: once a scene of a given size has been built, rebuilding it (or any
+*   smaller one) allocates nothing.
+*
+*   Rays march the grid cell by cell (Amanatides & Woo), skip empty cells through a bitmap and
+*   look occupied ones up in the table; a coarser bitmap of blocks of cells lets them cross empty
+*   space a block at a time. Every sphere is in every cell its padded bounds overlap,
+*   so a hit no farther than the exit of the current cell can't be beaten by a later one and
+*   ends the march.
+*
+**********************************************************************************************/
+
+#ifndef SPATIAL_HASH_H
+#define SPATIAL_HASH_H
+
+#include "bvh.h"
+#include "scene_snapshot.h"
+#include <atomic>
+#include <memory>
+#include <vector>
+
+// Cell edge in mean (grazing-padded) sphere radii.
+#define SPATIAL_HASH_CELL_RADII 4.0f
+
+// Cells in the grid's box, capped so the bitmap stays within 16 MB; cells grow past
+// SPATIAL_HASH_CELL_RADII when the scene's bounds need it.
+#define SPATIAL_HASH_MAX_CELLS (1ll << 27)
+
+// Spheres spanning more cells than this along any axis are tested by every ray instead.
+#define SPATIAL_HASH_MAX_SPAN 16
+
+// Rays cross empty blocks of 2^BITS cells per axis in one step.
+#define SPATIAL_HASH_BLOCK_BITS 3
+
+struct SpatialHashCounters
+{
+    long long cells_visited;  // occupied cells looked up
+    long long sphere_tests;
+};
+
+class SpatialHashGrid
+{
+public:
+    void Build(const SceneSnapshot& source);
+
+    // Closest hit, with the same arithmetic per sphere as ClosestHit.
+    RayHit ClosestHit(Ray r, float tmin, float tmax, SpatialHashCounters* counters) const;
+
+    float CellSize() const { return cell_size; }
+    int OccupiedCells() const { return occupied_cells; }
+    int EntryCount() const { return entry_count; }
+    int OversizedCount() const { return oversized_count; }
+    size_t MemoryBytes() const;
+
+    // Times storage had to grow, over all builds so far.
+    int Allocations() const { return allocations; }
+
+    unsigned long long scene_version = 0;
+
+private:
+    struct WorkerSums
+    {
+        Vector3 min;
+        Vector3 max;
+        double radius_sum;       // grazing-padded
+        long long entries;
+        int oversized;
+        int occupied;
+    };
+
+    // Keyed by the cell's index in the grid's box.
+    struct HashSlot
+    {
+        std::atomic<unsigned int> key; // or empty
+        int first;                     // start of the cell's range in entries
+        int count;
+    };
+
+    float cell_size = 1.0f;
+    Vector3 origin = { 0 };
+    int dims[3] = { 0, 0, 0 };
+    int block_dims[3] = { 0, 0, 0 };
+    int sphere_count = 0;
+    int occupied_cells = 0;
+    int entry_count = 0;
+    int oversized_count = 0;
+    unsigned int table_size = 0;
+    int allocations = 0;
+
+    std::unique_ptr<BvhSphere[]> spheres;   // folded, in scene order
+    std::unique_ptr<float[]> bound_radii;   // grazing-padded
+    std::unique_ptr<int[]> oversized;
+    std::unique_ptr<HashSlot[]> table;
+    std::unique_ptr<unsigned long long[]> entry_buffers[2]; // cell << 32 | sphere, radix sorted
+    const unsigned long long* entries = NULL; // the sorted buffer, so grouped by cell
+    std::unique_ptr<BvhSphere[]> entry_spheres; // each entry's sphere, so a cell's are contiguous
+    std::unique_ptr<std::atomic<unsigned int>[]> cell_bits;  // one per cell of the grid's box
+    std::unique_ptr<std::atomic<unsigned int>[]> block_bits; // one per block of cells
+    size_t sphere_capacity = 0;
+    size_t table_capacity = 0;
+    size_t entry_capacity = 0;
+    size_t cell_bits_capacity = 0;
+    size_t block_bits_capacity = 0;
+    std::vector<WorkerSums> workers;
+    std::vector<int> histograms;
+
+    bool Grow(size_t* capacity, size_t count);
+    bool CellRange(int sphere, int* lo, int* hi) const;
+    int SortEntries();
+    int FindSlot(unsigned int cell) const;
+};
+
+// Rebuilds the grid whenever frame_scene changes, then traces the canvas through it, rows split
+// across workers.
+void DrawSceneSpatialHash(Image* img, SpatialHashGrid* grid);
+
+#endif //SPATIAL_HASH_H
@@ -0,0 +1,79 @@
+#include "static_scene.h"
+#include "render_stats.h"
+#include "validation.h"
+
+static constexpr StaticScene<DEFAULT_SCENE_COUNT> default_static_scene = MakeStaticScene(DEFAULT_SCENE);
+
+RayHit DefaultStaticClosestHit(Ray r, float tmin, float tmax)
+{
+    return StaticClosestHit(default_static_scene, r.direction, tmin, tmax);
+}
+
+RayHit DefaultStaticClosestHitUnrolled(Ray r, float tmin, float tmax)
+{
+    return StaticClosestHitUnrolled(default_static_scene, r.direction, tmin, tmax, std::make_index_sequence<DEFAULT_SCENE_COUNT>{});
+}
+
+RayHit DefaultStaticClosestHitBvh(Ray r, float tmin, float tmax)
+{
+    return StaticClosestHitBvh(default_static_scene, r.direction, tmin, tmax);
+}
+
+bool DefaultStaticRemap(const SceneSnapshot& source, int remap[DEFAULT_SCENE_COUNT])
+{
+    bool taken[DEFAULT_SCENE_COUNT] = {};
+    int found = 0;
+    for (int i = 0; i < DEFAULT_SCENE_COUNT; i++)
+    {
+        remap[i] = STATIC_SPHERE_REMOVED;
+    }
+    for (int index = 0; index < source.count && found < DEFAULT_SCENE_COUNT; index++)
+    {
+        Sphere sp = source.GetSphere(index);
+        for (int i = 0; i < DEFAULT_SCENE_COUNT; i++)
+        {
+            const Sphere& d = DEFAULT_SCENE[i];
+            if (!taken[i] && sp.center.x == d.center.x && sp.center.y == d.center.y && sp.center.z == d.center.z && sp.radius == d.radius &&
+                sp.color.r == d.color.r && sp.color.g == d.color.g && sp.color.b == d.color.b && sp.color.a == d.color.a)
+            {
+                taken[i] = true;
+                remap[i] = index;
+                found++;
+                break;
+            }
+        }
+    }
+    return found == DEFAULT_SCENE_COUNT && source.count == DEFAULT_SCENE_COUNT;
+}
+
+void DrawSceneStatic(Image* img)
+{
+    static unsigned long long remap_version = 0;
+    static int remap[DEFAULT_SCENE_COUNT];
+    static bool remapped = false;
+    if (!remapped || remap_version != frame_scene->version)
+    {
+        if (!DefaultStaticRemap(*frame_scene, remap))
+        {
+            TraceLog(LOG_WARNING, "The scene no longer holds exactly DEFAULT_SCENE; the compile-time scene still draws it");
+        }
+        remap_version = frame_scene->version;
+        remapped = true;
+    }
+
+    for (int x = -CANVAS_WIDTH / 2; x < CANVAS_WIDTH / 2; x++)
+    {
+        for (int y = -CANVAS_HEIGHT / 2; y < CANVAS_HEIGHT / 2; y++)
+        {
+            Vector2Int canvas_pos = { x,y };
+            RayHit hit = StaticClosestHit(default_static_scene, CanvasRay(canvas_pos).direction, 1.0f, INFINITY);
+            Color col = hit.sphere < 0 ? BACKGROUND_COLOR : default_static_scene.spheres[hit.sphere].color;
+            CaptureHit(x, y, RayHit{ hit.sphere < 0 ? -1 : remap[hit.sphere], hit.t });
+            render_stats.primary_rays++;
+            canvas_pos = CanvasToScreen(canvas_pos);
+            RecordPixelCost(canvas_pos.x, canvas_pos.y, DEFAULT_SCENE_COUNT);
+            SetPixel(img, canvas_pos.x, canvas_pos.y, col);
+        }
+    }
+    render_stats.intersection_tests += (long long)DEFAULT_SCENE_COUNT * CANVAS_WIDTH * CANVAS_HEIGHT;
+}
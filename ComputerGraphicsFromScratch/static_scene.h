@@ -0,0 +1,255 @@
+/**********************************************************************************************
+*
+*   Compile-time specialized scenes
+*
+*   A fixed scene such as DEFAULT_SCENE can be turned into a StaticScene<N> by constexpr
+*   evaluation: everything in the intersection quadratic that doesn't depend on the ray is
+*   folded per sphere, and a small BVH is built over the spheres. Small scenes are then
+*   intersected with a fully unrolled loop, larger ones through the BVH.
+*
+*   Since IntersectRaySphere measures from CAMERA_ORIGIN, the folded terms are only valid for
+*   rays from there, i.e. primary rays.
+*
+**********************************************************************************************/
+
+#ifndef STATIC_SCENE_H
+#define STATIC_SCENE_H
+
+#include "raytracer.h"
+#include "scene_snapshot.h"
+#include <utility>
+
+// Scenes up to this size skip the BVH and test every sphere in an unrolled loop.
+#define STATIC_SCENE_BVH_MIN_SPHERES 8
+
+struct StaticSphere
+{
+    Vector3 co;     // CAMERA_ORIGIN - center
+    float c;        // co.co - r*r, the ray-independent term of the quadratic
+    Vector3 center;
+    float radius;
+    Color color;
+};
+
+struct StaticBvhNode
+{
+    Vector3 min;
+    Vector3 max;
+    int left;   // child node indices, -1 for a leaf
+    int right;
+    int sphere; // leaf only
+};
+
+template <int N>
+struct StaticScene
+{
+    StaticSphere spheres[N];
+    StaticBvhNode nodes[2 * N - 1];
+    int node_count;
+};
+
+constexpr float StaticDot(Vector3 a, Vector3 b)
+{
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+constexpr float StaticMin(float a, float b)
+{
+    return a < b ? a : b;
+}
+
+constexpr float StaticMax(float a, float b)
+{
+    return a > b ? a : b;
+}
+
+constexpr float StaticAxis(Vector3 v, int axis)
+{
+    return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+// Median split on the longest axis of the centroid bounds. Returns the index of the new node.
+template <int N>
+constexpr int BuildStaticBvhNode(StaticScene<N>& scene, int* order, int begin, int end)
+{
+    int node = scene.node_count++;
+    StaticBvhNode& n = scene.nodes[node];
+    const StaticSphere& first = scene.spheres[order[begin]];
+    n.min = Vector3{ first.center.x - first.radius, first.center.y - first.radius, first.center.z - first.radius };
+    n.max = Vector3{ first.center.x + first.radius, first.center.y + first.radius, first.center.z + first.radius };
+    Vector3 cmin = first.center;
+    Vector3 cmax = first.center;
+    for (int i = begin + 1; i < end; i++)
+    {
+        const StaticSphere& sp = scene.spheres[order[i]];
+        n.min = Vector3{ n.min.x < sp.center.x - sp.radius ? n.min.x : sp.center.x - sp.radius,
+                         n.min.y < sp.center.y - sp.radius ? n.min.y : sp.center.y - sp.radius,
+                         n.min.z < sp.center.z - sp.radius ? n.min.z : sp.center.z - sp.radius };
+        n.max = Vector3{ n.max.x > sp.center.x + sp.radius ? n.max.x : sp.center.x + sp.radius,
+                         n.max.y > sp.center.y + sp.radius ? n.max.y : sp.center.y + sp.radius,
+                         n.max.z > sp.center.z + sp.radius ? n.max.z : sp.center.z + sp.radius };
+        cmin = Vector3{ cmin.x < sp.center.x ? cmin.x : sp.center.x, cmin.y < sp.center.y ? cmin.y : sp.center.y, cmin.z < sp.center.z ? cmin.z : sp.center.z };
+        cmax = Vector3{ cmax.x > sp.center.x ? cmax.x : sp.center.x, cmax.y > sp.center.y ? cmax.y : sp.center.y, cmax.z > sp.center.z ? cmax.z : sp.center.z };
+    }
+
+    if (end - begin == 1)
+    {
+        n.left = -1;
+        n.right = -1;
+        n.sphere = order[begin];
+        return node;
+    }
+
+    int axis = 0;
+    Vector3 extent = Vector3{ cmax.x - cmin.x, cmax.y - cmin.y, cmax.z - cmin.z };
+    if (extent.y > StaticAxis(extent, axis)) axis = 1;
+    if (extent.z > StaticAxis(extent, axis)) axis = 2;
+
+    // Insertion sort is plenty for the handful of spheres this is meant for.
+    for (int i = begin + 1; i < end; i++)
+    {
+        int key = order[i];
+        float value = StaticAxis(scene.spheres[key].center, axis);
+        int j = i - 1;
+        while (j >= begin && StaticAxis(scene.spheres[order[j]].center, axis) > value)
+        {
+            order[j + 1] = order[j];
+            j--;
+        }
+        order[j + 1] = key;
+    }
+
+    int mid = (begin + end) / 2;
+    n.sphere = -1;
+    int left = BuildStaticBvhNode(scene, order, begin, mid);
+    int right = BuildStaticBvhNode(scene, order, mid, end);
+    scene.nodes[node].left = left;
+    scene.nodes[node].right = right;
+    return node;
+}
+
+template <int N>
+constexpr StaticScene<N> MakeStaticScene(const Sphere (&spheres)[N])
+{
+    StaticScene<N> scene = {};
+    int order[N] = {};
+    for (int i = 0; i < N; i++)
+    {
+        const Sphere& sp = spheres[i];
+        Vector3 co = Vector3{ CAMERA_ORIGIN.x - sp.center.x, CAMERA_ORIGIN.y - sp.center.y, CAMERA_ORIGIN.z - sp.center.z };
+        scene.spheres[i] = StaticSphere{ co, StaticDot(co, co) - sp.radius * sp.radius, sp.center, sp.radius, sp.color };
+        order[i] = i;
+    }
+    scene.node_count = 0;
+    BuildStaticBvhNode(scene, order, 0, N);
+    return scene;
+}
+
+// Same arithmetic as IntersectRaySphere and the closest-hit update in raytracer.cpp, with a and 2a
+// computed once per ray.
+inline void StaticTestSphere(const StaticSphere& sp, int index, Vector3 d, float a, float two_a, float tmin, float tmax, RayHit* closest)
+{
+    float b = 2.0f * StaticDot(sp.co, d);
+    float discriminant = (b * b) - (4.0f * a * sp.c);
+    if (discriminant < 0.0f)
+    {
+        return;
+    }
+    float root = sqrtf(discriminant);
+    float t1 = (-b + root) / two_a;
+    float t2 = (-b - root) / two_a;
+    if (t1 >= tmin && t1 <= tmax && t1 < closest->t)
+    {
+        closest->t = t1;
+        closest->sphere = index;
+    }
+    if (t2 >= tmin && t2 <= tmax && t2 < closest->t)
+    {
+        closest->t = t2;
+        closest->sphere = index;
+    }
+}
+
+template <int N, size_t... I>
+inline RayHit StaticClosestHitUnrolled(const StaticScene<N>& scene, Vector3 d, float tmin, float tmax, std::index_sequence<I...>)
+{
+    float a = StaticDot(d, d);
+    float two_a = 2.0f * a;
+    RayHit closest = { -1, INFINITY };
+    (StaticTestSphere(scene.spheres[I], (int)I, d, a, two_a, tmin, tmax, &closest), ...);
+    return closest;
+}
+
+template <int N>
+inline RayHit StaticClosestHitBvh(const StaticScene<N>& scene, Vector3 d, float tmin, float tmax)
+{
+    float a = StaticDot(d, d);
+    float two_a = 2.0f * a;
+    Vector3 inv_d = Vector3{ 1.0f / d.x, 1.0f / d.y, 1.0f / d.z };
+    RayHit closest = { -1, INFINITY };
+
+    int stack[N];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+    while (stack_size > 0)
+    {
+        const StaticBvhNode& n = scene.nodes[stack[--stack_size]];
+
+        // Slab test from CAMERA_ORIGIN against [tmin, closest so far].
+        float tx0 = (n.min.x - CAMERA_ORIGIN.x) * inv_d.x;
+        float tx1 = (n.max.x - CAMERA_ORIGIN.x) * inv_d.x;
+        float ty0 = (n.min.y - CAMERA_ORIGIN.y) * inv_d.y;
+        float ty1 = (n.max.y - CAMERA_ORIGIN.y) * inv_d.y;
+        float tz0 = (n.min.z - CAMERA_ORIGIN.z) * inv_d.z;
+        float tz1 = (n.max.z - CAMERA_ORIGIN.z) * inv_d.z;
+        float t0 = StaticMax(StaticMax(StaticMin(tx0, tx1), StaticMin(ty0, ty1)), StaticMax(StaticMin(tz0, tz1), tmin));
+        float t1 = StaticMin(StaticMin(StaticMax(tx0, tx1), StaticMax(ty0, ty1)), StaticMin(StaticMax(tz0, tz1), StaticMin(closest.t, tmax)));
+        if (t0 > t1)
+        {
+            continue;
+        }
+
+        if (n.left < 0)
+        {
+            StaticTestSphere(scene.spheres[n.sphere], n.sphere, d, a, two_a, tmin, tmax, &closest);
+            continue;
+        }
+        stack[stack_size++] = n.right;
+        stack[stack_size++] = n.left;
+    }
+    return closest;
+}
+
+template <int N>
+inline RayHit StaticClosestHit(const StaticScene<N>& scene, Vector3 d, float tmin, float tmax)
+{
+    if constexpr (N < STATIC_SCENE_BVH_MIN_SPHERES)
+    {
+        return StaticClosestHitUnrolled(scene, d, tmin, tmax, std::make_index_sequence<N>{});
+    }
+    else
+    {
+        return StaticClosestHitBvh(scene, d, tmin, tmax);
+    }
+}
+
+// DEFAULT_SCENE, specialized at compile time. Sphere indices in the returned hits are
+// DEFAULT_SCENE's, not the runtime scene's: translate them through DefaultStaticRemap.
+RayHit DefaultStaticClosestHit(Ray r, float tmin, float tmax);
+RayHit DefaultStaticClosestHitUnrolled(Ray r, float tmin, float tmax);
+RayHit DefaultStaticClosestHitBvh(Ray r, float tmin, float tmax);
+
+// Remapped index of a DEFAULT_SCENE sphere the runtime scene no longer has. It is neither a sphere
+// nor a miss, so every pixel drawn from that sphere shows up as a mismatch.
+#define STATIC_SPHERE_REMOVED -3
+
+// Dense index in source of every DEFAULT_SCENE sphere, found by its contents, since edits and
+// reorders of the runtime scene move spheres the compile-time copy can't follow; STATIC_SPHERE_REMOVED
+// for one source no longer has. Returns whether source holds exactly DEFAULT_SCENE's spheres, in any order.
+bool DefaultStaticRemap(const SceneSnapshot& source, int remap[DEFAULT_SCENE_COUNT]);
+
+// Draws DEFAULT_SCENE, whatever frame_scene holds, with hits captured under frame_scene's indices;
+// warns once per snapshot that no longer holds exactly its spheres.
+void DrawSceneStatic(Image* img);
+
+#endif //STATIC_SCENE_H
@@ -0,0 +1,249 @@
+#include "tile_binning.h"
+#include "scene_snapshot.h"
+#include <raymath.h>
+
+bool SphereCanvasBounds(const Sphere& sp, CanvasRect* rect)
+{
+    Vector3 c = Vector3Subtract(sp.center, CAMERA_ORIGIN);
+    float r = sp.radius;
+
+    // Primary rays have direction.z == CAMERA_ORIGIN_DISTANCE and start at t = 1,
+    // so only the part of the sphere with z >= CAMERA_ORIGIN_DISTANCE can show up.
+    float z_far = c.z + r;
+    if (z_far < CAMERA_ORIGIN_DISTANCE)
+    {
+        return false;
+    }
+    float z_near = fmaxf(c.z - r, CAMERA_ORIGIN_DISTANCE);
+
+    // x/z and y/z are monotonic in each coordinate, so their extremes over the sphere's
+    // bounding box are found at the box corners.
+    float x_min = fminf((c.x - r) / z_near, (c.x - r) / z_far);
+    float x_max = fmaxf((c.x + r) / z_near, (c.x + r) / z_far);
+    float y_min = fminf((c.y - r) / z_near, (c.y - r) / z_far);
+    float y_max = fmaxf((c.y + r) / z_near, (c.y + r) / z_far);
+
+    float scale_x = CAMERA_ORIGIN_DISTANCE * (CANVAS_WIDTH / VIEWPORT_WIDTH);
+    float scale_y = CAMERA_ORIGIN_DISTANCE * (CANVAS_HEIGHT / VIEWPORT_HEIGHT);
+    const float half_w = CANVAS_WIDTH / 2;
+    const float half_h = CANVAS_HEIGHT / 2;
+
+    // One extra pixel on each side covers rounding in IntersectRaySphere near the silhouette.
+    float x0 = Clamp(floorf(x_min * scale_x) - 1.0f, -half_w, half_w - 1.0f);
+    float x1 = Clamp(ceilf(x_max * scale_x) + 1.0f, -half_w, half_w - 1.0f);
+    float y0 = Clamp(floorf(y_min * scale_y) - 1.0f, -half_h, half_h - 1.0f);
+    float y1 = Clamp(ceilf(y_max * scale_y) + 1.0f, -half_h, half_h - 1.0f);
+
+    if (x_max * scale_x + 1.0f < -half_w || x_min * scale_x - 1.0f > half_w - 1.0f
+        || y_max * scale_y + 1.0f < -half_h || y_min * scale_y - 1.0f > half_h - 1.0f)
+    {
+        return false;
+    }
+
+    *rect = CanvasRect{ (int)x0, (int)y0, (int)x1, (int)y1 };
+    return true;
+}
+
+static void TileRange(const CanvasRect& rect, int* tx0, int* ty0, int* tx1, int* ty1)
+{
+    *tx0 = (rect.x0 + CANVAS_WIDTH / 2) / TILE_SIZE;
+    *tx1 = (rect.x1 + CANVAS_WIDTH / 2) / TILE_SIZE;
+    *ty0 = (rect.y0 + CANVAS_HEIGHT / 2) / TILE_SIZE;
+    *ty1 = (rect.y1 + CANVAS_HEIGHT / 2) / TILE_SIZE;
+}
+
+void BinSpheres(TileBins* bins)
+{
+    bins->bounds.resize(frame_scene->count);
+    bins->on_screen.resize(frame_scene->count);
+
+    // Counting pass, then a prefix sum turns the counts into list offsets.
+    int counts[TILE_COUNT] = { 0 };
+    for (int i = 0; i < frame_scene->count; i++)
+    {
+        bins->on_screen[i] = SphereCanvasBounds(frame_scene->GetSphere(i), &bins->bounds[i]);
+        if (!bins->on_screen[i])
+        {
+            continue;
+        }
+        int tx0, ty0, tx1, ty1;
+        TileRange(bins->bounds[i], &tx0, &ty0, &tx1, &ty1);
+        for (int ty = ty0; ty <= ty1; ty++)
+        {
+            for (int tx = tx0; tx <= tx1; tx++)
+            {
+                counts[ty * TILE_COUNT_X + tx]++;
+            }
+        }
+    }
+
+    bins->first[0] = 0;
+    for (int t = 0; t < TILE_COUNT; t++)
+    {
+        bins->first[t + 1] = bins->first[t] + counts[t];
+        counts[t] = bins->first[t];
+    }
+    bins->spheres.resize(bins->first[TILE_COUNT]);
+
+    // Filling pass, in object order so each list stays sorted by index.
+    for (int i = 0; i < frame_scene->count; i++)
+    {
+        if (!bins->on_screen[i])
+        {
+            continue;
+        }
+        int tx0, ty0, tx1, ty1;
+        TileRange(bins->bounds[i], &tx0, &ty0, &tx1, &ty1);
+        for (int ty = ty0; ty <= ty1; ty++)
+        {
+            for (int tx = tx0; tx <= tx1; tx++)
+            {
+                bins->spheres[counts[ty * TILE_COUNT_X + tx]++] = i;
+            }
+        }
+    }
+}
+
+CanvasRect TileCanvasRect(int tile_x, int tile_y)
+{
+    int x0 = -CANVAS_WIDTH / 2 + tile_x * TILE_SIZE;
+    int y0 = -CANVAS_HEIGHT / 2 + tile_y * TILE_SIZE;
+    return CanvasRect{ x0, y0, x0 + TILE_SIZE - 1, y0 + TILE_SIZE - 1 };
+}
+
+void FillCanvasRect(Image* img, CanvasRect rect, Color c)
+{
+    // Canvas y grows upwards, screen y downwards: the rectangle's top-left on screen is its top canvas row.
+    Vector2Int top_left = CanvasToScreen(Vector2Int{ rect.x0, rect.y1 });
+    ImageDrawRectangle(img, top_left.x, top_left.y, rect.x1 - rect.x0 + 1, rect.y1 - rect.y0 + 1, c);
+}
+
+void FillTile(Image* img, int tile_x, int tile_y, Color c)
+{
+    FillCanvasRect(img, TileCanvasRect(tile_x, tile_y), c);
+}
+
+Beam BuildBeam(CanvasRect rect)
+{
+    // Every pixel ray of the rectangle is a convex combination of the corner pixel rays,
+    // so the pyramid they span holds all of them.
+    Beam beam;
+    beam.corners[0] = Vector3Subtract(CanvasToViewport(Vector2Int{ rect.x0, rect.y0 }), CAMERA_ORIGIN);
+    beam.corners[1] = Vector3Subtract(CanvasToViewport(Vector2Int{ rect.x1, rect.y0 }), CAMERA_ORIGIN);
+    beam.corners[2] = Vector3Subtract(CanvasToViewport(Vector2Int{ rect.x1, rect.y1 }), CAMERA_ORIGIN);
+    beam.corners[3] = Vector3Subtract(CanvasToViewport(Vector2Int{ rect.x0, rect.y1 }), CAMERA_ORIGIN);
+
+    Vector3 axis = Vector3Add(Vector3Add(beam.corners[0], beam.corners[1]), Vector3Add(beam.corners[2], beam.corners[3]));
+    beam.axis = Vector3Normalize(axis);
+    beam.half_angle = 0.0f;
+    for (int i = 0; i < 4; i++)
+    {
+        Vector3 n = Vector3Normalize(Vector3CrossProduct(beam.corners[i], beam.corners[(i + 1) % 4]));
+        if (Vector3DotProduct(n, axis) < 0.0f)
+        {
+            n = Vector3Negate(n);
+        }
+        beam.side_normals[i] = n;
+
+        float corner_cos = Vector3DotProduct(beam.axis, Vector3Normalize(beam.corners[i]));
+        beam.half_angle = fmaxf(beam.half_angle, acosf(Clamp(corner_cos, -1.0f, 1.0f)));
+    }
+    return beam;
+}
+
+bool BeamMayHitSphere(const Beam& beam, const Sphere& sp)
+{
+    Vector3 c = Vector3Subtract(sp.center, CAMERA_ORIGIN);
+    for (int i = 0; i < 4; i++)
+    {
+        if (Vector3DotProduct(beam.side_normals[i], c) < -sp.radius)
+        {
+            return false;
+        }
+    }
+
+    // The planes alone let spheres slip past near the pyramid's edges; the bounding cone catches those.
+    // A sphere subtends a cone of half-angle asin(r / |c|) around its center direction.
+    float distance = Vector3Length(c);
+    if (distance <= sp.radius)
+    {
+        return true;
+    }
+    float center_angle = acosf(Clamp(Vector3DotProduct(beam.axis, c) / distance, -1.0f, 1.0f));
+    float sphere_angle = asinf(sp.radius / distance);
+    return center_angle <= beam.half_angle + sphere_angle + 1e-4f;
+}
+
+// True if every ray of the beam hits the sphere at t >= 1. The sphere's silhouette cone is convex,
+// so it is enough for the corner rays to be inside it; they are kept a little away from the
+// silhouette so rounding in IntersectRaySphere can't turn a corner pixel into a miss.
+static bool BeamInsideSphere(const Beam& beam, const Sphere& sp)
+{
+    Vector3 c = Vector3Subtract(sp.center, CAMERA_ORIGIN);
+    float r2 = sp.radius * sp.radius;
+    if (c.z - sp.radius < CAMERA_ORIGIN_DISTANCE)
+    {
+        return false;
+    }
+    for (int i = 0; i < 4; i++)
+    {
+        Vector3 d = beam.corners[i];
+        float dc = Vector3DotProduct(d, c);
+        float dist2 = Vector3DotProduct(c, c) - (dc * dc) / Vector3DotProduct(d, d);
+        if (dc <= 0.0f || dist2 > r2 * 0.999f)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SphereInFrontOf(const Sphere& front, const Sphere& other)
+{
+    // Along any ray, the entry point on a sphere is no farther than the length of the tangent from
+    // the origin, and no point of another sphere is nearer than its center distance minus its radius.
+    Vector3 fc = Vector3Subtract(front.center, CAMERA_ORIGIN);
+    float front_far = sqrtf(Vector3DotProduct(fc, fc) - front.radius * front.radius);
+    float other_near = Vector3Distance(other.center, CAMERA_ORIGIN) - other.radius;
+    return front_far < other_near;
+}
+
+TileCoverage ClassifyTileBeam(int tile_x, int tile_y, const int* candidates, int candidate_count,
+    int* visible, int* visible_count, int* covering_sphere)
+{
+    Beam beam = BuildBeam(TileCanvasRect(tile_x, tile_y));
+
+    *visible_count = 0;
+    for (int i = 0; i < candidate_count; i++)
+    {
+        if (BeamMayHitSphere(beam, frame_scene->GetSphere(candidates[i])))
+        {
+            visible[(*visible_count)++] = candidates[i];
+        }
+    }
+    if (*visible_count == 0)
+    {
+        return TILE_EMPTY;
+    }
+
+    for (int i = 0; i < *visible_count; i++)
+    {
+        const Sphere& front = frame_scene->GetSphere(visible[i]);
+        if (!BeamInsideSphere(beam, front))
+        {
+            continue;
+        }
+
+        bool occludes_all = true;
+        for (int j = 0; j < *visible_count && occludes_all; j++)
+        {
+            occludes_all = j == i || SphereInFrontOf(front, frame_scene->GetSphere(visible[j]));
+        }
+        if (occludes_all)
+        {
+            *covering_sphere = visible[i];
+            return TILE_COVERED;
+        }
+    }
+    return TILE_MIXED;
+}
@@ -0,0 +1,88 @@
+/**********************************************************************************************
+*
+*   Screen-space tile binning
+*
+*   Every sphere is projected to a conservative canvas rectangle and appended to the candidate
+*   list of each tile that rectangle overlaps, the way a tiled rasterizer bins triangles.
+*   Primary rays then only test their own tile's list.
+*
+*   A tile can further be resolved as a whole by testing its beam, the pyramid spanned by its
+*   corner pixel rays: if the beam misses every candidate the tile is background, and if it lies
+*   entirely inside one sphere's silhouette in front of every other candidate it takes that
+*   sphere's color. Only tiles left over (the ones containing silhouette edges) are traced per pixel.
+*
+**********************************************************************************************/
+
+#ifndef TILE_BINNING_H
+#define TILE_BINNING_H
+
+#include "raytracer.h"
+#include <vector>
+
+#define TILE_SIZE 16
+#define TILE_COUNT_X (CANVAS_WIDTH / TILE_SIZE)
+#define TILE_COUNT_Y (CANVAS_HEIGHT / TILE_SIZE)
+#define TILE_COUNT (TILE_COUNT_X * TILE_COUNT_Y)
+
+// Inclusive canvas-space pixel bounds.
+struct CanvasRect
+{
+    int x0;
+    int y0;
+    int x1;
+    int y1;
+};
+
+// Per-tile sphere lists, stored compactly: tile i owns spheres[first[i] .. first[i+1]).
+// The canvas bounds each sphere was binned with are kept alongside, indexed like the scene.
+struct TileBins
+{
+    int first[TILE_COUNT + 1];
+    std::vector<int> spheres;
+    std::vector<CanvasRect> bounds;
+    std::vector<bool> on_screen;
+};
+
+// Returns false when the sphere can't be hit by a primary ray at all (entirely before the viewport).
+bool SphereCanvasBounds(const Sphere& sp, CanvasRect* rect);
+
+void BinSpheres(TileBins* bins);
+
+// Pyramid spanned by the corner pixel rays of a canvas rectangle.
+struct Beam
+{
+    Vector3 corners[4];      // corner pixel ray directions, counter-clockwise
+    Vector3 side_normals[4]; // unit normals of the side planes, pointing inwards
+    Vector3 axis;            // unit axis of the cone bounding the pyramid
+    float half_angle;        // and its half-angle, in radians
+};
+
+Beam BuildBeam(CanvasRect rect);
+
+// False only if the sphere lies entirely outside one of the beam's side planes, or outside its bounding cone.
+bool BeamMayHitSphere(const Beam& beam, const Sphere& sp);
+
+// True if, along every primary ray, front is hit before any point of other.
+bool SphereInFrontOf(const Sphere& front, const Sphere& other);
+
+enum TileCoverage
+{
+    TILE_EMPTY,   // the beam misses every sphere
+    TILE_COVERED, // every ray of the beam hits the same front-most sphere
+    TILE_MIXED    // contains silhouette edges, needs per-pixel tracing
+};
+
+// Conservative beam test of a tile against its candidate list. Spheres the beam can touch are
+// written to visible (room for candidate_count entries); for TILE_COVERED the sphere index is
+// written to covering_sphere.
+TileCoverage ClassifyTileBeam(int tile_x, int tile_y, const int* candidates, int candidate_count,
+    int* visible, int* visible_count, int* covering_sphere);
+
+// Canvas-space pixel bounds of a tile.
+CanvasRect TileCanvasRect(int tile_x, int tile_y);
+
+// Fill a canvas rectangle or a whole tile with one color, without going through SetPixel for each pixel.
+void FillCanvasRect(Image* img, CanvasRect rect, Color c);
+void FillTile(Image* img, int tile_x, int tile_y, Color c);
+
+#endif //TILE_BINNING_H
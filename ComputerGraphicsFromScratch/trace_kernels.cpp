@@ -0,0 +1,187 @@
+#include "trace_kernels.h"
+#include "render_stats.h"
+#include <stdlib.h>
+
+namespace trace_scalar
+{
+
+struct Lanes
+{
+    typedef float F;
+    typedef bool M;
+    typedef int I;
+    static const int WIDTH = 1;
+
+    static F Set1(float v) { return v; }
+    static F LaneIndex() { return 0.0f; }
+    static F Add(F a, F b) { return a + b; }
+    static F Sub(F a, F b) { return a - b; }
+    static F Mul(F a, F b) { return a * b; }
+    static F Div(F a, F b) { return a / b; }
+    static F Sqrt(F a) { return sqrtf(a); }
+    static F Neg(F a) { return -a; }
+    static M Ge(F a, F b) { return a >= b; }
+    static M Le(F a, F b) { return a <= b; }
+    static M Lt(F a, F b) { return a < b; }
+    static M Eq(F a, F b) { return a == b; }
+    static M And(M a, M b) { return a && b; }
+    static M Or(M a, M b) { return a || b; }
+    static M AndNot(M a, M b) { return a && !b; }
+    static bool Any(M m) { return m; }
+    static F Select(M m, F a, F b) { return m ? a : b; }
+    static I SetIndex(int v) { return v; }
+    static I SelectIndex(M m, I a, I b) { return m ? a : b; }
+    static void Store(float* p, F a) { *p = a; }
+    static F Load(const float* p) { return *p; }
+    static void StoreIndex(int* p, I a) { *p = a; }
+    static F Min(F a, F b) { return a < b ? a : b; }
+    static F Max(F a, F b) { return a > b ? a : b; }
+    static F LoadBytes(const unsigned char* p) { return (float)*p; }
+    static int MoveMask(M m) { return m ? 1 : 0; }
+    static void GatherColors(const int* ids, const Color* palette, Color* out) { *out = palette[*ids + 1]; }
+};
+
+} // namespace trace_scalar
+
+#define TRACE_KERNEL_NAMESPACE trace_scalar
+#include "trace_kernels_simd.inl"
+
+const TraceKernels trace_kernels_scalar = { ISA_SCALAR, trace_scalar::TraceRows, trace_scalar::ResolvePixels, trace_scalar::WideBvhClosestHit,
+    trace_scalar::BvhClosestHits, trace_scalar::BvhAnyHits, trace_scalar::SurfaceHits };
+
+const TraceKernels* trace_kernels = &trace_kernels_scalar;
+
+const TraceKernels* GetTraceKernels(IsaLevel isa)
+{
+    switch (isa)
+    {
+    case ISA_SSE2:
+        return &trace_kernels_sse2;
+    case ISA_AVX2:
+        return &trace_kernels_avx2;
+    case ISA_AVX512:
+        return &trace_kernels_avx512;
+    default:
+        return &trace_kernels_scalar;
+    }
+}
+
+void SelectTraceKernels(const char* isa_override)
+{
+    IsaLevel supported = DetectIsa();
+    IsaLevel isa = supported;
+
+    char* env = NULL;
+    size_t env_length = 0;
+    if (isa_override == NULL && _dupenv_s(&env, &env_length, "CGFS_ISA") == 0 && env != NULL)
+    {
+        isa_override = env;
+    }
+
+    if (isa_override != NULL)
+    {
+        IsaLevel requested;
+        if (!ParseIsa(isa_override, &requested))
+        {
+            TraceLog(LOG_WARNING, "KERNELS: Unknown ISA '%s', expected scalar, sse2, avx2 or avx512", isa_override);
+        }
+        else if (requested > supported)
+        {
+            TraceLog(LOG_WARNING, "KERNELS: CPU can't run %s kernels, falling back to %s", isa_names[requested], isa_names[supported]);
+        }
+        else
+        {
+            isa = requested;
+        }
+    }
+    free(env);
+
+    trace_kernels = GetTraceKernels(isa);
+    render_stats.isa = isa_names[isa];
+    TraceLog(LOG_INFO, "KERNELS: Using %s tracing kernels (CPU supports up to %s)", isa_names[isa], isa_names[supported]);
+}
+
+static void StoreSphereSoA(SphereSoA* soa, int i, const Sphere& sp)
+{
+    // Same terms IntersectRaySphere computes for every ray.
+    Vector3 co = Vector3{ CAMERA_ORIGIN.x - sp.center.x, CAMERA_ORIGIN.y - sp.center.y, CAMERA_ORIGIN.z - sp.center.z };
+    soa->co_x[i] = co.x;
+    soa->co_y[i] = co.y;
+    soa->co_z[i] = co.z;
+    soa->c[i] = (co.x * co.x + co.y * co.y + co.z * co.z) - sp.radius * sp.radius;
+    soa->palette[i + 1] = sp.color;
+}
+
+static void ResizeSphereSoA(SphereSoA* soa, int count)
+{
+    soa->count = count;
+    soa->co_x.resize(count);
+    soa->co_y.resize(count);
+    soa->co_z.resize(count);
+    soa->c.resize(count);
+    soa->palette.resize((size_t)count + 1);
+    soa->palette[0] = BACKGROUND_COLOR;
+}
+
+static void StoreSphereSoAChunk(SphereSoA* soa, const SceneSnapshot& source, int chunk)
+{
+    int first = chunk << SNAPSHOT_CHUNK_SHIFT;
+    int end = first + SNAPSHOT_CHUNK_SIZE < source.count ? first + SNAPSHOT_CHUNK_SIZE : source.count;
+    for (int i = first; i < end; i++)
+    {
+        StoreSphereSoA(soa, i, source.GetSphere(i));
+    }
+}
+
+void BuildSphereSoA(const SceneSnapshot& source, SphereSoA* soa)
+{
+    ResizeSphereSoA(soa, source.count);
+    for (int c = 0; c < (int)source.chunks.size(); c++)
+    {
+        StoreSphereSoAChunk(soa, source, c);
+    }
+    soa->source_chunks = source.chunks;
+}
+
+void UpdateSphereSoA(const SceneSnapshot& source, SphereSoA* soa)
+{
+    // Holding on to the chunks keeps them alive, so an equal pointer really is the same data.
+    ResizeSphereSoA(soa, source.count);
+    for (int c = 0; c < (int)source.chunks.size(); c++)
+    {
+        if (c >= (int)soa->source_chunks.size() || soa->source_chunks[c] != source.chunks[c])
+        {
+            StoreSphereSoAChunk(soa, source, c);
+        }
+    }
+    soa->source_chunks = source.chunks;
+}
+
+void ResizeHitBuffer(HitBuffer* hits)
+{
+    hits->sphere.resize((size_t)CANVAS_WIDTH * CANVAS_HEIGHT);
+    hits->t.resize((size_t)CANVAS_WIDTH * CANVAS_HEIGHT);
+}
+
+void DrawSceneKernels(Image* img, const TraceKernels& kernels, const SphereSoA& spheres, HitBuffer* hits)
+{
+    kernels.trace_rows(spheres, -CANVAS_HEIGHT / 2, CANVAS_HEIGHT / 2, 1.0f, INFINITY, hits);
+
+    // Canvas rows are contiguous left to right, just like image rows, so each one converts straight
+    // into the image. The bottom canvas row maps one past the last screen row, as in DrawScene.
+    Color* pixels = (Color*)img->data;
+    for (int y = -CANVAS_HEIGHT / 2; y < CANVAS_HEIGHT / 2; y++)
+    {
+        int screen_y = CanvasToScreen(Vector2Int{ 0, y }).y;
+        if (screen_y < 0 || screen_y >= img->height)
+        {
+            continue;
+        }
+        int row = (y + CANVAS_HEIGHT / 2) * CANVAS_WIDTH;
+        kernels.resolve_pixels(&hits->sphere[row], CANVAS_WIDTH, spheres.palette.data(), pixels + screen_y * img->width);
+    }
+
+    render_stats.primary_rays += (long long)CANVAS_WIDTH * CANVAS_HEIGHT;
+    render_stats.intersection_tests += (long long)CANVAS_WIDTH * CANVAS_HEIGHT * spheres.count;
+    RecordUniformPixelCost(spheres.count);
+}
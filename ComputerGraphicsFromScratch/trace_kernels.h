@@ -0,0 +1,110 @@
+/**********************************************************************************************
+*
+*   ISA-specific tracing kernels
+*
+*   The per-pixel hot path (primary ray setup, the IntersectRaySphere quadratic, the closest-hit
+*   update and the hit-to-pixel conversion) is compiled once per instruction set, each in its
+*   own translation unit built with the matching /arch. The lanes of a vector hold neighbouring
+*   pixels of a canvas row, so every kernel does exactly the scalar arithmetic per ray and
+*   produces the same hits.
+*
+*   The batch kernels do the same for rays from anywhere, such as the path tracer's bounces and
+*   shadow rays, a lane per ray: the rays of a batch walk the BVH together, fetching a node once
+*   for all of them when any enters it and testing each sphere of a leaf against all of them at
+*   once, then find where they hit and which way the surface faces there. Every lane keeps the
+*   arithmetic of the scalar queries in bvh.h, so a ray gets the same hit as alone, unless two
+*   spheres are hit at exactly the same distance and are reached in another order.
+*
+*   The variant is picked once at startup from cpuid. It can be forced with the CGFS_ISA
+*   environment variable or the --isa=<name> flag (scalar, sse2, avx2, avx512), which fall back
+*   to the best supported variant if the CPU can't run the requested one.
+*
+**********************************************************************************************/
+
+#ifndef TRACE_KERNELS_H
+#define TRACE_KERNELS_H
+
+#include "cpu_dispatch.h"
+#include "raytracer.h"
+#include "scene_snapshot.h"
+#include "wide_bvh.h"
+#include <vector>
+
+// Spheres with the ray-independent part of the quadratic folded, one array per field, in the
+// scene's dense order.
+struct SphereSoA
+{
+    int count = 0;
+    std::vector<float> co_x; // CAMERA_ORIGIN - center
+    std::vector<float> co_y;
+    std::vector<float> co_z;
+    std::vector<float> c;    // co.co - r*r
+    std::vector<Color> palette; // [0] is the background, [i + 1] the color of sphere i
+    std::vector<std::shared_ptr<const SnapshotChunk>> source_chunks; // the snapshot chunks this reflects
+};
+
+// Where a ray from anywhere meets the sphere it hit.
+struct SurfaceHit
+{
+    Vector3 point;
+    Vector3 normal;    // unit length, turned to face the ray
+    Vector3 direction; // the ray's, at unit length
+};
+
+// Closest hit of every canvas pixel, indexed by (y + CANVAS_HEIGHT / 2) * CANVAS_WIDTH + (x + CANVAS_WIDTH / 2).
+struct HitBuffer
+{
+    std::vector<int> sphere; // -1 for a miss
+    std::vector<float> t;
+};
+
+struct TraceKernels
+{
+    IsaLevel isa;
+
+    // Traces the primary rays of canvas rows [canvas_y_begin, canvas_y_end) against every sphere.
+    void (*trace_rows)(const SphereSoA& spheres, int canvas_y_begin, int canvas_y_end, float tmin, float tmax, HitBuffer* hits);
+
+    // Converts sphere indices to pixel colors through the palette.
+    void (*resolve_pixels)(const int* sphere_ids, int count, const Color* palette, Color* out);
+
+    // Closest hit through a wide BVH, testing a node's children Lanes::WIDTH at a time.
+    RayHit (*wide_bvh_closest_hit)(const WideBvh& bvh, Ray r, float tmin, float tmax, BvhTraceCounters* counters);
+
+    // BvhClosestHitFrom of count rays, Lanes::WIDTH at a time. A node visited for a batch counts
+    // once, a sphere test once per ray.
+    void (*bvh_closest_hits)(const Bvh& bvh, const SceneSnapshot& source, const Ray* rays, int count, float tmin, float tmax, RayHit* hits,
+        BvhTraceCounters* counters);
+
+    // BvhAnyHit of count rays, each over [tmin, tmax[i]]; a ray drops out of its batch once blocked.
+    void (*bvh_any_hits)(const Bvh& bvh, const SceneSnapshot& source, const Ray* rays, const float* tmax, int count, float tmin, bool* blocked,
+        BvhTraceCounters* counters);
+
+    // Surfaces at the hits of count rays, which must all have hit a sphere.
+    void (*surface_hits)(const SceneSnapshot& source, const Ray* rays, const RayHit* hits, int count, SurfaceHit* surfaces);
+};
+
+extern const TraceKernels trace_kernels_scalar;
+extern const TraceKernels trace_kernels_sse2;
+extern const TraceKernels trace_kernels_avx2;
+extern const TraceKernels trace_kernels_avx512;
+
+// The variant in use, set by SelectTraceKernels.
+extern const TraceKernels* trace_kernels;
+
+const TraceKernels* GetTraceKernels(IsaLevel isa);
+
+// Picks the kernels for this CPU, unless isa_override (or else CGFS_ISA) names a variant to force.
+void SelectTraceKernels(const char* isa_override);
+
+void BuildSphereSoA(const SceneSnapshot& source, SphereSoA* soa);
+
+// Refolds only the chunks the snapshot doesn't share with the one the arrays were last built from,
+// so the cost follows the number of edits rather than the number of spheres.
+void UpdateSphereSoA(const SceneSnapshot& source, SphereSoA* soa);
+void ResizeHitBuffer(HitBuffer* hits);
+
+// Traces the whole canvas with the selected kernels and writes it into the image.
+void DrawSceneKernels(Image* img, const TraceKernels& kernels, const SphereSoA& spheres, HitBuffer* hits);
+
+#endif //TRACE_KERNELS_H
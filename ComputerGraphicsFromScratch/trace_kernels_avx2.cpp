@@ -0,0 +1,54 @@
+#include "trace_kernels.h"
+#include <immintrin.h>
+
+namespace trace_avx2
+{
+
+struct Lanes
+{
+    typedef __m256 F;
+    typedef __m256 M;
+    typedef __m256i I;
+    static const int WIDTH = 8;
+
+    static F Set1(float v) { return _mm256_set1_ps(v); }
+    static F LaneIndex() { return _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f); }
+    static F Add(F a, F b) { return _mm256_add_ps(a, b); }
+    static F Sub(F a, F b) { return _mm256_sub_ps(a, b); }
+    static F Mul(F a, F b) { return _mm256_mul_ps(a, b); }
+    static F Div(F a, F b) { return _mm256_div_ps(a, b); }
+    static F Sqrt(F a) { return _mm256_sqrt_ps(a); }
+    static F Neg(F a) { return _mm256_xor_ps(a, _mm256_set1_ps(-0.0f)); }
+    static M Ge(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+    static M Le(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+    static M Lt(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    static M Eq(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+    static M And(M a, M b) { return _mm256_and_ps(a, b); }
+    static M Or(M a, M b) { return _mm256_or_ps(a, b); }
+    static M AndNot(M a, M b) { return _mm256_andnot_ps(b, a); }
+    static bool Any(M m) { return _mm256_movemask_ps(m) != 0; }
+    static F Select(M m, F a, F b) { return _mm256_blendv_ps(b, a, m); }
+    static I SetIndex(int v) { return _mm256_set1_epi32(v); }
+    static I SelectIndex(M m, I a, I b) { return _mm256_blendv_epi8(b, a, _mm256_castps_si256(m)); }
+    static void Store(float* p, F a) { _mm256_storeu_ps(p, a); }
+    static F Load(const float* p) { return _mm256_loadu_ps(p); }
+    static void StoreIndex(int* p, I a) { _mm256_storeu_si256((__m256i*)p, a); }
+    static F Min(F a, F b) { return _mm256_min_ps(a, b); }
+    static F Max(F a, F b) { return _mm256_max_ps(a, b); }
+    static F LoadBytes(const unsigned char* p) { return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)p))); }
+    static int MoveMask(M m) { return _mm256_movemask_ps(m); }
+
+    static void GatherColors(const int* ids, const Color* palette, Color* out)
+    {
+        __m256i index = _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)ids), _mm256_set1_epi32(1));
+        _mm256_storeu_si256((__m256i*)out, _mm256_i32gather_epi32((const int*)palette, index, 4));
+    }
+};
+
+} // namespace trace_avx2
+
+#define TRACE_KERNEL_NAMESPACE trace_avx2
+#include "trace_kernels_simd.inl"
+
+const TraceKernels trace_kernels_avx2 = { ISA_AVX2, trace_avx2::TraceRows, trace_avx2::ResolvePixels, trace_avx2::WideBvhClosestHit,
+    trace_avx2::BvhClosestHits, trace_avx2::BvhAnyHits, trace_avx2::SurfaceHits };
@@ -0,0 +1,56 @@
+#include "trace_kernels.h"
+#include <immintrin.h>
+
+namespace trace_avx512
+{
+
+struct Lanes
+{
+    typedef __m512 F;
+    typedef __mmask16 M;
+    typedef __m512i I;
+    static const int WIDTH = 16;
+
+    static F Set1(float v) { return _mm512_set1_ps(v); }
+    static F LaneIndex() { return _mm512_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f, 8.0f, 9.0f, 10.0f, 11.0f, 12.0f, 13.0f, 14.0f, 15.0f); }
+    static F Add(F a, F b) { return _mm512_add_ps(a, b); }
+    static F Sub(F a, F b) { return _mm512_sub_ps(a, b); }
+    static F Mul(F a, F b) { return _mm512_mul_ps(a, b); }
+    static F Div(F a, F b) { return _mm512_div_ps(a, b); }
+    static F Sqrt(F a) { return _mm512_sqrt_ps(a); }
+    static F Neg(F a) { return _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(a), _mm512_set1_epi32((int)0x80000000))); }
+    static M Ge(F a, F b) { return _mm512_cmp_ps_mask(a, b, _CMP_GE_OQ); }
+    static M Le(F a, F b) { return _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ); }
+    static M Lt(F a, F b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+    static M Eq(F a, F b) { return _mm512_cmp_ps_mask(a, b, _CMP_EQ_OQ); }
+    static M And(M a, M b) { return (M)(a & b); }
+    static M Or(M a, M b) { return (M)(a | b); }
+    static M AndNot(M a, M b) { return (M)(a & ~b); }
+    static bool Any(M m) { return m != 0; }
+    static F Select(M m, F a, F b) { return _mm512_mask_blend_ps(m, b, a); }
+    static I SetIndex(int v) { return _mm512_set1_epi32(v); }
+    static I SelectIndex(M m, I a, I b) { return _mm512_mask_blend_epi32(m, b, a); }
+    static void Store(float* p, F a) { _mm512_storeu_ps(p, a); }
+    static F Load(const float* p) { return _mm512_loadu_ps(p); }
+    static void StoreIndex(int* p, I a) { _mm512_storeu_si512(p, a); }
+    static F Min(F a, F b) { return _mm512_min_ps(a, b); }
+    static F Max(F a, F b) { return _mm512_max_ps(a, b); }
+
+    // Only eight bytes are read; the upper lanes come out as zero.
+    static F LoadBytes(const unsigned char* p) { return _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)p))); }
+    static int MoveMask(M m) { return (int)m; }
+
+    static void GatherColors(const int* ids, const Color* palette, Color* out)
+    {
+        __m512i index = _mm512_add_epi32(_mm512_loadu_si512(ids), _mm512_set1_epi32(1));
+        _mm512_storeu_si512(out, _mm512_i32gather_epi32(index, (const int*)palette, 4));
+    }
+};
+
+} // namespace trace_avx512
+
+#define TRACE_KERNEL_NAMESPACE trace_avx512
+#include "trace_kernels_simd.inl"
+
+const TraceKernels trace_kernels_avx512 = { ISA_AVX512, trace_avx512::TraceRows, trace_avx512::ResolvePixels, trace_avx512::WideBvhClosestHit,
+    trace_avx512::BvhClosestHits, trace_avx512::BvhAnyHits, trace_avx512::SurfaceHits };
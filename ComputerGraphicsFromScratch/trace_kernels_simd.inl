@@ -0,0 +1,566 @@
+// Body of the tracing kernels, shared by every ISA variant. The including translation unit defines
+// TRACE_KERNEL_NAMESPACE and, inside it, a Lanes struct wrapping its vector type before including
+// this file; keeping each variant in its own namespace stops the linker from merging instantiations
+// compiled for different instruction sets.
+
+namespace TRACE_KERNEL_NAMESPACE
+{
+
+static_assert(CANVAS_WIDTH % Lanes::WIDTH == 0, "canvas rows must split evenly into lanes");
+
+static void TraceRows(const SphereSoA& spheres, int canvas_y_begin, int canvas_y_end, float tmin, float tmax, HitBuffer* hits)
+{
+    typedef Lanes::F F;
+    typedef Lanes::M M;
+    typedef Lanes::I I;
+
+    const F lane_index = Lanes::LaneIndex();
+    const F step_x = Lanes::Set1(VIEWPORT_WIDTH / CANVAS_WIDTH);
+    const F origin_x = Lanes::Set1(CAMERA_ORIGIN.x);
+    const F origin_y = Lanes::Set1(CAMERA_ORIGIN.y);
+    const F origin_z = Lanes::Set1(CAMERA_ORIGIN.z);
+    const F v_tmin = Lanes::Set1(tmin);
+    const F v_tmax = Lanes::Set1(tmax);
+    const F zero = Lanes::Set1(0.0f);
+    const F two = Lanes::Set1(2.0f);
+    const F four = Lanes::Set1(4.0f);
+
+    for (int y = canvas_y_begin; y < canvas_y_end; y++)
+    {
+        // Same steps as CanvasRay: viewport point, then direction from the camera.
+        const F dir_y = Lanes::Sub(Lanes::Set1((float)y * (VIEWPORT_HEIGHT / CANVAS_HEIGHT)), origin_y);
+        const F dir_z = Lanes::Sub(Lanes::Set1(CAMERA_ORIGIN_DISTANCE), origin_z);
+        int row = (y + CANVAS_HEIGHT / 2) * CANVAS_WIDTH;
+
+        for (int i = 0; i < CANVAS_WIDTH; i += Lanes::WIDTH)
+        {
+            F canvas_x = Lanes::Add(Lanes::Set1((float)(i - CANVAS_WIDTH / 2)), lane_index);
+            F dir_x = Lanes::Sub(Lanes::Mul(canvas_x, step_x), origin_x);
+
+            F a = Lanes::Add(Lanes::Add(Lanes::Mul(dir_x, dir_x), Lanes::Mul(dir_y, dir_y)), Lanes::Mul(dir_z, dir_z));
+            F four_a = Lanes::Mul(four, a);
+            F two_a = Lanes::Mul(two, a);
+            F closest_t = Lanes::Set1(INFINITY);
+            // Indices stay in integer lanes: floats stop holding every integer past 2^24 spheres.
+            I closest_sphere = Lanes::SetIndex(-1);
+
+            for (int s = 0; s < spheres.count; s++)
+            {
+                F dot = Lanes::Add(Lanes::Add(Lanes::Mul(Lanes::Set1(spheres.co_x[s]), dir_x),
+                    Lanes::Mul(Lanes::Set1(spheres.co_y[s]), dir_y)), Lanes::Mul(Lanes::Set1(spheres.co_z[s]), dir_z));
+                F b = Lanes::Mul(two, dot);
+                F discriminant = Lanes::Sub(Lanes::Mul(b, b), Lanes::Mul(four_a, Lanes::Set1(spheres.c[s])));
+                M hit = Lanes::Ge(discriminant, zero);
+                if (!Lanes::Any(hit))
+                {
+                    continue;
+                }
+
+                F root = Lanes::Sqrt(discriminant);
+                F neg_b = Lanes::Neg(b);
+                F t1 = Lanes::Div(Lanes::Add(neg_b, root), two_a);
+                F t2 = Lanes::Div(Lanes::Sub(neg_b, root), two_a);
+                I index = Lanes::SetIndex(s);
+
+                M take_t1 = Lanes::And(hit, Lanes::And(Lanes::And(Lanes::Ge(t1, v_tmin), Lanes::Le(t1, v_tmax)), Lanes::Lt(t1, closest_t)));
+                closest_t = Lanes::Select(take_t1, t1, closest_t);
+                closest_sphere = Lanes::SelectIndex(take_t1, index, closest_sphere);
+
+                M take_t2 = Lanes::And(hit, Lanes::And(Lanes::And(Lanes::Ge(t2, v_tmin), Lanes::Le(t2, v_tmax)), Lanes::Lt(t2, closest_t)));
+                closest_t = Lanes::Select(take_t2, t2, closest_t);
+                closest_sphere = Lanes::SelectIndex(take_t2, index, closest_sphere);
+            }
+
+            Lanes::Store(&hits->t[row + i], closest_t);
+            Lanes::StoreIndex(&hits->sphere[row + i], closest_sphere);
+        }
+    }
+}
+
+static void ResolvePixels(const int* sphere_ids, int count, const Color* palette, Color* out)
+{
+    int i = 0;
+    for (; i + Lanes::WIDTH <= count; i += Lanes::WIDTH)
+    {
+        Lanes::GatherColors(sphere_ids + i, palette, out + i);
+    }
+    for (; i < count; i++)
+    {
+        out[i] = palette[sphere_ids[i] + 1];
+    }
+}
+
+static RayHit WideBvhClosestHit(const WideBvh& bvh, Ray r, float tmin, float tmax, BvhTraceCounters* counters)
+{
+    typedef Lanes::F F;
+
+    RayHit closest = { -1, INFINITY };
+    if (bvh.nodes.empty())
+    {
+        return closest;
+    }
+
+    Vector3 d = r.direction;
+    float a = d.x * d.x + d.y * d.y + d.z * d.z;
+    float two_a = 2.0f * a;
+
+    // A ray parallel to an axis still gets a finite inverse: padded child boxes never have a face
+    // on the ray's own plane, so any large slope gives the right answer.
+    float inv_x = 1.0f / (d.x != 0.0f ? d.x : 1e-20f);
+    float inv_y = 1.0f / (d.y != 0.0f ? d.y : 1e-20f);
+    float inv_z = 1.0f / (d.z != 0.0f ? d.z : 1e-20f);
+
+    // Entering through the near faces and leaving through the far ones, picked by direction, makes
+    // the inverted boxes of unused slots fail the test.
+    size_t near_x = inv_x >= 0.0f ? offsetof(WideBvhNode, lo_x) : offsetof(WideBvhNode, hi_x);
+    size_t near_y = inv_y >= 0.0f ? offsetof(WideBvhNode, lo_y) : offsetof(WideBvhNode, hi_y);
+    size_t near_z = inv_z >= 0.0f ? offsetof(WideBvhNode, lo_z) : offsetof(WideBvhNode, hi_z);
+    size_t far_x = inv_x >= 0.0f ? offsetof(WideBvhNode, hi_x) : offsetof(WideBvhNode, lo_x);
+    size_t far_y = inv_y >= 0.0f ? offsetof(WideBvhNode, hi_y) : offsetof(WideBvhNode, lo_y);
+    size_t far_z = inv_z >= 0.0f ? offsetof(WideBvhNode, hi_z) : offsetof(WideBvhNode, lo_z);
+    const F v_tmin = Lanes::Set1(tmin);
+
+    struct StackEntry
+    {
+        int node;
+        float t;
+    };
+    StackEntry stack[WIDE_BVH_STACK_SIZE];
+    int stack_size = 0;
+    stack[stack_size++] = StackEntry{ 0, tmin };
+    while (stack_size > 0)
+    {
+        StackEntry entry = stack[--stack_size];
+        if (entry.t > closest.t)
+        {
+            continue;
+        }
+        const WideBvhNode& n = bvh.nodes[entry.node];
+        const unsigned char* bytes = (const unsigned char*)&n;
+        counters->nodes_visited++;
+
+        // Child face = origin + q * step, so its distance along the ray is q * (step / d) + (origin - o) / d.
+        const F scale_x = Lanes::Set1(WideBvhStep(n.exponent[0]) * inv_x);
+        const F scale_y = Lanes::Set1(WideBvhStep(n.exponent[1]) * inv_y);
+        const F scale_z = Lanes::Set1(WideBvhStep(n.exponent[2]) * inv_z);
+        const F base_x = Lanes::Set1((n.origin.x - CAMERA_ORIGIN.x) * inv_x);
+        const F base_y = Lanes::Set1((n.origin.y - CAMERA_ORIGIN.y) * inv_y);
+        const F base_z = Lanes::Set1((n.origin.z - CAMERA_ORIGIN.z) * inv_z);
+        const F v_far = Lanes::Set1(closest.t < tmax ? closest.t : tmax);
+
+        float entry_t[WIDE_BVH_WIDTH > Lanes::WIDTH ? WIDE_BVH_WIDTH : Lanes::WIDTH];
+        unsigned int hit_mask = 0;
+        for (int base = 0; base < WIDE_BVH_WIDTH; base += Lanes::WIDTH)
+        {
+            F t_near_x = Lanes::Add(Lanes::Mul(Lanes::LoadBytes(bytes + near_x + base), scale_x), base_x);
+            F t_near_y = Lanes::Add(Lanes::Mul(Lanes::LoadBytes(bytes + near_y + base), scale_y), base_y);
+            F t_near_z = Lanes::Add(Lanes::Mul(Lanes::LoadBytes(bytes + near_z + base), scale_z), base_z);
+            F t_far_x = Lanes::Add(Lanes::Mul(Lanes::LoadBytes(bytes + far_x + base), scale_x), base_x);
+            F t_far_y = Lanes::Add(Lanes::Mul(Lanes::LoadBytes(bytes + far_y + base), scale_y), base_y);
+            F t_far_z = Lanes::Add(Lanes::Mul(Lanes::LoadBytes(bytes + far_z + base), scale_z), base_z);
+            F t0 = Lanes::Max(Lanes::Max(t_near_x, t_near_y), Lanes::Max(t_near_z, v_tmin));
+            F t1 = Lanes::Min(Lanes::Min(t_far_x, t_far_y), Lanes::Min(t_far_z, v_far));
+            hit_mask |= (unsigned int)Lanes::MoveMask(Lanes::Le(t0, t1)) << base;
+            Lanes::Store(&entry_t[base], t0);
+        }
+        hit_mask &= (1u << WIDE_BVH_WIDTH) - 1;
+
+        // Children front to back: leaves are tested right away, nodes are pushed so the nearest pops first.
+        int order[WIDE_BVH_WIDTH];
+        int hit_count = 0;
+        for (int i = 0; i < WIDE_BVH_WIDTH; i++)
+        {
+            if (hit_mask & (1u << i))
+            {
+                int j = hit_count++;
+                while (j > 0 && entry_t[order[j - 1]] > entry_t[i])
+                {
+                    order[j] = order[j - 1];
+                    j--;
+                }
+                order[j] = i;
+            }
+        }
+        for (int k = 0; k < hit_count; k++)
+        {
+            int c = order[k];
+            if ((n.interior_mask & (1 << c)) || entry_t[c] > closest.t)
+            {
+                continue;
+            }
+            int first = n.first_sphere + (n.meta[c] >> 3);
+            int count = n.meta[c] & 7;
+            for (int s = first; s < first + count; s++)
+            {
+                BvhTestSphere(bvh.spheres[s], bvh.sphere_ids[s], d, a, two_a, tmin, tmax, &closest);
+            }
+            counters->sphere_tests += count;
+        }
+        for (int k = hit_count - 1; k >= 0; k--)
+        {
+            int c = order[k];
+            if ((n.interior_mask & (1 << c)) && entry_t[c] <= closest.t)
+            {
+                stack[stack_size++] = StackEntry{ n.first_node + n.meta[c], entry_t[c] };
+            }
+        }
+    }
+    return closest;
+}
+
+
+// Rays of one batch, a lane each, with the terms every box and sphere test of a ray shares.
+struct RayLanes
+{
+    Lanes::F o_x, o_y, o_z;
+    Lanes::F d_x, d_y, d_z;
+    Lanes::F inv_x, inv_y, inv_z;
+    Lanes::M parallel_x, parallel_y, parallel_z; // no direction along the axis
+    Lanes::F two_a, four_a;
+};
+
+// Loads up to Lanes::WIDTH rays; the lanes past count repeat the last one, so they go wherever it goes.
+static void LoadRayLanes(const Ray* rays, int count, RayLanes* r)
+{
+    float v[6][Lanes::WIDTH];
+    for (int l = 0; l < Lanes::WIDTH; l++)
+    {
+        const Ray& ray = rays[l < count ? l : count - 1];
+        v[0][l] = ray.position.x;
+        v[1][l] = ray.position.y;
+        v[2][l] = ray.position.z;
+        v[3][l] = ray.direction.x;
+        v[4][l] = ray.direction.y;
+        v[5][l] = ray.direction.z;
+    }
+    const Lanes::F zero = Lanes::Set1(0.0f);
+    const Lanes::F one = Lanes::Set1(1.0f);
+    r->o_x = Lanes::Load(v[0]);
+    r->o_y = Lanes::Load(v[1]);
+    r->o_z = Lanes::Load(v[2]);
+    r->d_x = Lanes::Load(v[3]);
+    r->d_y = Lanes::Load(v[4]);
+    r->d_z = Lanes::Load(v[5]);
+    r->inv_x = Lanes::Div(one, r->d_x);
+    r->inv_y = Lanes::Div(one, r->d_y);
+    r->inv_z = Lanes::Div(one, r->d_z);
+    r->parallel_x = Lanes::Eq(r->d_x, zero);
+    r->parallel_y = Lanes::Eq(r->d_y, zero);
+    r->parallel_z = Lanes::Eq(r->d_z, zero);
+    Lanes::F a = Lanes::Add(Lanes::Add(Lanes::Mul(r->d_x, r->d_x), Lanes::Mul(r->d_y, r->d_y)), Lanes::Mul(r->d_z, r->d_z));
+    r->two_a = Lanes::Mul(Lanes::Set1(2.0f), a);
+    r->four_a = Lanes::Mul(Lanes::Set1(4.0f), a);
+}
+
+static int CountLanes(Lanes::M m)
+{
+    int count = 0;
+    for (int bits = Lanes::MoveMask(m); bits != 0; bits &= bits - 1)
+    {
+        count++;
+    }
+    return count;
+}
+
+// BvhClipSlab in every lane, through the same comparisons.
+static void ClipSlabLanes(float lo, float hi, Lanes::F o, Lanes::F inv_d, Lanes::M parallel, Lanes::F* t0, Lanes::F* t1)
+{
+    typedef Lanes::F F;
+    typedef Lanes::M M;
+
+    const F v_lo = Lanes::Set1(lo);
+    const F v_hi = Lanes::Set1(hi);
+    F ta = Lanes::Mul(Lanes::Sub(v_lo, o), inv_d);
+    F tb = Lanes::Mul(Lanes::Sub(v_hi, o), inv_d);
+    M a_first = Lanes::Lt(ta, tb);
+    F t_near = Lanes::Select(a_first, ta, tb);
+    F t_far = Lanes::Select(a_first, tb, ta);
+    F clipped0 = Lanes::Select(Lanes::Lt(*t0, t_near), t_near, *t0);
+    F clipped1 = Lanes::Select(Lanes::Lt(t_far, *t1), t_far, *t1);
+    M outside = Lanes::Or(Lanes::Lt(o, v_lo), Lanes::Lt(v_hi, o));
+    *t0 = Lanes::Select(parallel, Lanes::Select(outside, Lanes::Set1(INFINITY), *t0), clipped0);
+    *t1 = Lanes::Select(parallel, *t1, clipped1);
+}
+
+// BvhSlabEntry in every lane; *entered has the lanes whose entry isn't INFINITY.
+static Lanes::F SlabEntryLanes(const BvhNode& n, const RayLanes& r, Lanes::F tmin, Lanes::F tmax, Lanes::M* entered)
+{
+    Lanes::F t0 = tmin;
+    Lanes::F t1 = tmax;
+    ClipSlabLanes(n.min.x, n.max.x, r.o_x, r.inv_x, r.parallel_x, &t0, &t1);
+    ClipSlabLanes(n.min.y, n.max.y, r.o_y, r.inv_y, r.parallel_y, &t0, &t1);
+    ClipSlabLanes(n.min.z, n.max.z, r.o_z, r.inv_z, r.parallel_z, &t0, &t1);
+    const Lanes::F infinity = Lanes::Set1(INFINITY);
+    *entered = Lanes::And(Lanes::Le(t0, t1), Lanes::Lt(t0, infinity));
+    return Lanes::Select(*entered, t0, infinity);
+}
+
+// BvhSphereRoots of the sphere folded against every lane's origin; returns the lanes that hit it.
+static Lanes::M SphereRootsLanes(const Sphere& sp, const RayLanes& r, Lanes::F* t1, Lanes::F* t2)
+{
+    typedef Lanes::F F;
+
+    F co_x = Lanes::Sub(r.o_x, Lanes::Set1(sp.center.x));
+    F co_y = Lanes::Sub(r.o_y, Lanes::Set1(sp.center.y));
+    F co_z = Lanes::Sub(r.o_z, Lanes::Set1(sp.center.z));
+    F c = Lanes::Sub(Lanes::Add(Lanes::Add(Lanes::Mul(co_x, co_x), Lanes::Mul(co_y, co_y)), Lanes::Mul(co_z, co_z)),
+        Lanes::Set1(sp.radius * sp.radius));
+    F dot = Lanes::Add(Lanes::Add(Lanes::Mul(co_x, r.d_x), Lanes::Mul(co_y, r.d_y)), Lanes::Mul(co_z, r.d_z));
+    F b = Lanes::Mul(Lanes::Set1(2.0f), dot);
+    F discriminant = Lanes::Sub(Lanes::Mul(b, b), Lanes::Mul(r.four_a, c));
+    F root = Lanes::Sqrt(discriminant);
+    F neg_b = Lanes::Neg(b);
+    *t1 = Lanes::Div(Lanes::Add(neg_b, root), r.two_a);
+    *t2 = Lanes::Div(Lanes::Sub(neg_b, root), r.two_a);
+    return Lanes::Ge(discriminant, Lanes::Set1(0.0f));
+}
+
+// Pushes the children some lane enters, the one more lanes enter first on top.
+static void PushChildrenLanes(const BvhNode& n, Lanes::F t_left, Lanes::F t_right, Lanes::M enter_left, Lanes::M enter_right, int* stack,
+    int* stack_size)
+{
+    bool left_first = 2 * CountLanes(Lanes::And(Lanes::Or(enter_left, enter_right), Lanes::Le(t_left, t_right))) >=
+        CountLanes(Lanes::Or(enter_left, enter_right));
+    int near_child = left_first ? n.first : n.first + 1;
+    int far_child = left_first ? n.first + 1 : n.first;
+    bool near_entered = Lanes::Any(left_first ? enter_left : enter_right);
+    bool far_entered = Lanes::Any(left_first ? enter_right : enter_left);
+    if (far_entered)
+    {
+        stack[(*stack_size)++] = far_child;
+    }
+    if (near_entered)
+    {
+        stack[(*stack_size)++] = near_child;
+    }
+}
+
+static void BvhClosestHits(const Bvh& bvh, const SceneSnapshot& source, const Ray* rays, int count, float tmin, float tmax, RayHit* hits,
+    BvhTraceCounters* counters)
+{
+    typedef Lanes::F F;
+    typedef Lanes::M M;
+    typedef Lanes::I I;
+
+    // A single lane is no batch: the masks and selects only cost more than the scalar query.
+    if (Lanes::WIDTH == 1)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            hits[i] = BvhClosestHitFrom(bvh, source, rays[i], tmin, tmax, counters);
+        }
+        return;
+    }
+
+    const F v_tmin = Lanes::Set1(tmin);
+    const F v_tmax = Lanes::Set1(tmax);
+    for (int base = 0; base < count; base += Lanes::WIDTH)
+    {
+        int lanes = count - base < Lanes::WIDTH ? count - base : Lanes::WIDTH;
+        RayLanes r;
+        LoadRayLanes(rays + base, lanes, &r);
+        F closest_t = Lanes::Set1(INFINITY);
+        I closest_sphere = Lanes::SetIndex(-1);
+        F far = v_tmax;
+
+        int stack[BVH_STACK_SIZE];
+        int stack_size = 0;
+        M entered;
+        if (!bvh.nodes.empty())
+        {
+            SlabEntryLanes(bvh.nodes[0], r, v_tmin, far, &entered);
+            if (Lanes::Any(entered))
+            {
+                stack[stack_size++] = 0;
+            }
+        }
+        while (stack_size > 0)
+        {
+            const BvhNode& n = bvh.nodes[stack[--stack_size]];
+            counters->nodes_visited++;
+            if (n.count > 0)
+            {
+                for (int i = n.first; i < n.first + n.count; i++)
+                {
+                    F t1, t2;
+                    M hit = SphereRootsLanes(source.GetSphere(bvh.sphere_ids[i]), r, &t1, &t2);
+                    if (!Lanes::Any(hit))
+                    {
+                        continue;
+                    }
+                    I index = Lanes::SetIndex(bvh.sphere_ids[i]);
+
+                    M take_t1 = Lanes::And(hit, Lanes::And(Lanes::And(Lanes::Ge(t1, v_tmin), Lanes::Le(t1, v_tmax)), Lanes::Lt(t1, closest_t)));
+                    closest_t = Lanes::Select(take_t1, t1, closest_t);
+                    closest_sphere = Lanes::SelectIndex(take_t1, index, closest_sphere);
+
+                    M take_t2 = Lanes::And(hit, Lanes::And(Lanes::And(Lanes::Ge(t2, v_tmin), Lanes::Le(t2, v_tmax)), Lanes::Lt(t2, closest_t)));
+                    closest_t = Lanes::Select(take_t2, t2, closest_t);
+                    closest_sphere = Lanes::SelectIndex(take_t2, index, closest_sphere);
+                }
+                counters->sphere_tests += (long long)n.count * lanes;
+                far = Lanes::Select(Lanes::Lt(closest_t, v_tmax), closest_t, v_tmax);
+                continue;
+            }
+
+            M enter_left, enter_right;
+            F t_left = SlabEntryLanes(bvh.nodes[n.first], r, v_tmin, far, &enter_left);
+            F t_right = SlabEntryLanes(bvh.nodes[n.first + 1], r, v_tmin, far, &enter_right);
+            PushChildrenLanes(n, t_left, t_right, enter_left, enter_right, stack, &stack_size);
+        }
+
+        float t[Lanes::WIDTH];
+        int sphere[Lanes::WIDTH];
+        Lanes::Store(t, closest_t);
+        Lanes::StoreIndex(sphere, closest_sphere);
+        for (int l = 0; l < lanes; l++)
+        {
+            hits[base + l] = RayHit{ sphere[l], t[l] };
+        }
+    }
+}
+
+static void BvhAnyHits(const Bvh& bvh, const SceneSnapshot& source, const Ray* rays, const float* tmax, int count, float tmin, bool* blocked,
+    BvhTraceCounters* counters)
+{
+    typedef Lanes::F F;
+    typedef Lanes::M M;
+
+    if (Lanes::WIDTH == 1)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            int occluder = -1;
+            blocked[i] = BvhAnyHit(bvh, source, rays[i], tmin, tmax[i], &occluder, counters);
+        }
+        return;
+    }
+
+    const F v_tmin = Lanes::Set1(tmin);
+    for (int base = 0; base < count; base += Lanes::WIDTH)
+    {
+        int lanes = count - base < Lanes::WIDTH ? count - base : Lanes::WIDTH;
+        RayLanes r;
+        LoadRayLanes(rays + base, lanes, &r);
+        float lane_tmax[Lanes::WIDTH];
+        for (int l = 0; l < Lanes::WIDTH; l++)
+        {
+            lane_tmax[l] = tmax[base + (l < lanes ? l : lanes - 1)];
+        }
+        const F v_tmax = Lanes::Load(lane_tmax);
+
+        // Lanes still looking for an occluder; the repeated ones past count never are.
+        const M real = Lanes::Lt(Lanes::LaneIndex(), Lanes::Set1((float)lanes));
+        M open = real;
+
+        int stack[BVH_STACK_SIZE];
+        int stack_size = 0;
+        M entered;
+        if (!bvh.nodes.empty())
+        {
+            SlabEntryLanes(bvh.nodes[0], r, v_tmin, v_tmax, &entered);
+            if (Lanes::Any(Lanes::And(open, entered)))
+            {
+                stack[stack_size++] = 0;
+            }
+        }
+        while (stack_size > 0 && Lanes::Any(open))
+        {
+            const BvhNode& n = bvh.nodes[stack[--stack_size]];
+            counters->nodes_visited++;
+            if (n.count > 0)
+            {
+                for (int i = n.first; i < n.first + n.count && Lanes::Any(open); i++)
+                {
+                    counters->sphere_tests += CountLanes(open);
+                    F t1, t2;
+                    M hit = SphereRootsLanes(source.GetSphere(bvh.sphere_ids[i]), r, &t1, &t2);
+                    M in_range = Lanes::Or(Lanes::And(Lanes::Ge(t1, v_tmin), Lanes::Le(t1, v_tmax)),
+                        Lanes::And(Lanes::Ge(t2, v_tmin), Lanes::Le(t2, v_tmax)));
+                    open = Lanes::AndNot(open, Lanes::And(hit, in_range));
+                }
+                continue;
+            }
+
+            M enter_left, enter_right;
+            F t_left = SlabEntryLanes(bvh.nodes[n.first], r, v_tmin, v_tmax, &enter_left);
+            F t_right = SlabEntryLanes(bvh.nodes[n.first + 1], r, v_tmin, v_tmax, &enter_right);
+            PushChildrenLanes(n, t_left, t_right, Lanes::And(open, enter_left), Lanes::And(open, enter_right), stack, &stack_size);
+        }
+
+        int blocked_bits = Lanes::MoveMask(Lanes::AndNot(real, open));
+        for (int l = 0; l < lanes; l++)
+        {
+            blocked[base + l] = (blocked_bits & (1 << l)) != 0;
+        }
+    }
+}
+
+// Vector3Normalize in every lane: vectors of length 0 are left as they are.
+static void NormalizeLanes(Lanes::F* x, Lanes::F* y, Lanes::F* z)
+{
+    Lanes::F length = Lanes::Sqrt(Lanes::Add(Lanes::Add(Lanes::Mul(*x, *x), Lanes::Mul(*y, *y)), Lanes::Mul(*z, *z)));
+    Lanes::F inv_length = Lanes::Div(Lanes::Set1(1.0f), length);
+    Lanes::M zero = Lanes::Eq(length, Lanes::Set1(0.0f));
+    *x = Lanes::Select(zero, *x, Lanes::Mul(*x, inv_length));
+    *y = Lanes::Select(zero, *y, Lanes::Mul(*y, inv_length));
+    *z = Lanes::Select(zero, *z, Lanes::Mul(*z, inv_length));
+}
+
+// Same steps as the scalar shading code: hit point, normal from the center, flipped if it faces
+// along the ray.
+static void SurfaceHits(const SceneSnapshot& source, const Ray* rays, const RayHit* hits, int count, SurfaceHit* surfaces)
+{
+    typedef Lanes::F F;
+    typedef Lanes::M M;
+
+    for (int base = 0; base < count; base += Lanes::WIDTH)
+    {
+        int lanes = count - base < Lanes::WIDTH ? count - base : Lanes::WIDTH;
+        float v[10][Lanes::WIDTH];
+        for (int l = 0; l < Lanes::WIDTH; l++)
+        {
+            int k = base + (l < lanes ? l : lanes - 1);
+            Sphere sp = source.GetSphere(hits[k].sphere);
+            v[0][l] = rays[k].position.x;
+            v[1][l] = rays[k].position.y;
+            v[2][l] = rays[k].position.z;
+            v[3][l] = rays[k].direction.x;
+            v[4][l] = rays[k].direction.y;
+            v[5][l] = rays[k].direction.z;
+            v[6][l] = hits[k].t;
+            v[7][l] = sp.center.x;
+            v[8][l] = sp.center.y;
+            v[9][l] = sp.center.z;
+        }
+        F d_x = Lanes::Load(v[3]);
+        F d_y = Lanes::Load(v[4]);
+        F d_z = Lanes::Load(v[5]);
+        F t = Lanes::Load(v[6]);
+        F p_x = Lanes::Add(Lanes::Load(v[0]), Lanes::Mul(d_x, t));
+        F p_y = Lanes::Add(Lanes::Load(v[1]), Lanes::Mul(d_y, t));
+        F p_z = Lanes::Add(Lanes::Load(v[2]), Lanes::Mul(d_z, t));
+        F n_x = Lanes::Sub(p_x, Lanes::Load(v[7]));
+        F n_y = Lanes::Sub(p_y, Lanes::Load(v[8]));
+        F n_z = Lanes::Sub(p_z, Lanes::Load(v[9]));
+        NormalizeLanes(&n_x, &n_y, &n_z);
+        NormalizeLanes(&d_x, &d_y, &d_z);
+        M facing_away = Lanes::Lt(Lanes::Set1(0.0f), Lanes::Add(Lanes::Add(Lanes::Mul(n_x, d_x), Lanes::Mul(n_y, d_y)), Lanes::Mul(n_z, d_z)));
+        n_x = Lanes::Select(facing_away, Lanes::Neg(n_x), n_x);
+        n_y = Lanes::Select(facing_away, Lanes::Neg(n_y), n_y);
+        n_z = Lanes::Select(facing_away, Lanes::Neg(n_z), n_z);
+
+        F out[9] = { p_x, p_y, p_z, n_x, n_y, n_z, d_x, d_y, d_z };
+        for (int f = 0; f < 9; f++)
+        {
+            Lanes::Store(v[f], out[f]);
+        }
+        for (int l = 0; l < lanes; l++)
+        {
+            surfaces[base + l] = SurfaceHit{ Vector3{ v[0][l], v[1][l], v[2][l] }, Vector3{ v[3][l], v[4][l], v[5][l] },
+                Vector3{ v[6][l], v[7][l], v[8][l] } };
+        }
+    }
+}
+
+} // namespace TRACE_KERNEL_NAMESPACE
@@ -0,0 +1,67 @@
+#include "trace_kernels.h"
+#include <emmintrin.h>
+#include <string.h>
+
+namespace trace_sse2
+{
+
+struct Lanes
+{
+    typedef __m128 F;
+    typedef __m128 M;
+    typedef __m128i I;
+    static const int WIDTH = 4;
+
+    static F Set1(float v) { return _mm_set1_ps(v); }
+    static F LaneIndex() { return _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f); }
+    static F Add(F a, F b) { return _mm_add_ps(a, b); }
+    static F Sub(F a, F b) { return _mm_sub_ps(a, b); }
+    static F Mul(F a, F b) { return _mm_mul_ps(a, b); }
+    static F Div(F a, F b) { return _mm_div_ps(a, b); }
+    static F Sqrt(F a) { return _mm_sqrt_ps(a); }
+    static F Neg(F a) { return _mm_xor_ps(a, _mm_set1_ps(-0.0f)); }
+    static M Ge(F a, F b) { return _mm_cmpge_ps(a, b); }
+    static M Le(F a, F b) { return _mm_cmple_ps(a, b); }
+    static M Lt(F a, F b) { return _mm_cmplt_ps(a, b); }
+    static M Eq(F a, F b) { return _mm_cmpeq_ps(a, b); }
+    static M And(M a, M b) { return _mm_and_ps(a, b); }
+    static M Or(M a, M b) { return _mm_or_ps(a, b); }
+    static M AndNot(M a, M b) { return _mm_andnot_ps(b, a); }
+    static bool Any(M m) { return _mm_movemask_ps(m) != 0; }
+    static F Select(M m, F a, F b) { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+    static I SetIndex(int v) { return _mm_set1_epi32(v); }
+    static I SelectIndex(M m, I a, I b) { return _mm_or_si128(_mm_and_si128(_mm_castps_si128(m), a), _mm_andnot_si128(_mm_castps_si128(m), b)); }
+    static void Store(float* p, F a) { _mm_storeu_ps(p, a); }
+    static F Load(const float* p) { return _mm_loadu_ps(p); }
+    static void StoreIndex(int* p, I a) { _mm_storeu_si128((__m128i*)p, a); }
+    static F Min(F a, F b) { return _mm_min_ps(a, b); }
+    static F Max(F a, F b) { return _mm_max_ps(a, b); }
+    static int MoveMask(M m) { return _mm_movemask_ps(m); }
+
+    // Four bytes widened to floats; no pmovzx before SSE4.1.
+    static F LoadBytes(const unsigned char* p)
+    {
+        int packed;
+        memcpy(&packed, p, sizeof(packed));
+        __m128i zero = _mm_setzero_si128();
+        __m128i bytes = _mm_cvtsi32_si128(packed);
+        return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(bytes, zero), zero));
+    }
+
+    // No gather before AVX2.
+    static void GatherColors(const int* ids, const Color* palette, Color* out)
+    {
+        for (int i = 0; i < WIDTH; i++)
+        {
+            out[i] = palette[ids[i] + 1];
+        }
+    }
+};
+
+} // namespace trace_sse2
+
+#define TRACE_KERNEL_NAMESPACE trace_sse2
+#include "trace_kernels_simd.inl"
+
+const TraceKernels trace_kernels_sse2 = { ISA_SSE2, trace_sse2::TraceRows, trace_sse2::ResolvePixels, trace_sse2::WideBvhClosestHit,
+    trace_sse2::BvhClosestHits, trace_sse2::BvhAnyHits, trace_sse2::SurfaceHits };
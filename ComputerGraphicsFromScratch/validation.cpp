@@ -0,0 +1,133 @@
+#include "validation.h"
+#include <math.h>
+#include <stdio.h>
+
+HitBuffer* captured_hits = NULL;
+
+static HitBuffer frame_hits;
+static HitBuffer reference_hits;
+
+void CaptureFill(CanvasRect rect, int sphere)
+{
+    if (captured_hits == NULL)
+    {
+        return;
+    }
+    for (int y = rect.y0; y <= rect.y1; y++)
+    {
+        for (int x = rect.x0; x <= rect.x1; x++)
+        {
+            CaptureHit(x, y, RayHit{ sphere, NAN });
+        }
+    }
+}
+
+void TraceReferenceHits(HitBuffer* hits)
+{
+    ResizeHitBuffer(hits);
+    for (int y = -CANVAS_HEIGHT / 2; y < CANVAS_HEIGHT / 2; y++)
+    {
+        for (int x = -CANVAS_WIDTH / 2; x < CANVAS_WIDTH / 2; x++)
+        {
+            RayHit hit = TraceRayHit(CanvasRay(Vector2Int{ x, y }), 1.0f, INFINITY);
+            size_t i = (size_t)(y + CANVAS_HEIGHT / 2) * CANVAS_WIDTH + (x + CANVAS_WIDTH / 2);
+            hits->sphere[i] = hit.sphere;
+            hits->t[i] = hit.t;
+        }
+    }
+}
+
+void CompareHits(const HitBuffer& expected, const HitBuffer& actual, ValidationReport* report)
+{
+    *report = ValidationReport{ 0 };
+    for (int y = -CANVAS_HEIGHT / 2; y < CANVAS_HEIGHT / 2; y++)
+    {
+        for (int x = -CANVAS_WIDTH / 2; x < CANVAS_WIDTH / 2; x++)
+        {
+            size_t i = (size_t)(y + CANVAS_HEIGHT / 2) * CANVAS_WIDTH + (x + CANVAS_WIDTH / 2);
+            RayHit e = RayHit{ expected.sphere[i], expected.t[i] };
+            RayHit a = RayHit{ actual.sphere[i], actual.t[i] };
+            report->pixels++;
+
+            bool mismatch = false;
+            if (a.sphere != e.sphere)
+            {
+                report->id_mismatches++;
+                mismatch = true;
+            }
+            else if (isnan(a.t))
+            {
+                report->filled_pixels++;
+            }
+            else if (e.sphere >= 0)
+            {
+                float error = fabsf(a.t - e.t) / e.t;
+                report->max_t_error = error > report->max_t_error ? error : report->max_t_error;
+                if (!(error <= VALIDATION_T_TOLERANCE))
+                {
+                    report->t_mismatches++;
+                    mismatch = true;
+                }
+            }
+
+            if (mismatch && report->reported_count < VALIDATION_MAX_REPORTED)
+            {
+                report->reported[report->reported_count++] = PixelMismatch{ Vector2Int{ x, y }, e, a };
+            }
+        }
+    }
+}
+
+void ValidateFrame(Image* img, RenderMode mode, ValidationReport* report)
+{
+    ResizeHitBuffer(&frame_hits);
+    for (size_t i = 0; i < frame_hits.sphere.size(); i++)
+    {
+        frame_hits.sphere[i] = HIT_NOT_RENDERED;
+        frame_hits.t[i] = NAN;
+    }
+
+    captured_hits = &frame_hits;
+    DrawScene(img, mode);
+    captured_hits = NULL;
+
+    TraceReferenceHits(&reference_hits);
+    CompareHits(reference_hits, frame_hits, report);
+}
+
+void PrintValidationReport(const char* name, const ValidationReport& report)
+{
+    printf("  %-24s %10lld %10lld %12lld %12lld %12.2e\n", name, report.pixels, report.filled_pixels,
+        report.id_mismatches, report.t_mismatches, report.max_t_error);
+    for (int i = 0; i < report.reported_count; i++)
+    {
+        const PixelMismatch& m = report.reported[i];
+        printf("    at (%d, %d): expected sphere %d t %g, got sphere %d t %g\n", m.canvas_pos.x, m.canvas_pos.y,
+            m.expected.sphere, m.expected.t, m.actual.sphere, m.actual.t);
+    }
+}
+
+void MarkMismatches(Image* img, const ValidationReport& report)
+{
+    for (int i = 0; i < report.reported_count; i++)
+    {
+        Vector2Int screen_pos = CanvasToScreen(report.reported[i].canvas_pos);
+        Rectangle marker = { (float)screen_pos.x - 5.0f, (float)screen_pos.y - 5.0f, 11.0f, 11.0f };
+        ImageDrawRectangleLines(img, marker, 1, MAGENTA);
+    }
+}
+
+void DrawValidationReport(int x, int y, const ValidationReport& report)
+{
+    const int font_size = 10;
+    long long mismatches = report.id_mismatches + report.t_mismatches;
+    DrawRectangle(x - 4, y - 4, 330, font_size + 8, Fade(BLACK, 0.6f));
+    if (mismatches == 0)
+    {
+        DrawText(TextFormat("validation: ok, max t error %.1e", report.max_t_error), x, y, font_size, GREEN);
+        return;
+    }
+    const PixelMismatch& first = report.reported[0];
+    DrawText(TextFormat("validation: %lld id, %lld t mismatches, first at (%d, %d)", report.id_mismatches,
+        report.t_mismatches, first.canvas_pos.x, first.canvas_pos.y), x, y, font_size, MAGENTA);
+}
@@ -0,0 +1,82 @@
+/**********************************************************************************************
+*
+*   Validation of the optimized renderers against the scalar reference
+*
+*   While validating, every renderer also records the hit it produced for each canvas pixel:
+*   traced pixels store the sphere and t, pixels filled without tracing (empty or covered tiles,
+*   uniform preview blocks) store the sphere only. The frame is then traced again pixel by pixel
+*   through TraceRayHit, the original IntersectRaySphere loop, and the two are diffed. Sphere ids
+*   must match exactly; t must agree within VALIDATION_T_TOLERANCE.
+*
+*   At runtime it is turned on with --validate or V, and marks mismatching pixels on the canvas;
+*   --bench validates every render mode once.
+*
+**********************************************************************************************/
+
+#ifndef VALIDATION_H
+#define VALIDATION_H
+
+#include "raytracer.h"
+#include "renderer.h"
+#include "tile_binning.h"
+#include "trace_kernels.h"
+
+// Relative error allowed on t. Paths with the same arithmetic match exactly; the fast precision
+// tier is good to about 1e-4.
+#define VALIDATION_T_TOLERANCE 2e-4f
+
+// Mismatches kept with their coordinates per report, the rest are only counted.
+#define VALIDATION_MAX_REPORTED 8
+
+// Sphere id of a pixel the renderer never wrote.
+#define HIT_NOT_RENDERED -2
+
+struct PixelMismatch
+{
+    Vector2Int canvas_pos;
+    RayHit expected;
+    RayHit actual;
+};
+
+struct ValidationReport
+{
+    long long pixels;
+    long long filled_pixels;   // compared by sphere id only
+    long long id_mismatches;
+    long long t_mismatches;
+    float max_t_error;         // relative, over pixels with matching ids
+    int reported_count;
+    PixelMismatch reported[VALIDATION_MAX_REPORTED];
+};
+
+// Hits of the frame being validated, NULL when validation is off.
+extern HitBuffer* captured_hits;
+
+inline void CaptureHit(int x, int y, RayHit hit)
+{
+    if (captured_hits != NULL)
+    {
+        size_t i = (size_t)(y + CANVAS_HEIGHT / 2) * CANVAS_WIDTH + (x + CANVAS_WIDTH / 2);
+        captured_hits->sphere[i] = hit.sphere;
+        captured_hits->t[i] = hit.t;
+    }
+}
+
+// A rectangle filled with one sphere (or -1 for the background) without tracing.
+void CaptureFill(CanvasRect rect, int sphere);
+
+// Traces every canvas pixel with the scalar reference.
+void TraceReferenceHits(HitBuffer* hits);
+
+void CompareHits(const HitBuffer& expected, const HitBuffer& actual, ValidationReport* report);
+
+// Renders a frame with DrawScene while capturing its hits, then diffs them against the reference.
+void ValidateFrame(Image* img, RenderMode mode, ValidationReport* report);
+
+void PrintValidationReport(const char* name, const ValidationReport& report);
+
+// Paints the reported mismatches of the last frame onto the canvas and draws a summary line.
+void MarkMismatches(Image* img, const ValidationReport& report);
+void DrawValidationReport(int x, int y, const ValidationReport& report);
+
+#endif //VALIDATION_H
@@ -0,0 +1,165 @@
+#include "wide_bvh.h"
+#include "bvh_cache.h"
+#include "render_stats.h"
+#include "trace_kernels.h"
+#include "validation.h"
+#include <math.h>
+
+static float HalfArea(const BvhNode& n)
+{
+    float dx = n.max.x - n.min.x;
+    float dy = n.max.y - n.min.y;
+    float dz = n.max.z - n.min.z;
+    return dx * dy + dy * dz + dz * dx;
+}
+
+// Picks the step so 253 of them span the node with a step to spare on either side.
+static void QuantizeAxis(float lo, float hi, float* origin, unsigned char* exponent)
+{
+    int e;
+    frexpf((hi - lo) / 253.0f, &e);
+    e = e < -126 ? -126 : (e > 127 ? 127 : e);
+    float step = ldexpf(1.0f, e);
+    while (lo - step + 254.0f * step < hi && e < 127)
+    {
+        e++;
+        step = ldexpf(1.0f, e);
+    }
+    *origin = lo - step;
+    *exponent = (unsigned char)(e + 127);
+}
+
+static void QuantizeFaces(float lo, float hi, float origin, float step, unsigned char* q_lo, unsigned char* q_hi)
+{
+    int l = (int)floorf((lo - origin) / step) - 1;
+    int h = (int)ceilf((hi - origin) / step) + 1;
+    *q_lo = (unsigned char)(l < 0 ? 0 : (l > 255 ? 255 : l));
+    *q_hi = (unsigned char)(h < 0 ? 0 : (h > 255 ? 255 : h));
+}
+
+static void CollapseNode(const Bvh& binary, int source, WideBvh* wide, int target)
+{
+    // Open the child with the largest surface until the node is full or only leaves are left.
+    int children[WIDE_BVH_WIDTH];
+    int child_count = 0;
+    if (binary.nodes[source].count > 0)
+    {
+        children[child_count++] = source;
+    }
+    else
+    {
+        children[child_count++] = binary.nodes[source].first;
+        children[child_count++] = binary.nodes[source].first + 1;
+    }
+    while (child_count < WIDE_BVH_WIDTH)
+    {
+        int widest = -1;
+        for (int i = 0; i < child_count; i++)
+        {
+            const BvhNode& c = binary.nodes[children[i]];
+            if (c.count == 0 && (widest < 0 || HalfArea(c) > HalfArea(binary.nodes[children[widest]])))
+            {
+                widest = i;
+            }
+        }
+        if (widest < 0)
+        {
+            break;
+        }
+        int opened = binary.nodes[children[widest]].first;
+        children[widest] = opened;
+        children[child_count++] = opened + 1;
+    }
+
+    const BvhNode& parent = binary.nodes[source];
+    WideBvhNode n = {};
+    QuantizeAxis(parent.min.x, parent.max.x, &n.origin.x, &n.exponent[0]);
+    QuantizeAxis(parent.min.y, parent.max.y, &n.origin.y, &n.exponent[1]);
+    QuantizeAxis(parent.min.z, parent.max.z, &n.origin.z, &n.exponent[2]);
+    float step_x = WideBvhStep(n.exponent[0]);
+    float step_y = WideBvhStep(n.exponent[1]);
+    float step_z = WideBvhStep(n.exponent[2]);
+
+    n.first_node = (int)wide->nodes.size();
+    n.first_sphere = (int)wide->spheres.size();
+    int interior_count = 0;
+    int sphere_offset = 0;
+    for (int i = 0; i < WIDE_BVH_WIDTH; i++)
+    {
+        if (i >= child_count)
+        {
+            n.lo_x[i] = n.lo_y[i] = n.lo_z[i] = 255;
+            n.hi_x[i] = n.hi_y[i] = n.hi_z[i] = 0;
+            continue;
+        }
+        const BvhNode& c = binary.nodes[children[i]];
+        QuantizeFaces(c.min.x, c.max.x, n.origin.x, step_x, &n.lo_x[i], &n.hi_x[i]);
+        QuantizeFaces(c.min.y, c.max.y, n.origin.y, step_y, &n.lo_y[i], &n.hi_y[i]);
+        QuantizeFaces(c.min.z, c.max.z, n.origin.z, step_z, &n.lo_z[i], &n.hi_z[i]);
+        if (c.count == 0)
+        {
+            n.interior_mask |= (unsigned char)(1 << i);
+            n.meta[i] = (unsigned char)interior_count++;
+            continue;
+        }
+        n.meta[i] = WIDE_BVH_LEAF_META(sphere_offset, c.count);
+        for (int s = c.first; s < c.first + c.count; s++)
+        {
+            wide->spheres.push_back(binary.spheres[s]);
+            wide->sphere_ids.push_back(binary.sphere_ids[s]);
+        }
+        sphere_offset += c.count;
+    }
+
+    wide->nodes.resize(wide->nodes.size() + interior_count);
+    wide->nodes[target] = n;
+    for (int i = 0; i < child_count; i++)
+    {
+        if (n.interior_mask & (1 << i))
+        {
+            CollapseNode(binary, children[i], wide, n.first_node + n.meta[i]);
+        }
+    }
+}
+
+void BuildWideBvh(const Bvh& binary, WideBvh* wide)
+{
+    wide->nodes.clear();
+    wide->spheres.clear();
+    wide->sphere_ids.clear();
+    if (binary.nodes.empty())
+    {
+        return;
+    }
+    wide->spheres.reserve(binary.spheres.size());
+    wide->sphere_ids.reserve(binary.sphere_ids.size());
+    wide->nodes.resize(1);
+    CollapseNode(binary, 0, wide, 0);
+}
+
+void DrawSceneWideBvh(Image* img, Bvh* binary, WideBvh* wide)
+{
+    if (binary->scene_version != frame_scene->version || binary->builder != bvh_builder)
+    {
+        BuildBvhCached(bvh_builder, *frame_scene, binary);
+        BuildWideBvh(*binary, wide);
+    }
+
+    BvhTraceCounters counters = { 0 };
+    for (int y = -CANVAS_HEIGHT / 2; y < CANVAS_HEIGHT / 2; y++)
+    {
+        for (int x = -CANVAS_WIDTH / 2; x < CANVAS_WIDTH / 2; x++)
+        {
+            Vector2Int canvas_pos = { x,y };
+            long long tests_before = counters.sphere_tests;
+            RayHit hit = trace_kernels->wide_bvh_closest_hit(*wide, CanvasRay(canvas_pos), 1.0f, INFINITY, &counters);
+            Color col = hit.sphere < 0 ? BACKGROUND_COLOR : frame_scene->GetSphere(hit.sphere).color;
+            CaptureHit(x, y, hit);
+            render_stats.primary_rays++;
+            canvas_pos = CanvasToScreen(canvas_pos);
+            RecordPixelCost(canvas_pos.x, canvas_pos.y, (int)(counters.sphere_tests - tests_before));
+            SetPixel(img, canvas_pos.x, canvas_pos.y, col);
+        }
+    }
+    render_stats.intersection_tests += counters.sphere_tests;
+}
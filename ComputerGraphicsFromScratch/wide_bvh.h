@@ -0,0 +1,74 @@
+/**********************************************************************************************
+*
+*   8-wide BVH with quantized child bounds
+*
+*   Collapses a binary BVH (see bvh.h) so every node holds up to WIDE_BVH_WIDTH children,
+*   pulling up the grandchildren with the largest surface area first. A node stores its own
+*   bounds as an origin and a power-of-two step per axis, and each child's box as 8-bit
+*   multiples of those steps, one array per face, so a single ray tests all children of a node
+*   with one vector load and multiply-add per face (see TraceKernels::wide_bvh_closest_hit).
+*
+*   Child boxes are rounded outwards and padded by one step, so they always contain the exact
+*   box with a margin far larger than any rounding of the slab test. Unused slots hold an
+*   inverted box that no ray can enter.
+*
+*   A node is 80 bytes for up to 8 children, against 32 bytes per binary node.
+*
+**********************************************************************************************/
+
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+
+#include "bvh.h"
+#include <stddef.h>
+#include <string.h>
+#include <vector>
+
+#define WIDE_BVH_WIDTH 8
+
+// Each pop can push all but one child, over at most the binary tree's depth.
+#define WIDE_BVH_STACK_SIZE ((WIDE_BVH_WIDTH - 1) * BVH_STACK_SIZE + 1)
+
+// meta of a leaf child: spheres first_sphere + (meta >> 3) onwards, (meta & 7) of them.
+#define WIDE_BVH_LEAF_META(offset, count) (unsigned char)(((offset) << 3) | (count))
+
+struct WideBvhNode
+{
+    // Child faces in steps from origin, first so a vector load past the 8th child stays inside the node.
+    unsigned char lo_x[WIDE_BVH_WIDTH];
+    unsigned char lo_y[WIDE_BVH_WIDTH];
+    unsigned char lo_z[WIDE_BVH_WIDTH];
+    unsigned char hi_x[WIDE_BVH_WIDTH];
+    unsigned char hi_y[WIDE_BVH_WIDTH];
+    unsigned char hi_z[WIDE_BVH_WIDTH];
+    Vector3 origin;
+    unsigned char exponent[3];   // step of each axis is 2^(exponent - 127), as in a float's exponent bits
+    unsigned char interior_mask; // bit i set: child i is a node
+    int first_node;              // interior children are nodes first_node + meta
+    int first_sphere;
+    unsigned char meta[WIDE_BVH_WIDTH];
+};
+
+struct WideBvh
+{
+    std::vector<WideBvhNode> nodes; // nodes[0] is the root
+    std::vector<BvhSphere> spheres; // each node's leaf spheres are contiguous
+    std::vector<int> sphere_ids;    // dense scene index of each entry of spheres
+};
+
+// Step of one axis of a node.
+inline float WideBvhStep(unsigned char exponent)
+{
+    unsigned int bits = (unsigned int)exponent << 23;
+    float step;
+    memcpy(&step, &bits, sizeof(step));
+    return step;
+}
+
+void BuildWideBvh(const Bvh& binary, WideBvh* wide);
+
+// Traces the canvas through a wide BVH of frame_scene, collapsed from *binary, both rebuilt
+// whenever the snapshot changes.
+void DrawSceneWideBvh(Image* img, Bvh* binary, WideBvh* wide);
+
+#endif //WIDE_BVH_H